@@ -231,6 +231,7 @@ LOCAL_SRC_FILES := \
 		ePub3/xml/tree/element.cpp \
 		ePub3/xml/tree/node.cpp \
 		ePub3/xml/tree/xpath.cpp \
+		ePub3/utilities/async_io_engine.cpp \
 		ePub3/utilities/byte_buffer.cpp \
 		ePub3/utilities/byte_stream.cpp \
 		ePub3/utilities/CPUCacheUtils_arm.S \
@@ -254,7 +255,11 @@ LOCAL_SRC_FILES := \
 		ePub3/ePub/content_handler.cpp \
 		ePub3/ePub/content_module_manager.cpp \
 		ePub3/ePub/credential_request.cpp \
+		ePub3/ePub/document_cache.cpp \
 		ePub3/ePub/encryption.cpp \
+		ePub3/ePub/property_atom.cpp \
+		ePub3/ePub/cfi_resolver.cpp \
+		ePub3/ePub/zip_stream_writer.cpp \
 		ePub3/ePub/epub_collection.cpp \
 		ePub3/ePub/filter_chain.cpp \
 		ePub3/ePub/filter_manager_impl.cpp \
@@ -265,6 +270,7 @@ LOCAL_SRC_FILES := \
 		ePub3/ePub/library.cpp \
 		ePub3/ePub/link.cpp \
 		ePub3/ePub/manifest.cpp \
+		ePub3/ePub/markup_rewriter.cpp \
 		ePub3/ePub/media_support_info.cpp \
 		ePub3/ePub/media-overlays_smil_data.cpp \
 		ePub3/ePub/media-overlays_smil_model.cpp \
@@ -187,7 +187,7 @@ public:
 
 	STDMETHODIMP get_Capacity(UINT32 *value)
 	{
-		*value = _buf->m_bufferCapacity;
+		*value = _buf->m_bufferCapacity - _buf->m_bufferOffset;
 		return S_OK;
 	}
 
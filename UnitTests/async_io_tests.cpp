@@ -0,0 +1,141 @@
+//
+//  async_io_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2012-2013 The Readium Foundation and contributors.
+//
+//  The Readium SDK is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "../ePub3/utilities/async_io_engine.h"
+#include "../ePub3/utilities/byte_stream.h"
+#include "catch.hpp"
+
+using namespace EPUB3_NAMESPACE;
+
+TEST_CASE("ShardedAsyncIOEngine spreads channels across its threads", "")
+{
+    ShardedAsyncIOEngine engine(3);
+    REQUIRE(engine.ThreadCount() == 3);
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::set<std::thread::id> threads;
+    size_t calls = 0;
+
+    std::vector<AsyncIOEngine::ChannelPtr> channels;
+    for ( int i = 0; i < 6; i++ )
+    {
+        channels.push_back(engine.Attach([&]() {
+            std::lock_guard<std::mutex> _(lock);
+            threads.insert(std::this_thread::get_id());
+            calls++;
+            cond.notify_all();
+        }));
+    }
+
+    std::set<size_t> shards;
+    for ( auto& channel : channels )
+    {
+        shards.insert(channel->Shard());
+        channel->Signal();
+    }
+    REQUIRE(shards.size() == 3);
+
+    {
+        std::unique_lock<std::mutex> _(lock);
+        REQUIRE(cond.wait_for(_, std::chrono::seconds(5), [&]() { return calls == 6; }));
+        REQUIRE(threads.size() == 3);
+        REQUIRE(threads.count(std::this_thread::get_id()) == 0);
+    }
+
+    // companions share a thread
+    auto companion = engine.Attach([](){}, channels[1]);
+    REQUIRE(companion->Shard() == channels[1]->Shard());
+
+    for ( auto& channel : channels )
+    {
+        channel->Cancel();
+    }
+}
+
+TEST_CASE("Cancelled async I/O channels are never serviced again", "")
+{
+    ShardedAsyncIOEngine engine(1);
+
+    std::atomic<int> calls(0);
+    std::atomic<bool> inService(false);
+    auto channel = engine.Attach([&]() {
+        inService = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        calls++;
+        inService = false;
+    });
+
+    channel->Signal();
+    while ( !inService )
+        std::this_thread::yield();
+
+    // waits for the call in progress
+    channel->Cancel();
+    REQUIRE(channel->IsCancelled());
+    REQUIRE_FALSE(bool(inService));
+
+    channel->Signal();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    int finalCalls = calls;
+    REQUIRE(finalCalls == 1);
+}
+
+TEST_CASE("Async pipes move data through their I/O engine", "")
+{
+    auto engine = std::make_shared<ShardedAsyncIOEngine>(2);
+    auto pipe = AsyncPipe::LinkedPair();
+    pipe.first->SetIOEngine(engine);
+    pipe.second->SetIOEngine(engine);
+
+    std::string received;
+    pipe.second->SetEventHandler([&](AsyncEvent evt, AsyncByteStream* stream) {
+        if ( evt != AsyncEvent::HasBytesAvailable )
+            return;
+
+        char buf[64];
+        ByteStream::size_type n = stream->ReadBytes(buf, sizeof(buf));
+        received.append(buf, n);
+    });
+
+    // events are delivered here; the I/O itself happens on the engine's threads
+    RunLoopPtr runloop = RunLoop::CurrentRunLoop();
+    pipe.first->SetTargetRunLoop(runloop);
+
+    const std::string message("The quick brown fox jumps over the lazy dog");
+    pipe.first->WriteBytes(message.data(), message.size());
+
+    auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while ( received.size() < message.size() && std::chrono::steady_clock::now() < giveUp )
+    {
+        runloop->Run(false, std::chrono::milliseconds(10));
+    }
+    REQUIRE(received == message);
+
+    pipe.second->SetEventHandler(nullptr);
+    pipe.first->Close();
+}
@@ -0,0 +1,140 @@
+//
+//  byte_buffer_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2012-2013 The Readium Foundation and contributors.
+//
+//  The Readium SDK is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <chrono>
+#include <vector>
+#include "../ePub3/utilities/byte_buffer.h"
+#include "catch.hpp"
+
+using namespace EPUB3_NAMESPACE;
+
+static bool IsZeroed(const unsigned char* p, size_t len)
+{
+    for ( size_t i = 0; i < len; i++ )
+    {
+        if ( p[i] != 0 )
+            return false;
+    }
+    return true;
+}
+
+TEST_CASE("ByteBuffer removes bytes from the front without moving the rest", "")
+{
+    unsigned char bytes[256];
+    for ( int i = 0; i < 256; i++ )
+        bytes[i] = uint8_t(i);
+
+    ByteBuffer buf(bytes, sizeof(bytes));
+    unsigned char* start = buf.GetBytes();
+
+    buf.RemoveBytes(100);
+    REQUIRE(buf.GetBufferSize() == 156);
+    REQUIRE(buf.GetBytes() == start + 100);
+    REQUIRE(memcmp(buf.GetBytes(), bytes + 100, 156) == 0);
+
+    // the consumed space is reused once it's at least as large as the content
+    buf.RemoveBytes(60);
+    buf.AddBytes(bytes, 150);
+    REQUIRE(buf.GetBufferSize() == 246);
+    REQUIRE(buf.GetBytes() == start);
+    REQUIRE(memcmp(buf.GetBytes(), bytes + 160, 96) == 0);
+    REQUIRE(memcmp(buf.GetBytes() + 96, bytes, 150) == 0);
+
+    unsigned char out[16];
+    REQUIRE(buf.MoveTo(out, sizeof(out)) == 16);
+    REQUIRE(memcmp(out, bytes + 160, 16) == 0);
+    REQUIRE(buf.GetBufferSize() == 230);
+}
+
+TEST_CASE("ByteBuffer removes bytes from the middle", "")
+{
+    ByteBuffer buf(reinterpret_cast<const unsigned char*>("0123456789"), 10);
+    buf.RemoveBytes(2);                 // "23456789"
+    buf.RemoveBytes(3, 2);              // "23789"
+    REQUIRE(buf.GetBufferSize() == 5);
+    REQUIRE(memcmp(buf.GetBytes(), "23789", 5) == 0);
+
+    buf.RemoveBytes(100, 3);            // "237"
+    REQUIRE(buf.GetBufferSize() == 3);
+    REQUIRE(memcmp(buf.GetBytes(), "237", 3) == 0);
+
+    ByteBuffer copy(buf);
+    REQUIRE(copy == buf);
+}
+
+TEST_CASE("Secure ByteBuffers erase the bytes they consume", "")
+{
+    const size_t batch = ByteBuffer::SecureErasureBatchSize;
+    std::vector<unsigned char> bytes(batch * 2, 0xA5);
+
+    ByteBuffer buf(bytes.size(), prealloc_buf);
+    REQUIRE_FALSE(buf.UsesSecureErasure());
+    buf.SetUsesSecureErasure();
+    buf.AddBytes(bytes.data(), bytes.size());
+    unsigned char* start = buf.GetBytes();
+
+    // erasure happens in batches...
+    buf.RemoveBytes(batch - 1);
+    buf.RemoveBytes(1);
+    REQUIRE(IsZeroed(start, batch));
+
+    // ...or when the buffer is drained
+    buf.RemoveBytes(10);
+    buf.RemoveBytes(buf.GetBufferSize());
+    REQUIRE(buf.GetBufferSize() == 0);
+    REQUIRE(buf.GetBytes() == start);
+    REQUIRE(IsZeroed(start, bytes.size()));
+
+    // removing from the middle erases the vacated tail
+    buf.AddBytes(bytes.data(), 100);
+    buf.RemoveBytes(40, 10);
+    REQUIRE(buf.GetBufferSize() == 60);
+    REQUIRE(IsZeroed(start + 60, 40));
+}
+
+TEST_CASE("ByteBuffer consumption benchmark", "[.][benchmark]")
+{
+    const size_t total = 64 * 1024 * 1024;
+    const size_t chunk = 4096;
+    std::vector<unsigned char> bytes(chunk, 0x5A);
+    typedef std::chrono::duration<double> seconds;
+
+    // the filter chain's usage: fill a buffer, then consume it in small reads
+    for ( bool secure : { false, true } )
+    {
+        ByteBuffer buf(0, prealloc_buf);
+        if ( secure )
+            buf.SetUsesSecureErasure();
+
+        unsigned char out[512];
+        auto start = std::chrono::high_resolution_clock::now();
+        for ( size_t done = 0; done < total; done += chunk * 64 )
+        {
+            for ( int i = 0; i < 64; i++ )
+                buf.AddBytes(bytes.data(), chunk);
+            while ( buf.GetBufferSize() > 0 )
+                buf.MoveTo(out, sizeof(out));
+        }
+        seconds elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        WARN((secure ? "secure: " : "plain: ")
+             << double(total) / (1024 * 1024) / elapsed.count() << " MB/s");
+    }
+}
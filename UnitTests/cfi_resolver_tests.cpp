@@ -0,0 +1,196 @@
+//
+//  cfi_resolver_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2012-2013 The Readium Foundation and contributors.
+//
+//  The Readium SDK is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <chrono>
+#include <vector>
+#include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/package.h"
+#include "../ePub3/ePub/cfi_resolver.h"
+#include "../ePub3/utilities/error_handler.h"
+#include "catch.hpp"
+
+using namespace ePub3;
+
+#define EPUB_PATH "TestData/childrens-literature-20120722.epub"
+
+// <body>
+//   <section id="pgepubid00492">
+//     <div class="center"><span ... id="Page_169">169</span></div>
+//     <h2>SECTION IV <span class="subhd">FAIRY STORIES—MODERN FANTASTIC TALES</span></h2>
+static shared_ptr<xml::Document> ChapterDocument(ContainerPtr& container, CFI& remainder)
+{
+    container = Container::New();
+    REQUIRE(container->Open(EPUB_PATH, false));
+    CFI cfi("epubcfi(/6/6[s04]!/4/2[pgepubid00492]/4/1:8)");
+    auto doc = container->DefaultPackage()->DocumentForCFI(cfi, &remainder);
+    REQUIRE(doc != nullptr);
+    return doc;
+}
+
+static shared_ptr<xml::Document> ParseDocument(const std::string& markup)
+{
+    xmlDocPtr doc = xmlReadMemory(markup.data(), static_cast<int>(markup.size()), "test.xhtml", nullptr, 0);
+    REQUIRE(doc != nullptr);
+    return xml::Wrapped<xml::Document>(doc);
+}
+
+// the node's text from the location's offset, which counts UTF-16 code units
+static std::string TextAt(const CFIResolver::Location& location)
+{
+    std::string text = location.node.StringValue().stl_str();
+    size_t pos = 0;
+    for ( uint32_t units = 0; units < location.characterOffset && pos < text.size(); )
+    {
+        unsigned char lead = static_cast<unsigned char>(text[pos]);
+        units += (lead >= 0xF0 ? 2 : 1);
+        pos += (lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1);
+    }
+    return text.substr(pos);
+}
+
+TEST_CASE("CFIs resolve to nodes within a content document", "")
+{
+    ContainerPtr container;
+    CFI remainder;
+    CFIResolver resolver(ChapterDocument(container, remainder));
+
+    CFIResolver::Location location = resolver.Resolve(remainder);
+    REQUIRE(bool(location));
+    REQUIRE(location.node.Type() == xml::NodeType::Text);
+    REQUIRE(location.hasCharacterOffset);
+    REQUIRE(TextAt(location) == "IV ");
+
+    location = resolver.Resolve(CFI("/4/2/2/2[Page_169]"));
+    REQUIRE(location.node.Name() == "span");
+    REQUIRE(location.node.AttributeValue("id") == "Page_169");
+
+    // a stale index is corrected by the asserted id
+    location = resolver.Resolve(CFI("/4/2/4[Page_169]"));
+    REQUIRE(location.node.AttributeValue("id") == "Page_169");
+
+    // empty text after the last child element
+    location = resolver.Resolve(CFI("/4/2/4/3"));
+    REQUIRE(location.node.Name() == "h2");
+
+    // offsets count characters, not bytes
+    location = resolver.Resolve(CFI("/4/2/4/2/1:14"));
+    REQUIRE(TextAt(location) == "MODERN FANTASTIC TALES");
+
+    CFIResolver::Location start, end;
+    REQUIRE(resolver.ResolveRange(CFI("/4/2/4,/1:0,/1:7"), start, end));
+    REQUIRE(start.node == end.node);
+    REQUIRE(start.characterOffset == 0);
+    REQUIRE(end.characterOffset == 7);
+
+    EPUBError triggeredError = EPUBError::NoError;
+    SetErrorHandler([&](const error_details& err){
+        if (err.is_spec_error())
+            triggeredError = err.epub_error_code();
+        return true;
+    });
+
+    REQUIRE_FALSE(bool(resolver.Resolve(CFI("/4/2/400"))));
+    REQUIRE(int(triggeredError) == int(EPUBError::CFIStepOutOfBounds));
+    REQUIRE_FALSE(bool(resolver.Resolve(CFI("/4/2/4/1:100"))));
+    REQUIRE(int(triggeredError) == int(EPUBError::CFICharOffsetOutOfBounds));
+
+    SetErrorHandler(DefaultErrorHandler);
+}
+
+TEST_CASE("CFIs are generated for nodes within a content document", "")
+{
+    ContainerPtr container;
+    CFI remainder;
+    CFIResolver resolver(ChapterDocument(container, remainder));
+
+    CFIResolver::Location location = resolver.Resolve(remainder);
+    REQUIRE(resolver.CFIForLocation(location) == remainder);
+
+    location = resolver.Resolve(CFI("/4/2/4[Page_169]"));
+    REQUIRE(resolver.CFIForNode(location.node).String() == "epubcfi(/4/2[pgepubid00492]/2/2[Page_169])");
+
+    location = resolver.Resolve(CFI("/4/2/6[pgepubid00495]/6/2/2/1:3"));
+    REQUIRE(TextAt(location).compare(0, 11, " the Chimes") == 0);
+    REQUIRE(resolver.CFIForLocation(location) == "epubcfi(/4/2[pgepubid00492]/6[pgepubid00495]/6/2/2/1:3)");
+
+    // only the elements on the paths walked are recorded
+    REQUIRE(resolver.CachedElementCount() < 20);
+}
+
+TEST_CASE("CFI text steps span several text nodes", "")
+{
+    auto doc = ParseDocument("<r><p>ab<i/>cd<!--x--><![CDATA[ef]]></p><p>a\xF0\x9F\x98\x80" "b</p></r>");
+    CFIResolver resolver(doc);
+
+    CFIResolver::Location location = resolver.Resolve(CFI("/2/3:3"));
+    REQUIRE(location.node.StringValue() == "ef");
+    REQUIRE(location.characterOffset == 1);
+    REQUIRE(resolver.CFIForLocation(location) == "epubcfi(/2/3:3)");
+
+    // the boundary between two text nodes belongs to the first
+    location = resolver.Resolve(CFI("/2/3:2"));
+    REQUIRE(location.node.StringValue() == "cd");
+    REQUIRE(location.characterOffset == 2);
+
+    // characters outside the BMP take two UTF-16 code units
+    location = resolver.Resolve(CFI("/4/1:3"));
+    REQUIRE(TextAt(location) == "b");
+    REQUIRE(resolver.CFIForLocation(location) == "epubcfi(/4/1:3)");
+}
+
+TEST_CASE("CFI resolution benchmark", "[.][benchmark]")
+{
+    ContainerPtr container;
+    CFI remainder;
+    auto doc = ChapterDocument(container, remainder);
+    typedef std::chrono::duration<double> seconds;
+
+    // a location in every run of text in the chapter
+    std::vector<CFI> cfis;
+    {
+        CFIResolver generator(doc);
+        std::vector<xml::NodeHandle> stack(1, xml::NodeHandle(xmlDocGetRootElement(doc->xml())));
+        while ( !stack.empty() )
+        {
+            xml::NodeHandle node = stack.back();
+            stack.pop_back();
+            for ( xml::NodeHandle child = node.FirstChild(); bool(child); child = child.NextSibling() )
+            {
+                if ( child.Type() == xml::NodeType::Text )
+                    cfis.push_back(generator.CFIForNode(child, 0));
+                else if ( child.IsElementNode() )
+                    stack.push_back(child);
+            }
+        }
+    }
+
+    // the first pass records each element's children; the rest only look them up
+    const int passes = 20;
+    CFIResolver resolver(doc);
+    auto start = std::chrono::high_resolution_clock::now();
+    for ( int i = 0; i < passes; i++ )
+    {
+        for ( auto& cfi : cfis )
+            resolver.Resolve(cfi);
+    }
+    seconds elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    WARN(cfis.size() << " CFIs: " << double(cfis.size() * passes) / elapsed.count() << " resolutions/s");
+}
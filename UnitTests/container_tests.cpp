@@ -20,7 +20,11 @@
 //
 
 #include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/zip_archive.h"
+#include "../ePub3/utilities/byte_stream.h"
 #include "catch.hpp"
+#include <thread>
+#include <vector>
 
 using namespace ePub3;
 
@@ -49,3 +53,189 @@ TEST_CASE("", "Version should be 1.0")
     ContainerPtr container = Container::OpenContainer(EPUB_PATH);
     REQUIRE(container->Version() == "1.0");
 }
+
+TEST_CASE("Zip archives should locate items by name", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    REQUIRE(archive.ContainsItem("META-INF/container.xml"));
+    REQUIRE(archive.ContainsItem("/EPUB/package.opf"));
+    REQUIRE_FALSE(archive.ContainsItem("EPUB/missing.xhtml"));
+    REQUIRE_FALSE(archive.ContainsItem("epub/PACKAGE.opf"));
+    
+    REQUIRE(archive.InfoAtPath("EPUB/css/epub.css").UncompressedSize() == 1647);
+    REQUIRE(archive.ReaderAtPath("EPUB/missing.xhtml") == nullptr);
+    REQUIRE_FALSE(archive.ByteStreamAtPath("EPUB/missing.xhtml")->IsOpen());
+    
+    auto stream = archive.ByteStreamAtPath("/EPUB/cover.xhtml");
+    REQUIRE(stream->IsOpen());
+    REQUIRE(stream->BytesAvailable() == 381);
+}
+
+TEST_CASE("Zip archives should optionally ignore case when locating items", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    archive.SetCaseInsensitiveLookup(true);
+    REQUIRE(archive.ContainsItem("epub/PACKAGE.opf"));
+    REQUIRE(archive.InfoAtPath("Epub/Css/Epub.CSS").UncompressedSize() == 1647);
+    
+    archive.SetCaseInsensitiveLookup(false);
+    REQUIRE_FALSE(archive.ContainsItem("epub/PACKAGE.opf"));
+}
+
+static std::string ReadWholeItem(const ZipArchive& archive, const string& path)
+{
+    std::string result;
+    auto stream = archive.ByteStreamAtPath(path);
+    char buf[4096];
+    ByteStream::size_type n;
+    while ( (n = stream->ReadBytes(buf, sizeof(buf))) > 0 )
+        result.append(buf, n);
+    return result;
+}
+
+TEST_CASE("Zip archive items should be readable concurrently", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    std::vector<string> paths = {
+        "EPUB/s04.xhtml", "EPUB/images/cover.png", "EPUB/nav.xhtml", "EPUB/css/epub.css",
+        "EPUB/s04.xhtml", "EPUB/images/cover.png", "EPUB/nav.xhtml", "EPUB/package.opf"
+    };
+    
+    std::vector<std::string> expected;
+    for ( auto& path : paths )
+        expected.push_back(ReadWholeItem(archive, path));
+    
+    std::vector<std::string> actual(paths.size());
+    std::vector<std::thread> threads;
+    for ( size_t i = 0; i < paths.size(); i++ )
+    {
+        threads.emplace_back([&, i]() {
+            for ( int pass = 0; pass < 10; pass++ )
+                actual[i] = ReadWholeItem(archive, paths[i]);
+        });
+    }
+    for ( auto& thread : threads )
+        thread.join();
+    
+    for ( size_t i = 0; i < paths.size(); i++ )
+    {
+        CAPTURE(paths[i]);
+        REQUIRE(actual[i].size() == archive.InfoAtPath(paths[i]).UncompressedSize());
+        REQUIRE(actual[i] == expected[i]);
+    }
+}
+
+TEST_CASE("Mapped zip archives should vend stored items without copying", "")
+{
+    MappedZipArchive archive(EPUB_PATH);
+    REQUIRE(archive.IsMapped());
+    
+    ArchiveSpan mimetype = archive.SpanAtPath("mimetype");
+    REQUIRE(bool(mimetype));
+    REQUIRE(std::string(reinterpret_cast<const char*>(mimetype.data()), mimetype.size()) == "application/epub+zip");
+    
+    // compressed and missing items can't be accessed in place
+    REQUIRE(archive.SpanAtPath("EPUB/package.opf").empty());
+    REQUIRE(archive.SpanAtPath("EPUB/missing.png").empty());
+    
+    // other access works as normal
+    REQUIRE(ReadWholeItem(archive, "EPUB/css/epub.css").size() == 1647);
+    
+    MappedZipArchive moby("TestData/moby-dick-preview-collection.epub");
+    const char* imagePath = "OPS/images/9780316000000.jpg";
+    ArchiveSpan image = moby.SpanAtPath(imagePath);
+    REQUIRE(image.size() == 348700);
+    REQUIRE(std::string(image.begin(), image.end()) == ReadWholeItem(moby, imagePath));
+}
+
+TEST_CASE("Seek checkpoints should allow random access within compressed items", "")
+{
+    ZipArchive archive(EPUB_PATH);
+    const char* path = "EPUB/s04.xhtml";
+    std::string expected = ReadWholeItem(archive, path);
+    REQUIRE(expected.size() == 338111);
+    
+    archive.SetSeekCheckpointInterval(32*1024);
+    REQUIRE(archive.SeekCheckpointInterval() == 32*1024);
+    
+    // one complete read records the checkpoints
+    REQUIRE(ReadWholeItem(archive, path) == expected);
+    
+    auto stream = archive.ByteStreamAtPath(path);
+    SeekableByteStream* seekable = dynamic_cast<SeekableByteStream*>(stream.get());
+    REQUIRE(seekable != nullptr);
+    
+    const ByteStream::size_type offsets[] = { 300000, 1000, 200000, 65536, 337000, 0, 150001 };
+    char buf[1024];
+    for ( auto offset : offsets )
+    {
+        CAPTURE(offset);
+        REQUIRE(seekable->Seek(offset, std::ios::beg) == offset);
+        ByteStream::size_type n = seekable->ReadBytes(buf, sizeof(buf));
+        REQUIRE(n == std::min<ByteStream::size_type>(sizeof(buf), expected.size() - offset));
+        REQUIRE(std::string(buf, n) == expected.substr(offset, n));
+    }
+}
+
+class LazyTestContainer : public Container
+{
+public:
+    bool PackagesLoaded()   const { return _packagesLoaded; }
+    bool EncryptionLoaded() const { return _encryptionLoaded; }
+};
+
+static std::string ReadFilteredItem(PackagePtr pkg, const string& id)
+{
+    auto stream = pkg->SyncContentStreamForItem(pkg->ManifestItemWithID(id));
+    std::string result;
+    char buf[4096];
+    ByteStream::size_type n;
+    while ( (n = stream->ReadBytes(buf, sizeof(buf))) > 0 )
+        result.append(buf, n);
+    return result;
+}
+
+TEST_CASE("Lazily-opened containers should load each stage on first access", "")
+{
+    const char* path = "TestData/wasteland-otf-obf-20120118.epub";
+    ContainerPtr eager = Container::New();
+    REQUIRE(eager->Open(path, false));
+    PackagePtr eagerPkg = eager->DefaultPackage();
+    
+    auto lazy = std::make_shared<LazyTestContainer>();
+    REQUIRE(lazy->Open(path, true));
+    REQUIRE_FALSE(lazy->PackagesLoaded());
+    REQUIRE_FALSE(lazy->EncryptionLoaded());
+    REQUIRE(lazy->PackageLocations() == eager->PackageLocations());
+    
+    // metadata needs only the OPF
+    PackagePtr lazyPkg = lazy->DefaultPackage();
+    REQUIRE(lazyPkg != nullptr);
+    REQUIRE(lazy->PackagesLoaded());
+    REQUIRE_FALSE(lazy->EncryptionLoaded());
+    REQUIRE(lazyPkg->Title() == eagerPkg->Title());
+    REQUIRE(lazyPkg->SpineItemCount() == eagerPkg->SpineItemCount());
+    
+    // navigation and spine titles are loaded on demand
+    REQUIRE(lazyPkg->SpineItemAt(0)->Title() == eagerPkg->SpineItemAt(0)->Title());
+    REQUIRE(lazyPkg->NavigationTables().size() == eagerPkg->NavigationTables().size());
+    REQUIRE(lazyPkg->TableOfContents() != nullptr);
+    REQUIRE(lazyPkg->MediaOverlaysSmilModel() != nullptr);
+    
+    // the filter chain, and with it the encryption data, is built on first read
+    REQUIRE(ReadFilteredItem(lazyPkg, "font.OldStandard.regular") == ReadFilteredItem(eagerPkg, "font.OldStandard.regular"));
+    REQUIRE(lazy->EncryptionLoaded());
+    REQUIRE(lazy->EncryptionData().size() == eager->EncryptionData().size());
+}
+
+TEST_CASE("Containers should open lazily by default when asked to", "")
+{
+    Container::SetOpensLazily(true);
+    ContainerPtr container = Container::OpenContainer(EPUB_PATH);
+    Container::SetOpensLazily(false);
+    
+    REQUIRE(container != nullptr);
+    REQUIRE(container->DefaultPackage() != nullptr);
+    REQUIRE(container->DefaultPackage()->TableOfContents() != nullptr);
+    REQUIRE_FALSE(container->DefaultPackage()->Title().empty());
+}
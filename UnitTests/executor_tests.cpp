@@ -183,6 +183,40 @@ TEST_CASE("scheduled_executor", "scheduled_executor should only enqueue closures
     REQUIRE(itRan == true);
 }
 
+TEST_CASE("thread_pool nested submissions", "closures added from within a thread_pool should run, and be shared between its threads")
+{
+    thread_pool pool(4);
+    std::atomic<int> count(0);
+    std::mutex mut;
+    std::set<std::thread::id> tids;
+    
+    for ( int i = 0; i < 100; i++ )
+    {
+        pool.add([&]() {
+            for ( int j = 0; j < 50; j++ )
+            {
+                pool.add([&]() {
+                    {
+                        std::lock_guard<std::mutex> _(mut);
+                        tids.insert(std::this_thread::get_id());
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(20));
+                    ++count;
+                });
+            }
+            ++count;
+        });
+    }
+    
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while ( count < 5100 && std::chrono::steady_clock::now() < deadline )
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    
+    REQUIRE(count == 5100);
+    REQUIRE(pool.uninitiated_task_count() == 0);
+    REQUIRE(tids.size() > 1);
+}
+
 TEST_CASE("loop_executor execution", "loop_executor should only run closures when requested")
 {
     loop_executor loop;
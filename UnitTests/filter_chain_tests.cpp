@@ -298,4 +298,185 @@ TEST_CASE("Font de-obfuscation happens automatically", "")
     
     REQUIRE(filteredBuffer == rawBuf);
 }
-*/
\ No newline at end of file
+*/
+// applies ROT13 in place, but only to whole 16-byte blocks until the end of the data
+class BlockROT13Filter : public ePub3::ContentFilter, public PointerType<BlockROT13Filter>
+{
+public:
+    BlockROT13Filter() : ContentFilter([](ConstManifestItemPtr) { return true; }) {}
+    virtual ~BlockROT13Filter() {}
+    
+    virtual void* FilterData(FilterContext* context, void* data, size_t len, size_t* outputLen) OVERRIDE {
+        throw std::logic_error("BlockROT13Filter only filters in place");
+    }
+    
+    virtual bool SupportsInPlaceFiltering() const OVERRIDE { return true; }
+    virtual size_t FilterDataInPlace(FilterContext* context, uint8_t* data, size_t len, size_t* consumed, bool final) OVERRIDE {
+        size_t n = (final ? len : len - (len % 16));
+        ROT13Filter().FilterData(nullptr, data, n, nullptr);
+        *consumed = n;
+        return n;
+    }
+};
+
+// applies ROT13 to a new copy of the data
+class CopyingROT13Filter : public ePub3::ContentFilter, public PointerType<CopyingROT13Filter>
+{
+public:
+    CopyingROT13Filter() : ContentFilter([](ConstManifestItemPtr) { return true; }) {}
+    virtual ~CopyingROT13Filter() {}
+    
+    virtual void* FilterData(FilterContext* context, void* data, size_t len, size_t* outputLen) OVERRIDE {
+        uint8_t* result = new uint8_t[len];
+        memcpy(result, data, len);
+        return ROT13Filter().FilterData(nullptr, result, len, outputLen);
+    }
+};
+
+static std::string ReadAll(ByteStream& stream, size_t chunkSize)
+{
+    std::string result;
+    std::vector<char> buf(chunkSize);
+    ByteStream::size_type n = 0;
+    while ( (n = stream.ReadBytes(buf.data(), buf.size())) > 0 )
+        result.append(buf.data(), n);
+    return result;
+}
+
+TEST_CASE("Synchronous filter chains should filter in place, carrying over unconsumed bytes", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr item = pkg->FirstSpineItem()->ManifestItem();
+    
+    auto raw = item->Reader();
+    std::string expected = ReadAll(*raw, 4096);
+    ROT13Filter().FilterData(nullptr, &expected[0], expected.size(), nullptr);
+    
+    for ( size_t chunkSize : { 1, 7, 16, 100, 4096, 65536 } )
+    {
+        CAPTURE(chunkSize);
+        
+        // a single in-place filter
+        FilterChain inPlace(FilterChain::FilterList{ BlockROT13Filter::New() });
+        auto stream = inPlace.GetSyncFilteredOutputStreamForManifestItem(item);
+        REQUIRE(ReadAll(*stream, chunkSize) == expected);
+        REQUIRE(stream->AtEnd());
+        
+        // in-place filters mixed with one that returns new memory
+        FilterChain mixed(FilterChain::FilterList{ BlockROT13Filter::New(), CopyingROT13Filter::New(), BlockROT13Filter::New() });
+        stream = mixed.GetSyncFilteredOutputStreamForManifestItem(item);
+        REQUIRE(ReadAll(*stream, chunkSize) == expected);
+    }
+}
+
+// a toy 16-byte block cipher: XOR with a key, then rotate each byte left by three bits
+class ToyBlockCipherFilter : public BlockCipherFilter, public PointerType<ToyBlockCipherFilter>
+{
+public:
+    static const uint8_t Key = 0x5A;
+    
+    ToyBlockCipherFilter(Mode mode, bool padded=false) : BlockCipherFilter([](ConstManifestItemPtr) { return true; }, mode, 16, padded) {}
+    virtual ~ToyBlockCipherFilter() {}
+    
+    static void EncryptBlocks(const uint8_t* in, uint8_t* out, size_t len) {
+        for ( size_t i = 0; i < len; i++ )
+        {
+            uint8_t b = in[i] ^ uint8_t(Key + i % 16);
+            out[i] = uint8_t((b << 3) | (b >> 5));
+        }
+    }
+    static void DecryptBlocks(const uint8_t* in, uint8_t* out, size_t len) {
+        for ( size_t i = 0; i < len; i++ )
+        {
+            uint8_t b = uint8_t((in[i] >> 3) | (in[i] << 5));
+            out[i] = b ^ uint8_t(Key + i % 16);
+        }
+    }
+    
+protected:
+    virtual void TransformBlocks(BlockCipherContext*, const uint8_t* input, uint8_t* output, size_t len) const OVERRIDE {
+        if ( ChainingMode() == Mode::CBC )
+            DecryptBlocks(input, output, len);
+        else
+            EncryptBlocks(input, output, len);
+    }
+};
+
+// decrypts a whole buffer at once, treating any trailing partial CBC block as junk
+static std::string ReferenceDecrypt(BlockCipherFilter::Mode mode, const std::string& ciphertext)
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(ciphertext.data());
+    uint8_t chain[16];
+    memcpy(chain, in, 16);
+    
+    std::string result;
+    for ( size_t pos = 16; pos < ciphertext.size(); pos += 16 )
+    {
+        size_t n = std::min(size_t(16), ciphertext.size() - pos);
+        uint8_t block[16];
+        if ( mode == BlockCipherFilter::Mode::CBC )
+        {
+            if ( n < 16 )
+                break;
+            ToyBlockCipherFilter::DecryptBlocks(in + pos, block, 16);
+            for ( size_t i = 0; i < 16; i++ )
+                block[i] ^= chain[i];
+            memcpy(chain, in + pos, 16);
+        }
+        else
+        {
+            ToyBlockCipherFilter::EncryptBlocks(chain, block, 16);
+            for ( size_t i = 0; i < n; i++ )
+                block[i] ^= in[pos+i];
+            for ( size_t i = 16; i > 0 && ++chain[i-1] == 0; i-- )
+                ;
+        }
+        result.append(reinterpret_cast<char*>(block), n);
+    }
+    return result;
+}
+
+TEST_CASE("Block cipher filters should decrypt progressively in any chunk size", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr item = pkg->FirstSpineItem()->ManifestItem();
+    
+    // the raw resource stands in for the ciphertext
+    auto raw = item->Reader();
+    std::string ciphertext = ReadAll(*raw, 4096);
+    
+    for ( auto mode : { BlockCipherFilter::Mode::CBC, BlockCipherFilter::Mode::CTR } )
+    {
+        std::string expected = ReferenceDecrypt(mode, ciphertext);
+        for ( size_t chunkSize : { 1, 15, 17, 4096, 65536 } )
+        {
+            CAPTURE(chunkSize);
+            FilterChain chain(FilterChain::FilterList{ ToyBlockCipherFilter::New(mode) });
+            auto stream = chain.GetSyncFilteredOutputStreamForManifestItem(item);
+            REQUIRE(ReadAll(*stream, chunkSize) == expected);
+        }
+    }
+}
+
+TEST_CASE("CBC block cipher filters should remove PKCS #7 padding", "")
+{
+    // IV, then the encryption of "0123456789" padded with six 0x06 bytes
+    uint8_t data[32] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                         '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 6, 6, 6, 6, 6, 6 };
+    for ( size_t i = 0; i < 16; i++ )
+        data[16+i] ^= data[i];
+    ToyBlockCipherFilter::EncryptBlocks(data+16, data+16, 16);
+    
+    ToyBlockCipherFilter filter(BlockCipherFilter::Mode::CBC, true);
+    std::unique_ptr<FilterContext> ctx(filter.MakeFilterContext(nullptr));
+    
+    // a whole block that might be the last is held back until the end
+    size_t consumed = 0;
+    REQUIRE(filter.FilterDataInPlace(ctx.get(), data, 32, &consumed, false) == 0);
+    REQUIRE(consumed == 16);
+    REQUIRE(filter.FilterDataInPlace(ctx.get(), data+16, 16, &consumed, true) == 10);
+    REQUIRE(consumed == 16);
+    REQUIRE(std::string(reinterpret_cast<char*>(data+16), 10) == "0123456789");
+}
@@ -24,6 +24,7 @@
 #include "../ePub3/ePub/package.h"
 #include "../ePub3/utilities/byte_stream.h"
 #include "catch.hpp"
+#include <chrono>
 
 #define EPUB_PATH "TestData/wasteland-otf-obf-20120118.epub"
 #define FONT_SUBPATH "EPUB/OldStandard-Regular.obf.otf"
@@ -76,3 +77,84 @@ TEST_CASE("Obfuscated fonts are decrypted properly", "")
     
     delete ctx;
 }
+
+// exposes the obfuscation key, to check the optimized kernel against a simple one
+class TestFontObfuscator : public FontObfuscator
+{
+public:
+    TestFontObfuscator(ConstContainerPtr c) : FontObfuscator(c) {}
+    
+    FilterContext* MakeContext() const {
+        return new FontObfuscationContext(_mask, ObfuscatedLength);
+    }
+    
+    // the original byte-at-a-time kernel
+    void ReferenceFilter(uint8_t* buf, size_t len, size_t bytesFiltered) const {
+        for ( size_t i = 0; i < len && (i + bytesFiltered) < 1040; i++ )
+            buf[i] ^= _key[(i+bytesFiltered)%20];
+    }
+};
+
+TEST_CASE("Font de-obfuscation should give the same results for any chunk size", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    ManifestItemPtr manifestItem = pkg->ManifestItemWithID(FONT_MANIFEST_ID);
+    TestFontObfuscator obfuscator(c);
+    
+    uint8_t raw[2048];
+    auto stream = c->ReadStreamAtPath(FONT_SUBPATH);
+    REQUIRE(stream->ReadBytes(raw, sizeof(raw)) == sizeof(raw));
+    
+    uint8_t expected[2048];
+    memcpy(expected, raw, sizeof(raw));
+    obfuscator.ReferenceFilter(expected, sizeof(expected), 0);
+    
+    for ( size_t chunkSize : { 1, 3, 8, 13, 1000, 1040, 2048 } )
+    {
+        CAPTURE(chunkSize);
+        uint8_t buf[2048];
+        memcpy(buf, raw, sizeof(raw));
+        
+        std::unique_ptr<FilterContext> ctx(obfuscator.MakeFilterContext(manifestItem));
+        for ( size_t pos = 0; pos < sizeof(buf); pos += chunkSize )
+        {
+            size_t n = std::min(chunkSize, sizeof(buf) - pos), consumed = 0;
+            REQUIRE(obfuscator.FilterDataInPlace(ctx.get(), buf + pos, n, &consumed, false) == n);
+            REQUIRE(consumed == n);
+        }
+        
+        REQUIRE(memcmp(buf, expected, sizeof(buf)) == 0);
+    }
+}
+
+TEST_CASE("Font de-obfuscation benchmark", "[.][benchmark]")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    TestFontObfuscator obfuscator(c);
+    
+    const int iterations = 200000;
+    uint8_t buf[4096] = {};
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    for ( int i = 0; i < iterations; i++ )
+        obfuscator.ReferenceFilter(buf, sizeof(buf), 0);
+    auto reference = std::chrono::high_resolution_clock::now() - start;
+    
+    start = std::chrono::high_resolution_clock::now();
+    for ( int i = 0; i < iterations; i++ )
+    {
+        size_t consumed = 0;
+        std::unique_ptr<FilterContext> ctx(obfuscator.MakeContext());
+        obfuscator.FilterDataInPlace(ctx.get(), buf, sizeof(buf), &consumed, false);
+    }
+    auto optimized = std::chrono::high_resolution_clock::now() - start;
+    
+    // an even number of passes of each leaves the buffer as it started
+    for ( size_t i = 0; i < sizeof(buf); i++ )
+        REQUIRE(buf[i] == 0);
+    
+    typedef std::chrono::duration<double, std::micro> micros;
+    WARN("byte-at-a-time: " << micros(reference).count()/iterations << "us per font; "
+         << "expanded key: " << micros(optimized).count()/iterations << "us per font");
+}
@@ -7,6 +7,7 @@
 //
 
 #include "../ePub3/utilities/iri.h"
+#include "../ePub3/utilities/path_help.h"
 #include "catch.hpp"
 
 using namespace ePub3;
@@ -100,3 +101,22 @@ TEST_CASE("IRIs should be buildable by component", "")
     REQUIRE(iri.Query() == "q=10");
     REQUIRE(iri.Fragment() == "bottom");
 }
+
+TEST_CASE("IRI components should percent-decode to UTF-8", "")
+{
+    REQUIRE(IRI::URLDecodeComponent("EPUB/s04.xhtml") == "EPUB/s04.xhtml");
+    REQUIRE(IRI::URLDecodeComponent("EPUB/my%20chapter.xhtml") == "EPUB/my chapter.xhtml");
+    REQUIRE(IRI::URLDecodeComponent("EPUB/%E2%88%82.xhtml") == "EPUB/∂.xhtml");
+    REQUIRE(IRI::URLDecodeComponent(IRI::URLEncodeComponent("a b/∂#c")) == "a b/∂#c");
+}
+
+TEST_CASE("Paths should be normalized", "")
+{
+    REQUIRE(CleanupPath("EPUB/s04.xhtml") == "EPUB/s04.xhtml");
+    REQUIRE(CleanupPath("EPUB/text/../s04.xhtml") == "EPUB/s04.xhtml");
+    REQUIRE(CleanupPath("EPUB/./text/./../s04.xhtml") == "EPUB/s04.xhtml");
+    REQUIRE(CleanupPath("/EPUB/a/b/../../s04.xhtml") == "/EPUB/s04.xhtml");
+    REQUIRE(CleanupPath("EPUB/text/") == "EPUB/text/");
+    REQUIRE(CleanupPath("../images/cover.png") == "../images/cover.png");
+    REQUIRE(CleanupPath("/../images/cover.png") == "/images/cover.png");
+}
@@ -0,0 +1,188 @@
+//
+//  library_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2012-2013 The Readium Foundation and contributors.
+//
+//  The Readium SDK is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include "../ePub3/ePub/library.h"
+#include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/package.h"
+#include "catch.hpp"
+
+using namespace ePub3;
+
+#define EPUB_PATH       "TestData/childrens-literature-20120722.epub"
+#define FXL_EPUB_PATH   "TestData/page-blanche.epub"
+#define CATALOG_PATH    "library-test.catalog"
+#define CSV_PATH        "library-test.csv"
+
+// Library's constructors are only available to subclasses
+class TestLibrary : public Library
+{
+public:
+    TestLibrary() : Library() {}
+    TestLibrary(const string& path) : Library(path) {}
+};
+
+static string UniqueIDOf(const char* path)
+{
+    return Container::OpenContainer(path)->DefaultPackage()->UniqueID();
+}
+
+TEST_CASE("Libraries round-trip through a binary catalog", "")
+{
+    string uid = UniqueIDOf(EPUB_PATH), fxlUID = UniqueIDOf(FXL_EPUB_PATH);
+    {
+        TestLibrary library;
+        library.AddPublicationsInContainerAtPath(EPUB_PATH);
+        library.AddPublicationsInContainerAtPath(FXL_EPUB_PATH);
+        REQUIRE(library.NumberOfPublications() == 2);
+        REQUIRE(library.WriteCatalog(CATALOG_PATH));
+    }
+
+    TestLibrary library(CATALOG_PATH);
+    REQUIRE(library.NumberOfPublications() == 2);
+    REQUIRE(library.NumberOfCachedContainers() == 0);
+    REQUIRE(library.PathForEPubWithUniqueID(uid) == EPUB_PATH);
+    REQUIRE(library.PathForEPubWithUniqueID(fxlUID) == FXL_EPUB_PATH);
+    REQUIRE(library.PathForEPubWithUniqueID("urn:uuid:not-in-the-library").empty());
+
+    // the package-ID is the unique-ID without its modification date
+    string packageID = uid.substr(0, uid.find('@'));
+    REQUIRE(library.PathForEPubWithPackageID(packageID) == EPUB_PATH);
+
+    // cached details don't need the container
+    REQUIRE(library.TitleForEPubWithUniqueID(uid) == "Children's Literature");
+    REQUIRE_FALSE(library.AuthorForEPubWithUniqueID(uid).empty());
+    REQUIRE(library.SpineCountForEPubWithUniqueID(uid) > 0);
+    REQUIRE(library.NumberOfCachedContainers() == 0);
+
+    PackagePtr pkg = library.PackageForUniqueID(uid);
+    REQUIRE(bool(pkg));
+    REQUIRE(pkg->UniqueID() == uid);
+    REQUIRE(library.NumberOfCachedContainers() == 1);
+
+    // the catalog can be replaced while it's mapped
+    REQUIRE(library.WriteCatalog(CATALOG_PATH));
+    REQUIRE(library.PathForEPubWithUniqueID(fxlUID) == FXL_EPUB_PATH);
+    REQUIRE(TestLibrary(CATALOG_PATH).NumberOfPublications() == 2);
+
+    std::remove(CATALOG_PATH);
+}
+
+TEST_CASE("Libraries still import and export CSV", "")
+{
+    string uid = UniqueIDOf(EPUB_PATH);
+    {
+        TestLibrary library;
+        library.AddPublicationsInContainerAtPath(EPUB_PATH);
+        library.AddPublicationsInContainerAtPath(FXL_EPUB_PATH);
+        REQUIRE(library.WriteToFile(CSV_PATH));
+    }
+
+    std::ifstream stream(CSV_PATH);
+    std::string line;
+    REQUIRE(std::getline(stream, line));
+    REQUIRE(line == _Str(EPUB_PATH, ",", uid));
+    stream.close();
+
+    TestLibrary library(CSV_PATH);
+    REQUIRE(library.NumberOfPublications() == 2);
+    REQUIRE(library.PathForEPubWithUniqueID(uid) == EPUB_PATH);
+
+    // details aren't in the CSV, so are filled in once the container is opened
+    REQUIRE(library.TitleForEPubWithUniqueID(uid).empty());
+    REQUIRE(bool(library.PackageForUniqueID(uid)));
+    REQUIRE(library.TitleForEPubWithUniqueID(uid) == "Children's Literature");
+
+    std::remove(CSV_PATH);
+}
+
+TEST_CASE("Libraries keep a bounded number of containers open", "")
+{
+    string uid = UniqueIDOf(EPUB_PATH), fxlUID = UniqueIDOf(FXL_EPUB_PATH);
+    TestLibrary library;
+    library.AddPublicationsInContainerAtPath(EPUB_PATH);
+    library.AddPublicationsInContainerAtPath(FXL_EPUB_PATH);
+    REQUIRE(library.NumberOfCachedContainers() == 2);
+
+    library.SetContainerCacheLimit(1);
+    REQUIRE(library.NumberOfCachedContainers() == 1);
+
+    // the least recently used is released, and reopened on demand
+    REQUIRE_FALSE(bool(library.PackageForUniqueID(uid, false)));
+    PackagePtr pkg = library.PackageForUniqueID(uid);
+    REQUIRE(bool(pkg));
+    REQUIRE(bool(pkg->GetContainer()));
+    REQUIRE(library.NumberOfCachedContainers() == 1);
+
+    REQUIRE(bool(library.PackageForUniqueID(fxlUID)));
+    REQUIRE(library.NumberOfCachedContainers() == 1);
+    REQUIRE(pkg->UniqueID() == uid);     // still usable
+}
+
+TEST_CASE("Damaged catalogs are rejected", "")
+{
+    {
+        std::ofstream stream(CATALOG_PATH, std::ios::binary);
+        stream.write("RDMLIBCT", 8);
+        stream << std::string(64, '\xff');
+    }
+
+    REQUIRE_THROWS_AS(TestLibrary(CATALOG_PATH), std::invalid_argument);
+    std::remove(CATALOG_PATH);
+}
+
+TEST_CASE("Library catalog benchmark", "[.][benchmark]")
+{
+    const int count = 300000;
+    typedef std::chrono::duration<double> seconds;
+    {
+        std::ofstream stream(CSV_PATH);
+        for ( int i = 0; i < count; i++ )
+            stream << "books/" << i << ".epub,urn:uuid:" << i << "@2012-01-01T00:00:00Z" << std::endl;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    {
+        TestLibrary library(CSV_PATH);
+        REQUIRE(library.NumberOfPublications() == size_t(count));
+        seconds elapsed = std::chrono::high_resolution_clock::now() - start;
+        WARN(count << " titles: CSV loaded in " << elapsed.count() << "s");
+        REQUIRE(library.WriteCatalog(CATALOG_PATH));
+    }
+
+    start = std::chrono::high_resolution_clock::now();
+    TestLibrary library(CATALOG_PATH);
+    seconds elapsed = std::chrono::high_resolution_clock::now() - start;
+    WARN(count << " titles: catalog loaded in " << elapsed.count() << "s");
+
+    start = std::chrono::high_resolution_clock::now();
+    size_t found = 0;
+    for ( int i = 0; i < count; i += 3 )
+        found += !library.PathForEPubWithPackageID(_Str("urn:uuid:", i)).empty();
+    elapsed = std::chrono::high_resolution_clock::now() - start;
+    REQUIRE(found == size_t((count + 2) / 3));
+    WARN(double(found) / elapsed.count() << " package-ID lookups/s");
+
+    std::remove(CSV_PATH);
+    std::remove(CATALOG_PATH);
+}
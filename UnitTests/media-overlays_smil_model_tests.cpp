@@ -0,0 +1,121 @@
+//
+//  media-overlays_smil_model_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2012-2013 The Readium Foundation and contributors.
+//
+//  The Readium SDK is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/package.h"
+#include "../ePub3/ePub/media-overlays_smil_model.h"
+#include "../ePub3/utilities/executor.h"
+#include "catch.hpp"
+
+using namespace ePub3;
+
+// chapter1.smil: 2000ms, 1500ms, a par without audio, then 1000ms in a nested seq
+// chapter2: no overlay
+// chapter3.smil: 3000ms, 2000ms
+#define EPUB_PATH "TestData/media-overlays-sample.epub"
+
+// the container owns the package, which owns the model
+static std::shared_ptr<MediaOverlaysSmilModel> OpenSmilModel(ContainerPtr& container, bool lazy)
+{
+    container = Container::New();
+    REQUIRE(container->Open(EPUB_PATH, lazy));
+    PackagePtr pkg = container->DefaultPackage();
+    REQUIRE(pkg != nullptr);
+    return pkg->MediaOverlaysSmilModel();
+}
+
+static double Percent(uint32_t milliseconds)
+{
+    return ((double) milliseconds / 9500.0) * 100.0;
+}
+
+TEST_CASE("Media overlay positions are located on the timeline", "")
+{
+    ContainerPtr container;
+    auto model = OpenSmilModel(container, false);
+    REQUIRE(model->GetSmilCount() == 3);
+    REQUIRE(model->DurationMilliseconds_Calculated() == 9500);
+
+    REQUIRE(model->PositionToPercent(0, 0, 0) == 0.0);
+    REQUIRE(model->PositionToPercent(0, 1, 0) == Percent(2000));
+    REQUIRE(model->PositionToPercent(0, 3, 100) == Percent(3600));     // the par without audio takes no time
+    REQUIRE(model->PositionToPercent(2, 1, 500) == Percent(8000));
+    REQUIRE(model->PositionToPercent(0, 4, 0) == -1.0);
+    REQUIRE(model->PositionToPercent(3, 0, 0) == -1.0);
+
+    SMILDataPtr smilData;
+    uint32_t smilIndex = 0, parIndex = 0, milliseconds = 0;
+    shared_ptr<const SMILData::Parallel> par;
+    model->PercentToPosition(50.0, smilData, smilIndex, par, parIndex, milliseconds);
+    REQUIRE(par != nullptr);
+    REQUIRE(smilIndex == 2);
+    REQUIRE(parIndex == 0);
+    REQUIRE(milliseconds == 250);
+    REQUIRE(smilData == model->GetSmil(2));
+    REQUIRE(par->Owner() == smilData);
+
+    model->PercentToPosition(40.0, smilData, smilIndex, par, parIndex, milliseconds);
+    REQUIRE(smilIndex == 0);
+    REQUIRE(parIndex == 3);
+    REQUIRE(milliseconds == 300);
+    REQUIRE(par->Text()->SrcFragmentId() == "s4");
+}
+
+TEST_CASE("Media overlays can parse each SMIL on first use", "")
+{
+    ContainerPtr eagerContainer, container;
+    auto eager = OpenSmilModel(eagerContainer, false);
+    auto model = OpenSmilModel(container, true);
+    model->SetPrefetchCount(0);
+
+    REQUIRE(model->ParsesLazily());
+    REQUIRE_FALSE(model->GetSmil(0)->IsParsed());
+    REQUIRE(model->GetSmil(1)->IsParsed());                 // a placeholder: nothing to parse
+    REQUIRE_FALSE(model->GetSmil(2)->IsParsed());
+    REQUIRE(model->DurationMilliseconds_Calculated() == 9500);  // from the metadata
+
+    // only the SMIL containing the requested time is parsed
+    SMILDataPtr smilData;
+    uint32_t smilIndex = 0, parIndex = 0, milliseconds = 0;
+    shared_ptr<const SMILData::Parallel> par;
+    model->PercentToPosition(50.0, smilData, smilIndex, par, parIndex, milliseconds);
+    REQUIRE(par != nullptr);
+    REQUIRE(smilIndex == 2);
+    REQUIRE(milliseconds == 250);
+    REQUIRE(model->GetSmil(2)->IsParsed());
+    REQUIRE_FALSE(model->GetSmil(0)->IsParsed());
+
+    // the body is parsed on demand
+    REQUIRE(model->GetSmil(0)->Body() != nullptr);
+    REQUIRE(model->GetSmil(0)->IsParsed());
+    REQUIRE(model->GetSmil(0)->Body()->GetChildrenCount() == eager->GetSmil(0)->Body()->GetChildrenCount());
+    REQUIRE(model->PositionToPercent(0, 3, 100) == eager->PositionToPercent(0, 3, 100));
+}
+
+TEST_CASE("Media overlays prefetch the following SMILs", "")
+{
+    ContainerPtr container;
+    auto model = OpenSmilModel(container, true);
+    model->SetPrefetchExecutor(std::make_shared<inline_executor>());
+    model->SetPrefetchCount(2);
+
+    REQUIRE(model->GetSmil(0)->Body() != nullptr);
+    REQUIRE(model->GetSmil(2)->IsParsed());
+}
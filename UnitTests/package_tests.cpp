@@ -26,6 +26,9 @@
 #include "catch.hpp"
 #include <cstdlib>
 #include "../ePub3/xml/tree/document.h"
+#include "../ePub3/xml/tree/element.h"
+#include "../ePub3/ePub/xpath_wrangler.h"
+#include <thread>
 
 #define EPUB_PATH "TestData/childrens-literature-20120722.epub"
 #define BINDINGS_EPUB_PATH "TestData/widget-figure-gallery-20121022.epub"
@@ -985,6 +988,49 @@ TEST_CASE("Package should have multiple spine items", "")
     REQUIRE(pkg->SpineItemAt(idx) == (*pkg)[idx]);
 }
 
+TEST_CASE("Spine lookups by index and idref should agree with the spine's linked list", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    REQUIRE(pkg->SpineItemCount() == pkg->FirstSpineItem()->Count());
+    
+    size_t idx = 0;
+    for ( auto item = pkg->FirstSpineItem(); item != nullptr; item = item->Next(), idx++ )
+    {
+        REQUIRE(item->Index() == idx);
+        REQUIRE(pkg->SpineItemAt(idx) == item);
+        REQUIRE(pkg->IndexOfSpineItemWithIDRef(item->Idref()) == idx);
+        REQUIRE(pkg->SpineItemWithIDRef(item->Idref()) == item);
+    }
+    
+    REQUIRE(pkg->SpineItemAt(idx) == nullptr);
+    REQUIRE(pkg->IndexOfSpineItemWithIDRef("no-such-idref") == size_t(-1));
+    REQUIRE(pkg->SpineItemWithIDRef("no-such-idref") == nullptr);
+}
+
+TEST_CASE("Manifest items should be locatable by relative path", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    
+    for ( auto& pair : pkg->Manifest() )
+    {
+        ManifestItemPtr item = pair.second;
+        string href = item->BaseHref();
+        CAPTURE(href);
+        
+        REQUIRE(pkg->ManifestItemAtRelativePath(href) == item);
+        REQUIRE(pkg->ManifestItemAtRelativePath(_Str("/", href)) == item);
+        REQUIRE(pkg->ManifestItemAtRelativePath(_Str("./", href)) == item);
+        REQUIRE(pkg->ManifestItemAtRelativePath(_Str("missing/../", href)) == item);
+        REQUIRE(pkg->ManifestItemAtRelativePath(_Str(href, "#fragment")) == item);
+        REQUIRE(pkg->ManifestItemAtRelativePath(IRI::URLEncodeComponent(href)) == item);
+    }
+    
+    REQUIRE(pkg->ManifestItemAtRelativePath("missing.xhtml") == nullptr);
+    REQUIRE(pkg->ManifestItemAtRelativePath("") == nullptr);
+}
+
 TEST_CASE("Package should be able to create and resolve basic CFIs", "")
 {
     ContainerPtr c = Container::OpenContainer(EPUB_PATH);
@@ -1033,3 +1079,113 @@ TEST_CASE("Package should parse bindings correctly.", "")
     IRI target = handler->Target("test.xml", ContentHandler::ParameterList());
     REQUIRE(target.URIString() == _Str("epub3://", pkg->PackageID(), "/EPUB/figure-gallery-widget/figure-gallery-impl.xhtml?src=test.xml"));
 }
+
+TEST_CASE("XPath wranglers should reuse their context across queries and threads", "")
+{
+    auto doc = ePub3::xml::Wrapped<ePub3::xml::Document>(xmlParseMemory(kInvalidVersion, (int)strlen(kInvalidVersion)));
+    
+    XPathWrangler xpath(doc, {{"opf", "http://www.idpf.org/2007/opf"}});
+    REQUIRE(xpath.Nodes("/opf:package/opf:manifest/opf:item").size() == 5);
+    REQUIRE(xpath.Nodes("/opf:package/opf:spine/opf:itemref").size() == 3);
+    
+    // namespaces added later apply to the existing context
+    REQUIRE(xpath.Strings("//dc:language/text()").empty());
+    xpath.RegisterNamespaces({{"dc", "http://purl.org/dc/elements/1.1/"}});
+    XPathWrangler::StringList strings = xpath.Strings("//dc:language/text()");
+    REQUIRE(strings.size() == 1);
+    REQUIRE(strings[0] == "en");
+    
+    // the compiled expressions are shared between threads, though documents aren't
+    std::vector<std::thread> threads;
+    std::vector<size_t> counts(4);
+    for ( size_t i = 0; i < counts.size(); i++ )
+    {
+        threads.emplace_back([&, i]() {
+            auto localDoc = ePub3::xml::Wrapped<ePub3::xml::Document>(xmlParseMemory(kInvalidVersion, (int)strlen(kInvalidVersion)));
+            XPathWrangler local(localDoc, {{"opf", "http://www.idpf.org/2007/opf"}});
+            for ( int n = 0; n < 100; n++ )
+                counts[i] += local.Nodes("/opf:package/opf:manifest/opf:item").size();
+        });
+    }
+    for ( auto& thread : threads )
+        thread.join();
+    
+    for ( size_t count : counts )
+        REQUIRE(count == 500);
+}
+
+TEST_CASE("Node handles should walk the tree without creating wrappers", "")
+{
+    xmlDocPtr xml = xmlParseMemory(kInvalidVersion, (int)strlen(kInvalidVersion));
+    auto doc = ePub3::xml::Wrapped<ePub3::xml::Document>(xml);
+    
+    ePub3::xml::NodeHandle root(doc->Root());
+    REQUIRE(root.HasName("package"));
+    REQUIRE(root.AttributeValue("unique-identifier") == "id");
+    
+    size_t elements = 0;
+    for ( ePub3::xml::NodeHandle child = root.FirstElementChild(); bool(child); child = child.NextElementSibling() )
+    {
+        REQUIRE(child.Parent() == root);
+        REQUIRE(child.xml()->_private == nullptr);
+        elements++;
+    }
+    REQUIRE(elements == 3);
+    
+    // wrappers come from the document's arena, and are created only once
+    ePub3::xml::NodeHandle spine = root.FirstElementChild().NextElementSibling().NextElementSibling();
+    auto wrapper = spine.Wrapper();
+    REQUIRE(wrapper->Name() == "spine");
+    REQUIRE(wrapper == spine.Wrapper());
+    REQUIRE(wrapper == doc->Root()->FirstElementChild()->NextElementSibling()->NextElementSibling());
+    REQUIRE(ePub3::xml::NodeHandle(wrapper) == spine);
+}
+
+TEST_CASE("Manifest items should share parsed documents through the package's cache", "")
+{
+    ContainerPtr c = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = c->DefaultPackage();
+    DocumentCache& cache = pkg->ParsedDocumentCache();
+    cache.Clear();
+    cache.ResetStatistics();
+    
+    ManifestItemPtr first = pkg->SpineItemAt(0)->ManifestItem();
+    ManifestItemPtr second = pkg->SpineItemAt(1)->ManifestItem();
+    
+    auto doc = first->ReferencedDocument();
+    REQUIRE(bool(doc));
+    REQUIRE(first->ReferencedDocument() == doc);
+    REQUIRE(cache.Misses() == 1);
+    REQUIRE(cache.Hits() == 1);
+    REQUIRE(cache.Count() == 1);
+    REQUIRE(cache.ByteCount() > 0);
+    
+    // shrinking the budget evicts the least recently used document
+    auto other = second->ReferencedDocument();
+    REQUIRE(other != doc);
+    REQUIRE(cache.Count() == 2);
+    cache.SetByteBudget(cache.ByteCount() - 1);
+    REQUIRE(cache.Count() == 1);
+    REQUIRE(cache.Evictions() == 1);
+    REQUIRE(cache.Find(second->BaseHref()) == other);
+    REQUIRE_FALSE(bool(cache.Find(first->BaseHref())));
+    cache.SetByteBudget(DocumentCache::DefaultByteBudget);
+    
+    // concurrent lookups all see the same document
+    std::vector<std::thread> threads;
+    std::vector<std::shared_ptr<ePub3::xml::Document>> docs(4);
+    for ( size_t i = 0; i < docs.size(); i++ )
+    {
+        threads.emplace_back([&, i]() {
+            for ( int n = 0; n < 50; n++ )
+                docs[i] = first->ReferencedDocument();
+        });
+    }
+    for ( auto& thread : threads )
+        thread.join();
+    
+    for ( auto& d : docs )
+        REQUIRE(d == docs[0]);
+    size_t lookups = cache.Hits() + cache.Misses();
+    REQUIRE(lookups == 203);
+}
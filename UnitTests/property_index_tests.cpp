@@ -0,0 +1,144 @@
+//
+//  property_index_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2012-2013 The Readium Foundation and contributors.
+//
+//  The Readium SDK is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <chrono>
+#include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/package.h"
+#include "../ePub3/ePub/property_holder.h"
+#include "../ePub3/ePub/property_atom.h"
+#include "catch.hpp"
+
+using namespace ePub3;
+
+#define EPUB_PATH "TestData/childrens-literature-20120722.epub"
+
+static PropertyPtr MakeProperty(shared_ptr<PropertyHolder>& holder, const string& reference, const string& value)
+{
+    PropertyPtr prop = Property::New(holder);
+    prop->SetPropertyIdentifier(holder->MakePropertyIRI(reference));
+    prop->SetValue(value);
+    return prop;
+}
+
+TEST_CASE("Property IRIs are interned as atoms", "")
+{
+    PropertyAtom a(IRI("http://idpf.org/epub/vocab/package/#title-type"));
+    PropertyAtom b(IRI("http://idpf.org/epub/vocab/package/#title-type"));
+    PropertyAtom c(IRI("http://idpf.org/epub/vocab/package/#display-seq"));
+    REQUIRE(bool(a));
+    REQUIRE(a == b);
+    REQUIRE(a != c);
+    REQUIRE(PropertyAtom::Lookup(IRI("http://idpf.org/epub/vocab/package/#title-type")) == a);
+    REQUIRE(a.AtomIRI() == IRI("http://idpf.org/epub/vocab/package/#title-type"));
+
+    // looking up an unknown IRI doesn't intern it
+    IRI unknown("http://example.com/vocab/#never-interned");
+    REQUIRE_FALSE(bool(PropertyAtom::Lookup(unknown)));
+    REQUIRE_FALSE(bool(PropertyAtom::Lookup(unknown)));
+
+    REQUIRE(AtomForDCType(DCType::Title) == PropertyAtom(IRIForDCType(DCType::Title)));
+}
+
+TEST_CASE("Property holders keep their index up to date", "")
+{
+    shared_ptr<PropertyHolder> holder = std::make_shared<PropertyHolder>();
+    PropertyPtr first = MakeProperty(holder, "alpha", "1");
+    PropertyPtr second = MakeProperty(holder, "beta", "2");
+    PropertyPtr third = MakeProperty(holder, "alpha", "3");
+    holder->AddProperty(first);
+    holder->AddProperty(second);
+    holder->AddProperty(third);
+
+    IRI alpha = holder->MakePropertyIRI("alpha");
+    IRI gamma = holder->MakePropertyIRI("gamma");
+    REQUIRE(holder->ContainsProperty(alpha));
+    REQUIRE(holder->PropertyMatching(alpha) == first);
+    REQUIRE(holder->PropertiesMatching(alpha).size() == 2);
+    REQUIRE_FALSE(holder->ContainsProperty(gamma));
+
+    // an extension added after the property was, still in document order
+    PropertyExtensionPtr extension = PropertyExtension::New(second);
+    extension->SetPropertyIdentifier(alpha);
+    second->AddExtension(extension);
+    auto matches = holder->PropertiesMatching(alpha);
+    REQUIRE(matches.size() == 3);
+    REQUIRE(matches[0] == first);
+    REQUIRE(matches[1] == second);
+    REQUIRE(matches[2] == third);
+    REQUIRE(second->ExtensionWithIdentifier(alpha) == extension);
+    REQUIRE(holder->PropertyMatching(alpha) == first);  // identifiers only
+
+    // changing an identifier moves the property
+    first->SetPropertyIdentifier(gamma);
+    REQUIRE(holder->PropertyMatching(gamma) == first);
+    REQUIRE(holder->PropertyMatching(alpha) == third);
+
+    // removing shifts the positions of the rest
+    holder->RemoveProperty(gamma);
+    REQUIRE(holder->NumberOfProperties() == 2);
+    REQUIRE_FALSE(holder->ContainsProperty(gamma));
+    matches = holder->PropertiesMatching(alpha);
+    REQUIRE(matches.size() == 2);
+    REQUIRE(matches[0] == second);
+    REQUIRE(matches[1] == third);
+
+    holder->ErasePropertyAt(0);
+    REQUIRE(holder->PropertiesMatching(alpha).size() == 1);
+    REQUIRE(holder->PropertyMatching(holder->MakePropertyIRI("beta")) == nullptr);
+
+    // copies carry their index along
+    PropertyHolder copy(*holder);
+    REQUIRE(copy.PropertyMatching(alpha) == third);
+}
+
+TEST_CASE("Package metadata is found through the property index", "")
+{
+    ContainerPtr container = Container::OpenContainer(EPUB_PATH);
+    PackagePtr pkg = container->DefaultPackage();
+
+    auto titles = pkg->PropertiesMatching(DCType::Title);
+    REQUIRE(titles.size() >= 1);
+    REQUIRE(pkg->PropertyMatching(DCType::Title) == titles[0]);
+    REQUIRE(pkg->PropertiesMatching(AtomForDCType(DCType::Title)).size() == titles.size());
+
+    // by prefixed reference, and never for a null atom
+    REQUIRE(pkg->ContainsProperty("modified", "dcterms"));
+    REQUIRE_FALSE(pkg->ContainsProperty(PropertyAtom()));
+}
+
+TEST_CASE("Property lookup benchmark", "[.][benchmark]")
+{
+    shared_ptr<PropertyHolder> holder = std::make_shared<PropertyHolder>();
+    for ( int i = 0; i < 200; i++ )
+        holder->AddProperty(MakeProperty(holder, _Str("property-", i), _Str(i)));
+    typedef std::chrono::duration<double> seconds;
+
+    const int lookups = 200000;
+    IRI iri = holder->MakePropertyIRI("property-150");
+    size_t found = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for ( int i = 0; i < lookups; i++ )
+        found += holder->PropertiesMatching(iri, false).size();
+    seconds elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    REQUIRE(found == size_t(lookups));
+    WARN("200 properties: " << double(lookups) / elapsed.count() << " lookups/s");
+}
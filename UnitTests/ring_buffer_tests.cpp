@@ -0,0 +1,204 @@
+//
+//  ring_buffer_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2012-2013 The Readium Foundation and contributors.
+//
+//  The Readium SDK is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "../ePub3/utilities/ring_buffer.h"
+#include "catch.hpp"
+
+using namespace EPUB3_NAMESPACE;
+
+// Streams a counting byte pattern through a buffer from one thread to another,
+// returning the number of mismatched bytes seen by the consumer. Benchmarks skip
+// generating and checking the pattern, so as to measure only the buffer.
+template <class _Produce, class _Consume>
+static size_t TransferPattern(size_t total, _Produce produce, _Consume consume, bool verify=true)
+{
+    std::thread producer([&]() {
+        uint8_t chunk[1500];
+        size_t sent = 0;
+        while ( sent < total )
+        {
+            size_t n = std::min(sizeof(chunk), total - sent);
+            for ( size_t i = 0; verify && i < n; i++ )
+                chunk[i] = uint8_t(sent + i);
+
+            size_t done = 0;
+            while ( done < n )
+            {
+                size_t w = produce(chunk + done, n - done);
+                if ( w == 0 )
+                    std::this_thread::yield();
+                done += w;
+            }
+            sent += n;
+        }
+    });
+
+    size_t received = 0, mismatches = 0;
+    uint8_t chunk[1100];
+    while ( received < total )
+    {
+        size_t n = consume(chunk, sizeof(chunk));
+        if ( n == 0 )
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for ( size_t i = 0; verify && i < n; i++ )
+        {
+            if ( chunk[i] != uint8_t(received + i) )
+                mismatches++;
+        }
+        received += n;
+    }
+
+    producer.join();
+    return mismatches;
+}
+
+TEST_CASE("RingBuffer capacity is a power of two", "")
+{
+    RingBuffer a(4096), b(1000), c(1);
+    REQUIRE(a.Capacity() == 4096);
+    REQUIRE(b.Capacity() == 1024);
+    REQUIRE(c.Capacity() == 1);
+    REQUIRE(b.SpaceAvailable() == 1024);
+    REQUIRE_FALSE(b.HasData());
+}
+
+TEST_CASE("RingBuffer reads and writes wrap around the end of the storage", "")
+{
+    RingBuffer buf(16);
+    uint8_t in[16], out[16];
+    for ( int i = 0; i < 16; i++ )
+        in[i] = uint8_t(i);
+
+    REQUIRE(buf.WriteBytes(in, 10) == 10);
+    REQUIRE(buf.ReadBytes(out, 4) == 4);
+    buf.RemoveBytes(4);
+
+    // only 10 bytes of space: the write is truncated, and wraps
+    REQUIRE(buf.WriteBytes(in, 16) == 10);
+    REQUIRE(buf.BytesAvailable() == 16);
+    REQUIRE_FALSE(buf.HasSpace());
+
+    // asking for more than is present copies only what's there
+    uint8_t big[32];
+    REQUIRE(buf.ReadBytes(big, sizeof(big)) == 16);
+    REQUIRE(memcmp(big, in + 4, 6) == 0);
+    REQUIRE(memcmp(big + 6, in, 10) == 0);
+}
+
+TEST_CASE("RingBuffer regions expose contiguous storage", "")
+{
+    RingBuffer buf(16);
+    uint8_t filler[12] = {};
+    REQUIRE(buf.WriteBytes(filler, 12) == 12);
+    buf.RemoveBytes(12);
+
+    size_t len = 0;
+    uint8_t* dst = buf.WriteRegion(&len);
+    REQUIRE(len == 4);                  // up to the end of the storage
+    memcpy(dst, "abcd", 4);
+    buf.CommitBytes(4);
+
+    dst = buf.WriteRegion(&len);
+    REQUIRE(len == 12);                 // then from the start
+    memcpy(dst, "efgh", 4);
+    buf.CommitBytes(4);
+
+    const uint8_t* src = buf.ReadRegion(&len);
+    REQUIRE(len == 4);
+    REQUIRE(memcmp(src, "abcd", 4) == 0);
+    buf.RemoveBytes(4);
+
+    src = buf.ReadRegion(&len);
+    REQUIRE(len == 4);
+    REQUIRE(memcmp(src, "efgh", 4) == 0);
+}
+
+TEST_CASE("RingBuffer needs no locking with one producer and one consumer", "")
+{
+    RingBuffer buf(256);
+    size_t mismatches = TransferPattern(1 << 20,
+        [&](const uint8_t* p, size_t n) { return buf.WriteBytes(p, n); },
+        [&](uint8_t* p, size_t n) {
+            size_t r = buf.ReadBytes(p, n);
+            buf.RemoveBytes(r);
+            return r;
+        });
+    REQUIRE(mismatches == 0);
+    REQUIRE_FALSE(buf.HasData());
+}
+
+TEST_CASE("RingBuffer throughput benchmark", "[.][benchmark]")
+{
+    const size_t total = 256 * 1024 * 1024;
+    typedef std::chrono::duration<double> seconds;
+
+    // the old usage: every access made under the buffer's lock
+    RingBuffer locked(4096);
+    auto start = std::chrono::high_resolution_clock::now();
+    TransferPattern(total,
+        [&](const uint8_t* p, size_t n) {
+            std::lock_guard<RingBuffer> _(locked);
+            return locked.WriteBytes(p, n);
+        },
+        [&](uint8_t* p, size_t n) {
+            std::lock_guard<RingBuffer> _(locked);
+            size_t r = locked.ReadBytes(p, n);
+            locked.RemoveBytes(r);
+            return r;
+        }, false);
+    seconds lockedTime = std::chrono::high_resolution_clock::now() - start;
+
+    RingBuffer lockFree(4096);
+    start = std::chrono::high_resolution_clock::now();
+    TransferPattern(total,
+        [&](const uint8_t* p, size_t n) { return lockFree.WriteBytes(p, n); },
+        [&](uint8_t* p, size_t n) {
+            size_t r = lockFree.ReadBytes(p, n);
+            lockFree.RemoveBytes(r);
+            return r;
+        }, false);
+    seconds lockFreeTime = std::chrono::high_resolution_clock::now() - start;
+
+    // zero-copy on the consumer side, as the async streams' I/O threads do
+    RingBuffer regions(4096);
+    start = std::chrono::high_resolution_clock::now();
+    TransferPattern(total,
+        [&](const uint8_t* p, size_t n) { return regions.WriteBytes(p, n); },
+        [&](uint8_t* p, size_t n) {
+            size_t len = 0;
+            const uint8_t* src = regions.ReadRegion(&len);
+            len = std::min(len, n);
+            memcpy(p, src, len);
+            regions.RemoveBytes(len);
+            return len;
+        }, false);
+    seconds regionsTime = std::chrono::high_resolution_clock::now() - start;
+
+    double mb = double(total) / (1024 * 1024);
+    WARN("locked: " << mb/lockedTime.count() << " MB/s; "
+         << "lock-free: " << mb/lockFreeTime.count() << " MB/s; "
+         << "regions: " << mb/regionsTime.count() << " MB/s");
+}
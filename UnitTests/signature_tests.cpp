@@ -0,0 +1,97 @@
+//
+//  signature_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2012-2013 The Readium Foundation and contributors.
+//
+//  The Readium SDK is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "../ePub3/ePub/container.h"
+#include "../ePub3/ePub/signatures.h"
+#include "../ePub3/utilities/executor.h"
+#include "catch.hpp"
+
+using namespace ePub3;
+
+// META-INF/signatures.xml references, in order:
+//  cover.png (sha256), package.opf (C14N 1.0, sha1), s04.xhtml (sha512, percent-encoded),
+//  epub.css (wrong digest), missing.xhtml (not in the container), #object (same-document)
+#define EPUB_PATH "TestData/signed-sample.epub"
+
+static ContainerPtr OpenSigned()
+{
+    ContainerPtr container = Container::New();
+    REQUIRE(container->Open(EPUB_PATH, false));
+    return container;
+}
+
+TEST_CASE("Signatures are read from META-INF/signatures.xml", "")
+{
+    ContainerPtr container = OpenSigned();
+    REQUIRE(container->Signatures().size() == 1);
+
+    const SignedInfo* info = container->Signatures()[0]->SignedInfo();
+    REQUIRE(info != nullptr);
+    REQUIRE(info->CanonicalizationMethod() == "http://www.w3.org/TR/2001/REC-xml-c14n-20010315");
+    REQUIRE(info->References().size() == 6);
+
+    const SignatureReference& opf = info->References()[1];
+    REQUIRE(opf.Path() == "EPUB/package.opf");
+    REQUIRE(opf.Transforms().size() == 1);
+    REQUIRE(opf.Digest().Algorithm() == "http://www.w3.org/2000/09/xmldsig#sha1");
+    REQUIRE(opf.Digest().Bytes().size() == 20);
+
+    REQUIRE(info->References()[2].Path() == "EPUB/s04.xhtml");
+    REQUIRE(info->References()[5].Path().empty());
+
+    REQUIRE(Container::New()->Signatures().empty());
+}
+
+TEST_CASE("Signature reference digests are verified", "")
+{
+    ContainerPtr container = OpenSigned();
+    DigitalSignature::DigestResults results;
+    REQUIRE_FALSE(container->VerifySignatureDigests(false, &results));
+    REQUIRE(results.size() == 6);
+
+    REQUIRE(results[0].second == DigestStatus::Valid);
+    REQUIRE(results[1].second == DigestStatus::Valid);      // canonicalized first
+    REQUIRE(results[2].second == DigestStatus::Valid);
+    REQUIRE(results[3].second == DigestStatus::Mismatch);
+    REQUIRE(results[4].second == DigestStatus::MissingItem);
+    REQUIRE(results[5].second == DigestStatus::Unsupported);
+    REQUIRE(results[3].first->URI() == "EPUB/css/epub.css");
+
+    // the valid references alone
+    auto& refs = container->Signatures()[0]->SignedInfo()->References();
+    std::vector<const SignatureReference*> valid = { &refs[0], &refs[1], &refs[2] };
+    REQUIRE(DigitalSignature::VerifyReferenceDigests(valid, *container->GetArchive()));
+}
+
+TEST_CASE("Signature verification can stop at the first failure", "")
+{
+    ContainerPtr container = OpenSigned();
+    DigitalSignature::DigestResults results;
+
+    // run in order, so nothing after the mismatch is checked
+    auto signature = container->Signatures()[0];
+    REQUIRE_FALSE(signature->VerifyReferenceDigests(*container->GetArchive(), true, &results,
+                                                    std::make_shared<inline_executor>()));
+    REQUIRE(results.size() == 6);
+    REQUIRE(results[2].second == DigestStatus::Valid);
+    REQUIRE(results[3].second == DigestStatus::Mismatch);
+    REQUIRE(results[4].second == DigestStatus::NotChecked);
+    REQUIRE(results[5].second == DigestStatus::NotChecked);
+}
@@ -424,3 +424,41 @@ TEST_CASE("Processors should NOT uncomment switch constructs which have been com
     
     SwitchPreprocessor::SetSupportedNamespaces({});
 }
+
+static std::string FilterInChunks(SwitchPreprocessor& proc, const char* input, size_t len, size_t chunkSize)
+{
+    std::unique_ptr<FilterContext> ctx(proc.MakeFilterContext(nullptr));
+    std::string pending, result;
+    
+    for ( size_t pos = 0; pos < len; pos += chunkSize )
+    {
+        size_t n = std::min(chunkSize, len - pos);
+        bool final = (pos + n == len);
+        pending.append(input + pos, n);
+        
+        size_t consumed = 0;
+        size_t produced = proc.FilterDataInPlace(ctx.get(), reinterpret_cast<uint8_t*>(&pending[0]), pending.size(), &consumed, final);
+        result.append(pending.data(), produced);
+        pending.erase(0, consumed);
+    }
+    
+    return result;
+}
+
+TEST_CASE("Processors should produce the same output however the content is chunked", "")
+{
+    SwitchPreprocessor proc;
+    
+    for ( const char* input : {gInput, gCommentedInput, gTotallyCommentedInput} )
+    {
+        size_t len = strlen(input);
+        std::string whole = FilterInChunks(proc, input, len, len);
+        REQUIRE_FALSE(whole.empty());
+        
+        for ( size_t chunkSize : {1, 3, 17, 64, 1000} )
+        {
+            INFO("Chunk size: " << chunkSize);
+            REQUIRE(FilterInChunks(proc, input, len, chunkSize) == whole);
+        }
+    }
+}
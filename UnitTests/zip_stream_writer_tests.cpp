@@ -0,0 +1,176 @@
+//
+//  zip_stream_writer_tests.cpp
+//  ePub3
+//
+//  Copyright (c) 2012-2013 The Readium Foundation and contributors.
+//
+//  The Readium SDK is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include "../ePub3/ePub/zip_archive.h"
+#include "../ePub3/ePub/zip_stream_writer.h"
+#include "../ePub3/utilities/byte_stream.h"
+#include "../ePub3/utilities/executor.h"
+#include "catch.hpp"
+
+using namespace ePub3;
+
+#define EPUB_PATH   "TestData/childrens-literature-20120722.epub"
+#define OUTPUT_PATH "zip-stream-writer-test.epub"
+
+static std::string ReadWholeItem(const ZipArchive& archive, const string& path)
+{
+    std::string result;
+    auto stream = archive.ByteStreamAtPath(path);
+    char buf[4096];
+    ByteStream::size_type n;
+    while ( (n = stream->ReadBytes(buf, sizeof(buf))) > 0 )
+        result.append(buf, n);
+    return result;
+}
+
+// compressible, but not trivially so
+static std::string MakeText(size_t size)
+{
+    std::string text;
+    text.reserve(size);
+    uint32_t seed = 12345;
+    while ( text.size() < size )
+    {
+        seed = seed * 1103515245 + 12345;
+        text += "<p id=\"p" + std::to_string(seed % 997) + "\">Lorem ipsum dolor sit amet " + std::to_string(seed >> 16) + "</p>\n";
+    }
+    text.resize(size);
+    return text;
+}
+
+static bool WriteItem(ZipStreamWriter& zip, const string& path, const std::string& data, bool compress, size_t chunk=4000)
+{
+    auto writer = zip.WriterAtPath(path, compress);
+    if ( !bool(writer) )
+        return false;
+    for ( size_t done = 0; done < data.size(); done += chunk )
+    {
+        size_t n = std::min(chunk, data.size() - done);
+        if ( writer->write(data.data() + done, n) != ssize_t(n) )
+            return false;
+    }
+    return true;
+}
+
+TEST_CASE("Streamed zip archives are readable by ZipArchive", "")
+{
+    std::string small("body { margin: 0; }\n");
+    std::string large = MakeText(1500000);
+    {
+        ZipStreamWriter zip(OUTPUT_PATH);
+        zip.SetBlockSize(64 * 1024);
+        REQUIRE(zip.BlockSize() == 64 * 1024);
+
+        REQUIRE(WriteItem(zip, "mimetype", "application/epub+zip", false));
+        REQUIRE(zip.CreateFolder("EPUB"));
+        REQUIRE(WriteItem(zip, "EPUB/epub.css", small, true));
+        REQUIRE(WriteItem(zip, "EPUB/empty.xhtml", "", true));
+
+        // cut into many blocks, compressed in parallel
+        REQUIRE(WriteItem(zip, "/EPUB/large.xhtml", large, true, 10000));
+        REQUIRE(zip.Close());
+        REQUIRE_FALSE(zip.IsOpen());
+        REQUIRE(zip.WriterAtPath("EPUB/late.xhtml") == nullptr);
+    }
+
+    {
+        MappedZipArchive archive(OUTPUT_PATH);
+        REQUIRE(archive.ContainsItem("EPUB/"));
+
+        // stored first, with its local header complete, as OCF requires
+        ArchiveSpan mimetype = archive.SpanAtPath("mimetype");
+        REQUIRE(std::string(reinterpret_cast<const char*>(mimetype.data()), mimetype.size()) == "application/epub+zip");
+
+        REQUIRE(ReadWholeItem(archive, "EPUB/epub.css") == small);
+        REQUIRE(ReadWholeItem(archive, "EPUB/empty.xhtml").empty());
+
+        ArchiveItemInfo info = archive.InfoAtPath("EPUB/large.xhtml");
+        REQUIRE(info.UncompressedSize() == large.size());
+        REQUIRE(info.CompressedSize() < large.size() / 2);
+        REQUIRE(ReadWholeItem(archive, "EPUB/large.xhtml") == large);
+    }
+
+    std::remove(OUTPUT_PATH);
+}
+
+TEST_CASE("Streamed zip archives can replace an archive in place", "")
+{
+    {
+        std::ifstream in(EPUB_PATH, std::ios::binary);
+        std::ofstream out(OUTPUT_PATH, std::ios::binary|std::ios::trunc);
+        out << in.rdbuf();
+    }
+
+    std::vector<string> paths;
+    {
+        // the original stays readable until the new archive is closed
+        ZipArchive original(OUTPUT_PATH);
+        original.EachItem([&](const ArchiveItemInfo& info) { paths.push_back(info.Path()); });
+
+        ZipStreamWriter zip(OUTPUT_PATH, true);
+        zip.SetExecutor(std::make_shared<inline_executor>());
+        for ( auto& path : paths )
+        {
+            REQUIRE(WriteItem(zip, path, ReadWholeItem(original, path), path != "mimetype"));
+        }
+        REQUIRE(WriteItem(zip, "EPUB/added.txt", "added", true));
+        REQUIRE(zip.Close());
+    }
+
+    ZipArchive original(EPUB_PATH), replaced(OUTPUT_PATH);
+    REQUIRE(replaced.ContainsItem("EPUB/added.txt"));
+    for ( auto& path : paths )
+    {
+        CAPTURE(path);
+        REQUIRE(ReadWholeItem(replaced, path) == ReadWholeItem(original, path));
+    }
+
+    std::remove(OUTPUT_PATH);
+}
+
+TEST_CASE("Zip writing benchmark", "[.][benchmark]")
+{
+    const int items = 100;
+    std::string text = MakeText(1024 * 1024);
+    typedef std::chrono::duration<double> seconds;
+
+    // serial deflate, as zip_close() does, against deflating blocks on the shared pool
+    seconds elapsed[2];
+    for ( int parallel = 0; parallel < 2; parallel++ )
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        {
+            ZipStreamWriter zip(OUTPUT_PATH);
+            if ( !parallel )
+                zip.SetExecutor(std::make_shared<inline_executor>());
+            for ( int i = 0; i < items; i++ )
+                WriteItem(zip, "EPUB/item" + std::to_string(i) + ".xhtml", text, true, 64 * 1024);
+        }
+        elapsed[parallel] = std::chrono::high_resolution_clock::now() - start;
+        std::remove(OUTPUT_PATH);
+    }
+
+    double mb = double(items * text.size()) / (1024 * 1024);
+    WARN("serial: " << mb/elapsed[0].count() << " MB/s; parallel: " << mb/elapsed[1].count() << " MB/s");
+}
@@ -48,13 +48,18 @@ zip_fclose(struct zip_file *zf)
 	inflateEnd(zf->zstr);
     free(zf->buffer);
     free(zf->zstr);
+    free(zf->window);
 
-    for (i=0; i<zf->za->nfile; i++) {
-	if (zf->za->file[i] == zf) {
-	    zf->za->file[i] = zf->za->file[zf->za->nfile-1];
-	    zf->za->nfile--;
-	    break;
+    if (zf->za) {
+	_zip_lock(&zf->za->file_lock);
+	for (i=0; i<zf->za->nfile; i++) {
+	    if (zf->za->file[i] == zf) {
+		zf->za->file[i] = zf->za->file[zf->za->nfile-1];
+		zf->za->nfile--;
+		break;
+	    }
 	}
+	_zip_unlock(&zf->za->file_lock);
     }
 
     ret = 0;
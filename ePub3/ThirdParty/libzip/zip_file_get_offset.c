@@ -60,22 +60,32 @@
 unsigned int
 _zip_file_get_offset(struct zip *za, int idx)
 {
-    struct zip_dirent de;
+    unsigned char buf[LENTRYSIZE];
     unsigned int offset;
+    ssize_t n;
 
     offset = za->cdir->entry[idx].offset;
 
-    if (fseeko(za->zp, offset, SEEK_SET) != 0) {
-	_zip_error_set(&za->error, ZIP_ER_SEEK, errno);
+    /* JCD: only the name and extra field lengths are needed from the local
+       header, and reading them positionally leaves the shared FILE alone */
+    n = _zip_pread(za, buf, LENTRYSIZE, offset);
+    if (n < 0) {
+	_zip_error_set(&za->error, ZIP_ER_READ, errno);
 	return 0;
     }
-
-    if (_zip_dirent_read(&de, za->zp, NULL, NULL, 1, &za->error) != 0)
+    if (n < LENTRYSIZE) {
+	_zip_error_set(&za->error, ZIP_ER_NOZIP, 0);
 	return 0;
+    }
 
-    offset += LENTRYSIZE + de.filename_len + de.extrafield_len;
+    if (memcmp(buf, LOCAL_MAGIC, 4) != 0) {
+	_zip_error_set(&za->error, ZIP_ER_NOZIP, 0);
+	return 0;
+    }
 
-    _zip_dirent_finalize(&de);
+    offset += LENTRYSIZE;
+    offset += (unsigned int)buf[26] | ((unsigned int)buf[27] << 8);    /* filename length */
+    offset += (unsigned int)buf[28] | ((unsigned int)buf[29] << 8);    /* extra field length */
 
     return offset;
 }
@@ -84,12 +94,6 @@ _zip_file_get_offset(struct zip *za, int idx)
 unsigned int
 _zip_file_get_offset_safe(struct zip* za, int idx)
 {
-    off_t curoff;
-    unsigned int offset;
-    
-    curoff = ftello(za->zp);
-    offset = _zip_file_get_offset(za, idx);
-    fseeko(za->zp, curoff, SEEK_SET);
-    
-    return offset;
+    /* _zip_file_get_offset() no longer moves the FILE position */
+    return _zip_file_get_offset(za, idx);
 }
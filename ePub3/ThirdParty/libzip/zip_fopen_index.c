@@ -36,6 +36,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "zipint.h"
 
@@ -46,6 +47,12 @@
 # define fileno _fileno
 #endif
 
+#if defined(_WIN32)
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
+
 static struct zip_file *_zip_file_new(struct zip *za);
 
 
@@ -108,6 +115,7 @@ zip_fopen_index(struct zip *za, int fileno, int flags)
 	zip_fclose(zf);
 	return NULL;
     }
+    zf->data_fpos = zf->fpos;
     
     if ((zf->flags & ZIP_ZF_DECOMP) == 0)
 	zf->bytes_left = zf->cbytes_left;
@@ -142,6 +150,15 @@ zip_fopen_index(struct zip *za, int fileno, int flags)
 	    zip_fclose(zf);
 	    return NULL;
 	}
+
+	/* JCD added: large entries record seek checkpoints as they're inflated */
+	if (za->inflate_span > 0 && zf->bytes_left > za->inflate_span) {
+	    if ((zf->window=(unsigned char *)calloc(1, WINSIZE)) == NULL) {
+		_zip_error_set(&za->error, ZIP_ER_MEMORY, 0);
+		zip_fclose(zf);
+		return NULL;
+	    }
+	}
     }
 
 	/* JCD added begin */
@@ -171,8 +188,8 @@ _zip_file_fillbuf(void *buf, size_t buflen, struct zip_file *zf)
     if ((zf->flags & ZIP_ZF_EOF) || zf->cbytes_left <= 0 || buflen <= 0)
 	return 0;
     
-    if (fseeko(zf->za->zp, zf->fpos, SEEK_SET) < 0) {
-	_zip_error_set(&zf->error, ZIP_ER_SEEK, errno);
+    if (zf->za == NULL) {
+	_zip_error_set(&zf->error, ZIP_ER_ZIPCLOSED, 0);
 	return -1;
     }
     if (buflen < zf->cbytes_left)
@@ -180,7 +197,9 @@ _zip_file_fillbuf(void *buf, size_t buflen, struct zip_file *zf)
     else
 	i = zf->cbytes_left;
 
-    j = (ssize_t)fread(buf, 1, i, zf->za->zp);
+    /* JCD: positional read, so files opened from the same archive don't
+       contend over (or corrupt) the position of the shared FILE */
+    j = _zip_pread(zf->za, buf, i, zf->fpos);
     if (j == 0) {
 	_zip_error_set(&zf->error, ZIP_ER_EOF, 0);
 	j = -1;
@@ -195,6 +214,45 @@ _zip_file_fillbuf(void *buf, size_t buflen, struct zip_file *zf)
     return (int)j;
 }
 
+
+
+/* JCD added */
+ssize_t
+_zip_pread(struct zip *za, void *buf, size_t len, off_t offset)
+{
+#if defined(_WIN32)
+    HANDLE h;
+    OVERLAPPED ov;
+    DWORD nread;
+
+    h = (HANDLE)_get_osfhandle(fileno(za->zp));
+    if (h == INVALID_HANDLE_VALUE) {
+	errno = EBADF;
+	return -1;
+    }
+
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)((unsigned long long)offset & 0xFFFFFFFFu);
+    ov.OffsetHigh = (DWORD)((unsigned long long)offset >> 32);
+
+    if (!ReadFile(h, buf, (DWORD)len, &nread, &ov)) {
+	if (GetLastError() == ERROR_HANDLE_EOF)
+	    return 0;
+	errno = EIO;
+	return -1;
+    }
+    return (ssize_t)nread;
+#else
+    ssize_t n;
+
+    do {
+	n = pread(fileno(za->zp), buf, len, offset);
+    } while (n < 0 && errno == EINTR);
+
+    return n;
+#endif
+}
+
 
 
 static struct zip_file *
@@ -208,11 +266,13 @@ _zip_file_new(struct zip *za)
 	return NULL;
     }
     
+    _zip_lock(&za->file_lock);
     if (za->nfile >= za->nfile_alloc-1) {
 	n = za->nfile_alloc + 10;
 	file = (struct zip_file **)realloc(za->file,
 					   n*sizeof(struct zip_file *));
 	if (file == NULL) {
+	    _zip_unlock(&za->file_lock);
 	    _zip_error_set(&za->error, ZIP_ER_MEMORY, 0);
 	    free(zf);
 	    return NULL;
@@ -222,6 +282,7 @@ _zip_file_new(struct zip *za)
     }
 
     za->file[za->nfile++] = zf;
+    _zip_unlock(&za->file_lock);
 
     zf->za = za;
     _zip_error_init(&zf->error);
@@ -233,6 +294,9 @@ _zip_file_new(struct zip *za)
     zf->fpos = 0;
     zf->buffer = NULL;
     zf->zstr = NULL;
+    zf->data_fpos = 0;
+    zf->window = NULL;
+    zf->window_pos = 0;
 
     return zf;
 }
@@ -81,12 +81,19 @@ zip_fread(struct zip_file *zf, void *outbuf, size_t toread)
     
     /* endless loop until something has been accomplished */
     for (;;) {
-	ret = inflate(zf->zstr, Z_SYNC_FLUSH);
+	Bytef *out_start = zf->zstr->next_out;
+
+	/* JCD: when building seek checkpoints, stop at each block boundary */
+	ret = inflate(zf->zstr, (zf->window ? Z_BLOCK : Z_SYNC_FLUSH));
+
+	if (zf->window && (ret == Z_OK || ret == Z_STREAM_END))
+	    _zip_inflate_index_record(zf, out_start, zf->zstr->next_out - out_start,
+				      zf->file_fpos + (off_t)(zf->zstr->total_out - out_before));
 
 	switch (ret) {
 	case Z_STREAM_END:
 	    if (zf->zstr->total_out == out_before) {
-		if (zf->crc != zf->crc_orig) {
+		if ((zf->flags & ZIP_ZF_CRC) && zf->crc != zf->crc_orig) {
 		    _zip_error_set(&zf->error, ZIP_ER_CRC, 0);
 		    return -1;
 		}
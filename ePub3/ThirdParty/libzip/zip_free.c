@@ -57,6 +57,7 @@ _zip_free(struct zip *za)
     if (za->zp)
 	fclose(za->zp);
 
+    _zip_inflate_index_free(za);
     _zip_cdir_free(za->cdir);
 
     if (za->entry) {
@@ -74,6 +75,7 @@ _zip_free(struct zip *za)
     }
 
     free(za->file);
+    _zip_lock_destroy(&za->file_lock);
     
     free(za);
 
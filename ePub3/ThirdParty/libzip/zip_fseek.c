@@ -51,8 +51,13 @@ static int _zip_fseek_comp(struct zip_file* zf, off_t abspos, off_t flen);
 
 /* helpers for dealing with inline decompression */
 static int _zip_fseek_to_start(struct zip_file* zf);
+static int _zip_fseek_to_point(struct zip_file* zf, struct zip_inflate_point* point);
 static int _zip_fseek_by_reading(struct zip_file* zf, size_t toread);
 
+/* helpers for seek checkpoints */
+static struct zip_inflate_point* _zip_inflate_index_find(struct zip* za, int idx, off_t abspos);
+static void _zip_inflate_window_append(struct zip_file* zf, const unsigned char* buf, size_t len);
+
 ZIP_EXTERN int
 zip_fseek(struct zip_file *zf, long pos, int whence)
 {
@@ -67,7 +72,15 @@ zip_fseek(struct zip_file *zf, long pos, int whence)
     if (pos == 0 && whence == ZIP_SEEK_CUR)
         return 0;
     
-    flen = zf->za->cdir->entry[zf->file_index].uncomp_size;
+    if (zf->za == NULL) {
+        _zip_error_set(&zf->error, ZIP_ER_ZIPCLOSED, 0);
+        return -1;
+    }
+    
+    if ((zf->flags & ZIP_ZF_DECOMP) == 0)
+        flen = zf->za->cdir->entry[zf->file_index].comp_size;
+    else
+        flen = zf->za->cdir->entry[zf->file_index].uncomp_size;
     
     switch (whence)
     {
@@ -109,20 +122,26 @@ int _zip_fseek_bytes(struct zip_file* zf, off_t abspos, off_t flen)
     /* CAN set offset past EOF: keeps offset, sets EOF */
     else if (abspos >= flen) {
         zf->flags |= ZIP_ZF_EOF;
-        zf->bytes_left = 0;
+        zf->bytes_left = zf->cbytes_left = 0;
     }
     /* not at or past EOF? ensure EOF is unset and update bytes_left */
     else {
         zf->flags &= ~ZIP_ZF_EOF;
-        zf->bytes_left = flen - abspos;
+        zf->bytes_left = zf->cbytes_left = flen - abspos;
+        zf->fpos = zf->data_fpos + abspos;
     }
     zf->file_fpos = abspos;
+    
+    /* the CRC can't be verified unless every byte is read in order */
+    zf->flags &= ~ZIP_ZF_CRC;
     return 0;
 }
 
 /* seeking by raw byte amounts - no compression/decompression to handle */
 int _zip_fseek_comp(struct zip_file* zf, off_t abspos, off_t flen)
 {
+    struct zip_inflate_point* point;
+    
     if (abspos >= flen) {
         // simple case -- set EOF
         zf->flags |= ZIP_ZF_EOF;
@@ -130,12 +149,6 @@ int _zip_fseek_comp(struct zip_file* zf, off_t abspos, off_t flen)
         zf->file_fpos = abspos;
         return 0;
     }
-    else if (abspos > zf->file_fpos) {
-        // read & decompress bytes until we reach the right position
-        return _zip_fseek_by_reading(zf, abspos-zf->file_fpos);
-    }
-    
-    /* at this point, we're definitely moving backwards */
     
     /* can't set a negative offset */
     if (abspos < 0) {
@@ -143,11 +156,25 @@ int _zip_fseek_comp(struct zip_file* zf, off_t abspos, off_t flen)
         return -1;
     }
     
-    if (_zip_fseek_to_start(zf) < 0)
-        return -1;      /* error already set */
+    /* find the nearest checkpoint before the target, if any */
+    point = _zip_inflate_index_find(zf->za, zf->file_index, abspos);
     
-    /* this is a no-op for abspos == 0 */
-    return _zip_fseek_by_reading(zf, abspos);
+    if (abspos > zf->file_fpos && (point == NULL || point->out <= zf->file_fpos)) {
+        /* moving forwards, with no checkpoint to skip ahead to:
+           read & decompress bytes until we reach the right position */
+        return _zip_fseek_by_reading(zf, abspos-zf->file_fpos);
+    }
+    
+    if (point != NULL) {
+        if (_zip_fseek_to_point(zf, point) < 0)
+            return -1;      /* error already set */
+    }
+    else if (_zip_fseek_to_start(zf) < 0) {
+        return -1;          /* error already set */
+    }
+    
+    /* this is a no-op when landing on the target */
+    return _zip_fseek_by_reading(zf, abspos-zf->file_fpos);
 }
 
 int _zip_fseek_to_start(struct zip_file* zf)
@@ -158,22 +185,75 @@ int _zip_fseek_to_start(struct zip_file* zf)
     zf->file_fpos = 0;
     zf->bytes_left = zf->za->cdir->entry[zf->file_index].uncomp_size;
     zf->cbytes_left = zf->za->cdir->entry[zf->file_index].comp_size;
-    zf->fpos = _zip_file_get_offset_safe(zf->za, zf->file_index);
+    zf->fpos = zf->data_fpos;
+    zf->crc = crc32(0L, Z_NULL, 0);
+    zf->window_pos = 0;
+    
+    /* reuse the existing inflate state */
+    if ((ret=inflateReset(zf->zstr)) != Z_OK) {
+        _zip_error_set(&zf->error, ZIP_ER_ZLIB, ret);
+        return -1;
+    }
     
     len = _zip_file_fillbuf(zf->buffer, BUFSIZE, zf);
+    if (len < 0)
+        return -1;      /* error already set */
     
-    zf->zstr->zalloc = Z_NULL;
-    zf->zstr->zfree = Z_NULL;
-	zf->zstr->opaque = NULL;
 	zf->zstr->next_in = (Bytef *)zf->buffer;
 	zf->zstr->avail_in = len;
     
-    /* negative value to tell zlib that there is no header */
-    if ((ret=inflateInit2(zf->zstr, -MAX_WBITS)) != Z_OK) {
+    return 0;
+}
+
+int _zip_fseek_to_point(struct zip_file* zf, struct zip_inflate_point* point)
+{
+    int len, ret;
+    unsigned char c;
+    off_t in = point->in - (point->bits ? 1 : 0);
+    
+    zf->flags &= ~ZIP_ZF_EOF;
+    zf->file_fpos = point->out;
+    zf->bytes_left = zf->za->cdir->entry[zf->file_index].uncomp_size - point->out;
+    zf->cbytes_left = zf->za->cdir->entry[zf->file_index].comp_size - in;
+    zf->fpos = zf->data_fpos + in;
+    
+    /* the CRC can't be verified unless every byte is read in order */
+    zf->flags &= ~ZIP_ZF_CRC;
+    
+    if ((ret=inflateReset(zf->zstr)) != Z_OK) {
+        _zip_error_set(&zf->error, ZIP_ER_ZLIB, ret);
+        return -1;
+    }
+    
+    /* the checkpoint may sit partway through a byte */
+    if (point->bits) {
+        if (_zip_file_fillbuf(&c, 1, zf) != 1) {
+            _zip_error_set(&zf->error, ZIP_ER_INCONS, 0);
+            return -1;
+        }
+        if ((ret=inflatePrime(zf->zstr, point->bits, c >> (8 - point->bits))) != Z_OK) {
+            _zip_error_set(&zf->error, ZIP_ER_ZLIB, ret);
+            return -1;
+        }
+    }
+    
+    len = _zip_file_fillbuf(zf->buffer, BUFSIZE, zf);
+    if (len < 0)
+        return -1;      /* error already set */
+    
+    zf->zstr->next_in = (Bytef *)zf->buffer;
+    zf->zstr->avail_in = len;
+    
+    if ((ret=inflateSetDictionary(zf->zstr, point->window, WINSIZE)) != Z_OK) {
         _zip_error_set(&zf->error, ZIP_ER_ZLIB, ret);
         return -1;
     }
     
+    if (zf->window) {
+        memcpy(zf->window, point->window, WINSIZE);
+        zf->window_pos = 0;
+    }
+    
     return 0;
 }
 
@@ -196,3 +276,141 @@ int _zip_fseek_by_reading(struct zip_file* zf, size_t toread)
     /* zf has been updated for us by zip_fread() already */
     return 0;
 }
+
+/* JCD added: seek checkpoints for deflated entries (after zlib's examples/zran.c) */
+
+/* Returns the last checkpoint of entry idx at or before abspos, or NULL.
+   Checkpoints are never modified or freed until the archive is, so the
+   result may be used without holding the lock. */
+struct zip_inflate_point* _zip_inflate_index_find(struct zip* za, int idx, off_t abspos)
+{
+    struct zip_inflate_index* index;
+    struct zip_inflate_point* result = NULL;
+    int lo, hi, mid;
+    
+    _zip_lock(&za->file_lock);
+    if (za->inflate_index != NULL && idx < za->ninflate_index
+        && (index=za->inflate_index[idx]) != NULL) {
+        /* binary search for the last point with out <= abspos */
+        lo = 0;
+        hi = index->npoint;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (index->point[mid]->out <= abspos)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo > 0)
+            result = index->point[lo-1];
+    }
+    _zip_unlock(&za->file_lock);
+    
+    return result;
+}
+
+/* Called with each run of data inflated by a file building checkpoints;
+   outpos is the uncompressed offset of the end of that data. */
+void _zip_inflate_index_record(struct zip_file* zf, const unsigned char* buf, size_t len, off_t outpos)
+{
+    struct zip* za = zf->za;
+    struct zip_inflate_index* index;
+    struct zip_inflate_point* point;
+    struct zip_inflate_point** points;
+    off_t frontier;
+    int n;
+    
+    _zip_inflate_window_append(zf, buf, len);
+    
+    /* only at the end of a block which isn't the last one */
+    if ((zf->zstr->data_type & 128) == 0 || (zf->zstr->data_type & 64) != 0)
+        return;
+    if (za == NULL || za->inflate_span == 0)
+        return;
+    
+    _zip_lock(&za->file_lock);
+    
+    if (za->inflate_index == NULL) {
+        za->inflate_index = (struct zip_inflate_index **)calloc(za->cdir->nentry, sizeof(struct zip_inflate_index *));
+        if (za->inflate_index == NULL)
+            goto done;
+        za->ninflate_index = za->cdir->nentry;
+    }
+    
+    index = za->inflate_index[zf->file_index];
+    if (index == NULL) {
+        if ((index=(struct zip_inflate_index *)calloc(1, sizeof(struct zip_inflate_index))) == NULL)
+            goto done;
+        za->inflate_index[zf->file_index] = index;
+    }
+    
+    /* only extend the index: another file may already have covered this area */
+    frontier = (index->npoint > 0 ? index->point[index->npoint-1]->out : 0);
+    if (outpos <= frontier || (unsigned long)(outpos - frontier) < za->inflate_span)
+        goto done;
+    
+    if (index->npoint >= index->npoint_alloc) {
+        n = index->npoint_alloc + 16;
+        points = (struct zip_inflate_point **)realloc(index->point, n*sizeof(struct zip_inflate_point *));
+        if (points == NULL)
+            goto done;
+        index->point = points;
+        index->npoint_alloc = n;
+    }
+    
+    if ((point=(struct zip_inflate_point *)malloc(sizeof(struct zip_inflate_point))) == NULL)
+        goto done;
+    
+    point->out = outpos;
+    point->in = (zf->fpos - zf->zstr->avail_in) - zf->data_fpos;
+    point->bits = zf->zstr->data_type & 7;
+    
+    /* unroll the circular window */
+    memcpy(point->window, zf->window + zf->window_pos, WINSIZE - zf->window_pos);
+    memcpy(point->window + (WINSIZE - zf->window_pos), zf->window, zf->window_pos);
+    
+    index->point[index->npoint++] = point;
+    
+done:
+    _zip_unlock(&za->file_lock);
+}
+
+void _zip_inflate_window_append(struct zip_file* zf, const unsigned char* buf, size_t len)
+{
+    size_t n;
+    
+    if (len >= WINSIZE) {
+        memcpy(zf->window, buf + (len - WINSIZE), WINSIZE);
+        zf->window_pos = 0;
+        return;
+    }
+    
+    n = WINSIZE - zf->window_pos;
+    if (n > len)
+        n = len;
+    memcpy(zf->window + zf->window_pos, buf, n);
+    memcpy(zf->window, buf + n, len - n);
+    zf->window_pos = (unsigned int)((zf->window_pos + len) % WINSIZE);
+}
+
+void _zip_inflate_index_free(struct zip* za)
+{
+    struct zip_inflate_index* index;
+    int i, j;
+    
+    if (za->inflate_index == NULL)
+        return;
+    
+    for (i=0; i<za->ninflate_index; i++) {
+        if ((index=za->inflate_index[i]) == NULL)
+            continue;
+        for (j=0; j<index->npoint; j++)
+            free(index->point[j]);
+        free(index->point);
+        free(index);
+    }
+    
+    free(za->inflate_index);
+    za->inflate_index = NULL;
+    za->ninflate_index = 0;
+}
@@ -65,6 +65,10 @@ _zip_new(struct zip_error *error)
     za->nfile = za->nfile_alloc = 0;
     za->file = NULL;
     za->flags = za->ch_flags = 0;
+    _zip_lock_init(&za->file_lock);
+    za->inflate_span = 0;
+    za->ninflate_index = 0;
+    za->inflate_index = NULL;
     
     return za;
 }
@@ -60,6 +60,24 @@ int _zip_mkstemp(char *);
 #define ftello(s)	((long)ftell((s)))
 #endif
 
+/* JCD added: lock guarding the list of open files, so that entries may be
+   opened, read and closed concurrently from multiple threads */
+#if defined(_WIN32)
+#include <windows.h>
+typedef SRWLOCK zip_lock_t;
+#define _zip_lock_init(l)	InitializeSRWLock(l)
+#define _zip_lock_destroy(l)	((void)(l))
+#define _zip_lock(l)		AcquireSRWLockExclusive(l)
+#define _zip_unlock(l)		ReleaseSRWLockExclusive(l)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t zip_lock_t;
+#define _zip_lock_init(l)	pthread_mutex_init((l), NULL)
+#define _zip_lock_destroy(l)	pthread_mutex_destroy(l)
+#define _zip_lock(l)		pthread_mutex_lock(l)
+#define _zip_unlock(l)		pthread_mutex_unlock(l)
+#endif
+
 
 
 #define CENTRAL_MAGIC "PK\1\2"
@@ -76,6 +94,7 @@ int _zip_mkstemp(char *);
 #define EOCDLEN             22
 #define CDBUFSIZE       (MAXCOMLEN+EOCDLEN)
 #define BUFSIZE		8192
+#define WINSIZE		32768u	/* JCD added: deflate window size */
 
 
 
@@ -124,6 +143,15 @@ struct zip {
     int nfile;			/* number of opened files within archive */
     int nfile_alloc;		/* number of files allocated */
     struct zip_file **file;	/* opened files within archive */
+
+    /* JCD added below */
+
+    zip_lock_t file_lock;	/* guards nfile, nfile_alloc, file and inflate_index */
+
+    unsigned long inflate_span;	/* uncompressed bytes between seek checkpoints
+				 * of deflated entries, or 0 for none */
+    int ninflate_index;		/* number of entries in inflate_index */
+    struct zip_inflate_index **inflate_index;	/* seek checkpoints, per cdir entry */
 };
 
 /* file in zip archive, part of API */
@@ -150,6 +178,27 @@ struct zip_file {
     off_t file_fpos;    /* position within this file itself -- relative to data type being returned */
                         /* i.e. if ZIP_FL_COMPRESSED, this is offset into compressed bytes, */
                         /* otherwise offset is into decompressed bytes */
+    off_t data_fpos;    /* position of the file's data within the zip file */
+    
+    unsigned char *window;      /* last WINSIZE bytes inflated, when building seek checkpoints */
+    unsigned int window_pos;    /* next write position within window */
+};
+
+/* JCD added: a point from which inflation of an entry can be resumed */
+
+struct zip_inflate_point {
+    off_t out;			/* offset within the uncompressed data */
+    off_t in;			/* offset within the compressed data of the first full byte */
+    int bits;			/* number of bits (1-7) of the preceding byte still to use, or 0 */
+    unsigned char window[WINSIZE];	/* the WINSIZE bytes of uncompressed data preceding out */
+};
+
+/* JCD added: seek checkpoints of a deflated entry, in ascending order */
+
+struct zip_inflate_index {
+    int npoint;
+    int npoint_alloc;
+    struct zip_inflate_point **point;
 };
 
 /* zip archive directory entry (central or local) */
@@ -244,9 +293,13 @@ void _zip_error_set(struct zip_error *, int, int);
 const char *_zip_error_strerror(struct zip_error *);
 
 int _zip_file_fillbuf(void *, size_t, struct zip_file *);
+ssize_t _zip_pread(struct zip *, void *, size_t, off_t);    /* JCD added, reads without moving the shared FILE position */
 unsigned int _zip_file_get_offset(struct zip *, int);
 unsigned int _zip_file_get_offset_safe(struct zip*, int);   /* JCD added, resets fpos before returning */
 
+void _zip_inflate_index_record(struct zip_file *, const unsigned char *, size_t, off_t);  /* JCD added */
+void _zip_inflate_index_free(struct zip *);                                                /* JCD added */
+
 int _zip_filerange_crc(FILE *, off_t, off_t, uLong *, struct zip_error *);
 
 struct zip_source *_zip_source_file_or_p(struct zip *, const char *, FILE *,
@@ -44,6 +44,46 @@ class ArchiveWriter;
 class ByteStream;
 class AsyncByteStream;
 
+/**
+ A read-only view of an item's bytes, held in memory owned by an archive.
+ 
+ The view remains valid only as long as the Archive which vended it.
+ @ingroup archives
+ */
+class ArchiveSpan
+{
+public:
+    ///
+    /// Creates an empty span.
+    ArchiveSpan() : _data(nullptr), _size(0) {}
+    ///
+    /// Creates a span covering `size` bytes starting at `data`.
+    ArchiveSpan(const uint8_t* data, size_t size) : _data(data), _size(size) {}
+    ArchiveSpan(const ArchiveSpan& o) : _data(o._data), _size(o._size) {}
+    ArchiveSpan& operator=(const ArchiveSpan& o) { _data = o._data; _size = o._size; return *this; }
+    
+    ///
+    /// The first byte of the item's data, or `nullptr` for an empty span.
+    const uint8_t*  data()  const { return _data; }
+    ///
+    /// The number of bytes in the span.
+    size_t          size()  const { return _size; }
+    ///
+    /// Whether the span covers no data.
+    bool            empty() const { return _data == nullptr; }
+    
+    const uint8_t*  begin() const { return _data; }
+    const uint8_t*  end()   const { return _data + _size; }
+    
+    ///
+    /// Returns `true` if the span refers to an item's data.
+    explicit operator bool() const { return _data != nullptr; }
+    
+private:
+    const uint8_t*  _data;
+    size_t          _size;
+};
+
 /**
  An abstract class representing a generic archive.
  
@@ -200,6 +240,21 @@ public:
      */
     virtual unique_ptr<ArchiveWriter> WriterAtPath(const string & path, bool compress=true, bool create=true) = 0;
     
+    /**
+     Obtains direct, read-only access to the data of a file within the archive.
+     
+     This is only possible for archive types which hold their contents in memory
+     (for instance by mapping the archive file), and only for items which are
+     stored without compression or encryption. No data is copied.
+     
+     The default implementation returns an empty span.
+     @param path The path of the item to access.
+     @result A span covering the item's data, or an empty span if the item does not
+     exist or cannot be accessed directly. In the latter case, use
+     ByteStreamAtPath(const string&)const to read the item.
+     */
+    virtual ArchiveSpan SpanAtPath(const string& path) const { return ArchiveSpan(); }
+    
     /**
      Determines whether a given file ought to be compressed when stored in the archive.
      
@@ -304,6 +304,7 @@ protected:
     // PackageBase should be able to work with components
     friend class    PackageBase;
     friend class    Package;
+    friend class    CFIResolver;
     
     ///
     /// The total number of components in a CFI, including range components.
@@ -0,0 +1,322 @@
+//
+//  cfi_resolver.cpp
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "cfi_resolver.h"
+#include <ePub3/utilities/error_handler.h>
+
+#if EPUB_USE(LIBXML2)
+#include <libxml/valid.h>
+
+EPUB3_BEGIN_NAMESPACE
+
+static inline bool IsText(xmlNodePtr node)
+{
+    return node->type == XML_TEXT_NODE || node->type == XML_CDATA_SECTION_NODE;
+}
+
+// DOM offsets count UTF-16 code units: one per UTF-8 sequence, two for those outside the BMP
+static uint32_t UTF16Length(const xmlChar* utf8)
+{
+    uint32_t length = 0;
+    if ( utf8 == nullptr )
+        return 0;
+    for ( const xmlChar* p = utf8; *p != 0; p++ )
+    {
+        if ( (*p & 0xC0) != 0x80 )
+            length++;
+        if ( *p >= 0xF0 )
+            length++;
+    }
+    return length;
+}
+
+// the value of an element's `id` attribute, without copying it
+static const xmlChar* IdentifierOf(xmlNodePtr element)
+{
+    xmlAttrPtr attr = xmlHasProp(element, BAD_CAST "id");
+    if ( attr == nullptr || attr->children == nullptr || attr->children->next != nullptr )
+        return nullptr;
+    return attr->children->content;
+}
+
+CFIResolver::CFIResolver(shared_ptr<xml::Document> document) : _document(document), _lock(), _children(), _positions(), _ids(), _idsIndexed(false)
+{
+    if ( !bool(_document) )
+        throw std::invalid_argument("CFIResolver requires a document");
+}
+const CFIResolver::ChildList& CFIResolver::ChildElements(NativePtr element) const
+{
+    auto found = _children.find(element);
+    if ( found != _children.end() )
+        return found->second;
+
+    ChildList& list = _children[element];
+    for ( xmlNodePtr child = element->children; child != nullptr; child = child->next )
+    {
+        if ( child->type != XML_ELEMENT_NODE )
+            continue;
+        _positions[child] = static_cast<uint32_t>(list.size());
+        list.push_back(child);
+    }
+
+    return list;
+}
+CFIResolver::NativePtr CFIResolver::ElementWithID(const std::string &ident) const
+{
+    // DTD-declared IDs and xml:id are already indexed by libxml
+    xmlAttrPtr attr = xmlGetID(_document->xml(), BAD_CAST ident.c_str());
+    if ( attr != nullptr && attr->parent != nullptr )
+        return attr->parent;
+
+    if ( !_idsIndexed )
+    {
+        // walk the whole tree once, iteratively
+        xmlNodePtr node = xmlDocGetRootElement(_document->xml());
+        while ( node != nullptr )
+        {
+            const xmlChar* value = IdentifierOf(node);
+            if ( value != nullptr )
+                _ids.emplace(reinterpret_cast<const char*>(value), node);
+
+            // next in document order: first child, else the next sibling of the nearest ancestor with one
+            xmlNodePtr next = xmlFirstElementChild(node);
+            for ( xmlNodePtr up = node; next == nullptr && up != nullptr && up->type == XML_ELEMENT_NODE; up = up->parent )
+                next = xmlNextElementSibling(up);
+            node = next;
+        }
+        _idsIndexed = true;
+    }
+
+    auto found = _ids.find(ident);
+    return (found == _ids.end() ? nullptr : found->second);
+}
+CFIResolver::Location CFIResolver::Walk(NativePtr start, CFI::ComponentList::const_iterator begin, CFI::ComponentList::const_iterator end, NativePtr* pParent) const
+{
+    Location result;
+    xmlNodePtr current = start;
+
+    for ( auto pos = begin; pos != end; ++pos )
+    {
+        const CFI::Component& step = *pos;
+        bool last = (pos+1 == end);
+
+        if ( step.IsIndirector() )
+        {
+            HandleError(EPUBError::CFIUnexpectedComponent, "Indirection from within a content document is not supported");
+            return Location();
+        }
+        if ( step.HasCharacterOffset() && !last )
+        {
+            HandleError(EPUBError::CFICharOffsetInNonTerminatingStep);
+            return Location();
+        }
+
+        const ChildList& children = ChildElements(current);
+
+        if ( (step.nodeIndex & 1) == 0 )
+        {
+            xmlNodePtr next = nullptr;
+            size_t idx = (step.nodeIndex >> 1);
+            if ( idx > 0 && idx <= children.size() )
+                next = children[idx-1];
+
+            // an asserted ID wins over the index, which may be stale
+            if ( step.HasQualifier() )
+            {
+                const xmlChar* ident = (next == nullptr ? nullptr : IdentifierOf(next));
+                if ( ident == nullptr || step.qualifier != reinterpret_cast<const char*>(ident) )
+                {
+                    xmlNodePtr corrected = ElementWithID(step.qualifier.stl_str());
+                    if ( corrected != nullptr )
+                        next = corrected;
+                }
+            }
+
+            if ( next == nullptr )
+            {
+                HandleError(EPUBError::CFIStepOutOfBounds, _Str("CFI step ", step.nodeIndex, " is beyond the ", children.size(), " child elements of <", current->name, ">"));
+                return Location();
+            }
+
+            current = next;
+            if ( last )
+            {
+                result.node = xml::NodeHandle(current);
+                result.characterOffset = step.characterOffset;
+                result.hasCharacterOffset = step.HasCharacterOffset();
+            }
+            continue;
+        }
+
+        // odd steps select the text between two child elements, so can only come last
+        size_t chunk = (step.nodeIndex >> 1);
+        if ( !last || chunk > children.size() )
+        {
+            HandleError(EPUBError::CFIStepOutOfBounds, _Str("CFI step ", step.nodeIndex, " does not select text within <", current->name, ">"));
+            return Location();
+        }
+
+        xmlNodePtr node = (chunk == 0 ? current->children : children[chunk-1]->next);
+        xmlNodePtr stop = (chunk == children.size() ? nullptr : children[chunk]);
+        uint32_t offset = step.characterOffset;
+
+        result.hasCharacterOffset = step.HasCharacterOffset();
+        for ( ; node != stop; node = node->next )
+        {
+            if ( !IsText(node) )
+                continue;
+
+            // an offset at the boundary of two text nodes belongs to the first
+            uint32_t length = UTF16Length(node->content);
+            if ( offset <= length )
+            {
+                result.node = xml::NodeHandle(node);
+                result.characterOffset = offset;
+                return result;
+            }
+            offset -= length;
+        }
+
+        if ( offset > 0 )
+        {
+            HandleError(EPUBError::CFICharOffsetOutOfBounds, _Str("CFI character offset ", step.characterOffset, " is beyond the text at step ", step.nodeIndex));
+            return Location();
+        }
+
+        // no text at all
+        result.node = xml::NodeHandle(current);
+        result.characterOffset = 0;
+    }
+
+    if ( pParent != nullptr )
+        *pParent = current;
+    return result;
+}
+CFIResolver::Location CFIResolver::Resolve(const CFI &cfi) const
+{
+    Location start, end;
+    if ( cfi.IsRangeTriplet() )
+    {
+        ResolveRange(cfi, start, end);
+        return start;
+    }
+
+    if ( cfi.Empty() )
+        return Location();
+
+    std::lock_guard<std::mutex> _(_lock);
+    xmlNodePtr root = xmlDocGetRootElement(_document->xml());
+    if ( root == nullptr )
+        return Location();
+    return Walk(root, cfi._components.begin(), cfi._components.end());
+}
+bool CFIResolver::ResolveRange(const CFI &cfi, Location &start, Location &end) const
+{
+    start = end = Location();
+    if ( !cfi.IsRangeTriplet() )
+        return false;
+
+    std::lock_guard<std::mutex> _(_lock);
+    xmlNodePtr base = xmlDocGetRootElement(_document->xml());
+    if ( base == nullptr )
+        return false;
+
+    if ( !cfi._components.empty() )
+    {
+        Location common = Walk(base, cfi._components.begin(), cfi._components.end(), &base);
+        if ( !common || common.node.Type() != xml::NodeType::Element )
+            return false;
+    }
+
+    start = Walk(base, cfi._rangeStart.begin(), cfi._rangeStart.end());
+    end = Walk(base, cfi._rangeEnd.begin(), cfi._rangeEnd.end());
+    return bool(start) && bool(end);
+}
+CFI CFIResolver::CFIForNode(xml::NodeHandle handle, uint32_t characterOffset) const
+{
+    CFI result;
+    xmlNodePtr node = handle.xml();
+    if ( node == nullptr || node->doc != _document->xml() )
+        return result;
+
+    std::lock_guard<std::mutex> _(_lock);
+    xmlNodePtr root = xmlDocGetRootElement(_document->xml());
+
+    CFI::ComponentList reversed;
+    if ( IsText(node) )
+    {
+        // count the text before this node in the same run, and find the element before the run
+        uint32_t offset = characterOffset;
+        xmlNodePtr prev = node->prev;
+        for ( ; prev != nullptr && prev->type != XML_ELEMENT_NODE; prev = prev->prev )
+        {
+            if ( IsText(prev) )
+                offset += UTF16Length(prev->content);
+        }
+
+        uint32_t chunk = 0;
+        if ( prev != nullptr )
+        {
+            ChildElements(node->parent);
+            chunk = _positions[prev] + 1;
+        }
+
+        CFI::Component step(chunk*2 + 1);
+        step.characterOffset = offset;
+        step.flags |= CFI::Component::CharacterOffset;
+        reversed.push_back(std::move(step));
+        node = node->parent;
+    }
+
+    for ( ; node != root; node = node->parent )
+    {
+        if ( node == nullptr || node->type != XML_ELEMENT_NODE )
+            return result;      // not within the root element
+
+        ChildElements(node->parent);
+        CFI::Component step((_positions[node] + 1) * 2);
+        const xmlChar* ident = IdentifierOf(node);
+        if ( ident != nullptr )
+        {
+            step.qualifier = ident;
+            step.flags |= CFI::Component::Qualifier;
+        }
+        reversed.push_back(std::move(step));
+    }
+
+    result._components.assign(reversed.rbegin(), reversed.rend());
+    return result;
+}
+void CFIResolver::Invalidate()
+{
+    std::lock_guard<std::mutex> _(_lock);
+    _children.clear();
+    _positions.clear();
+    _ids.clear();
+    _idsIndexed = false;
+}
+size_t CFIResolver::CachedElementCount() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _children.size();
+}
+
+EPUB3_END_NAMESPACE
+
+#endif  // EPUB_USE(LIBXML2)
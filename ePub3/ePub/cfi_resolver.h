@@ -0,0 +1,176 @@
+//
+//  cfi_resolver.h
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __ePub3__cfi_resolver__
+#define __ePub3__cfi_resolver__
+
+#include <ePub3/epub3.h>
+#include <ePub3/cfi.h>
+#include <ePub3/xml/document.h>
+#include <ePub3/xml/node.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ Resolves CFIs against a content document, and generates CFIs for its nodes.
+
+ The CFIs handled here are document-relative: the part of a publication CFI which
+ follows the spine indirection, such as the `pRemainingCFI` produced by
+ Package::ManifestItemForCFI(). Their first step selects a child of the document's
+ root element.
+
+ Each step of a CFI selects a child of the current element: an even index `2n`
+ selects its nth child element, and an odd index `2n+1` selects the text lying
+ between the nth and (n+1)th child elements. The resolver records the child
+ elements of every element it steps through, so once a chapter's paths have been
+ walked a resolution costs one table lookup per step. Keep one resolver per
+ document for as long as CFIs are being resolved against it.
+
+ Character offsets are counted in UTF-16 code units, as they are by the DOM.
+
+ The document must not be modified while a resolver is in use. A resolver may be
+ used from several threads at once.
+ @remarks Only available when using libxml2.
+ @ingroup epub-model
+ */
+class CFIResolver
+{
+public:
+    typedef xml::NodeHandle::NativePtr      NativePtr;
+
+    ///
+    /// A location within a document.
+    struct Location
+    {
+        /// The node located: an element, or a text node if the CFI ended in an odd
+        /// step. When the selected text is empty this is the element containing it.
+        xml::NodeHandle     node;
+        /// The offset within `node`'s text, in UTF-16 code units.
+        uint32_t            characterOffset;
+        /// Whether the CFI specified a character offset.
+        bool                hasCharacterOffset;
+
+        Location() : node(), characterOffset(0), hasCharacterOffset(false) {}
+
+        ///
+        /// Whether anything was located.
+        explicit operator bool() const { return bool(node); }
+    };
+
+public:
+    ///
+    /// Creates a resolver for a document.
+    EPUB3_EXPORT    CFIResolver(shared_ptr<xml::Document> document);
+                    ~CFIResolver() {}
+
+    ///
+    /// The document against which CFIs are resolved.
+    shared_ptr<xml::Document>   Document()      const   { return _document; }
+
+    /**
+     Locates the node and offset identified by a document-relative CFI.
+
+     Where an element's `id` doesn't match the qualifier given in a step, the
+     element with that `id` is used instead, as for spine qualifiers.
+
+     For a range, this locates the start of the range.
+     @param cfi A CFI relative to the document.
+     @result The location, which evaluates to `false` if the CFI could not be
+     resolved.
+     */
+    EPUB3_EXPORT
+    Location        Resolve(const CFI& cfi)                                     const;
+
+    /**
+     Locates both ends of a ranged CFI.
+     @param cfi A ranged CFI relative to the document.
+     @param start Receives the start of the range.
+     @param end Receives the end of the range.
+     @result Returns `false` if `cfi` is not a range, or either end could not be
+     resolved.
+     */
+    EPUB3_EXPORT
+    bool            ResolveRange(const CFI& cfi, Location& start, Location& end) const;
+
+    /**
+     Generates the document-relative CFI for a node.
+
+     Steps into elements carrying an `id` attribute assert that id.
+     @param node An element or text node within the document.
+     @param characterOffset For a text node, an offset within its text in UTF-16
+     code units. Ignored for elements.
+     @result The CFI, or an empty CFI if the node isn't below the root element.
+     */
+    EPUB3_EXPORT
+    CFI             CFIForNode(xml::NodeHandle node, uint32_t characterOffset=0)  const;
+
+    /**
+     Generates the document-relative CFI for a location.
+     @see CFIForNode()
+     */
+    CFI             CFIForLocation(const Location& location)                    const   {
+        return CFIForNode(location.node, location.characterOffset);
+    }
+
+    ///
+    /// Forgets the recorded child elements, e.g. after the document was modified.
+    EPUB3_EXPORT
+    void            Invalidate();
+
+    ///
+    /// The number of elements whose children have been recorded.
+    size_t          CachedElementCount()        const;
+
+protected:
+    typedef std::vector<NativePtr>                          ChildList;
+
+    shared_ptr<xml::Document>                       _document;
+
+    mutable std::mutex                              _lock;
+    /// The child elements of each element stepped through, in document order.
+    mutable std::unordered_map<NativePtr, ChildList> _children;
+    /// The position of each recorded element among its parent's child elements.
+    mutable std::unordered_map<NativePtr, uint32_t> _positions;
+    /// Elements by `id`, built the first time a qualifier doesn't match.
+    mutable std::unordered_map<std::string, NativePtr> _ids;
+    mutable bool                                    _idsIndexed;
+
+    ///
+    /// Returns the child elements of `element`, recording them if necessary. Call with the lock held.
+    const ChildList&    ChildElements(NativePtr element)            const;
+    ///
+    /// Returns the element with a given `id`, or `nullptr`. Call with the lock held.
+    NativePtr           ElementWithID(const std::string& ident)     const;
+    ///
+    /// Follows a list of steps from `start`. Call with the lock held.
+    Location            Walk(NativePtr start, CFI::ComponentList::const_iterator begin,
+                             CFI::ComponentList::const_iterator end, NativePtr* pParent=nullptr) const;
+
+private:
+    CFIResolver(const CFIResolver&)                 _DELETED_;
+    CFIResolver& operator=(const CFIResolver&)      _DELETED_;
+
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__cfi_resolver__) */
@@ -33,22 +33,25 @@ EPUB3_BEGIN_NAMESPACE
 
 static const char * gContainerFilePath = "META-INF/container.xml";
 static const char * gEncryptionFilePath = "META-INF/encryption.xml";
+static const char * gSignaturesFilePath = "META-INF/signatures.xml";
 static const char * gRootfilesXPath = "/ocf:container/ocf:rootfiles/ocf:rootfile";
 static const char * gRootfilePathsXPath = "/ocf:container/ocf:rootfiles/ocf:rootfile/@full-path";
 static const char * gVersionXPath = "/ocf:container/@version";
 
+bool Container::gOpenLazily = false;
+
 Container::Container() :
 #if EPUB_PLATFORM(WINRT)
 	NativeBridge(),
 #endif
-	_archive(nullptr), _ocf(nullptr), _packages(), _encryption(), _path()
+	_archive(nullptr), _ocf(nullptr), _packages(), _encryption(), _signatures(), _path(), _lazy(false), _packagesLoaded(false), _encryptionLoaded(false), _signaturesLoaded(false)
 {
 }
 Container::Container(Container&& o) :
 #if EPUB_PLATFORM(WINRT)
 NativeBridge(),
 #endif
-_archive(std::move(o._archive)), _ocf(o._ocf), _packages(std::move(o._packages)), _path(std::move(o._path))
+_archive(std::move(o._archive)), _ocf(o._ocf), _packages(std::move(o._packages)), _encryption(std::move(o._encryption)), _signatures(std::move(o._signatures)), _path(std::move(o._path)), _lazy(o._lazy), _packagesLoaded(o._packagesLoaded.load()), _encryptionLoaded(o._encryptionLoaded.load()), _signaturesLoaded(o._signaturesLoaded.load())
 {
     o._ocf = nullptr;
 }
@@ -56,14 +59,17 @@ Container::~Container()
 {
 }
 bool Container::Open(const string& path)
+{
+    return Open(path, gOpenLazily);
+}
+bool Container::Open(const string& path, bool lazy)
 {
 	_archive = Archive::Open(path.stl_str());
 	if (_archive == nullptr)
 		throw std::invalid_argument(_Str("Path does not point to a recognised archive file: '", path, "'"));
 	_path = path;
+    _lazy = lazy;
 
-	// TODO: Initialize lazily? Doing so would make initialization faster, but require
-	// PackageLocations() to become non-const, like Packages().
 	ArchiveXmlReader reader(_archive->ReaderAtPath(gContainerFilePath));
 	if (!reader) {
 		throw std::invalid_argument(_Str("Path does not point to a recognised archive file: '", path, "'"));
@@ -89,7 +95,32 @@ bool Container::Open(const string& path)
 	if (nodes.empty())
 		return false;
 
-	LoadEncryption();
+    // everything else is loaded on first access when opening lazily
+    if (lazy)
+        return true;
+
+	EnsureEncryption();
+	EnsurePackages();
+
+    auto fm = FilterManager::Instance();
+	for (auto& pkg : _packages)
+	{
+        auto fc = fm->BuildFilterChainForPackage(pkg);
+		pkg->SetFilterChain(fc);
+	}
+
+	return true;
+}
+void Container::LoadPackages()
+{
+#if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
+	XPathWrangler xpath(_ocf, { { "ocf", "urn:oasis:names:tc:opendocument:xmlns:container" } });
+#else
+	XPathWrangler::NamespaceList __ns;
+	__ns["ocf"] = OCFNamespaceURI;
+	XPathWrangler xpath(_ocf, __ns);
+#endif
+	xml::NodeSet nodes = xpath.Nodes(gRootfilesXPath);
 
 	for (auto n : nodes)
 	{
@@ -100,18 +131,49 @@ bool Container::Open(const string& path)
 			continue;
 
 		auto pkg = Package::New(Ptr(), type);
-		if (pkg->Open(path))
+		if (_lazy ? pkg->OpenLazily(path) : pkg->Open(path))
 			_packages.push_back(pkg);
 	}
-
-    auto fm = FilterManager::Instance();
-	for (auto& pkg : _packages)
-	{
-        auto fc = fm->BuildFilterChainForPackage(pkg);
-		pkg->SetFilterChain(fc);
-	}
-
-	return true;
+}
+void Container::EnsurePackages() const
+{
+    if (_packagesLoaded || !bool(_ocf))
+        return;
+    
+    // loading is logically const: it only materializes what Open() would have
+    Container* self = const_cast<Container*>(this);
+    std::lock_guard<std::recursive_mutex> _(self->_loadLock);
+    if (_packagesLoaded)
+        return;
+    
+    self->LoadPackages();
+    self->_packagesLoaded = true;
+}
+void Container::EnsureEncryption() const
+{
+    if (_encryptionLoaded || !bool(_archive))
+        return;
+    
+    Container* self = const_cast<Container*>(this);
+    std::lock_guard<std::recursive_mutex> _(self->_loadLock);
+    if (_encryptionLoaded)
+        return;
+    
+    self->LoadEncryption();
+    self->_encryptionLoaded = true;
+}
+void Container::EnsureSignatures() const
+{
+    if (_signaturesLoaded || !bool(_archive))
+        return;
+    
+    Container* self = const_cast<Container*>(this);
+    std::lock_guard<std::recursive_mutex> _(self->_loadLock);
+    if (_signaturesLoaded)
+        return;
+    
+    self->LoadSignatures();
+    self->_signaturesLoaded = true;
 }
 ContainerPtr Container::OpenContainer(const string &path)
 {
@@ -191,8 +253,14 @@ Container::PathList Container::PackageLocations() const
     
     return output;
 }
+const Container::PackageList& Container::Packages() const
+{
+    EnsurePackages();
+    return _packages;
+}
 shared_ptr<Package> Container::DefaultPackage() const
 {
+    EnsurePackages();
     if ( _packages.empty() )
         return nullptr;
     return _packages[0];
@@ -250,8 +318,14 @@ void Container::LoadEncryption()
             _encryption.push_back(encPtr);
     }
 }
+const Container::EncryptionList& Container::EncryptionData() const
+{
+    EnsureEncryption();
+    return _encryption;
+}
 shared_ptr<EncryptionInfo> Container::EncryptionInfoForPath(const string &path) const
 {
+    EnsureEncryption();
     for ( auto item : _encryption )
     {
         if ( item->Path() == path )
@@ -260,6 +334,54 @@ shared_ptr<EncryptionInfo> Container::EncryptionInfoForPath(const string &path)
     
     return nullptr;
 }
+void Container::LoadSignatures()
+{
+    unique_ptr<ArchiveReader> pZipReader = _archive->ReaderAtPath(gSignaturesFilePath);
+    if ( !pZipReader )
+        return;
+    
+    ArchiveXmlReader reader(std::move(pZipReader));
+#if EPUB_USE(LIBXML2)
+    shared_ptr<xml::Document> sig = reader.xmlReadDocument(gSignaturesFilePath, nullptr, XML_PARSE_RECOVER|XML_PARSE_NOENT|XML_PARSE_DTDATTR);
+#elif EPUB_USE(WIN_XML)
+	auto sig = reader.ReadDocument(gSignaturesFilePath, nullptr, 0);
+#endif
+    if ( !bool(sig) )
+        return;
+#if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
+    XPathWrangler xpath(sig, {{"dsig", XMLDSigNamespaceURI}, {"ocf", OCFNamespaceURI}});
+#else
+    XPathWrangler::NamespaceList __ns;
+    __ns["ocf"] = OCFNamespaceURI;
+    __ns["dsig"] = XMLDSigNamespaceURI;
+    XPathWrangler xpath(sig, __ns);
+#endif
+    for ( auto node : xpath.Nodes("/ocf:signatures/dsig:Signature") )
+    {
+        auto sigPtr = std::make_shared<DigitalSignature>(node);
+        if ( sigPtr->SignedInfo() != nullptr )
+            _signatures.push_back(sigPtr);
+    }
+}
+const Container::SignatureList& Container::Signatures() const
+{
+    EnsureSignatures();
+    return _signatures;
+}
+bool Container::VerifySignatureDigests(bool stopAtFirstFailure, DigitalSignature::DigestResults *results) const
+{
+    // checked as one batch, so that stopAtFirstFailure covers every signature
+    std::vector<const SignatureReference*> references;
+    for ( auto& signature : Signatures() )
+    {
+        for ( auto& ref : signature->SignedInfo()->References() )
+        {
+            references.push_back(&ref);
+        }
+    }
+    
+    return DigitalSignature::VerifyReferenceDigests(references, *_archive, stopAtFirstFailure, results);
+}
 bool Container::FileExistsAtPath(const string& path) const
 {
 	return _archive->ContainsItem(path.stl_str());
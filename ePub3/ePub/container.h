@@ -23,12 +23,15 @@
 
 #include <ePub3/epub3.h>
 #include <ePub3/encryption.h>
+#include <ePub3/signatures.h>
 #include <ePub3/package.h>
 #include <ePub3/utilities/utfstring.h>
 #include <ePub3/utilities/owned_by.h>
 #include <ePub3/content_module.h>
 #include <ePub3/xml/node.h>
 #include <vector>
+#include <atomic>
+#include <mutex>
 #include <ePub3/utilities/future.h>
 
 ///////////////////////////////////////////////////////////////////////////////////
@@ -59,8 +62,9 @@ class ByteStream;
  
  @remarks The Container class holds owning references to the Archive instance used
  to read from the zip file, the XML document for the OCF file at META-INF/container.xml,
- all Packages within the container, and all EncryptionInfo instances from
- META-INF/encryption.xml.
+ all Packages within the container, all EncryptionInfo instances from
+ META-INF/encryption.xml, and all DigitalSignature instances from
+ META-INF/signatures.xml.
  
  @ingroup epub-model
  */
@@ -79,6 +83,9 @@ public:
     ///
     /// A list of encryption information.
     typedef shared_vector<EncryptionInfo>       EncryptionList;
+    ///
+    /// A list of digital signatures.
+    typedef shared_vector<DigitalSignature>     SignatureList;
 
 private:
     ///
@@ -97,9 +104,22 @@ public:
     EPUB3_EXPORT    Container();
     
     ///
-    /// Opens the archive at a given path.
+    /// Opens the archive at a given path, lazily if OpensLazily() is `true`.
     bool            Open(const string& path);
     
+    /**
+     Opens the archive at a given path.
+     
+     Only `META-INF/container.xml` is read up front. When opening lazily, the
+     encryption information, the Packages and their filter chains are each
+     created the first time they're requested, and each Package defers loading its
+     navigation documents and media overlays in the same way.
+     @param path The path of the archive to open.
+     @param lazy Whether to defer loading anything beyond the OCF document.
+     @result Returns `true` if the archive contains a valid OCF document.
+     */
+    bool            Open(const string& path, bool lazy);
+    
     ///
     /// Creates and returns a new Container instance by calling OpenContainerAsync() and blocking.
     static ContainerPtr
@@ -123,7 +143,7 @@ public:
     
     ///
     /// Retrieves the list of all instantiated packages within the container.
-    virtual const PackageList&      Packages()              const   { return _packages; }
+    virtual const PackageList&      Packages()              const;
     
     /**
      Retrieves the default Package instance.
@@ -140,7 +160,7 @@ public:
     
     ///
     /// Retrieves the encryption information embedded in the container.
-    virtual const EncryptionList&   EncryptionData()        const   { return _encryption; }
+    virtual const EncryptionList&   EncryptionData()        const;
     
     /**
      Retrieves the encryption information for a specific file within the container.
@@ -149,6 +169,25 @@ public:
      @result Returns the encryption information, or `nullptr` if none was found.
      */
     virtual EncryptionInfoPtr       EncryptionInfoForPath(const string& path)   const;
+    
+    ///
+    /// Retrieves the digital signatures embedded in the container.
+    virtual const SignatureList&    Signatures()            const;
+    
+    /**
+     Checks the digests of every reference in the container's signatures.
+     
+     The referenced items are hashed concurrently on the shared thread pool.
+     @param stopAtFirstFailure If `true`, stops checking as soon as any reference
+     fails; the remaining references are reported as DigestStatus::NotChecked.
+     @param results If not `nullptr`, receives the status of every reference.
+     @result Returns `true` if every digest is valid, including when the container
+     has no signatures.
+     @see DigitalSignature::VerifyReferenceDigests()
+     */
+    EPUB3_EXPORT
+    bool                            VerifySignatureDigests(bool stopAtFirstFailure=false,
+                                                           DigitalSignature::DigestResults* results=nullptr) const;
 
 	/**
 	 Determines whether a given file is present in the container.
@@ -182,17 +221,49 @@ public:
 		_creator = creator;
 	}
     
+    ///
+    /// Whether Open(const string&) defers loading packages and encryption data (default is `false`).
+    static bool                     OpensLazily()                   { return gOpenLazily; }
+    ///
+    /// Enable or disable lazy opening for containers opened without an explicit mode.
+    static void                     SetOpensLazily(bool lazy)       { gOpenLazily = lazy; }
+    
 protected:
     ArchivePtr						_archive;
     shared_ptr<xml::Document>		_ocf;
     PackageList						_packages;
     EncryptionList					_encryption;
+    SignatureList                   _signatures;
 	std::shared_ptr<ContentModule>	_creator;
 	string							_path;
+    bool                            _lazy;              ///< Whether the packages are opened lazily.
+    std::atomic<bool>               _packagesLoaded;    ///< Whether _packages has been populated.
+    std::atomic<bool>               _encryptionLoaded;  ///< Whether _encryption has been populated.
+    std::atomic<bool>               _signaturesLoaded;  ///< Whether _signatures has been populated.
+    std::recursive_mutex            _loadLock;          ///< Serializes deferred loading.
+    
+    // default is `false`
+    EPUB3_EXPORT
+    static bool                     gOpenLazily;
     
     ///
     /// Parses the file META-INF/encryption.xml into an EncryptionList.
     void							LoadEncryption();
+    ///
+    /// Parses the file META-INF/signatures.xml into a SignatureList.
+    void                            LoadSignatures();
+    ///
+    /// Opens each Package named in the OCF document.
+    void                            LoadPackages();
+    ///
+    /// Runs LoadEncryption() if it has not yet been run.
+    void                            EnsureEncryption()      const;
+    ///
+    /// Runs LoadSignatures() if it has not yet been run.
+    void                            EnsureSignatures()      const;
+    ///
+    /// Runs LoadPackages() if it has not yet been run.
+    void                            EnsurePackages()        const;
 
 	//////////////////////////////////////////////////////////////////////////////
 	// BLATANT HACK!
@@ -0,0 +1,152 @@
+//
+//  document_cache.cpp
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "document_cache.h"
+
+EPUB3_BEGIN_NAMESPACE
+
+DocumentCache::DocumentCache(size_t byteBudget) : _lock(), _entries(), _index(), _budget(byteBudget), _bytes(0), _hits(0), _misses(0), _evictions(0)
+{
+}
+DocumentCache::DocumentPtr DocumentCache::Get(const string& key, const Loader& loader)
+{
+    {
+        std::lock_guard<std::mutex> _(_lock);
+        auto found = _index.find(key.stl_str());
+        if ( found != _index.end() )
+        {
+            _hits++;
+            _entries.splice(_entries.begin(), _entries, found->second);
+            return found->second->document;
+        }
+
+        _misses++;
+    }
+
+    size_t cost = 0;
+    DocumentPtr doc = loader(&cost);
+    if ( !bool(doc) )
+        return nullptr;
+
+    return Insert(key, doc, cost);
+}
+DocumentCache::DocumentPtr DocumentCache::Find(const string& key)
+{
+    std::lock_guard<std::mutex> _(_lock);
+    auto found = _index.find(key.stl_str());
+    if ( found == _index.end() )
+        return nullptr;
+
+    _entries.splice(_entries.begin(), _entries, found->second);
+    return found->second->document;
+}
+DocumentCache::DocumentPtr DocumentCache::Insert(const string& key, DocumentPtr doc, size_t cost)
+{
+    std::lock_guard<std::mutex> _(_lock);
+
+    auto found = _index.find(key.stl_str());
+    if ( found != _index.end() )
+    {
+        // someone else got here first
+        _entries.splice(_entries.begin(), _entries, found->second);
+        return found->second->document;
+    }
+
+    if ( cost > _budget )
+        return doc;
+
+    _entries.push_front(Entry{key.stl_str(), doc, cost});
+    _index[key.stl_str()] = _entries.begin();
+    _bytes += cost;
+
+    _Trim();
+    return doc;
+}
+void DocumentCache::Remove(const string& key)
+{
+    std::lock_guard<std::mutex> _(_lock);
+    auto found = _index.find(key.stl_str());
+    if ( found == _index.end() )
+        return;
+
+    _bytes -= found->second->cost;
+    _entries.erase(found->second);
+    _index.erase(found);
+}
+void DocumentCache::Clear()
+{
+    std::lock_guard<std::mutex> _(_lock);
+    _entries.clear();
+    _index.clear();
+    _bytes = 0;
+}
+size_t DocumentCache::ByteBudget() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _budget;
+}
+void DocumentCache::SetByteBudget(size_t budget)
+{
+    std::lock_guard<std::mutex> _(_lock);
+    _budget = budget;
+    _Trim();
+}
+size_t DocumentCache::ByteCount() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _bytes;
+}
+size_t DocumentCache::Count() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _entries.size();
+}
+size_t DocumentCache::Hits() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _hits;
+}
+size_t DocumentCache::Misses() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _misses;
+}
+size_t DocumentCache::Evictions() const
+{
+    std::lock_guard<std::mutex> _(_lock);
+    return _evictions;
+}
+void DocumentCache::ResetStatistics()
+{
+    std::lock_guard<std::mutex> _(_lock);
+    _hits = _misses = _evictions = 0;
+}
+void DocumentCache::_Trim()
+{
+    while ( _bytes > _budget && !_entries.empty() )
+    {
+        Entry& victim = _entries.back();
+        _bytes -= victim.cost;
+        _index.erase(victim.key);
+        _entries.pop_back();
+        _evictions++;
+    }
+}
+
+EPUB3_END_NAMESPACE
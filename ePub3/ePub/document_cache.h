@@ -0,0 +1,161 @@
+//
+//  document_cache.h
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __ePub3__document_cache__
+#define __ePub3__document_cache__
+
+#include <ePub3/epub3.h>
+#include <ePub3/xml/document.h>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ A least-recently-used cache of parsed XML documents.
+
+ Each document is charged a cost in bytes when it's added, and the least recently
+ used documents are dropped whenever the total exceeds the cache's budget. Costs
+ are estimates: see EstimatedCost().
+
+ All methods may be called from any thread. Note that the cached documents are
+ shared by everyone who asks for them, and must not be modified.
+ @ingroup epub-model
+ */
+class DocumentCache
+{
+public:
+    typedef shared_ptr<xml::Document>   DocumentPtr;
+
+    /**
+     Parses a document on a cache miss.
+     @param pCost Storage for the cost of the new document.
+     @result The document, or `nullptr` if it could not be parsed.
+     */
+    typedef std::function<DocumentPtr(size_t* pCost)>   Loader;
+
+    ///
+    /// The budget used by a Package's cache unless told otherwise.
+    static const size_t DefaultByteBudget = 16 * 1024 * 1024;
+
+public:
+    explicit DocumentCache(size_t byteBudget = DefaultByteBudget);
+    ~DocumentCache() {}
+
+    /**
+     Fetches a document, parsing it on a miss.
+
+     The loader is called without any locks held, so two threads missing on the
+     same key at once may both parse it; both will still be handed the same
+     document.
+     @param key The key, usually the document's path within its container.
+     @param loader Called to parse the document if it isn't in the cache.
+     @result The document, or `nullptr` if the loader failed.
+     */
+    EPUB3_EXPORT
+    DocumentPtr     Get(const string& key, const Loader& loader);
+
+    ///
+    /// Fetches a document only if it's in the cache.
+    EPUB3_EXPORT
+    DocumentPtr     Find(const string& key);
+
+    /**
+     Adds a document to the cache.
+
+     Documents costing more than the entire budget are not cached.
+     @result The cached document, which will differ from `doc` if `key` was
+     already present.
+     */
+    EPUB3_EXPORT
+    DocumentPtr     Insert(const string& key, DocumentPtr doc, size_t cost);
+
+    ///
+    /// Drops a single document.
+    EPUB3_EXPORT
+    void            Remove(const string& key);
+    ///
+    /// Drops every document.
+    EPUB3_EXPORT
+    void            Clear();
+
+    size_t          ByteBudget()                const;
+    ///
+    /// Changes the budget, dropping documents as needed to fit within it.
+    EPUB3_EXPORT
+    void            SetByteBudget(size_t budget);
+
+    ///
+    /// The total cost of the cached documents.
+    size_t          ByteCount()                 const;
+    ///
+    /// The number of cached documents.
+    size_t          Count()                     const;
+
+    /// @{
+    /// @name Statistics
+
+    size_t          Hits()                      const;
+    size_t          Misses()                    const;
+    size_t          Evictions()                 const;
+    void            ResetStatistics();
+
+    /// @}
+
+    /**
+     Estimates the memory used by a parsed document.
+
+     A libxml2 tree, together with its wrappers, takes several times the space of
+     the markup it was parsed from.
+     @param sourceBytes The size of the document's source.
+     */
+    static size_t   EstimatedCost(size_t sourceBytes)   { return sourceBytes * 4; }
+
+private:
+    struct Entry
+    {
+        std::string     key;
+        DocumentPtr     document;
+        size_t          cost;
+    };
+    typedef std::list<Entry>                                    EntryList;
+    typedef std::unordered_map<std::string, EntryList::iterator> EntryIndex;
+
+    ///
+    /// Drops least recently used documents until within budget. Call with the lock held.
+    void            _Trim();
+
+    mutable std::mutex  _lock;
+    EntryList           _entries;       ///< Most recently used first.
+    EntryIndex          _index;
+    size_t              _budget;
+    size_t              _bytes;
+    size_t              _hits;
+    size_t              _misses;
+    size_t              _evictions;
+
+    DocumentCache(const DocumentCache&)             _DELETED_;
+    DocumentCache& operator=(const DocumentCache&)  _DELETED_;
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__document_cache__) */
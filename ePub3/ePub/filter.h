@@ -28,6 +28,7 @@
 #include <string>
 #include <functional>
 #include <memory>
+#include <vector>
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -190,22 +191,182 @@ public:
      returned to the user agent requesting the resource data itself.
      
      The data passed in is not guaranteed to be the entire resource unless the filter
-     overrides RequiresCompleteData() to return `true`.
+     overrides RequiresCompleteData() to return `true`. A filter which streams its
+     input may hold some of it back until the next call (see FlushData()), and so
+     may return zero bytes.
      @param data The data to process.
      @param len The number of bytes in `data`.
      @param outputLen Storage for the count of bytes being returned.
      @result The filtered bytes.
      @see ePub3::FontObfuscator for an example of a filter which handles data in a
      piecemeal fashion.
-     @see ePub3::SwitchPreprocessor or ePub3::ObjectPreprocessor for full-data
-     examples.
+     @see ePub3::ObjectPreprocessor for a filter which holds data back between
+     calls.
      */
     virtual void * FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen) = 0;
     
+    /**
+     Completes the filtering of a stream.
+     
+     Called once the last chunk of a resource has passed through FilterData(), so that
+     a filter which held back some input-- an incomplete tag, for instance-- can output
+     whatever remains.
+     @param context The filter context returned by MakeFilterContext().
+     @param outputLen Storage for the count of bytes being returned.
+     @result Any remaining output, allocated using `new[]`, or `nullptr` if there is
+     none. The default implementation returns `nullptr`.
+     */
+    virtual void * FlushData(FilterContext* context, size_t *outputLen) { *outputLen = 0; return nullptr; }
+    
+    ///
+    /// Subclasses can return `true` if they implement FilterDataInPlace().
+    virtual bool SupportsInPlaceFiltering() const { return false; }
+    
+    /**
+     The allocation-free processing function.
+     
+     Filters which never need more room for their output than their input occupies
+     can implement this in addition to FilterData(), and return `true` from
+     SupportsInPlaceFiltering(). The filter chain will then pass each chunk of data
+     through this function, working entirely within the caller's own read buffer.
+     
+     The filter reads bytes from the start of `data` and writes its output over
+     them. It need not consume every byte: any bytes it leaves unconsumed (for
+     instance, a partial cipher block) are held by the chain and presented again,
+     ahead of the next chunk, on the following call. The output may not exceed the
+     number of bytes consumed, and the filter must not modify unconsumed bytes.
+     
+     When `final` is `true` no more data will follow, and the filter must consume
+     all the input it is given. In this case `len` may be zero.
+     @param context The filter context returned by MakeFilterContext().
+     @param data The data to process; the output is written here too.
+     @param len The number of bytes in `data`.
+     @param consumed Storage for the number of input bytes consumed.
+     @param final `true` if this is the last data for the stream.
+     @result The number of output bytes written at the start of `data`.
+     */
+    virtual size_t FilterDataInPlace(FilterContext* context, uint8_t* data, size_t len, size_t* consumed, bool final) { return 0; }
+    
 protected:
     TypeSnifferFn       _sniffer;
 };
 
+/**
+ BlockCipherFilter is an abstract base class for filters which decrypt resources
+ encrypted using a block cipher in CBC or CTR mode.
+ 
+ Subclasses supply only the raw block cipher, through TransformBlocks(); this class
+ implements the chaining mode. It filters in place, so a resource is decrypted as it
+ streams through the filter chain rather than being collected in memory first. The
+ chain holds back any partial block until the next chunk arrives, and the chaining
+ value-- the previous ciphertext block in CBC mode, the counter in CTR mode-- is
+ carried between chunks in the filter context.
+ 
+ By default the IV is read from the first block of the resource, as described by
+ XML Encryption; subclasses can override InitializationVector() to supply it
+ separately.
+ 
+ @ingroup filters
+ */
+class BlockCipherFilter : public ContentFilter
+{
+public:
+    ///
+    /// The block cipher modes of operation supported.
+    enum class Mode : uint8_t
+    {
+        CBC,        ///< Cipher-block chaining, optionally with PKCS #7 padding.
+        CTR         ///< Counter mode, with a big-endian counter occupying the whole block.
+    };
+    
+    /**
+     Per-stream state: the chaining value and whether it has been set up.
+     
+     Subclasses needing their own per-stream data should derive from this class.
+     */
+    class BlockCipherContext : public FilterContext
+    {
+    public:
+        BlockCipherContext(size_t blockSize) : FilterContext(), _chain(blockSize, 0), _haveIV(false) {}
+        virtual ~BlockCipherContext() {}
+        
+        ///
+        /// The previous ciphertext block (CBC) or the next counter block (CTR).
+        uint8_t*        ChainingValue()         { return _chain.data(); }
+        ///
+        /// Whether the IV has been obtained yet.
+        bool            HasIV()         const   { return _haveIV; }
+        ///
+        /// Records that the IV is in place.
+        void            SetHasIV()              { _haveIV = true; }
+        
+    private:
+        std::vector<uint8_t>    _chain;
+        bool                    _haveIV;
+    };
+    
+public:
+    /**
+     Creates a new block cipher filter.
+     @param sniffer The TypeSnifferFn used to select the resources to decrypt.
+     @param mode The chaining mode used to encrypt those resources.
+     @param blockSize The cipher's block size in bytes, e.g. 16 for AES.
+     @param padded For CBC mode, whether to remove PKCS #7 padding.
+     @throws std::invalid_argument if the block size is zero or over 256 bytes.
+     */
+    EPUB3_EXPORT
+    BlockCipherFilter(TypeSnifferFn sniffer, Mode mode, size_t blockSize, bool padded=true);
+    BlockCipherFilter(const BlockCipherFilter& o) : ContentFilter(o), _mode(o._mode), _blockSize(o._blockSize), _padded(o._padded) {}
+    BlockCipherFilter(BlockCipherFilter&& o) : ContentFilter(std::move(o)), _mode(o._mode), _blockSize(o._blockSize), _padded(o._padded) {}
+    virtual ~BlockCipherFilter() {}
+    
+    Mode            ChainingMode()  const   { return _mode; }
+    size_t          BlockSize()     const   { return _blockSize; }
+    
+    virtual FilterContext* MakeFilterContext(ConstManifestItemPtr item) const OVERRIDE;
+    
+    ///
+    /// Decrypts into a new buffer, for callers filtering a whole resource at once.
+    virtual void * FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen) OVERRIDE;
+    
+    virtual bool SupportsInPlaceFiltering() const OVERRIDE { return true; }
+    
+    ///
+    /// @copydoc ContentFilter::FilterDataInPlace()
+    EPUB3_EXPORT
+    virtual size_t FilterDataInPlace(FilterContext* context, uint8_t* data, size_t len, size_t* consumed, bool final) OVERRIDE;
+    
+protected:
+    /**
+     Applies the raw block cipher to a run of whole blocks.
+     
+     In CBC mode this must *decrypt* each block; in CTR mode it must *encrypt* each
+     (counter) block. The input and output may be the same memory.
+     @param context The stream's context, as created by MakeFilterContext().
+     @param input The blocks to transform.
+     @param output Storage for the transformed blocks.
+     @param len The number of bytes to transform, always a multiple of BlockSize().
+     */
+    virtual void TransformBlocks(BlockCipherContext* context, const uint8_t* input, uint8_t* output, size_t len) const = 0;
+    
+    /**
+     Supplies the IV for a resource.
+     @param item The resource being decrypted.
+     @param iv Storage for BlockSize() bytes.
+     @result `true` if an IV was supplied, `false` (the default) if it should be
+     read from the start of the resource's data.
+     */
+    virtual bool InitializationVector(ConstManifestItemPtr item, uint8_t* iv) const { return false; }
+    
+protected:
+    Mode                _mode;
+    size_t              _blockSize;
+    bool                _padded;
+    
+    size_t              DecryptCBC(BlockCipherContext* context, const uint8_t* input, uint8_t* output, size_t len) const;
+    size_t              DecryptCTR(BlockCipherContext* context, const uint8_t* input, uint8_t* output, size_t len) const;
+};
+
 EPUB3_END_NAMESPACE
 
 #endif /* defined(__ePub3__filter__) */
@@ -35,17 +35,143 @@ EPUB3_BEGIN_NAMESPACE
 
 std::unique_ptr<thread_pool> FilterChain::_filterThreadPool(nullptr);
 
+FilterChain::FilterPipeline::Stage::Stage(ContentFilterPtr f, FilterContext* ctx)
+  : filter(f), context(ctx), inPlace(f->SupportsInPlaceFiltering()), carry()
+{
+	carry.SetUsesSecureErasure();
+}
+
+FilterChain::FilterPipeline::FilterPipeline(const std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem)
+  : _stages()
+{
+	_stages.reserve(filters.size());
+	for (auto& filter : filters)
+		_stages.emplace_back(filter, filter->MakeFilterContext(manifestItem));
+
+	// these potentially contain decrypted data, so use secure erasure
+	_scratch[0].SetUsesSecureErasure();
+	_scratch[1].SetUsesSecureErasure();
+}
+bool FilterChain::FilterPipeline::RequiresCompleteData() const
+{
+	for (auto& stage : _stages)
+	{
+		if (stage.filter->RequiresCompleteData())
+			return true;
+	}
+	return false;
+}
+size_t FilterChain::FilterPipeline::CarriedByteCount() const
+{
+	size_t result = 0;
+	for (auto& stage : _stages)
+		result += stage.carry.GetBufferSize();
+	return result;
+}
+uint8_t* FilterChain::FilterPipeline::Run(uint8_t* data, size_t len, size_t capacity, bool final, size_t* outputLen)
+{
+	uint8_t* cur = data;
+	ByteBuffer* holder = nullptr;		// the scratch buffer containing `cur`, if any
+
+	for (auto& stage : _stages)
+	{
+		// the scratch buffer not currently in use
+		ByteBuffer* spare = (holder == &_scratch[0] ? &_scratch[1] : &_scratch[0]);
+
+		if (stage.inPlace)
+		{
+			// put any bytes left over from last time ahead of the new ones
+			size_t carried = stage.carry.GetBufferSize();
+			if (carried > 0)
+			{
+				if (holder == nullptr && len + carried <= capacity)
+				{
+					::memmove(cur + carried, cur, len);
+					::memcpy(cur, stage.carry.GetBytes(), carried);
+				}
+				else
+				{
+					spare->RemoveBytes(spare->GetBufferSize());
+					spare->AddBytes(stage.carry.GetBytes(), carried);
+					if (len > 0)
+						spare->AddBytes(cur, len);
+					cur = spare->GetBytes();
+					holder = spare;
+				}
+
+				len += carried;
+				stage.carry.RemoveBytes(carried);
+			}
+
+			if (len == 0 && !final)
+				continue;
+
+			size_t consumed = 0;
+			size_t produced = stage.filter->FilterDataInPlace(stage.context.get(), cur, len, &consumed, final);
+			if (consumed > len || produced > consumed || (final && consumed < len))
+				throw std::logic_error("FilterPipeline: ContentFilter::FilterDataInPlace() returned inconsistent byte counts!");
+
+			if (consumed < len)
+				stage.carry.AddBytes(cur + consumed, len - consumed);
+
+			len = produced;
+		}
+		else
+		{
+			if (len > 0)
+			{
+				size_t filteredLen = 0;
+				void* filteredData = stage.filter->FilterData(stage.context.get(), cur, len, &filteredLen);
+				if (filteredData == nullptr)
+					throw std::logic_error("FilterPipeline: ContentFilter::FilterData() returned no data!");
+
+				if (filteredData != cur)
+				{
+					spare->RemoveBytes(spare->GetBufferSize());
+					spare->AddBytes(reinterpret_cast<uint8_t*>(filteredData), filteredLen);
+					delete[] reinterpret_cast<uint8_t*>(filteredData);
+					cur = spare->GetBytes();
+					holder = spare;
+					spare = (holder == &_scratch[0] ? &_scratch[1] : &_scratch[0]);
+				}
+
+				len = filteredLen;
+			}
+
+			if (final)
+			{
+				// append anything the filter was holding back
+				size_t flushedLen = 0;
+				void* flushedData = stage.filter->FlushData(stage.context.get(), &flushedLen);
+				if (flushedData != nullptr)
+				{
+					spare->RemoveBytes(spare->GetBufferSize());
+					if (len > 0)
+						spare->AddBytes(cur, len);
+					spare->AddBytes(reinterpret_cast<uint8_t*>(flushedData), flushedLen);
+					delete[] reinterpret_cast<uint8_t*>(flushedData);
+					cur = spare->GetBytes();
+					holder = spare;
+					len += flushedLen;
+				}
+			}
+		}
+	}
+
+	*outputLen = len;
+	return cur;
+}
+
 class FilterChainSyncStream : public ByteStream
 {
 private:
-	typedef std::pair<ContentFilterPtr, std::unique_ptr<FilterContext>>	_FilterNode;
-
 	std::unique_ptr<ByteStream>		_input;
-	std::vector<_FilterNode>		_filters;
+	FilterChain::FilterPipeline		_pipeline;
 
 	bool							_needs_cache;
+	bool							_finished;		///< The final chunk has been run through the filters.
 	ByteBuffer						_cache;
-	ByteBuffer						_read_cache;
+	ByteBuffer						_read_cache;	///< Filtered bytes which didn't fit into the reader's buffer.
 
 public:
 	FilterChainSyncStream(std::unique_ptr<ByteStream>&& input, std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem);
@@ -56,7 +182,7 @@ public:
 		if (_needs_cache && _input->AtEnd()) {
 			return _cache.GetBufferSize();
 		} else {
-			return _input->BytesAvailable();
+			return _read_cache.GetBufferSize() + _input->BytesAvailable();
 		}
 	}
 	virtual size_type SpaceAvailable() const _NOEXCEPT OVERRIDE
@@ -82,7 +208,7 @@ public:
 		if (_needs_cache && _input->AtEnd()) {
 			return _cache.IsEmpty();
 		} else {
-			return _input->AtEnd();
+			return _read_cache.IsEmpty() && (_finished || (_input->AtEnd() && _pipeline.CarriedByteCount() == 0));
 		}
 	}
 	virtual int Error() const _NOEXCEPT OVERRIDE
@@ -91,24 +217,17 @@ public:
 	}
 
 private:
-	size_type ReadBytesFromCache(void* bytes, size_type len);
+	size_type ReadBytesFromCache(ByteBuffer& cache, void* bytes, size_type len);
 	void CacheBytes();
-	size_type FilterBytes(void* bytes, size_type len);
 
 };
 
 FilterChainSyncStream::FilterChainSyncStream(std::unique_ptr<ByteStream>&& input, std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem)
-: _input(std::move(input)), _filters(), _needs_cache(false), _cache(), _read_cache()
+: _input(std::move(input)), _pipeline(filters, manifestItem), _needs_cache(false), _finished(false), _cache(), _read_cache()
 {
 	_cache.SetUsesSecureErasure();
 	_read_cache.SetUsesSecureErasure();
-
-	for (auto& filter : filters)
-	{
-		_filters.emplace_back(filter, std::unique_ptr<FilterContext>(filter->MakeFilterContext(manifestItem)));
-		if (filter->RequiresCompleteData() && !_needs_cache)
-			_needs_cache = true;
-	}
+	_needs_cache = _pipeline.RequiresCompleteData();
 }
 ByteStream::size_type FilterChainSyncStream::ReadBytes(void* bytes, size_type len)
 {
@@ -117,58 +236,44 @@ ByteStream::size_type FilterChainSyncStream::ReadBytes(void* bytes, size_type le
 		if (_cache.GetBufferSize() == 0 && _input->AtEnd() == false)
 			CacheBytes();
 
-		return ReadBytesFromCache(bytes, len);
+		return ReadBytesFromCache(_cache, bytes, len);
 	}
 
 	if (_read_cache.GetBufferSize() > 0)
-	{
-		size_type toMove = std::min(len, _read_cache.GetBufferSize());
-		::memcpy_s(bytes, len, _read_cache.GetBytes(), toMove);
-		_read_cache.RemoveBytes(toMove);
-		return toMove;
-	}
-	else 
-	{
-		size_type result = _input->ReadBytes(bytes, len);
-		result = FilterBytes(bytes, result);
-		size_type toMove = std::min(len, _read_cache.GetBufferSize());
-		::memcpy_s(bytes, len, _read_cache.GetBytes(), toMove);
-		_read_cache.RemoveBytes(toMove);
-		return toMove;
-	}
-}
-ByteStream::size_type FilterChainSyncStream::FilterBytes(void* bytes, size_type len)
-{
-	size_type result = len;
-	ByteBuffer buf(reinterpret_cast<uint8_t*>(bytes), len);
-	buf.SetUsesSecureErasure();
+		return ReadBytesFromCache(_read_cache, bytes, len);
 
-	for (auto& pair : _filters)
+	// read straight into the caller's buffer, leaving room for any bytes the
+	// filters are carrying over, so in-place filters need never copy the data
+	uint8_t* buf = reinterpret_cast<uint8_t*>(bytes);
+	while (!_finished && len > 0)
 	{
-		size_type filteredLen = 0;
-		void* filteredData = pair.first->FilterData(pair.second.get(), buf.GetBytes(), buf.GetBufferSize(), &filteredLen);
-		if (filteredData == nullptr || filteredLen == 0) {
-			if (filteredData != nullptr && filteredData != bytes)
-				delete[] reinterpret_cast<uint8_t*>(filteredData);
-			throw std::logic_error("ChainLinkProcessor: ContentFilter::FilterData() returned no data!");
-		}
-
-		if (filteredData != bytes)
-		{
-			buf = ByteBuffer(reinterpret_cast<uint8_t*>(filteredData), filteredLen);
-			result = filteredLen;
-			delete[] reinterpret_cast<uint8_t*>(filteredData);
-		}
+		size_type carried = _pipeline.CarriedByteCount();
+		size_type toRead = (len > carried ? len - carried : len);
+		size_type numRead = (_input->AtEnd() ? 0 : _input->ReadBytes(buf, toRead));
+		_finished = (numRead == 0 || _input->AtEnd());
+
+		size_t filteredLen = 0;
+		uint8_t* filtered = _pipeline.Run(buf, numRead, len, _finished, &filteredLen);
+		if (filteredLen == 0)
+			continue;
+		if (filtered == buf)
+			return filteredLen;
+
+		// the output ended up in the pipeline's own storage
+		size_type toMove = std::min(len, size_type(filteredLen));
+		::memcpy_s(bytes, len, filtered, toMove);
+		if (toMove < filteredLen)
+			_read_cache.AddBytes(filtered + toMove, filteredLen - toMove);
+		return toMove;
 	}
-	_read_cache = std::move(buf);
 
-	return result;
+	return 0;
 }
-ByteStream::size_type FilterChainSyncStream::ReadBytesFromCache(void* bytes, size_type len)
+ByteStream::size_type FilterChainSyncStream::ReadBytesFromCache(ByteBuffer& cache, void* bytes, size_type len)
 {
-	size_type numToRead = std::min(len, size_type(_cache.GetBufferSize()));
-	::memcpy_s(bytes, len, _cache.GetBytes(), numToRead);
-	_cache.RemoveBytes(numToRead);
+	size_type numToRead = std::min(len, size_type(cache.GetBufferSize()));
+	::memcpy_s(bytes, len, cache.GetBytes(), numToRead);
+	cache.RemoveBytes(numToRead);
 	return numToRead;
 }
 void FilterChainSyncStream::CacheBytes()
@@ -186,16 +291,19 @@ void FilterChainSyncStream::CacheBytes()
 	}
 
 	// filter everything completely
-	size_type filtered = FilterBytes(_cache.GetBytes(), _cache.GetBufferSize());
+	size_t filteredLen = 0;
+	uint8_t* filtered = _pipeline.Run(_cache.GetBytes(), _cache.GetBufferSize(), _cache.GetBufferSize(), true, &filteredLen);
+	_finished = true;
 
-	if (filtered > 0)
+	if (filtered == _cache.GetBytes())
 	{
-		_cache = std::move(_read_cache);
-		_read_cache.RemoveBytes(_read_cache.GetBufferSize());
+		_cache.RemoveBytes(_cache.GetBufferSize() - filteredLen, filteredLen);
+	}
+	else
+	{
+		_cache.RemoveBytes(_cache.GetBufferSize());
+		_cache.AddBytes(filtered, filteredLen);
 	}
-
-	// this potentially contains decrypted data, so use secure erasure
-	_cache.SetUsesSecureErasure();
 }
 
 std::shared_ptr<AsyncByteStream> FilterChain::GetFilteredOutputStreamForManifestItem(ConstManifestItemPtr item) const
@@ -276,7 +384,7 @@ std::shared_ptr<ByteStream> FilterChain::GetSyncFilteredOutputStreamForManifestI
 
 FilterChain::ChainLinkProcessor::ChainLinkProcessor(ContentFilterPtr filter, ChainLink input, ConstManifestItemPtr item)
   : _filter(filter),
-    _context(filter->MakeFilterContext(item)),
+    _pipeline(std::vector<ContentFilterPtr>{filter}, item),
     _input(input),
     _output(nullptr),
     _collectionBuffer()
@@ -320,29 +428,22 @@ void FilterChain::ChainLinkProcessor::ScheduleProcessor(RunLoopPtr runLoop)
                 
             case AsyncEvent::EndEncountered:
             {
-                if ( _filter->RequiresCompleteData() )
+                // run the collected data (or any bytes the filter held back) through the filter
+                size_t filteredLen = 0;
+                uint8_t *outputData = _pipeline.Run(_collectionBuffer.GetBytes(), _collectionBuffer.GetBufferSize(), _collectionBuffer.GetBufferSize(), true, &filteredLen);
+                
+                // forward the data
+                size_t offset = 0;
+                while ( offset < filteredLen )
                 {
-                    size_t filteredLen = 0;
-                    void* filteredData = _filter->FilterData(_context.get(), _collectionBuffer.GetBytes(), _collectionBuffer.GetBufferSize(), &filteredLen);
-                    if ( filteredData == nullptr || filteredLen == 0 ) {
-                        throw std::logic_error("ChainLinkProcessor: ContentFilter::FilterData() returned no data!");
-                    }
-                    
-                    // (securely) remove all bytes from the buffer
-                    _collectionBuffer.RemoveBytes(_collectionBuffer.GetBufferSize());
-                    
-                    // forward the data
-                    uint8_t *outputData = reinterpret_cast<uint8_t*>(filteredData);
-                    size_t offset = 0;
-                    
-                    while ( offset < filteredLen )
-                    {
-                        offset += _output->WriteBytes(&outputData[offset], filteredLen-offset);
-                        if ( offset < filteredLen )
-                            std::this_thread::yield();
-                    }
+                    offset += _output->WriteBytes(&outputData[offset], filteredLen-offset);
+                    if ( offset < filteredLen )
+                        std::this_thread::yield();
                 }
                 
+                // (securely) remove all bytes from the buffer
+                _collectionBuffer.RemoveBytes(_collectionBuffer.GetBufferSize());
+                
                 _output->Close();
                 break;
             }
@@ -398,8 +499,12 @@ ssize_t FilterChain::ChainLinkProcessor::FunnelBytes()
     
     while ( bytesToMove > 0 )
     {
-        size_t thisChunk = std::min(size_t(ASYNC_BUF_SIZE), bytesToMove);
+        // leave room for any bytes the filter carried over from the last chunk
+        size_t room = size_t(ASYNC_BUF_SIZE) - std::min(size_t(ASYNC_BUF_SIZE/2), _pipeline.CarriedByteCount());
+        size_t thisChunk = std::min(room, bytesToMove);
         thisChunk = _input->ReadBytes(buf, thisChunk);      // consumes read bytes from the buffer
+        if ( thisChunk == 0 )
+            break;
         
         if ( _filter->RequiresCompleteData() )
         {
@@ -408,17 +513,9 @@ ssize_t FilterChain::ChainLinkProcessor::FunnelBytes()
         else
         {
             size_t filteredLen = 0;
-            void* filteredData = _filter->FilterData(_context.get(), buf, thisChunk, &filteredLen);
-            if ( filteredData == nullptr || filteredLen == 0 ) {
-				if (filteredData != nullptr && filteredData != buf)
-					delete[] reinterpret_cast<char*>(filteredData);
-                throw std::logic_error("ChainLinkProcessor: ContentFilter::FilterData() returned no data!");
-            }
-
-            _output->WriteBytes(filteredData, filteredLen);
-
-			if (filteredData != buf)
-				delete[] reinterpret_cast<char*>(filteredData);
+            uint8_t* filteredData = _pipeline.Run(buf, thisChunk, sizeof(buf), false, &filteredLen);
+            if ( filteredLen > 0 )
+                _output->WriteBytes(filteredData, filteredLen);
         }
         
         bytesToMove -= thisChunk;
@@ -427,4 +524,142 @@ ssize_t FilterChain::ChainLinkProcessor::FunnelBytes()
     return (ssize_t)bytesToMove;
 }
 
+// how much data the block cipher filters handle at a time, using stack storage
+#define CIPHER_SEGMENT_SIZE 4096
+
+BlockCipherFilter::BlockCipherFilter(TypeSnifferFn sniffer, Mode mode, size_t blockSize, bool padded)
+  : ContentFilter(sniffer), _mode(mode), _blockSize(blockSize), _padded(padded && mode == Mode::CBC)
+{
+	if (blockSize == 0 || blockSize > 256)
+		throw std::invalid_argument(_Str("Unsupported cipher block size ", blockSize));
+}
+FilterContext* BlockCipherFilter::MakeFilterContext(ConstManifestItemPtr item) const
+{
+	BlockCipherContext* result = new BlockCipherContext(_blockSize);
+	if (InitializationVector(item, result->ChainingValue()))
+		result->SetHasIV();
+	return result;
+}
+void* BlockCipherFilter::FilterData(FilterContext* context, void* data, size_t len, size_t* outputLen)
+{
+	uint8_t* result = new uint8_t[len];
+	::memcpy(result, data, len);
+
+	size_t consumed = 0;
+	*outputLen = FilterDataInPlace(context, result, len, &consumed, true);
+	return result;
+}
+size_t BlockCipherFilter::FilterDataInPlace(FilterContext* context, uint8_t* data, size_t len, size_t* consumed, bool final)
+{
+	BlockCipherContext* ctx = dynamic_cast<BlockCipherContext*>(context);
+	if (ctx == nullptr)
+		throw std::invalid_argument("BlockCipherFilter: wrong type of filter context");
+
+	size_t offset = 0;
+	if (!ctx->HasIV())
+	{
+		if (len < _blockSize)
+		{
+			// wait for a whole block, unless there's no more to come
+			*consumed = (final ? len : 0);
+			return 0;
+		}
+
+		::memcpy(ctx->ChainingValue(), data, _blockSize);
+		ctx->SetHasIV();
+		offset = _blockSize;
+	}
+
+	size_t available = len - offset;
+	size_t toDecrypt = available - (available % _blockSize);
+	if (_mode == Mode::CTR && final)
+	{
+		// a counter-mode stream may end with a partial block
+		toDecrypt = available;
+	}
+	else if (_padded && !final && toDecrypt == available && toDecrypt > 0)
+	{
+		// hold back the last block: if it's the final one, it contains padding
+		toDecrypt -= _blockSize;
+	}
+
+	size_t produced = 0;
+	if (_mode == Mode::CBC)
+		produced = DecryptCBC(ctx, data + offset, data, toDecrypt);
+	else
+		produced = DecryptCTR(ctx, data + offset, data, toDecrypt);
+
+	if (final && _padded && produced > 0)
+	{
+		// strip PKCS #7 padding, if it's valid
+		uint8_t pad = data[produced-1];
+		if (pad > 0 && pad <= _blockSize && pad <= produced)
+		{
+			bool valid = true;
+			for (size_t i = produced - pad; i < produced; i++)
+				valid = valid && (data[i] == pad);
+			if (valid)
+				produced -= pad;
+		}
+	}
+
+	// any trailing partial block in a CBC stream can't be decrypted
+	*consumed = (final ? len : offset + toDecrypt);
+	return produced;
+}
+size_t BlockCipherFilter::DecryptCBC(BlockCipherContext* ctx, const uint8_t* input, uint8_t* output, size_t len) const
+{
+	// output may overlap (and precede) input, so each segment of ciphertext is
+	// copied aside first: it's needed again to undo the chaining
+	uint8_t segment[CIPHER_SEGMENT_SIZE];
+	size_t segmentSize = CIPHER_SEGMENT_SIZE - (CIPHER_SEGMENT_SIZE % _blockSize);
+	uint8_t* chain = ctx->ChainingValue();
+
+	for (size_t pos = 0; pos < len; pos += segmentSize)
+	{
+		size_t n = std::min(segmentSize, len - pos);
+		::memcpy(segment, input + pos, n);
+		TransformBlocks(ctx, segment, output + pos, n);
+
+		for (size_t i = 0; i < _blockSize; i++)
+			output[pos+i] ^= chain[i];
+		for (size_t i = _blockSize; i < n; i++)
+			output[pos+i] ^= segment[i-_blockSize];
+
+		::memcpy(chain, segment + n - _blockSize, _blockSize);
+	}
+
+	::memset(segment, 0, sizeof(segment));
+	return len;
+}
+size_t BlockCipherFilter::DecryptCTR(BlockCipherContext* ctx, const uint8_t* input, uint8_t* output, size_t len) const
+{
+	uint8_t keystream[CIPHER_SEGMENT_SIZE];
+	size_t segmentSize = CIPHER_SEGMENT_SIZE - (CIPHER_SEGMENT_SIZE % _blockSize);
+	uint8_t* counter = ctx->ChainingValue();
+
+	for (size_t pos = 0; pos < len; pos += segmentSize)
+	{
+		size_t n = std::min(segmentSize, len - pos);
+		size_t blocks = (n + _blockSize - 1) / _blockSize;
+
+		// lay out the counter blocks, incrementing the (big-endian) counter
+		for (size_t b = 0; b < blocks; b++)
+		{
+			::memcpy(keystream + b*_blockSize, counter, _blockSize);
+			for (size_t i = _blockSize; i > 0 && ++counter[i-1] == 0; i--)
+				;
+		}
+
+		TransformBlocks(ctx, keystream, keystream, blocks*_blockSize);
+
+		// output never follows input, so a forward pass is safe
+		for (size_t i = 0; i < n; i++)
+			output[pos+i] = input[pos+i] ^ keystream[i];
+	}
+
+	::memset(keystream, 0, sizeof(keystream));
+	return len;
+}
+
 EPUB3_END_NAMESPACE
@@ -26,6 +26,7 @@
 #include <ePub3/utilities/run_loop.h>
 #include <ePub3/utilities/executor.h>
 #include <ePub3/utilities/byte_buffer.h>
+#include <ePub3/filter.h>
 #include <memory>
 #include <thread>
 #include <condition_variable>
@@ -35,6 +36,7 @@
 EPUB3_BEGIN_NAMESPACE
 
 class FilterContext;
+class FilterChainSyncStream;
 
 class FilterChain : public PointerType<FilterChain>
 #if EPUB_PLATFORM(WINRT)
@@ -68,12 +70,71 @@ public:
 protected:
     typedef std::shared_ptr<AsyncByteStream>    ChainLink;
     
+    /**
+     Runs the data of a single resource through a sequence of filters.
+     
+     Filters which support in-place filtering work directly within the buffer
+     supplied to Run(), and any bytes they leave unconsumed are held here until the
+     next call. Other filters return new memory, which is copied into one of two
+     scratch buffers that are reused from one chunk to the next.
+     */
+    class FilterPipeline
+    {
+    public:
+        FilterPipeline(const std::vector<ContentFilterPtr>& filters, ConstManifestItemPtr manifestItem);
+        FilterPipeline(FilterPipeline&& o) : _stages(std::move(o._stages)), _scratch{std::move(o._scratch[0]), std::move(o._scratch[1])} {}
+        ~FilterPipeline() {}
+        
+        ///
+        /// Returns `true` if any filter needs to see all the data at once.
+        bool RequiresCompleteData() const;
+        
+        ///
+        /// The number of bytes currently held back by in-place filters.
+        size_t CarriedByteCount() const;
+        
+        /**
+         Filters a chunk of data.
+         
+         If `len` plus CarriedByteCount() is no greater than `capacity`, in-place
+         filters will not need to copy the data elsewhere.
+         @param data The bytes to filter.
+         @param len The number of bytes in `data`.
+         @param capacity The size of the buffer at `data`.
+         @param final `true` if no more data will follow.
+         @param outputLen Storage for the number of filtered bytes.
+         @result The filtered bytes: either `data` itself, or internal storage which
+         remains valid until the next call.
+         */
+        uint8_t* Run(uint8_t* data, size_t len, size_t capacity, bool final, size_t* outputLen);
+        
+    private:
+        struct Stage
+        {
+            ContentFilterPtr                filter;
+            std::unique_ptr<FilterContext>  context;
+            bool                            inPlace;
+            ByteBuffer                      carry;      ///< Bytes left unconsumed by an in-place filter.
+            
+            Stage(ContentFilterPtr f, FilterContext* ctx);
+            Stage(Stage&& o) : filter(std::move(o.filter)), context(std::move(o.context)), inPlace(o.inPlace), carry(std::move(o.carry)) {}
+        };
+        
+        std::vector<Stage>      _stages;
+        ByteBuffer              _scratch[2];
+        
+        FilterPipeline(const FilterPipeline&) _DELETED_;
+        
+    };
+    
+    friend class FilterChainSyncStream;
+    
     class ChainLinkProcessor : public PointerType<ChainLinkProcessor>
     {
     public:
         ChainLinkProcessor(ContentFilterPtr filter, ChainLink input, ConstManifestItemPtr manifestItem);
-        ChainLinkProcessor(const ChainLinkProcessor& o) : _filter(o._filter), _context(o._context), _input(o._input), _output(o._output), _collectionBuffer(o._collectionBuffer) {}
-        ChainLinkProcessor(ChainLinkProcessor&& o) : _filter(std::move(o._filter)), _context(o._context), _input(std::move(o._input)), _output(std::move(o._output)) {}
+        ChainLinkProcessor(const ChainLinkProcessor& o) _DELETED_;
+        ChainLinkProcessor(ChainLinkProcessor&& o) : _filter(std::move(o._filter)), _pipeline(std::move(o._pipeline)), _input(std::move(o._input)), _output(std::move(o._output)), _collectionBuffer(std::move(o._collectionBuffer)) {}
         virtual ~ChainLinkProcessor();
         
         virtual void SetOutputLink(ChainLink output) { _output = output; }
@@ -82,7 +143,7 @@ protected:
         
     protected:
         ContentFilterPtr                _filter;
-        std::shared_ptr<FilterContext>  _context;
+        FilterPipeline                  _pipeline;
         ChainLink                       _input;
         ChainLink                       _output;
         ByteBuffer                      _collectionBuffer;
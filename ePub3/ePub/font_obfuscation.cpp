@@ -40,11 +40,14 @@ using namespace ::Windows::Security::Cryptography::Core;
 #include "container.h"
 #include "package.h"
 #include "filter_manager.h"
+#include <algorithm>
+#include <cctype>
 
 EPUB3_BEGIN_NAMESPACE
 
 #if !EPUB_COMPILER_SUPPORTS(CXX_NONSTATIC_MEMBER_INIT) || EPUB_COMPILER(MSVC)
 const char * const FontObfuscator::FontObfuscationAlgorithmID = "http://www.idpf.org/2008/embedding";
+const char * const FontObfuscator::AdobeFontObfuscationAlgorithmID = "http://ns.adobe.com/pdf/enc#RC";
 #endif
 
 const char * const kBytesFiltered = "FontObfuscator::bytesFiltered";
@@ -53,20 +56,45 @@ const REGEX_NS::regex FontObfuscator::TypeCheck("(?:font/.*|application/(?:x-fon
 
 void * FontObfuscator::FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen)
 {
-    FontObfuscationContext* p = dynamic_cast<FontObfuscationContext*>(context);
+    size_t consumed = 0;
+    *outputLen = FilterDataInPlace(context, static_cast<uint8_t*>(data), len, &consumed, false);
+    return data;
+}
+FilterContext* FontObfuscator::MakeFilterContext(ConstManifestItemPtr item) const
+{
+    EncryptionInfoPtr encInfo = (bool(item) ? item->GetEncryptionInfo() : nullptr);
+    if ( encInfo != nullptr && encInfo->Algorithm() == AdobeFontObfuscationAlgorithmID )
+        return new FontObfuscationContext(_adobeMask, (_hasAdobeKey ? AdobeObfuscatedLength : 0));
+    return new FontObfuscationContext(_mask, ObfuscatedLength);
+}
+size_t FontObfuscator::FilterDataInPlace(FilterContext* context, uint8_t* data, size_t len, size_t* consumed, bool final)
+{
+    // we always create the context ourselves
+    FontObfuscationContext* p = static_cast<FontObfuscationContext*>(context);
     size_t bytesFiltered = p->ProcessedCount();
     
-    uint8_t *buf = static_cast<uint8_t*>(data);
-    for ( size_t i = 0; i < len && (i + bytesFiltered) < 1040; i++)
+    *consumed = len;
+    p->SetProcessedCount(bytesFiltered + len);
+    if ( bytesFiltered >= p->MaskLength() )
+        return len;
+    
+    // XOR the start of the font with the expanded key, a word at a time where possible;
+    // memcpy() keeps unaligned access safe, and compiles down to plain loads and stores
+    const uint8_t* mask = p->Mask() + bytesFiltered;
+    size_t n = std::min(len, p->MaskLength() - bytesFiltered);
+    size_t i = 0;
+    for ( ; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t) )
     {
-        // XOR each of the first 1040 bytes of the font with the key, circling around the keybuf
-        buf[i] ^= _key[(i+bytesFiltered)%20];
+        uint64_t d, m;
+        std::memcpy(&d, data+i, sizeof(d));
+        std::memcpy(&m, mask+i, sizeof(m));
+        d ^= m;
+        std::memcpy(data+i, &d, sizeof(d));
     }
+    for ( ; i < n; i++ )
+        data[i] ^= mask[i];
     
-    bytesFiltered += len;
-    p->SetProcessedCount(bytesFiltered);
-    *outputLen = len;
-    return buf;
+    return len;
 }
 bool FontObfuscator::BuildKey(ConstContainerPtr container)
 {
@@ -131,15 +159,76 @@ bool FontObfuscator::BuildKey(ConstContainerPtr container)
     SHA1_Update(&ctx, str.data(), str.length());
     SHA1_Final(_key, &ctx);
 #endif
+    
+    // expand the key to cover all the obfuscated bytes
+    for ( size_t i = 0; i < ObfuscatedLength; i++ )
+        _mask[i] = _key[i % KeySize];
+    
     return true;
 }
+bool FontObfuscator::BuildAdobeKey(ConstContainerPtr container)
+{
+    std::memset(_adobeMask, 0, AdobeObfuscatedLength);
+    
+    ConstPackagePtr pkg = container->DefaultPackage();
+    if ( !bool(pkg) )
+        return false;
+    
+    // prefer the unique identifier, but use any UUID identifier
+    std::vector<string> candidates;
+    candidates.push_back(pkg->PackageID());
+    for ( auto& prop : pkg->PropertiesMatching(DCType::Identifier) )
+        candidates.push_back(prop->Value());
+    
+    static const std::string prefix("urn:uuid:");
+    for ( auto& candidate : candidates )
+    {
+        const std::string& str = candidate.stl_str();
+        if ( str.compare(0, prefix.size(), prefix) != 0 )
+            continue;
+        
+        // 32 hex digits, ignoring hyphens
+        uint8_t key[AdobeKeySize];
+        size_t nibbles = 0;
+        for ( auto pos = str.begin() + prefix.size(); pos != str.end() && nibbles <= AdobeKeySize*2; ++pos )
+        {
+            char ch = *pos;
+            if ( ch == '-' )
+                continue;
+            if ( !isxdigit(static_cast<unsigned char>(ch)) )
+            {
+                nibbles = 0;
+                break;
+            }
+            
+            uint8_t value = static_cast<uint8_t>(isdigit(static_cast<unsigned char>(ch)) ? ch - '0' : (tolower(ch) - 'a' + 10));
+            if ( nibbles < AdobeKeySize*2 )
+            {
+                if ( (nibbles & 1) == 0 )
+                    key[nibbles/2] = static_cast<uint8_t>(value << 4);
+                else
+                    key[nibbles/2] |= value;
+            }
+            nibbles++;
+        }
+        
+        if ( nibbles != AdobeKeySize*2 )
+            continue;
+        
+        for ( size_t i = 0; i < AdobeObfuscatedLength; i++ )
+            _adobeMask[i] = key[i % AdobeKeySize];
+        return true;
+    }
+    
+    return false;
+}
 
 ContentFilterPtr FontObfuscator::FontObfuscatorFactory(ConstPackagePtr package)
 {
     ConstContainerPtr container = package->GetContainer();
     for ( auto& encInfo : container->EncryptionData() )
     {
-        if ( encInfo->Algorithm() == FontObfuscationAlgorithmID )
+        if ( encInfo->Algorithm() == FontObfuscationAlgorithmID || encInfo->Algorithm() == AdobeFontObfuscationAlgorithmID )
         {
             return New(container);
         }
@@ -41,10 +41,18 @@ class FontObfuscator : public ContentFilter, public PointerType<FontObfuscator>
 {
 protected:
     static const size_t         KeySize = 20;       // SHA-1 key size = 20 bytes
+    static const size_t         ObfuscatedLength = 1040;
+    static const size_t         AdobeKeySize = 16;  // UUID = 16 bytes
+    static const size_t         AdobeObfuscatedLength = 1024;
     static const REGEX_NS::regex     TypeCheck;
     CONSTEXPR static EPUB3_EXPORT const char * const	FontObfuscationAlgorithmID
 #if EPUB_COMPILER_SUPPORTS(CXX_NONSTATIC_MEMBER_INIT) && !EPUB_COMPILER(MSVC)
             = "http://www.idpf.org/2008/embedding"
+#endif
+              ;
+    CONSTEXPR static EPUB3_EXPORT const char * const	AdobeFontObfuscationAlgorithmID
+#if EPUB_COMPILER_SUPPORTS(CXX_NONSTATIC_MEMBER_INIT) && !EPUB_COMPILER(MSVC)
+            = "http://ns.adobe.com/pdf/enc#RC"
 #endif
               ;
     
@@ -53,13 +61,14 @@ protected:
      
      The sniffer looks at two things:
      
-     1. The encryption information for the item must specify the font
-     obfuscation algorithm.
+     1. The encryption information for the item must specify the IDPF or Adobe
+     font obfuscation algorithm.
      2. The item must be a font resource.
      */
     static bool FontTypeSniffer(ConstManifestItemPtr item) {
         EncryptionInfoPtr encInfo = item->GetEncryptionInfo();
-        if ( encInfo == nullptr || encInfo->Algorithm() != FontObfuscationAlgorithmID )
+        if ( encInfo == nullptr || (encInfo->Algorithm() != FontObfuscationAlgorithmID &&
+                                    encInfo->Algorithm() != AdobeFontObfuscationAlgorithmID) )
             return false;
         return REGEX_NS::regex_match(item->MediaType().stl_str(), TypeCheck);
     }
@@ -71,19 +80,28 @@ private:
     /// There is no default constructor.
     FontObfuscator() _DELETED_;
     
-private:
+protected:
     class FontObfuscationContext : public FilterContext
     {
     private:
         size_t          _count;
+        const uint8_t*  _mask;
+        size_t          _maskLength;
         
     public:
-        FontObfuscationContext() : FilterContext(), _count(0) {}
+        FontObfuscationContext(const uint8_t* mask, size_t maskLength) : FilterContext(), _count(0), _mask(mask), _maskLength(maskLength) {}
         virtual ~FontObfuscationContext() {}
         
         size_t  ProcessedCount() const      { return _count; }
         void SetProcessedCount(size_t val)  { _count = val; }
         
+        ///
+        /// The expanded key to XOR with the start of the resource.
+        const uint8_t*  Mask()      const   { return _mask; }
+        ///
+        /// The number of bytes obfuscated, and thus the length of Mask().
+        size_t      MaskLength()    const   { return _maskLength; }
+        
     };
 
 public:
@@ -95,21 +113,28 @@ public:
      only used during construction.
      @see BuildKey(const Container*)
      */
-    FontObfuscator(ConstContainerPtr container) : ContentFilter(FontTypeSniffer) {
+    FontObfuscator(ConstContainerPtr container) : ContentFilter(FontTypeSniffer), _hasAdobeKey(false) {
         BuildKey(container);
+        _hasAdobeKey = BuildAdobeKey(container);
     }
     ///
     /// Copy constructor.
-    FontObfuscator(const FontObfuscator& o) : ContentFilter(o) {
+    FontObfuscator(const FontObfuscator& o) : ContentFilter(o), _hasAdobeKey(o._hasAdobeKey) {
         std::memcpy(_key, o._key, KeySize);
+        std::memcpy(_mask, o._mask, ObfuscatedLength);
+        std::memcpy(_adobeMask, o._adobeMask, AdobeObfuscatedLength);
     }
     ///
     /// Move constructor.
-    FontObfuscator(FontObfuscator&& o) : ContentFilter(std::move(o)) {
+    FontObfuscator(FontObfuscator&& o) : ContentFilter(std::move(o)), _hasAdobeKey(o._hasAdobeKey) {
         std::memcpy(_key, o._key, KeySize);
+        std::memcpy(_mask, o._mask, ObfuscatedLength);
+        std::memcpy(_adobeMask, o._adobeMask, AdobeObfuscatedLength);
     }
     
-    virtual FilterContext* MakeFilterContext(ConstManifestItemPtr) const OVERRIDE { return new FontObfuscationContext; }
+    ///
+    /// Selects the IDPF or Adobe key, according to the item's encryption algorithm.
+    virtual FilterContext* MakeFilterContext(ConstManifestItemPtr item) const OVERRIDE;
     
     /**
      Applies the font obfuscation algorithm to the resource data.
@@ -121,10 +146,21 @@ public:
      */
     virtual void * FilterData(FilterContext* context, void * data, size_t len, size_t *outputLen) OVERRIDE;
     
+    ///
+    /// Font obfuscation is a simple XOR, so it always works in place.
+    virtual bool SupportsInPlaceFiltering() const OVERRIDE { return true; }
+    
+    ///
+    /// @copydoc ContentFilter::FilterDataInPlace()
+    virtual size_t FilterDataInPlace(FilterContext* context, uint8_t* data, size_t len, size_t* consumed, bool final) OVERRIDE;
+    
     static void Register();
     
 protected:
     uint8_t             _key[KeySize];
+    uint8_t             _mask[ObfuscatedLength];            ///< `_key` repeated over the obfuscated range.
+    uint8_t             _adobeMask[AdobeObfuscatedLength];  ///< The Adobe key repeated over its obfuscated range.
+    bool                _hasAdobeKey;
     
     /**
      Builds the obfuscaton key using data from the container.
@@ -135,6 +171,16 @@ protected:
      */
     EPUB3_EXPORT
     bool BuildKey(ConstContainerPtr container);
+    
+    /**
+     Builds the key for Adobe's font obfuscation algorithm: the bytes of the first
+     `urn:uuid:` identifier of the container's first package.
+     @param container The container for the resources to which this filter will
+     apply.
+     @result `true` if a UUID identifier was found, `false` otherwise.
+     */
+    EPUB3_EXPORT
+    bool BuildAdobeKey(ConstContainerPtr container);
 };
 
 EPUB3_END_NAMESPACE
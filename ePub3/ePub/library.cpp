@@ -23,17 +23,419 @@
 #include "manifest.h"
 #include "package.h"
 #include "zip_archive.h"
+#include <ePub3/utilities/__strhash.h>
 #include <sstream>
 #include <fstream>
 #include <list>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#if EPUB_OS(UNIX)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+#if EPUB_OS(WINDOWS)
+#include <windows.h>
+#endif
 
-// file format is CSV, unencrypted
+// Two file formats are supported:
+//  - CSV, unencrypted: each line holds a container path followed by its packages' unique-IDs.
+//  - A binary catalog, which is mapped into memory instead of being parsed. It consists of:
+//      CatalogHeader
+//      StringRef[containerCount]           container paths
+//      CatalogEntry[entryCount]            publications, sorted by unique-ID
+//      uint32_t[bucketCount]               open-addressed hash table of entries by unique-ID
+//      uint32_t[bucketCount]               open-addressed hash table of entries by package-ID
+//      char[stringsLength]                 string data, referenced by StringRef
+//    Hash table slots hold an entry's index plus one, or zero if empty, and are probed
+//    linearly from the key's hash. All values are in the byte order of the host which
+//    wrote the file; a catalog from a host with a different byte order is rejected.
 
 EPUB3_BEGIN_NAMESPACE
 
+namespace
+{
+    const char      CatalogMagic[8]     = { 'R', 'D', 'M', 'L', 'I', 'B', 'C', 'T' };
+    const uint32_t  CatalogVersion      = 1;
+    const uint32_t  CatalogByteOrder    = 0x01020304;
+    
+    struct StringRef
+    {
+        uint32_t    offset;
+        uint32_t    length;
+    };
+    
+    struct CatalogHeader
+    {
+        char        magic[8];
+        uint32_t    byteOrder;
+        uint32_t    version;
+        uint32_t    containerCount;
+        uint32_t    entryCount;
+        uint32_t    bucketCount;
+        uint32_t    containersOffset;
+        uint32_t    entriesOffset;
+        uint32_t    uniqueIDTableOffset;
+        uint32_t    packageIDTableOffset;
+        uint32_t    stringsOffset;
+        uint32_t    stringsLength;
+        uint32_t    reserved;
+    };
+    
+    struct CatalogEntry
+    {
+        uint32_t    container;
+        uint32_t    spineCount;
+        StringRef   uniqueID;
+        StringRef   packageID;
+        StringRef   title;
+        StringRef   author;
+    };
+    
+    inline uint32_t HashKey(const char* key, size_t length)
+    {
+        return __murmur2_or_cityhash<uint32_t>()(key, static_cast<uint32_t>(length));
+    }
+    
+    // the package-ID part of a unique-ID (which is `packageID@modified`)
+    std::string PackageIDFromUniqueID(const std::string& uniqueID)
+    {
+        return uniqueID.substr(0, uniqueID.find('@'));
+    }
+}
+
+/**
+ A read-only view of a catalog file written by Library::WriteCatalog(), mapped
+ into memory.
+ 
+ Only the header is read when the catalog is opened; each lookup then touches a
+ few pages of the file, so opening a catalog costs the same whatever its size.
+ */
+class Library::Catalog
+{
+public:
+    ///
+    /// Maps and validates a catalog. Sets `isCatalog` if the file is a catalog at all.
+    static shared_ptr<const Catalog>    Open(const string& path, bool& isCatalog);
+    ///
+    /// Writes a catalog of the given entries.
+    static bool                         Write(const string& path, std::vector<const Entry*>& entries);
+    
+                    ~Catalog()                  { Unmap(); }
+    
+    size_t          Count()             const   { return _header->entryCount; }
+    
+    bool            Contains(const std::string& uniqueID)       const   { return FindSlot(_uniqueIDs, uniqueID, &CatalogEntry::uniqueID) != nullptr; }
+    bool            Find(const std::string& uniqueID, Entry& entry)     const;
+    bool            FindPackage(const std::string& packageID, Entry& entry) const;
+    void            EntryAt(size_t idx, Entry& entry)           const;
+    
+private:
+                    Catalog() : _base(nullptr), _length(0),
+#if EPUB_PLATFORM(WIN)
+                                _mapping(nullptr),
+#endif
+                                _header(nullptr), _containers(nullptr), _entries(nullptr), _uniqueIDs(nullptr), _packageIDs(nullptr), _strings(nullptr) {}
+    Catalog(const Catalog&)                     _DELETED_;
+    Catalog& operator=(const Catalog&)          _DELETED_;
+    
+    const uint8_t*          _base;
+    size_t                  _length;
+#if EPUB_PLATFORM(WIN)
+    void*                   _mapping;
+#endif
+    
+    const CatalogHeader*    _header;
+    const StringRef*        _containers;
+    const CatalogEntry*     _entries;
+    const uint32_t*         _uniqueIDs;
+    const uint32_t*         _packageIDs;
+    const char*             _strings;
+    
+    bool                    Map(const string& path);
+    void                    Unmap();
+    bool                    Validate();
+    
+    // string references are checked as they're used, so opening needn't read every entry
+    bool                    IsValid(const StringRef& ref) const {
+        return ref.offset <= _header->stringsLength && ref.length <= _header->stringsLength - ref.offset;
+    }
+    bool                    Matches(const StringRef& ref, const std::string& key) const {
+        return ref.length == key.size() && IsValid(ref) && std::memcmp(_strings + ref.offset, key.data(), key.size()) == 0;
+    }
+    string                  String(const StringRef& ref) const {
+        if ( !IsValid(ref) )
+            return string::EmptyString;
+        return string(std::string(_strings + ref.offset, ref.length));
+    }
+    const CatalogEntry*     FindSlot(const uint32_t* table, const std::string& key, StringRef CatalogEntry::*field) const;
+};
+
+shared_ptr<const Library::Catalog> Library::Catalog::Open(const string& path, bool& isCatalog)
+{
+    isCatalog = false;
+    
+    shared_ptr<Catalog> catalog(new Catalog);
+    if ( !catalog->Map(path) )
+        return nullptr;
+    if ( catalog->_length < sizeof(CatalogHeader) || std::memcmp(catalog->_base, CatalogMagic, sizeof(CatalogMagic)) != 0 )
+        return nullptr;
+    
+    isCatalog = true;
+    if ( !catalog->Validate() )
+        return nullptr;
+    return catalog;
+}
+bool Library::Catalog::Validate()
+{
+    const CatalogHeader* header = reinterpret_cast<const CatalogHeader*>(_base);
+    if ( header->byteOrder != CatalogByteOrder || header->version != CatalogVersion )
+        return false;
+    
+    // every table must lie within the file, aligned to its elements
+    auto fits = [this](uint32_t offset, uint64_t size) {
+        return (offset % sizeof(uint32_t)) == 0 && offset <= _length && size <= _length - offset;
+    };
+    if ( header->bucketCount == 0 || (header->bucketCount & (header->bucketCount - 1)) != 0 || header->bucketCount < header->entryCount )
+        return false;
+    if ( !fits(header->containersOffset, uint64_t(header->containerCount) * sizeof(StringRef)) ||
+         !fits(header->entriesOffset, uint64_t(header->entryCount) * sizeof(CatalogEntry)) ||
+         !fits(header->uniqueIDTableOffset, uint64_t(header->bucketCount) * sizeof(uint32_t)) ||
+         !fits(header->packageIDTableOffset, uint64_t(header->bucketCount) * sizeof(uint32_t)) ||
+         header->stringsOffset > _length || header->stringsLength > _length - header->stringsOffset )
+        return false;
+    
+    _header = header;
+    _containers = reinterpret_cast<const StringRef*>(_base + header->containersOffset);
+    _entries = reinterpret_cast<const CatalogEntry*>(_base + header->entriesOffset);
+    _uniqueIDs = reinterpret_cast<const uint32_t*>(_base + header->uniqueIDTableOffset);
+    _packageIDs = reinterpret_cast<const uint32_t*>(_base + header->packageIDTableOffset);
+    _strings = reinterpret_cast<const char*>(_base + header->stringsOffset);
+    return true;
+}
+const CatalogEntry* Library::Catalog::FindSlot(const uint32_t* table, const std::string& key, StringRef CatalogEntry::*field) const
+{
+    uint32_t mask = _header->bucketCount - 1;
+    for ( uint32_t slot = HashKey(key.data(), key.size()) & mask, probes = 0; probes <= mask; slot = (slot + 1) & mask, probes++ )
+    {
+        uint32_t value = table[slot];
+        if ( value == 0 || value > _header->entryCount )
+            break;
+        
+        const CatalogEntry* entry = &_entries[value - 1];
+        if ( Matches(entry->*field, key) )
+            return entry;
+    }
+    
+    return nullptr;
+}
+bool Library::Catalog::Find(const std::string& uniqueID, Entry& entry) const
+{
+    const CatalogEntry* found = FindSlot(_uniqueIDs, uniqueID, &CatalogEntry::uniqueID);
+    if ( found == nullptr )
+        return false;
+    EntryAt(static_cast<size_t>(found - _entries), entry);
+    return true;
+}
+bool Library::Catalog::FindPackage(const std::string& packageID, Entry& entry) const
+{
+    const CatalogEntry* found = FindSlot(_packageIDs, packageID, &CatalogEntry::packageID);
+    if ( found == nullptr )
+        return false;
+    EntryAt(static_cast<size_t>(found - _entries), entry);
+    return true;
+}
+void Library::Catalog::EntryAt(size_t idx, Entry& entry) const
+{
+    const CatalogEntry& stored = _entries[idx];
+    entry.path = (stored.container < _header->containerCount ? String(_containers[stored.container]) : string::EmptyString);
+    entry.uniqueID = String(stored.uniqueID);
+    entry.packageID = String(stored.packageID);
+    entry.title = String(stored.title);
+    entry.author = String(stored.author);
+    entry.spineCount = stored.spineCount;
+}
+bool Library::Catalog::Write(const string& path, std::vector<const Entry*>& entries)
+{
+    // sorted, so the same library always produces the same file
+    std::sort(entries.begin(), entries.end(), [](const Entry* a, const Entry* b) {
+        return a->uniqueID.stl_str() < b->uniqueID.stl_str();
+    });
+    
+    std::string strings;
+    auto store = [&strings](const string& str) {
+        StringRef ref = { static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(str.size()) };
+        strings.append(str.stl_str());
+        return ref;
+    };
+    
+    std::vector<StringRef> containers;
+    std::map<std::string, uint32_t> containerIndices;
+    std::vector<CatalogEntry> stored;
+    stored.reserve(entries.size());
+    for ( const Entry* entry : entries )
+    {
+        auto inserted = containerIndices.emplace(entry->path.stl_str(), static_cast<uint32_t>(containers.size()));
+        if ( inserted.second )
+            containers.push_back(store(entry->path));
+        
+        CatalogEntry item;
+        item.container = inserted.first->second;
+        item.spineCount = entry->spineCount;
+        item.uniqueID = store(entry->uniqueID);
+        item.packageID = store(entry->packageID);
+        item.title = store(entry->title);
+        item.author = store(entry->author);
+        stored.push_back(item);
+    }
+    
+    // at most half full
+    uint32_t bucketCount = 16;
+    while ( bucketCount < stored.size() * 2 )
+        bucketCount <<= 1;
+    
+    std::vector<uint32_t> uniqueIDs(bucketCount, 0), packageIDs(bucketCount, 0);
+    auto insert = [&](std::vector<uint32_t>& table, const StringRef& key, uint32_t value) {
+        uint32_t mask = bucketCount - 1;
+        uint32_t slot = HashKey(strings.data() + key.offset, key.length) & mask;
+        while ( table[slot] != 0 )
+            slot = (slot + 1) & mask;
+        table[slot] = value;
+    };
+    for ( uint32_t i = 0; i < stored.size(); i++ )
+    {
+        // the first entry for a package-ID is the one found
+        insert(uniqueIDs, stored[i].uniqueID, i + 1);
+        insert(packageIDs, stored[i].packageID, i + 1);
+    }
+    
+    CatalogHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CatalogMagic, sizeof(CatalogMagic));
+    header.byteOrder = CatalogByteOrder;
+    header.version = CatalogVersion;
+    header.containerCount = static_cast<uint32_t>(containers.size());
+    header.entryCount = static_cast<uint32_t>(stored.size());
+    header.bucketCount = bucketCount;
+    
+    uint64_t offset = sizeof(CatalogHeader);
+    header.containersOffset = static_cast<uint32_t>(offset);
+    offset += containers.size() * sizeof(StringRef);
+    header.entriesOffset = static_cast<uint32_t>(offset);
+    offset += stored.size() * sizeof(CatalogEntry);
+    header.uniqueIDTableOffset = static_cast<uint32_t>(offset);
+    offset += bucketCount * sizeof(uint32_t);
+    header.packageIDTableOffset = static_cast<uint32_t>(offset);
+    offset += bucketCount * sizeof(uint32_t);
+    header.stringsOffset = static_cast<uint32_t>(offset);
+    header.stringsLength = static_cast<uint32_t>(strings.size());
+    if ( offset + strings.size() > UINT32_MAX )
+        return false;
+    
+    // write alongside, then replace, so a mapping of the old file is never truncated
+    std::string tmpPath = path.stl_str() + ".tmp";
+    {
+        std::ofstream stream(tmpPath, std::ios::binary|std::ios::trunc);
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(containers.data()), containers.size() * sizeof(StringRef));
+        stream.write(reinterpret_cast<const char*>(stored.data()), stored.size() * sizeof(CatalogEntry));
+        stream.write(reinterpret_cast<const char*>(uniqueIDs.data()), uniqueIDs.size() * sizeof(uint32_t));
+        stream.write(reinterpret_cast<const char*>(packageIDs.data()), packageIDs.size() * sizeof(uint32_t));
+        stream.write(strings.data(), strings.size());
+        if ( !stream.flush() )
+        {
+            stream.close();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+    
+#if EPUB_PLATFORM(WIN)
+    // rename() won't replace an existing file here
+    std::remove(path.c_str());
+#endif
+    if ( std::rename(tmpPath.c_str(), path.c_str()) != 0 )
+    {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+bool Library::Catalog::Map(const string& path)
+{
+#if EPUB_OS(UNIX)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if ( fd == -1 )
+        return false;
+    
+    struct stat sb;
+    if ( ::fstat(fd, &sb) == 0 && sb.st_size > 0 )
+    {
+        void* addr = ::mmap(nullptr, static_cast<size_t>(sb.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if ( addr != MAP_FAILED )
+        {
+            _base = reinterpret_cast<const uint8_t*>(addr);
+            _length = static_cast<size_t>(sb.st_size);
+        }
+    }
+    
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+#elif EPUB_PLATFORM(WIN)
+    HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+                                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if ( file == INVALID_HANDLE_VALUE )
+        return false;
+    
+    LARGE_INTEGER size;
+    if ( ::GetFileSizeEx(file, &size) && size.QuadPart > 0 )
+    {
+        HANDLE mapping = ::CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if ( mapping != NULL )
+        {
+            void* addr = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if ( addr != NULL )
+            {
+                _base = reinterpret_cast<const uint8_t*>(addr);
+                _length = static_cast<size_t>(size.QuadPart);
+                _mapping = mapping;
+            }
+            else
+            {
+                ::CloseHandle(mapping);
+            }
+        }
+    }
+    
+    ::CloseHandle(file);
+#endif
+    return _base != nullptr;
+}
+void Library::Catalog::Unmap()
+{
+    if ( _base == nullptr )
+        return;
+    
+#if EPUB_OS(UNIX)
+    ::munmap(const_cast<uint8_t*>(_base), _length);
+#elif EPUB_PLATFORM(WIN)
+    ::UnmapViewOfFile(_base);
+    ::CloseHandle(reinterpret_cast<HANDLE>(_mapping));
+    _mapping = nullptr;
+#endif
+    
+    _base = nullptr;
+    _length = 0;
+}
+
 unique_ptr<Library> Library::_singleton(nullptr);
 
-Library::Library(const string& path)
+Library::Library(const string& path) : _entries(), _packageIDs(), _catalog(), _containers(), _containerLookup(), _containerCacheLimit(DefaultContainerCacheLimit)
 {
     if ( !Load(path) )
         throw std::invalid_argument("The provided Locator doesn't appear to contain library data.");
@@ -43,37 +445,54 @@ Library::~Library()
 }
 bool Library::Load(const string& path)
 {
-    std::ifstream stream(path.stl_str());
+    bool isCatalog = false;
+    auto catalog = Catalog::Open(path, isCatalog);
+    if ( catalog )
+    {
+        _catalog = catalog;
+        return true;
+    }
+    else if ( isCatalog )
+    {
+        // damaged, or from another platform
+        return false;
+    }
     
-    std::stringstream ss;
+    std::ifstream stream(path.stl_str());
+    return LoadCSV(stream);
+}
+bool Library::LoadCSV(std::istream& stream)
+{
     std::string tmp;
-    while ( std::getline(stream, tmp).good() )
+    while ( std::getline(stream, tmp) )
     {
         try
         {
-            ss << tmp;
+            std::istringstream ss(tmp);
             
             string thisPath;
             std::list<std::string> uidList;
-            while ( !ss.eof() )
+            while ( std::getline(ss, tmp, ss.widen(',')) )
             {
-                std::getline(ss, tmp, ss.widen(','));
                 if ( thisPath.empty() )
                 {
                     // first item is a path to a local item
                     thisPath = tmp;
                 }
-                else
+                else if ( !tmp.empty() )
                 {
                     // remaining items are unique IDs
                     uidList.emplace_back(tmp);
                 }
             }
             
-            _containers[thisPath] = nullptr;
-            for ( auto uid : uidList )
+            for ( auto& uid : uidList )
             {
-                _packages[uid] = std::make_pair(thisPath, nullptr);
+                Entry entry;
+                entry.path = thisPath;
+                entry.uniqueID = uid;
+                entry.packageID = PackageIDFromUniqueID(uid);
+                AddEntry(std::move(entry));
             }
         }
         catch (...)
@@ -90,40 +509,114 @@ Library* Library::MainLibrary(const string& path)
     std::call_once(__guard, [&](){ _singleton.reset(new Library(path)); });
     return _singleton.get();
 }
+bool Library::FindEntry(const string& uniqueID, Entry& entry) const
+{
+    auto found = _entries.find(uniqueID.stl_str());
+    if ( found != _entries.end() )
+    {
+        entry = found->second;
+        return true;
+    }
+    
+    return _catalog && _catalog->Find(uniqueID.stl_str(), entry);
+}
+void Library::ForEachEntry(const std::function<void(const Entry&)>& fn) const
+{
+    for ( auto& pair : _entries )
+    {
+        fn(pair.second);
+    }
+    
+    if ( !_catalog )
+        return;
+    
+    Entry entry;
+    for ( size_t i = 0, count = _catalog->Count(); i < count; i++ )
+    {
+        _catalog->EntryAt(i, entry);
+        if ( _entries.find(entry.uniqueID.stl_str()) == _entries.end() )
+            fn(entry);
+    }
+}
+void Library::AddEntry(Entry&& entry)
+{
+    std::string uniqueID = entry.uniqueID.stl_str();
+    _packageIDs.emplace(entry.packageID.stl_str(), uniqueID);
+    _entries[uniqueID] = std::move(entry);
+}
 string Library::PathForEPubWithUniqueID(const string &uniqueID) const
 {
-    auto found = _packages.find(uniqueID);
-    if ( found == _packages.end() )
+    Entry entry;
+    if ( !FindEntry(uniqueID, entry) )
         return string::EmptyString;
     
-    return found->second.first;
+    return entry.path;
 }
 string Library::PathForEPubWithPackageID(const string &packageID) const
 {
-    string uniqueIDStart(packageID + "@");
-    for ( auto &pair : _packages )
-    {
-        if ( pair.first == packageID || pair.first.find(uniqueIDStart) == 0 )
-            return pair.second.first;
-    }
+    auto found = _packageIDs.find(packageID.stl_str());
+    if ( found != _packageIDs.end() )
+        return PathForEPubWithUniqueID(found->second);
+    
+    Entry entry;
+    if ( _catalog && _catalog->FindPackage(packageID.stl_str(), entry) )
+        return entry.path;
     
     return string::EmptyString;
 }
-void Library::AddPublicationsInContainer(shared_ptr<Container> container, const string& path)
+string Library::TitleForEPubWithUniqueID(const string &uniqueID) const
 {
-    // store the container
-    auto existing = _containers.find(path);
-    if ( existing == _containers.end() )
-        _containers[path] = container;
+    Entry entry;
+    if ( !FindEntry(uniqueID, entry) )
+        return string::EmptyString;
+    
+    return entry.title;
+}
+string Library::AuthorForEPubWithUniqueID(const string &uniqueID) const
+{
+    Entry entry;
+    if ( !FindEntry(uniqueID, entry) )
+        return string::EmptyString;
+    
+    return entry.author;
+}
+size_t Library::SpineCountForEPubWithUniqueID(const string &uniqueID) const
+{
+    Entry entry;
+    if ( !FindEntry(uniqueID, entry) )
+        return 0;
     
+    return entry.spineCount;
+}
+size_t Library::NumberOfPublications() const
+{
+    if ( !_catalog )
+        return _entries.size();
+    
+    size_t count = _catalog->Count();
+    for ( auto& pair : _entries )
+    {
+        if ( !_catalog->Contains(pair.first) )
+            count++;
+    }
+    return count;
+}
+void Library::AddPublicationsInContainer(shared_ptr<Container> container, const string& path)
+{
     for ( auto pkg : container->Packages() )
     {
-#if EPUB_HAVE(CXX_MAP_EMPLACE)
-        _packages.emplace(pkg->UniqueID(), LookupEntry(std::make_pair(path, pkg)));
-#else
-        _packages[pkg->UniqueID()] = LookupEntry({path, pkg});
-#endif
+        Entry entry;
+        entry.path = path;
+        entry.uniqueID = pkg->UniqueID();
+        entry.packageID = pkg->PackageID();
+        entry.title = pkg->Title();
+        entry.author = pkg->Authors();
+        entry.spineCount = static_cast<uint32_t>(pkg->SpineItemCount());
+        AddEntry(std::move(entry));
     }
+    
+    // store the container
+    CacheContainer(path, container);
 }
 void Library::AddPublicationsInContainerAtPath(const ePub3::string &path)
 {
@@ -131,6 +624,57 @@ void Library::AddPublicationsInContainerAtPath(const ePub3::string &path)
     if ( p )
         AddPublicationsInContainer(p, path);
 }
+void Library::SetContainerCacheLimit(size_t limit)
+{
+    _containerCacheLimit = limit;
+    while ( _containers.size() > _containerCacheLimit )
+    {
+        _containerLookup.erase(_containers.back().first.stl_str());
+        _containers.pop_back();
+    }
+}
+void Library::CacheContainer(const string& path, shared_ptr<Container> container)
+{
+    auto found = _containerLookup.find(path.stl_str());
+    if ( found != _containerLookup.end() )
+    {
+        found->second->second = container;
+        _containers.splice(_containers.begin(), _containers, found->second);
+    }
+    else
+    {
+        _containers.emplace_front(path, container);
+        _containerLookup[path.stl_str()] = _containers.begin();
+    }
+    
+    SetContainerCacheLimit(_containerCacheLimit);
+}
+void Library::RebuildContainerLookup()
+{
+    _containerLookup.clear();
+    for ( auto pos = _containers.begin(); pos != _containers.end(); ++pos )
+    {
+        _containerLookup[pos->first.stl_str()] = pos;
+    }
+}
+shared_ptr<Container> Library::ContainerAtPath(const string& path, bool allowLoad)
+{
+    auto found = _containerLookup.find(path.stl_str());
+    if ( found != _containerLookup.end() )
+    {
+        // now the most recently used
+        _containers.splice(_containers.begin(), _containers, found->second);
+        return found->second->second;
+    }
+    
+    if ( !allowLoad )
+        return nullptr;
+    
+    ContainerPtr container = Container::OpenContainer(path);
+    if ( container )
+        AddPublicationsInContainer(container, path);
+    return container;
+}
 IRI Library::EPubURLForPublication(shared_ptr<Package> package) const
 {
     return EPubURLForPublicationID(package->UniqueID());
@@ -145,18 +689,25 @@ shared_ptr<Package> Library::PackageForEPubURL(const IRI &url, bool allowLoad)
     if ( url.Scheme() != IRI::gEPUBScheme )
         return nullptr;
     
-    string ident = url.Host();
-    auto entry = _packages.find(ident);
-    if ( entry == _packages.end() )
+    return PackageForUniqueID(url.Host(), allowLoad);
+}
+shared_ptr<Package> Library::PackageForUniqueID(const string& uniqueID, bool allowLoad)
+{
+    Entry entry;
+    if ( !FindEntry(uniqueID, entry) )
         return nullptr;
     
-    if ( entry->second.second != nullptr || !allowLoad )
-        return entry->second.second;
+    ContainerPtr container = ContainerAtPath(entry.path, allowLoad);
+    if ( !container )
+        return nullptr;
     
-    AddPublicationsInContainerAtPath(entry->second.first);
+    for ( auto pkg : container->Packages() )
+    {
+        if ( pkg->UniqueID() == uniqueID )
+            return pkg;
+    }
     
-    // returns a package ptr or nullptr
-    return entry->second.second;
+    return nullptr;
 }
 IRI Library::EPubCFIURLForManifestItem(ManifestItemPtr item) const
 {
@@ -197,27 +748,37 @@ unique_ptr<ByteStream> Library::ReadStreamForEPubURL(const IRI &url, CFI *pRemai
 }
 bool Library::WriteToFile(const string& path) const
 {
+    // one line per container, listing its packages
+    std::map<std::string, std::vector<std::string>> lines;
+    ForEachEntry([&lines](const Entry& entry) {
+        lines[entry.path.stl_str()].push_back(entry.uniqueID.stl_str());
+    });
+    
     std::ofstream stream(path.stl_str());
-    for ( auto item : _containers )
+    for ( auto& line : lines )
     {
-        // works like an auto_ptr, scoping the allocation
-        ContainerPtr pContainer = item.second;
-        
-        if ( !pContainer )
-            pContainer = Container::OpenContainer(item.first);
-        if ( !pContainer )
-            continue;
-        
-        stream << item.first;
-        for ( auto pkg : pContainer->Packages() )
+        stream << line.first;
+        for ( auto& uid : line.second )
         {
-            stream << "," << pkg->UniqueID();
+            stream << "," << uid;
         }
         
         stream << std::endl;
     }
     
-    return true;
+    return bool(stream);
+}
+bool Library::WriteCatalog(const string& path) const
+{
+    // entries from the mapped catalog are copied out, as it may be the file being replaced
+    std::list<Entry> storage;
+    std::vector<const Entry*> entries;
+    ForEachEntry([&](const Entry& entry) {
+        storage.push_back(entry);
+        entries.push_back(&storage.back());
+    });
+    
+    return Catalog::Write(path, entries);
 }
 
 EPUB3_END_NAMESPACE
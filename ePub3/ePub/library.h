@@ -27,7 +27,9 @@
 #include <ePub3/cfi.h>
 #include <ePub3/utilities/utfstring.h>
 #include <ePub3/utilities/byte_stream.h>
-#include <map>
+#include <functional>
+#include <list>
+#include <unordered_map>
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -57,12 +59,18 @@ class Library
 public:
     typedef string      EPubIdentifier;
     
+    ///
+    /// The number of Containers kept open by default.
+    static const size_t DefaultContainerCacheLimit = 16;
+    
 protected:
-                        Library() : _containers(), _packages() {}
-                        Library(const Library& o) : _containers(o._containers), _packages(o._packages) {}
-                        Library(Library&& o) : _containers(std::move(o._containers)), _packages(std::move(o._packages)) {}
+    class Catalog;
+    
+                        Library() : _entries(), _packageIDs(), _catalog(), _containers(), _containerLookup(), _containerCacheLimit(DefaultContainerCacheLimit) {}
+                        Library(const Library& o) : _entries(o._entries), _packageIDs(o._packageIDs), _catalog(o._catalog), _containers(o._containers), _containerLookup(), _containerCacheLimit(o._containerCacheLimit) { RebuildContainerLookup(); }
+                        Library(Library&& o) : _entries(std::move(o._entries)), _packageIDs(std::move(o._packageIDs)), _catalog(std::move(o._catalog)), _containers(std::move(o._containers)), _containerLookup(), _containerCacheLimit(o._containerCacheLimit) { RebuildContainerLookup(); o._containerLookup.clear(); }
     
-    // load a library from a file generated using WriteToFile()
+    // load a library from a file generated using WriteToFile() or WriteCatalog()
     EPUB3_EXPORT        Library(const string& path);
     EPUB3_EXPORT bool   Load(const string& path);
     
@@ -77,6 +85,18 @@ public:
     string              PathForEPubWithUniqueID(const string& uniqueID)     const;
     EPUB3_EXPORT
     string              PathForEPubWithPackageID(const string& packageID)   const;
+    
+    // details recorded when the publication was added, so no container needs to be opened;
+    //  these are empty for publications imported from a CSV file and not yet opened
+    EPUB3_EXPORT
+    string              TitleForEPubWithUniqueID(const string& uniqueID)    const;
+    EPUB3_EXPORT
+    string              AuthorForEPubWithUniqueID(const string& uniqueID)   const;
+    EPUB3_EXPORT
+    size_t              SpineCountForEPubWithUniqueID(const string& uniqueID) const;
+    
+    EPUB3_EXPORT
+    size_t              NumberOfPublications()                              const;
 
     EPUB3_EXPORT
     void                AddPublicationsInContainer(shared_ptr<Container> container, const string& path);
@@ -92,6 +112,8 @@ public:
     // may load a container/package, so non-const
     EPUB3_EXPORT
     shared_ptr<Package> PackageForEPubURL(const IRI& url, bool allowLoad=true);
+    EPUB3_EXPORT
+    shared_ptr<Package> PackageForUniqueID(const string& uniqueID, bool allowLoad=true);
 
     EPUB3_EXPORT
     IRI                 EPubCFIURLForManifestItem(shared_ptr<ManifestItem> item) const;
@@ -103,25 +125,74 @@ public:
     EPUB3_EXPORT
     unique_ptr<ByteStream>  ReadStreamForEPubURL(const IRI& url, CFI* pRemainingCFI);
     
+    // Only the most recently used Containers are kept open; the rest are released and
+    //  re-opened when next needed. Packages already handed out remain usable, but once
+    //  their Container is released their GetContainer() returns nullptr.
+    EPUB3_EXPORT
+    void                SetContainerCacheLimit(size_t limit);
+    size_t              ContainerCacheLimit()                               const   { return _containerCacheLimit; }
+    size_t              NumberOfCachedContainers()                          const   { return _containers.size(); }
+    
     // file format is sort-of CSV
     // each line starts with a container locator's string representation followed by a
     //  comma-separated list of package identifiers
     EPUB3_EXPORT
     bool                WriteToFile(const string& path)                     const;
     
+    // Writes a binary catalog, which Load() maps into memory rather than parsing. It holds
+    //  hash tables keyed by unique-ID and by package-ID, and the details of each publication.
+    //  The file is replaced atomically, so a library may rewrite the catalog it was loaded from.
+    EPUB3_EXPORT
+    bool                WriteCatalog(const string& path)                    const;
+    
 protected:
-    // list of known (but not necessarily loaded) containers
-    typedef std::map<string, shared_ptr<Container>>     ContainerLookup;
+    // a publication, as recorded in the library
+    struct Entry
+    {
+        string          path;           ///< The path to the container, as given.
+        string          uniqueID;       ///< The package's unique identifier.
+        string          packageID;      ///< The package identifier, i.e. the unique identifier without the modification date.
+        string          title;          ///< The package's title, if known.
+        string          author;         ///< The package's author(s), if known.
+        uint32_t        spineCount;     ///< The number of items in the spine, if known.
+        
+        Entry() : path(), uniqueID(), packageID(), title(), author(), spineCount(0) {}
+    };
+    
+    // publications added since the catalog was loaded, or imported from CSV, by unique-ID
+    typedef std::unordered_map<std::string, Entry>       EntryLookup;
+    // unique-IDs by package-ID
+    typedef std::unordered_map<std::string, std::string> PackageIDLookup;
     
-    // if container is loaded, LookupEntry will contain a Package
-    // otherwise, the locator is used to load the Container
-    typedef std::pair<string, shared_ptr<Package>>      LookupEntry;
-    typedef std::map<EPubIdentifier, LookupEntry>       PackageLookup;
+    // open containers, most recently used first
+    typedef std::pair<string, shared_ptr<Container>>    CachedContainer;
+    typedef std::list<CachedContainer>                  ContainerCache;
+    typedef std::unordered_map<std::string, ContainerCache::iterator>   ContainerCacheLookup;
     
-    ContainerLookup                 _containers;
-    PackageLookup                   _packages;
+    EntryLookup                     _entries;
+    PackageIDLookup                 _packageIDs;
+    shared_ptr<const Catalog>       _catalog;           ///< The mapped catalog, if one was loaded.
+    
+    ContainerCache                  _containers;
+    ContainerCacheLookup            _containerLookup;
+    size_t                          _containerCacheLimit;
     
     static unique_ptr<Library>      _singleton;
+    
+    bool                LoadCSV(std::istream& stream);
+    
+    // finds a publication's entry, preferring those added since the catalog was loaded
+    bool                FindEntry(const string& uniqueID, Entry& entry)     const;
+    // calls `fn` for every publication, in no particular order
+    void                ForEachEntry(const std::function<void(const Entry&)>& fn) const;
+    // records a publication, replacing any existing entry with the same unique-ID
+    void                AddEntry(Entry&& entry);
+    
+    // returns the Container at `path`, from the cache or else by opening it (if `allowLoad`)
+    shared_ptr<Container>   ContainerAtPath(const string& path, bool allowLoad=true);
+    // stores a Container as the most recently used, releasing the least recently used beyond the limit
+    void                CacheContainer(const string& path, shared_ptr<Container> container);
+    void                RebuildContainerLookup();
 };
 
 EPUB3_END_NAMESPACE
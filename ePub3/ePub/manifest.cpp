@@ -202,7 +202,7 @@ string ManifestItem::BaseHref() const
     if ( s == string::npos )
         path = _href;
     else
-        path = path.substr(0, s);
+        path = _href.substr(0, s);
     return path;
 }
 bool ManifestItem::HasProperty(const std::vector<IRI>& properties) const
@@ -232,21 +232,26 @@ shared_ptr<xml::Document> ManifestItem::ReferencedDocument() const
     if ( !package )
         return nullptr;
     
-    unique_ptr<ArchiveXmlReader> reader = package->XmlReaderForRelativePath(path);
-    if ( !reader )
-        return nullptr;
-    
-    shared_ptr<xml::Document> result(nullptr);
+    // parsed documents are shared through the package's cache
+    return package->ParsedDocumentCache().Get(path, [&](size_t* pCost) -> shared_ptr<xml::Document> {
+        unique_ptr<ArchiveXmlReader> reader = package->XmlReaderForRelativePath(path);
+        if ( !reader )
+            return nullptr;
+        
+        *pCost = DocumentCache::EstimatedCost(reader->size());
+        
+        shared_ptr<xml::Document> result(nullptr);
 #if EPUB_USE(LIBXML2)
-    int flags = XML_PARSE_RECOVER|XML_PARSE_NOENT|XML_PARSE_DTDATTR;
-    if ( _mediaType == "text/html" )
-        result = reader->htmlReadDocument(path.c_str(), "utf-8", flags);
-    else
-        result = reader->xmlReadDocument(path.c_str(), "utf-8", flags);
+        int flags = XML_PARSE_RECOVER|XML_PARSE_NOENT|XML_PARSE_DTDATTR;
+        if ( _mediaType == "text/html" )
+            result = reader->htmlReadDocument(path.c_str(), "utf-8", flags);
+        else
+            result = reader->xmlReadDocument(path.c_str(), "utf-8", flags);
 #elif EPUB_USE(WIN_XML)
-	result = reader->ReadDocument(path.c_str(), "utf-8", 0);
+        result = reader->ReadDocument(path.c_str(), "utf-8", 0);
 #endif
-    return result;
+        return result;
+    });
 }
 unique_ptr<ByteStream> ManifestItem::Reader() const
 {
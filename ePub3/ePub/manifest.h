@@ -302,7 +302,7 @@ public:
 
 	bool						CanLoadDocument()					const;
     
-    // one-shot XML document loader
+    // XML document loader; documents are cached by the package and must not be modified
     EPUB3_EXPORT
 	shared_ptr<xml::Document>	ReferencedDocument()                const;
     
@@ -0,0 +1,398 @@
+//
+//  markup_rewriter.cpp
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "markup_rewriter.h"
+#include <algorithm>
+#include <cstring>
+
+EPUB3_BEGIN_NAMESPACE
+
+static inline bool IsMarkupSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+static inline bool IsNameStartChar(char c)
+{
+    // anything from a multi-byte UTF-8 sequence is allowed
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':' || (c & 0x80) != 0;
+}
+static inline bool HasPrefix(const char* data, size_t len, const char* prefix, size_t prefixLen)
+{
+    return len >= prefixLen && ::memcmp(data, prefix, prefixLen) == 0;
+}
+// true if more data might turn `data` into `prefix`
+static inline bool IsIncompletePrefix(const char* data, size_t len, const char* prefix, size_t prefixLen)
+{
+    return len < prefixLen && ::memcmp(data, prefix, len) == 0;
+}
+// returns the offset just past the first `term` at or after `from`, or zero
+static size_t FindTerminator(const char* data, size_t len, size_t from, const char* term, size_t termLen)
+{
+    for ( size_t i = from; i + termLen <= len; i++ )
+    {
+        const char* found = reinterpret_cast<const char*>(::memchr(data + i, term[0], len - i - termLen + 1));
+        if ( found == nullptr )
+            break;
+        i = found - data;
+        if ( ::memcmp(found, term, termLen) == 0 )
+            return i + termLen;
+    }
+    return 0;
+}
+
+#if 0
+#pragma mark - MarkupTokenizer
+#endif
+
+string_view MarkupTokenizer::Token::Name() const
+{
+    if ( !IsTag() )
+        return string_view();
+
+    size_t start = (_type == TokenType::EndTag ? 2 : 1);
+    size_t end = start;
+    while ( end < _length && !IsMarkupSpace(_data[end]) && _data[end] != '/' && _data[end] != '>' )
+        end++;
+    return string_view(_data + start, end - start);
+}
+string_view MarkupTokenizer::Token::CommentText() const
+{
+    if ( _type != TokenType::Comment )
+        return string_view();
+    return string_view(_data + 4, _length - 7);
+}
+bool MarkupTokenizer::Token::GetAttribute(string_view name, string_view& value) const
+{
+    if ( _type != TokenType::StartTag && _type != TokenType::EmptyElementTag )
+        return false;
+
+    size_t pos = 1 + Name().size();
+    while ( pos < _length )
+    {
+        while ( pos < _length && (IsMarkupSpace(_data[pos]) || _data[pos] == '/') )
+            pos++;
+        if ( pos >= _length || _data[pos] == '>' )
+            break;
+
+        size_t nameStart = pos;
+        while ( pos < _length && !IsMarkupSpace(_data[pos]) && _data[pos] != '=' && _data[pos] != '>' && _data[pos] != '/' )
+            pos++;
+        string_view attrName(_data + nameStart, pos - nameStart);
+
+        while ( pos < _length && IsMarkupSpace(_data[pos]) )
+            pos++;
+
+        string_view attrValue;
+        if ( pos < _length && _data[pos] == '=' )
+        {
+            pos++;
+            while ( pos < _length && IsMarkupSpace(_data[pos]) )
+                pos++;
+
+            if ( pos < _length && (_data[pos] == '"' || _data[pos] == '\'') )
+            {
+                char quote = _data[pos++];
+                size_t valueStart = pos;
+                while ( pos < _length && _data[pos] != quote )
+                    pos++;
+                attrValue = string_view(_data + valueStart, pos - valueStart);
+                pos++;
+            }
+            else
+            {
+                size_t valueStart = pos;
+                while ( pos < _length && !IsMarkupSpace(_data[pos]) && _data[pos] != '>' )
+                    pos++;
+                attrValue = string_view(_data + valueStart, pos - valueStart);
+            }
+        }
+
+        if ( attrName == name )
+        {
+            value = attrValue;
+            return true;
+        }
+    }
+
+    return false;
+}
+size_t MarkupTokenizer::MarkupLength(const char* data, size_t len, TokenType& type)
+{
+    // we need enough bytes to tell what sort of markup this is
+    if ( len < 2 )
+        return 0;
+
+    if ( data[1] == '!' )
+    {
+        if ( IsIncompletePrefix(data, len, "<!--", 4) || IsIncompletePrefix(data, len, "<![CDATA[", 9) )
+            return 0;
+
+        if ( HasPrefix(data, len, "<!--", 4) )
+        {
+            type = TokenType::Comment;
+            size_t from = std::max(_scanned, size_t(4));
+            size_t end = FindTerminator(data, len, (from > 6 ? from - 2 : 4), "-->", 3);
+            _scanned = (end == 0 ? len : 0);
+            return end;
+        }
+        if ( HasPrefix(data, len, "<![CDATA[", 9) )
+        {
+            type = TokenType::Other;
+            size_t from = std::max(_scanned, size_t(9));
+            size_t end = FindTerminator(data, len, (from > 11 ? from - 2 : 9), "]]>", 3);
+            _scanned = (end == 0 ? len : 0);
+            return end;
+        }
+
+        // a declaration, possibly with an internal subset in brackets
+        type = TokenType::Other;
+        size_t i = std::max(_scanned, size_t(2));
+        for ( ; i < len; i++ )
+        {
+            char c = data[i];
+            if ( _quote != 0 )
+            {
+                if ( c == _quote )
+                    _quote = 0;
+            }
+            else if ( c == '"' || c == '\'' )
+                _quote = c;
+            else if ( c == '[' )
+                _depth++;
+            else if ( c == ']' )
+                _depth--;
+            else if ( c == '>' && _depth <= 0 )
+            {
+                _scanned = 0;
+                _depth = 0;
+                return i + 1;
+            }
+        }
+        _scanned = len;
+        return 0;
+    }
+
+    if ( data[1] == '?' )
+    {
+        type = TokenType::Other;
+        size_t from = std::max(_scanned, size_t(2));
+        size_t end = FindTerminator(data, len, (from > 3 ? from - 1 : 2), "?>", 2);
+        _scanned = (end == 0 ? len : 0);
+        return end;
+    }
+
+    size_t nameStart = (data[1] == '/' ? 2 : 1);
+    if ( nameStart == 2 && len < 3 )
+        return 0;
+    if ( !IsNameStartChar(data[nameStart]) )
+    {
+        // a bare '<' in text isn't well-formed, but we'll pass it along
+        type = TokenType::Text;
+        return 1;
+    }
+
+    // a tag ends at the first '>' outside a quoted attribute value
+    size_t i = std::max(_scanned, nameStart);
+    for ( ; i < len; i++ )
+    {
+        char c = data[i];
+        if ( _quote != 0 )
+        {
+            if ( c == _quote )
+                _quote = 0;
+        }
+        else if ( c == '"' || c == '\'' )
+        {
+            _quote = c;
+        }
+        else if ( c == '>' )
+        {
+            if ( nameStart == 2 )
+                type = TokenType::EndTag;
+            else if ( data[i-1] == '/' )
+                type = TokenType::EmptyElementTag;
+            else
+                type = TokenType::StartTag;
+            _scanned = 0;
+            return i + 1;
+        }
+    }
+
+    _scanned = len;
+    return 0;
+}
+size_t MarkupTokenizer::Tokenize(const char* data, size_t len, bool final, const TokenHandler& handler)
+{
+    size_t pos = 0;
+    while ( pos < len )
+    {
+        if ( data[pos] != '<' )
+        {
+            const char* next = reinterpret_cast<const char*>(::memchr(data + pos, '<', len - pos));
+            size_t end = (next == nullptr ? len : size_t(next - data));
+            if ( !handler(Token(TokenType::Text, data + pos, end - pos)) )
+                return pos;
+            pos = end;
+            continue;
+        }
+
+        TokenType type = TokenType::Text;
+        size_t markupLen = MarkupLength(data + pos, len - pos, type);
+        if ( markupLen == 0 )
+        {
+            if ( !final )
+                return pos;     // wait for the rest of it
+
+            // unterminated markup at the end of the document
+            handler(Token(TokenType::Text, data + pos, len - pos));
+            Reset();
+            return len;
+        }
+
+        if ( !handler(Token(type, data + pos, markupLen)) )
+            return pos;
+        pos += markupLen;
+    }
+
+    return len;
+}
+
+#if 0
+#pragma mark - MarkupRewriter
+#endif
+
+void MarkupRewriter::Output::Write(const void* bytes, size_t len)
+{
+    if ( len == 0 )
+        return;
+
+    if ( _buffer != nullptr )
+    {
+        _buffer->AddBytes(reinterpret_cast<unsigned char*>(const_cast<void*>(bytes)), len);
+        return;
+    }
+
+    if ( _cursor + len > _limit )
+        throw std::logic_error("MarkupRewriter: in-place output overtook the input");
+    ::memmove(_cursor, bytes, len);
+    _cursor += len;
+}
+size_t MarkupRewriter::Rewrite(MarkupRewriterContext* context, const uint8_t* data, size_t len, bool final, Output& output)
+{
+    context->_inputEnd = reinterpret_cast<const char*>(data + len);
+    context->_final = final;
+    return context->Tokenizer().Tokenize(reinterpret_cast<const char*>(data), len, final, [&](const MarkupTokenizer::Token& token) {
+        output.SetLimit(token.Data() + token.Length());
+        return RewriteToken(context, token, output);
+    });
+}
+void* MarkupRewriter::FilterData(FilterContext* context, void* data, size_t len, size_t* outputLen)
+{
+    // no context means we're filtering a whole document in one go
+    std::unique_ptr<FilterContext> tempContext;
+    if ( context == nullptr )
+    {
+        tempContext.reset(MakeFilterContext(nullptr));
+        context = tempContext.get();
+    }
+
+    MarkupRewriterContext* ctx = dynamic_cast<MarkupRewriterContext*>(context);
+    if ( ctx == nullptr )
+        throw std::invalid_argument("MarkupRewriter: wrong type of filter context");
+
+    // anything held back from last time goes in front of the new bytes
+    const uint8_t* input = reinterpret_cast<const uint8_t*>(data);
+    size_t inputLen = len;
+    bool carried = !ctx->_carry.IsEmpty();
+    if ( carried )
+    {
+        ctx->_carry.AddBytes(reinterpret_cast<unsigned char*>(data), len);
+        input = ctx->_carry.GetBytes();
+        inputLen = ctx->_carry.GetBufferSize();
+    }
+
+    ByteBuffer& outBuf = ctx->_output;
+    outBuf.RemoveBytes(outBuf.GetBufferSize());
+    Output output(&outBuf);
+
+    bool final = bool(tempContext);
+    size_t consumed = Rewrite(ctx, input, inputLen, final, output);
+    if ( final )
+        FinishRewriting(ctx, output);
+
+    if ( carried )
+        ctx->_carry.RemoveBytes(consumed);
+    else if ( consumed < inputLen )
+        ctx->_carry.AddBytes(const_cast<unsigned char*>(input) + consumed, inputLen - consumed);
+
+    *outputLen = outBuf.GetBufferSize();
+    if ( *outputLen <= len )
+    {
+        if ( *outputLen > 0 )
+            ::memcpy(data, outBuf.GetBytes(), *outputLen);
+        return data;
+    }
+
+    uint8_t* result = new uint8_t[*outputLen];
+    ::memcpy(result, outBuf.GetBytes(), *outputLen);
+    return result;
+}
+void* MarkupRewriter::FlushData(FilterContext* context, size_t* outputLen)
+{
+    *outputLen = 0;
+    MarkupRewriterContext* ctx = dynamic_cast<MarkupRewriterContext*>(context);
+    if ( ctx == nullptr )
+        return nullptr;
+
+    ByteBuffer& outBuf = ctx->_output;
+    outBuf.RemoveBytes(outBuf.GetBufferSize());
+    Output output(&outBuf);
+
+    if ( !ctx->_carry.IsEmpty() )
+    {
+        Rewrite(ctx, ctx->_carry.GetBytes(), ctx->_carry.GetBufferSize(), true, output);
+        ctx->_carry.RemoveBytes(ctx->_carry.GetBufferSize());
+    }
+    FinishRewriting(ctx, output);
+
+    if ( outBuf.IsEmpty() )
+        return nullptr;
+
+    *outputLen = outBuf.GetBufferSize();
+    uint8_t* result = new uint8_t[*outputLen];
+    ::memcpy(result, outBuf.GetBytes(), *outputLen);
+    return result;
+}
+size_t MarkupRewriter::FilterDataInPlace(FilterContext* context, uint8_t* data, size_t len, size_t* consumed, bool final)
+{
+    MarkupRewriterContext* ctx = dynamic_cast<MarkupRewriterContext*>(context);
+    if ( ctx == nullptr )
+        throw std::invalid_argument("MarkupRewriter: wrong type of filter context");
+
+    Output output(data);
+    *consumed = Rewrite(ctx, data, len, final, output);
+    if ( final )
+    {
+        output.SetLimit(data + len);
+        FinishRewriting(ctx, output);
+    }
+    return output.Size();
+}
+
+EPUB3_END_NAMESPACE
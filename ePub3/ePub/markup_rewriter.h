@@ -0,0 +1,295 @@
+//
+//  markup_rewriter.h
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __ePub3__markup_rewriter__
+#define __ePub3__markup_rewriter__
+
+#include <ePub3/epub3.h>
+#include <ePub3/filter.h>
+#include <ePub3/utilities/byte_buffer.h>
+#include <ePub3/utilities/string_view.h>
+#include <functional>
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ An incremental tokenizer for XML and XHTML markup.
+
+ The tokenizer splits its input into runs of character data and complete pieces of
+ markup-- tags, comments, CDATA sections, processing instructions and the like. It
+ makes a single pass over its input and builds no tree, so it is suitable for
+ rewriting documents as they stream through a filter chain.
+
+ Input may arrive in chunks of any size. A piece of markup which is cut off at the
+ end of a chunk is left unconsumed; the caller must present those bytes again, at
+ the start of the next chunk. The tokenizer remembers how far it had scanned into
+ them, so a long comment split across many chunks is still only scanned once.
+
+ No validation is performed, and entities are not expanded.
+ @ingroup filters
+ */
+class MarkupTokenizer
+{
+public:
+    ///
+    /// The kinds of token produced.
+    enum class TokenType : uint8_t
+    {
+        Text,               ///< Character data.
+        StartTag,           ///< An element's start tag, e.g. `<p class="x">`.
+        EndTag,             ///< An element's end tag, e.g. `</p>`.
+        EmptyElementTag,    ///< An empty-element tag, e.g. `<br/>`.
+        Comment,            ///< A comment, e.g. `<!-- ... -->`.
+        Other               ///< A CDATA section, processing instruction or declaration.
+    };
+
+    /**
+     A single token, referencing the tokenizer's input.
+
+     Tokens are valid only for the duration of the handler call to which they're
+     passed.
+     */
+    class Token
+    {
+    public:
+        Token(TokenType type, const char* data, size_t length) : _type(type), _data(data), _length(length) {}
+
+        TokenType           Type()          const   { return _type; }
+        ///
+        /// The raw bytes of the token, exactly as they appeared in the input.
+        const char*         Data()          const   { return _data; }
+        size_t              Length()        const   { return _length; }
+
+        ///
+        /// `true` for start, end and empty-element tags.
+        bool                IsTag()         const   { return _type == TokenType::StartTag || _type == TokenType::EndTag || _type == TokenType::EmptyElementTag; }
+
+        ///
+        /// The qualified name of a tag, e.g. `epub:switch`, or an empty view for other tokens.
+        string_view         Name()          const;
+
+        ///
+        /// The text between `<!--` and `-->`, for comment tokens.
+        string_view         CommentText()   const;
+
+        /**
+         Locates an attribute of a start or empty-element tag.
+         @param name The qualified name of the attribute.
+         @param value Storage for the attribute's raw value, minus any quotes.
+         @result Returns `true` if the attribute is present.
+         */
+        bool                GetAttribute(string_view name, string_view& value) const;
+
+    private:
+        TokenType           _type;
+        const char*         _data;
+        size_t              _length;
+    };
+
+    ///
+    /// Returns `false` to stop tokenizing, leaving the token unconsumed.
+    typedef std::function<bool(const Token&)>   TokenHandler;
+
+public:
+    MarkupTokenizer() : _scanned(0), _quote(0), _depth(0) {}
+    MarkupTokenizer(const MarkupTokenizer& o) : _scanned(o._scanned), _quote(o._quote), _depth(o._depth) {}
+    ~MarkupTokenizer() {}
+
+    /**
+     Splits data into tokens, passing each to a handler in document order.
+     @param data The data to tokenize.
+     @param len The number of bytes at `data`.
+     @param final `true` if no more data will follow. Any incomplete markup is then
+     passed to the handler as text.
+     @param handler The function to call with each token.
+     @result The number of bytes consumed. Any remaining bytes hold an incomplete
+     piece of markup, or a token refused by the handler, and must be passed in again
+     at the start of the next call.
+     */
+    size_t              Tokenize(const char* data, size_t len, bool final, const TokenHandler& handler);
+
+    ///
+    /// Forgets any partially-scanned markup, ready for a new document.
+    void                Reset()                 { _scanned = 0; _quote = 0; _depth = 0; }
+
+private:
+    /**
+     Locates the end of the markup starting at `data`.
+     @result The length of the markup, or zero if it's incomplete. If the bytes do
+     not start a recognised piece of markup, returns 1 and sets `type` to Text.
+     */
+    size_t              MarkupLength(const char* data, size_t len, TokenType& type);
+
+    size_t              _scanned;       ///< How far into the unconsumed markup we've already looked.
+    char                _quote;         ///< The quote character open at `_scanned`, if any.
+    int                 _depth;         ///< The bracket depth at `_scanned` within a declaration.
+};
+
+/**
+ MarkupRewriter is an abstract base class for filters which make local edits to
+ XHTML content documents.
+
+ The content is run through a MarkupTokenizer as it streams through the filter
+ chain, and each token is passed to RewriteToken(). The subclass decides what, if
+ anything, to write in its place. State spanning more than one token lives in the
+ filter context, which subclasses may extend.
+
+ Filters whose output is never longer than their input can return `true` from
+ SupportsInPlaceFiltering(), in which case the document is rewritten within the
+ filter chain's own buffers. In either case, the work is linear in the size of the
+ document, and only a single incomplete tag (or comment) is ever held back, unless
+a subclass asks for more lookahead.
+
+ @ingroup filters
+ */
+class MarkupRewriter : public ContentFilter
+{
+public:
+    /**
+     The destination for rewritten markup.
+
+     When filtering in place, output is written over input which has already been
+     tokenized; writing more bytes than have been consumed is a logic error.
+     */
+    class Output
+    {
+    public:
+        ///
+        /// Writes into a ByteBuffer.
+        Output(ByteBuffer* buffer) : _buffer(buffer), _base(nullptr), _cursor(nullptr), _limit(nullptr) {}
+        ///
+        /// Writes over the input, starting at `base`.
+        Output(uint8_t* base) : _buffer(nullptr), _base(base), _cursor(base), _limit(base) {}
+
+        EPUB3_EXPORT
+        void            Write(const void* bytes, size_t len);
+        void            Write(string_view str)          { Write(str.data(), str.size()); }
+        void            Write(const MarkupTokenizer::Token& token)  { Write(token.Data(), token.Length()); }
+
+        ///
+        /// The number of bytes written so far.
+        size_t          Size()                  const   { return (_buffer != nullptr ? _buffer->GetBufferSize() : size_t(_cursor - _base)); }
+
+        ///
+        /// Records how far the input has been consumed, when filtering in place.
+        void            SetLimit(const void* end)       { if (_base != nullptr) _limit = reinterpret_cast<const uint8_t*>(end); }
+
+    private:
+        ByteBuffer*     _buffer;
+        uint8_t*        _base;
+        uint8_t*        _cursor;
+        const uint8_t*  _limit;
+    };
+
+    /**
+     Per-stream state: the tokenizer and any bytes held back between chunks.
+
+     Subclasses needing their own per-stream data should derive from this class.
+     */
+    class MarkupRewriterContext : public FilterContext
+    {
+    public:
+        MarkupRewriterContext() : FilterContext(), _tokenizer(), _inputEnd(nullptr), _final(false), _carry(), _output() {}
+        virtual ~MarkupRewriterContext() {}
+
+        MarkupTokenizer&    Tokenizer()     { return _tokenizer; }
+
+        ///
+        /// The input available after a token which is being rewritten.
+        string_view         Lookahead(const MarkupTokenizer::Token& token) const
+                                { return string_view(token.Data() + token.Length(), size_t(_inputEnd - (token.Data() + token.Length()))); }
+
+        ///
+        /// `true` if no more input will follow the current lookahead.
+        bool                IsFinal()       const   { return _final; }
+
+    private:
+        MarkupTokenizer     _tokenizer;
+        const char*         _inputEnd;      ///< The end of the data being rewritten.
+        bool                _final;         ///< Whether that data ends the document.
+        ByteBuffer          _carry;         ///< Input held back by FilterData().
+        ByteBuffer          _output;        ///< Reusable output storage for FilterData().
+
+        friend class MarkupRewriter;
+    };
+
+public:
+    MarkupRewriter(TypeSnifferFn sniffer) : ContentFilter(sniffer) {}
+    MarkupRewriter(const MarkupRewriter& o) : ContentFilter(o) {}
+    MarkupRewriter(MarkupRewriter&& o) : ContentFilter(std::move(o)) {}
+    virtual ~MarkupRewriter() {}
+
+    ///
+    /// Subclasses extending MarkupRewriterContext must override this.
+    virtual FilterContext* MakeFilterContext(ConstManifestItemPtr item) const OVERRIDE { return new MarkupRewriterContext(); }
+
+    /**
+     Rewrites a chunk of a document.
+
+     Any incomplete markup at the end of the chunk is held in the context until the
+     next call, or until FlushData() is called. If `context` is `nullptr`, the data
+     is taken to be the entire document.
+     */
+    EPUB3_EXPORT
+    virtual void * FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen) OVERRIDE;
+
+    ///
+    /// Rewrites anything held back by FilterData() at the end of a document.
+    EPUB3_EXPORT
+    virtual void * FlushData(FilterContext* context, size_t *outputLen) OVERRIDE;
+
+    ///
+    /// @copydoc ContentFilter::FilterDataInPlace()
+    EPUB3_EXPORT
+    virtual size_t FilterDataInPlace(FilterContext* context, uint8_t* data, size_t len, size_t* consumed, bool final) OVERRIDE;
+
+protected:
+    /**
+     Handles a single token.
+
+     To leave the token unchanged, write it to the output as-is.
+
+     A subclass which can't decide what to do with a token until it has seen some of
+     the content following it (see MarkupRewriterContext::Lookahead()) may refuse the
+     token by returning `false`, having written nothing. The token will be presented
+     again once more input is available. Tokens may not be refused once
+     MarkupRewriterContext::IsFinal() is `true`.
+     @param context The stream's context, as created by MakeFilterContext().
+     @param token The token to rewrite.
+     @param output The destination for the rewritten markup.
+     @result Returns `true` if the token was consumed.
+     */
+    virtual bool    RewriteToken(MarkupRewriterContext* context, const MarkupTokenizer::Token& token, Output& output) = 0;
+
+    /**
+     Called at the end of a document, once every token has been rewritten.
+
+     The default implementation does nothing.
+     */
+    virtual void    FinishRewriting(MarkupRewriterContext* context, Output& output) {}
+
+    ///
+    /// Tokenizes some data, passing each token to RewriteToken().
+    size_t          Rewrite(MarkupRewriterContext* context, const uint8_t* data, size_t len, bool final, Output& output);
+
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__markup_rewriter__) */
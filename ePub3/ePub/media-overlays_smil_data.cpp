@@ -19,6 +19,7 @@
 //  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "media-overlays_smil_data.h"
+#include "media-overlays_smil_model.h"
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -29,6 +30,20 @@ SMILData::~SMILData()
     //
 }
 
+shared_ptr<const SMILData::Sequence> SMILData::Body() const
+{
+    if (!_parsed)
+    {
+        std::shared_ptr<MediaOverlaysSmilModel> model = Owner(); // internally: std::weak_ptr<MediaOverlaysSmilModel>.lock()
+        if (model != nullptr)
+        {
+            model->ensureSmilParsed(_index);
+        }
+    }
+
+    return _root;
+}
+
 const string & SMILData::TimeNode::Name() const
 {
     throw std::runtime_error("TimeNode Name()");
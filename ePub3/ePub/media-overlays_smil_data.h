@@ -25,6 +25,8 @@
 #include <ePub3/utilities/owned_by.h>
 #include <ePub3/manifest.h>
 #include <ePub3/spine.h>
+#include <atomic>
+#include <mutex>
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -144,8 +146,6 @@ EPUB3_BEGIN_NAMESPACE
             {
                 friend class MediaOverlaysSmilModel; // _children
 
-                friend class SMILData; // ParallelAt, NthParallel, ClipOffset
-
             private:
                 Sequence() _DELETED_;
 
@@ -163,138 +163,6 @@ EPUB3_BEGIN_NAMESPACE
 
                 shared_vector<const TimeContainer> _children;
 
-                const bool ClipOffset(uint32_t & offset, shared_ptr<const Parallel> par) const
-                {
-                    std::shared_ptr<SMILData> smilData = Owner(); // internally: std::weak_ptr<SMILData>.lock()
-                    if (smilData == nullptr)
-                    {
-                        return false;
-                    }
-                    
-                    for (int i = 0; i < _children.size(); i++)
-                    {
-                        auto container = _children[i];
-                        if (container->IsParallel())
-                        {
-                            auto para = std::dynamic_pointer_cast<const Parallel>(container);
-                            if (para == par)
-                            {
-                                return true;
-                            }
-
-                            if (para->Audio() == nullptr)
-                            {
-                                continue;
-                            }
-
-                            if (para->Text() != nullptr && para->Text()->SrcManifestItem() != nullptr && para->Text()->SrcManifestItem() != smilData->XhtmlSpineItem()->ManifestItem())
-                            {
-                                continue;
-                            }
-
-                            uint32_t clipDur = para->Audio()->ClipDurationMilliseconds();
-                            offset += clipDur;
-                        }
-                        else if (container->IsSequence())
-                        {
-                            auto sequence = std::dynamic_pointer_cast<const Sequence>(container);
-
-                            bool found = sequence->ClipOffset(offset, par);
-                            if (found)
-                            {
-                                return true;
-                            }
-                        }
-                    }
-
-                    return false;
-                }
-
-                shared_ptr<const Parallel> ParallelAt(uint32_t timeMilliseconds) const
-                {
-                    std::shared_ptr<SMILData> smilData = Owner(); // internally: std::weak_ptr<SMILData>.lock()
-                    if (smilData == nullptr)
-                    {
-                        return nullptr;
-                    }
-                    
-                    uint32_t offset = 0;
-
-                    for (int i = 0; i < _children.size(); i++)
-                    {
-                        uint32_t timeAdjusted = timeMilliseconds - offset;
-
-                        auto container = _children[i];
-                        if (container->IsParallel())
-                        {
-                            auto para = std::dynamic_pointer_cast<const Parallel>(container);
-
-                            if (para->Audio() == nullptr)
-                            {
-                                continue;
-                            }
-
-                            if (para->Text() != nullptr && para->Text()->SrcManifestItem() != nullptr && para->Text()->SrcManifestItem() != smilData->XhtmlSpineItem()->ManifestItem())
-                            {
-                                continue;
-                            }
-
-                            uint32_t clipDur = para->Audio()->ClipDurationMilliseconds();
-
-                            if (clipDur > 0 && timeAdjusted <= clipDur)
-                            {
-                                return para;
-                            }
-
-                            offset += clipDur;
-                        }
-                        else if (container->IsSequence())
-                        {
-                            auto sequence = std::dynamic_pointer_cast<const Sequence>(container);
-
-                            auto para = sequence->ParallelAt(timeAdjusted);
-                            if (para != nullptr)
-                            {
-                                return para;
-                            }
-
-                            offset += sequence->DurationMilliseconds();
-                        }
-                    }
-
-                    return nullptr;
-                }
-
-                shared_ptr<const Parallel> NthParallel(uint32_t index, uint32_t & count) const
-                {
-                    for (int i = 0; i < _children.size(); i++)
-                    {
-                        auto container = _children[i];
-                        if (container->IsParallel())
-                        {
-                            count++;
-
-                            if (count == index)
-                            {
-                                auto para = std::dynamic_pointer_cast<const Parallel>(container);
-                                return para;
-                            }
-                        }
-                        else if (container->IsSequence())
-                        {
-                            auto sequence = std::dynamic_pointer_cast<const Sequence>(container);
-
-                            auto para = sequence->NthParallel(index, count);
-                            if (para != nullptr)
-                            {
-                                return para;
-                            }
-                        }
-                    }
-
-                    return nullptr;
-                }
-
             public:
                 EPUB3_EXPORT
 
@@ -666,42 +534,11 @@ EPUB3_BEGIN_NAMESPACE
 
             shared_ptr<Sequence> _root;
 
-            shared_ptr<const Parallel> ParallelAt(uint32_t timeMilliseconds) const
-            {
-                if (_root == nullptr)
-                {
-                    return nullptr;
-                }
-
-                return _root->ParallelAt(timeMilliseconds);
-            }
-
-            shared_ptr<const Parallel> NthParallel(uint32_t index) const
-            {
-                if (_root == nullptr)
-                {
-                    return nullptr;
-                }
-
-                uint32_t count = -1;
-                return _root->NthParallel(index, count);
-            }
-
-            const uint32_t ClipOffset(shared_ptr<const Parallel> par) const
-            {
-                if (_root == nullptr)
-                {
-                    return 0;
-                }
+            std::vector<std::shared_ptr<SMILData>>::size_type _index; // within the owning model
 
-                uint32_t offset = 0;
-                if (_root->ClipOffset(offset, par))
-                {
-                    return offset;
-                }
+            std::atomic<bool> _parsed; // whether _root is complete (SMIL documents may be parsed on demand)
 
-                return 0;
-            }
+            std::mutex _parseLock;
 
         public:
             EPUB3_EXPORT
@@ -710,7 +547,7 @@ EPUB3_BEGIN_NAMESPACE
 #if EPUB_PLATFORM(WINRT)
                 NativeBridge(),
 #endif
-                _manifestItem(manifestItem), _spineItem(spineItem), _duration(duration), _root(nullptr)
+                _manifestItem(manifestItem), _spineItem(spineItem), _duration(duration), _root(nullptr), _index(0), _parsed(manifestItem == nullptr), _parseLock()
             {
                 //printf("SMILData(%s)\n", manifestItem->Href().c_str());
             }
@@ -731,17 +568,19 @@ EPUB3_BEGIN_NAMESPACE
                 return _manifestItem;
             }
 
+            /**
+             The root time container. If the owning model parses lazily, the SMIL
+             document is parsed on the first call.
+             */
+            EPUB3_EXPORT
+
+            shared_ptr<const Sequence> Body() const;
+
             EPUB3_EXPORT
 
-            shared_ptr<const Sequence> Body() const
+            const bool IsParsed() const
             {
-                if (_root == nullptr)
-                {
-                    return nullptr;
-                }
-                
-                //return _root.get();
-                return _root;
+                return _parsed;
             }
 
             EPUB3_EXPORT
@@ -755,12 +594,13 @@ EPUB3_BEGIN_NAMESPACE
 
             const uint32_t DurationMilliseconds_Calculated() const
             {
-                if (_root == nullptr)
+                shared_ptr<const Sequence> body = Body();
+                if (body == nullptr)
                 {
                     return 0;
                 }
 
-                return _root->DurationMilliseconds();
+                return body->DurationMilliseconds();
             }
         };
 
@@ -24,9 +24,12 @@
 #include <ePub3/media-overlays_smil_data.h>
 #include "error_handler.h"
 #include "xpath_wrangler.h"
+#include <ePub3/utilities/executor.h>
+#include <iostream>
 
 
 //#include <iostream>
+#include <algorithm>
 #include <chrono>
 
 
@@ -156,12 +159,14 @@ public:
             //printf("~MediaOverlaysSmilModel()\n");
         }
 
-        MediaOverlaysSmilModel::MediaOverlaysSmilModel(const std::shared_ptr<Package> & package) : OwnedBy(package), _totalDuration(0), _smilDatas(std::vector<std::shared_ptr<SMILData>>())
+        MediaOverlaysSmilModel::MediaOverlaysSmilModel(const std::shared_ptr<Package> & package) : OwnedBy(package), _totalDuration(0), _smilDatas(std::vector<std::shared_ptr<SMILData>>()), _smilTimelines(), _smilOffsets(), _timedSmils(), _timelineLock(), _lazy(false), _prefetchCount(DefaultPrefetchCount), _prefetchExecutor(nullptr)
         {
         }
 
-        void MediaOverlaysSmilModel::Initialize()
+        void MediaOverlaysSmilModel::Initialize(bool lazy)
         {
+            _lazy = lazy;
+
             resetData();
             populateData();
         }
@@ -174,12 +179,25 @@ public:
 
             //_smilDatas.erase(_smilDatas.begin(), _smilDatas.end());
             _smilDatas.clear();
+
+            std::lock_guard<std::mutex> _(_timelineLock);
+            _smilTimelines.clear();
+            _smilOffsets.clear();
+            _timedSmils.clear();
         }
 
         void MediaOverlaysSmilModel::populateData()
         {
             parseMetadata();
 
+            initTimelines();
+
+            if (_lazy)
+            {
+                // each SMIL is parsed (and checked) when first needed
+                return;
+            }
+
             uint32_t totalDurationFromSMILs = parseSMILs();
 
             if (_totalDuration != totalDurationFromSMILs)
@@ -360,161 +378,115 @@ public:
         }
 
         uint32_t MediaOverlaysSmilModel::parseSMILs()
-        {       
+        {
+            uint32_t accumulatedDurationMilliseconds = 0;
+
+            for (std::vector<std::shared_ptr<SMILData>>::size_type i = 0; i < _smilDatas.size(); i++)
+            {
+                accumulatedDurationMilliseconds += loadSmil(i);
+            }
+
+            return accumulatedDurationMilliseconds;
+        }
+
+        uint32_t MediaOverlaysSmilModel::parseSmilDocument(SMILDataPtr smilData)
+        {
             std::shared_ptr<Package> package = Owner(); // internally: std::weak_ptr<Package>.lock()
             if (package == nullptr)
             {
                 return 0;
             }
 
-//Timer timer;
-            //uint counter = 0;
+            const ManifestItemPtr item = smilData->SmilManifestItem();
 
             std::map<std::shared_ptr<ManifestItem>, string> cache_manifestItemToAbsolutePath;
 
-            uint32_t accumulatedDurationMilliseconds = 0;
-
+            shared_ptr<xml::Document> doc = item->ReferencedDocument();
 
-            shared_ptr<SpineItem> spineItem = package->FirstSpineItem();
-            while (spineItem != nullptr)
+            if (doc == nullptr)
             {
-                ManifestItemPtr item = spineItem->ManifestItem();
-
-                //string
-                //const ManifestItem::MimeType & mediaType = item->MediaType();
-                //if (mediaType != "application/smil+xml")
-
-                //const string & mediaOverlayID = item->MediaOverlayID();
-                //printf("--- Media Overlays ID: %s\n", mediaOverlayID.c_str());
-                item = item->MediaOverlay();
-                if (item == nullptr)
-                {
-                    spineItem = spineItem->Next();
-                    continue;
-                }
-
-//                counter++;
-//                if (counter > 10)
-//                {
-//                    break;
-//                }
-
-                //printf("Media Overlays SMIL PARSING: %s\n", item->Href().c_str());
-
-                //unique_ptr<ArchiveXmlReader> xmlReader = package->XmlReaderForRelativePath(item->Href());
-                shared_ptr<xml::Document> doc = item->ReferencedDocument();
-
-                if (doc == nullptr)
-                {
-                    HandleError(EPUBError::MediaOverlayCannotParseSMILXML, _Str("Cannot parse XML: ", item->Href().c_str()));
-                }
+                HandleError(EPUBError::MediaOverlayCannotParseSMILXML, _Str("Cannot parse XML: ", item->Href().c_str()));
+            }
 
 #if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
-                XPathWrangler xpath(doc, {{"epub", ePub3NamespaceURI}, {"smil", SMILNamespaceURI}});
+            XPathWrangler xpath(doc, {{"epub", ePub3NamespaceURI}, {"smil", SMILNamespaceURI}});
 #else
-                XPathWrangler::NamespaceList __ns;
-                __ns["epub"] = ePub3NamespaceURI;
-                __ns["smil"] = SMILNamespaceURI;
-                XPathWrangler xpath(doc, __ns);
+            XPathWrangler::NamespaceList __ns;
+            __ns["epub"] = ePub3NamespaceURI;
+            __ns["smil"] = SMILNamespaceURI;
+            XPathWrangler xpath(doc, __ns);
 #endif
-                xpath.NameDefaultNamespace("smil");
+            xpath.NameDefaultNamespace("smil");
 
-                xml::NodeSet nodes = xpath.Nodes("/smil:smil");
+            xml::NodeSet nodes = xpath.Nodes("/smil:smil");
 
-                if (nodes.empty())
-                {
-                    HandleError(EPUBError::MediaOverlayInvalidRootElement, _Str("'smil' root element not found: ", item->Href().c_str()));
-                }
-                else if (nodes.size() > 1)
-                {
-                    HandleError(EPUBError::MediaOverlayInvalidRootElement, _Str("Multiple 'smil' root elements found: ", item->Href().c_str()));
-                }
-
-                if (nodes.size() != 1)
-                    return 0;
-
-                shared_ptr<xml::Node> smil = nodes[0];
-
-                string version = _getProp(smil, "version", SMILNamespaceURI);
-                if (version.empty())
-                {
-                    HandleError(EPUBError::MediaOverlayVersionMissing, _Str("SMIL version not found: ", item->Href().c_str()));
-                }
-                else if (version != "3.0")
-                {
-                    HandleError(EPUBError::MediaOverlayInvalidVersion, _Str("Invalid SMIL version (", version, "): ", item->Href().c_str()));
-                }
+            if (nodes.empty())
+            {
+                HandleError(EPUBError::MediaOverlayInvalidRootElement, _Str("'smil' root element not found: ", item->Href().c_str()));
+            }
+            else if (nodes.size() > 1)
+            {
+                HandleError(EPUBError::MediaOverlayInvalidRootElement, _Str("Multiple 'smil' root elements found: ", item->Href().c_str()));
+            }
 
-                nodes = xpath.Nodes("./smil:head", smil);
+            if (nodes.size() != 1)
+                return 0;
 
-                if (nodes.empty())
-                {
-                    // OKAY
-                }
-                else if (nodes.size() == 1)
-                {
-                    //TODO: check head placement
-                    //HandleError(EPUBError::MediaOverlayHeadIncorrectlyPlaced, _Str("'head' element incorrectly placed: ", item->Href().c_str()));
-                }
-                else if (nodes.size() > 1)
-                {
-                    HandleError(EPUBError::MediaOverlayHeadIncorrectlyPlaced, _Str("multiple 'head' elements found: ", item->Href().c_str()));
-                    return 0;
-                }
+            shared_ptr<xml::Node> smil = nodes[0];
 
-                nodes = xpath.Nodes("./smil:body", smil);
+            string version = _getProp(smil, "version", SMILNamespaceURI);
+            if (version.empty())
+            {
+                HandleError(EPUBError::MediaOverlayVersionMissing, _Str("SMIL version not found: ", item->Href().c_str()));
+            }
+            else if (version != "3.0")
+            {
+                HandleError(EPUBError::MediaOverlayInvalidVersion, _Str("Invalid SMIL version (", version, "): ", item->Href().c_str()));
+            }
 
-                if (nodes.empty())
-                {
-                    HandleError(EPUBError::MediaOverlayNoBody, _Str("'body' element not found: ", item->Href().c_str()));
-                }
-                else if (nodes.size() > 1)
-                {
-                    HandleError(EPUBError::MediaOverlayMultipleBodies, _Str("multiple 'body' elements found: ", item->Href().c_str()));
-                }
+            nodes = xpath.Nodes("./smil:head", smil);
 
-                if (nodes.size() != 1)
-                {
-                    return 0;
-                }
+            if (nodes.empty())
+            {
+                // OKAY
+            }
+            else if (nodes.size() == 1)
+            {
+                //TODO: check head placement
+                //HandleError(EPUBError::MediaOverlayHeadIncorrectlyPlaced, _Str("'head' element incorrectly placed: ", item->Href().c_str()));
+            }
+            else if (nodes.size() > 1)
+            {
+                HandleError(EPUBError::MediaOverlayHeadIncorrectlyPlaced, _Str("multiple 'head' elements found: ", item->Href().c_str()));
+                return 0;
+            }
 
-                shared_ptr<SMILData> smilData = nullptr;
-                string id = item->Identifier();
-                for (int i = 0; i < _smilDatas.size(); i++)
-                {
-                    const std::shared_ptr<SMILData> data = _smilDatas.at(i); // does not make a copy of the smart pointer (NO reference count++)
+            nodes = xpath.Nodes("./smil:body", smil);
 
-                    if (data->SmilManifestItem() == nullptr)
-                    {
-                        continue;
-                    }
+            if (nodes.empty())
+            {
+                HandleError(EPUBError::MediaOverlayNoBody, _Str("'body' element not found: ", item->Href().c_str()));
+            }
+            else if (nodes.size() > 1)
+            {
+                HandleError(EPUBError::MediaOverlayMultipleBodies, _Str("multiple 'body' elements found: ", item->Href().c_str()));
+            }
 
-                    if (data->SmilManifestItem()->Identifier() == id)
-                    {
-                        auto seq = data->Body();
-                        if (seq != nullptr)
-                        {
-                            continue;
-                        }
-
-                        if (data->XhtmlSpineItem()->ManifestItem()->Identifier() != spineItem->ManifestItem()->Identifier())
-                        {
-                            printf("XHTML spine item's manifest item ID mismatch?!\n");
-                        }
-                        smilData = data;
-                        break;
-                    }
-                }
+            if (nodes.size() != 1)
+            {
+                return 0;
+            }
 
-                shared_ptr<xml::Node> body = nodes[0];
+            shared_ptr<xml::Node> body = nodes[0];
 
-                std::map<string, std::shared_ptr<ManifestItem>> cache_smilRelativePathToManifestItem;
+            std::map<string, std::shared_ptr<ManifestItem>> cache_smilRelativePathToManifestItem;
 
 //// TIMER START
 //timer.reset();
 
-                uint32_t smilDur = parseSMIL(smilData, nullptr, nullptr, item, body, cache_manifestItemToAbsolutePath, cache_smilRelativePathToManifestItem);
-                //printf("Media Overlays SMIL DURATION (milliseconds): %ld\n", (long) smilDur);
+            bool excludeAudioDuration = false;
+            uint32_t smilDur = parseSMIL(smilData, nullptr, nullptr, item, body, cache_manifestItemToAbsolutePath, cache_smilRelativePathToManifestItem, excludeAudioDuration);
+            //printf("Media Overlays SMIL DURATION (milliseconds): %ld\n", (long) smilDur);
 
 //// TIMER END
 //double seconds = timer.elapsed();
@@ -524,29 +496,22 @@ public:
 //printf("%s\n", str.c_str());
 ////std::cout << t << std::endl;
 
-                uint32_t metaDur = smilData->DurationMilliseconds_Metadata();
-                if (metaDur != smilDur)
-                {
-                    std::stringstream s;
-                    s << "Media Overlays SMIL duration mismatch (milliseconds): METADATA " << (long) metaDur << " != SMIL " << (long) smilDur << " (" << item->Href().c_str() << ")";
-                    const std::string & str = _Str(s.str());
-                    //printf("%s\n", str.c_str());
-
-                    //smilData->_duration = smilDur;
-
-                    HandleError(EPUBError::MediaOverlayMismatchDurationMetadata, str);
-                }
+            uint32_t metaDur = smilData->DurationMilliseconds_Metadata();
+            if (metaDur != smilDur)
+            {
+                std::stringstream s;
+                s << "Media Overlays SMIL duration mismatch (milliseconds): METADATA " << (long) metaDur << " != SMIL " << (long) smilDur << " (" << item->Href().c_str() << ")";
+                const std::string & str = _Str(s.str());
+                //printf("%s\n", str.c_str());
 
-                accumulatedDurationMilliseconds += smilDur;
+                //smilData->_duration = smilDur;
 
-                spineItem = spineItem->Next();
+                HandleError(EPUBError::MediaOverlayMismatchDurationMetadata, str);
             }
 
-            return accumulatedDurationMilliseconds;
+            return smilDur;
         }
 
-        static std::vector<string> splitFileFragmentId; // = std::vector<string>(2);
-
         void splitIriFileFragmentID(const string & iri, std::vector<string> &splitFileFragmentId)
         {
             //printf("=========== IRI: %s\n", iri.c_str());
@@ -716,13 +681,15 @@ public:
             return nullptr;
         }
 
-        uint32_t MediaOverlaysSmilModel::parseSMIL(SMILDataPtr smilData, shared_ptr<SMILData::Sequence> sequence, shared_ptr<SMILData::Parallel> parallel, const ManifestItemPtr item, shared_ptr<xml::Node> element, std::map<std::shared_ptr<ManifestItem>, string> & cache_manifestItemToAbsolutePath, std::map<string, std::shared_ptr<ManifestItem>> & cache_smilRelativePathToManifestItem)
+        uint32_t MediaOverlaysSmilModel::parseSMIL(SMILDataPtr smilData, shared_ptr<SMILData::Sequence> sequence, shared_ptr<SMILData::Parallel> parallel, const ManifestItemPtr item, shared_ptr<xml::Node> element, std::map<std::shared_ptr<ManifestItem>, string> & cache_manifestItemToAbsolutePath, std::map<string, std::shared_ptr<ManifestItem>> & cache_smilRelativePathToManifestItem, bool & excludeAudioDuration)
         {
             if (!bool(element) || !element->IsElementNode())
             {
                 return 0;
             }
 
+            std::vector<string> splitFileFragmentId;
+
             uint32_t accumulatedDurationMilliseconds = 0;
 
             string elementName = element->Name();
@@ -815,7 +782,7 @@ public:
 
                 smilData->_root = std::make_shared<SMILData::Sequence>(nullptr, textref_file, textref_fragmentID, textrefManifestItem, type, smilData);
 
-                sequence = std::const_pointer_cast<SMILData::Sequence>(smilData->Body());
+                sequence = smilData->_root;
 
                 parallel = nullptr;
             }
@@ -960,7 +927,7 @@ public:
                 if (srcManifestItem != spineManifestItem)
                 {
                     printf("Media Overlays TEXT SRC mismatch (SMIL[1] with XHTML[1+]): %s (%s) [%s]\n", srcManifestItem->Href().c_str(), spineManifestItem->Href().c_str(), item->Href().c_str());
-                    _excludeAudioDuration = true;
+                    excludeAudioDuration = true;
                 }
 
                 parallel->_text = std::make_shared<SMILData::Text>(parallel, src_file, src_fragmentID, srcManifestItem, smilData);
@@ -976,13 +943,13 @@ public:
             shared_ptr<xml::Node> childNode = element->FirstElementChild();
             if (bool(childNode))
             {
-                _excludeAudioDuration = false;
+                excludeAudioDuration = false;
 
                 for (; bool(childNode); childNode = childNode->NextElementSibling())
                 {
-                    uint32_t time = parseSMIL(smilData, sequence, parallel, item, childNode, cache_manifestItemToAbsolutePath, cache_smilRelativePathToManifestItem);
+                    uint32_t time = parseSMIL(smilData, sequence, parallel, item, childNode, cache_manifestItemToAbsolutePath, cache_smilRelativePathToManifestItem, excludeAudioDuration);
 
-                    if (elementName != "par" || !_excludeAudioDuration)
+                    if (elementName != "par" || !excludeAudioDuration)
                     {
                         accumulatedDurationMilliseconds += time;
                     }
@@ -1045,103 +1012,350 @@ public:
             return pack->MediaOverlays_PlaybackActiveClass();
         }
 
-        const uint32_t MediaOverlaysSmilModel::DurationMilliseconds_Calculated() const
+        void MediaOverlaysSmilModel::initTimelines()
         {
-            uint32_t total = 0;
+            std::lock_guard<std::mutex> _(_timelineLock);
 
-            ForEachSmilData([&total](const std::shared_ptr<SMILData> & data)
+            _smilTimelines.clear();
+            _smilTimelines.resize(_smilDatas.size());
+
+            for (std::vector<std::shared_ptr<SMILData>>::size_type i = 0; i < _smilDatas.size(); i++)
             {
-                total += data->DurationMilliseconds_Calculated();
-            });
+                const std::shared_ptr<SMILData> & data = _smilDatas[i];
+                data->_index = i;
 
-            return total;
+                SmilTimeline & timeline = _smilTimelines[i];
+                timeline.duration = 0;
+                timeline.parsed = data->IsParsed();
+
+                if (!timeline.parsed)
+                {
+                    // until the SMIL is parsed, rely on the metadata
+                    timeline.duration = data->DurationMilliseconds_Metadata();
+                }
+                else if (data->_root != nullptr)
+                {
+                    appendToTimeline(data->_root, data->XhtmlSpineItem()->ManifestItem(), timeline.duration, timeline);
+                }
+            }
+
+            updateSmilOffsets();
         }
 
-        shared_ptr<const SMILData::Parallel> MediaOverlaysSmilModel::ParallelAt(uint32_t timeMilliseconds) const
+        void MediaOverlaysSmilModel::installTimeline(std::vector<std::shared_ptr<SMILData>>::size_type smilIndex)
+        {
+            const std::shared_ptr<SMILData> & data = _smilDatas[smilIndex];
+
+            SmilTimeline timeline;
+            timeline.duration = 0;
+            timeline.parsed = true;
+
+            if (data->_root != nullptr)
+            {
+                appendToTimeline(data->_root, data->XhtmlSpineItem()->ManifestItem(), timeline.duration, timeline);
+            }
+
+            std::lock_guard<std::mutex> _(_timelineLock);
+            _smilTimelines[smilIndex] = std::move(timeline);
+            updateSmilOffsets();
+        }
+
+        void MediaOverlaysSmilModel::updateSmilOffsets()
         {
+            _smilOffsets.resize(_smilTimelines.size() + 1);
+            _timedSmils.clear();
+
             uint32_t offset = 0;
 
-            for (int i = 0; i < _smilDatas.size(); i++)
+            for (std::vector<SmilTimeline>::size_type i = 0; i < _smilTimelines.size(); i++)
             {
-                const std::shared_ptr<SMILData> data = _smilDatas.at(i); // does not make a copy of the smart pointer (NO reference count++)
-                uint32_t timeAdjusted = timeMilliseconds - offset;
+                _smilOffsets[i] = offset;
 
-                shared_ptr<const SMILData::Parallel> para = data->ParallelAt(timeAdjusted);
-                if (para != nullptr)
+                if (_smilTimelines[i].duration > 0)
                 {
-                    return para;
+                    _timedSmils.push_back((uint32_t) i);
                 }
 
-                offset += data->DurationMilliseconds_Calculated();
+                offset += _smilTimelines[i].duration;
             }
 
-            return nullptr;
+            _smilOffsets[_smilTimelines.size()] = offset;
         }
 
-        const void MediaOverlaysSmilModel::PercentToPosition(double percent, SMILDataPtr & smilData, uint32_t & smilIndex, shared_ptr<const SMILData::Parallel>& par, uint32_t & parIndex, uint32_t & milliseconds) const
+        void MediaOverlaysSmilModel::appendToTimeline(shared_ptr<const SMILData::Sequence> sequence, const ManifestItemPtr xhtmlItem, uint32_t & offset, SmilTimeline & timeline)
         {
-            if (percent < 0.0 || percent > 100.0)
+            for (shared_vector<const SMILData::TimeContainer>::size_type i = 0; i < sequence->GetChildrenCount(); i++)
             {
-                percent = 0.0;
+                shared_ptr<const SMILData::TimeContainer> container = sequence->GetChild(i);
+
+                if (container->IsSequence())
+                {
+                    appendToTimeline(std::static_pointer_cast<const SMILData::Sequence>(container), xhtmlItem, offset, timeline);
+                    continue;
+                }
+
+                if (!container->IsParallel())
+                {
+                    continue;
+                }
+
+                TimelineEntry entry;
+                entry.par = std::static_pointer_cast<const SMILData::Parallel>(container);
+                entry.start = offset;
+                entry.duration = 0;
+                entry.parIndex = (uint32_t) timeline.entries.size();
+
+                // pars without audio, or whose text belongs to a different document, take up no time
+                const shared_ptr<const SMILData::Text> text = entry.par->Text();
+                bool timed = entry.par->Audio() != nullptr
+                        && (text == nullptr || text->SrcManifestItem() == nullptr || text->SrcManifestItem() == xhtmlItem);
+
+                if (timed)
+                {
+                    entry.duration = entry.par->Audio()->ClipDurationMilliseconds();
+                    offset += entry.duration;
+                }
+
+                if (entry.duration > 0)
+                {
+                    timeline.timedEntries.push_back(entry.parIndex);
+                }
+
+                timeline.entries.push_back(entry);
             }
+        }
 
-            uint32_t total = DurationMilliseconds_Calculated();
+        uint32_t MediaOverlaysSmilModel::loadSmil(std::vector<std::shared_ptr<SMILData>>::size_type smilIndex)
+        {
+            const std::shared_ptr<SMILData> & data = _smilDatas[smilIndex];
+            if (data->_parsed)
+            {
+                return 0;
+            }
 
-            uint32_t timeMs = (uint32_t) (total * (percent / 100.0));
+            std::lock_guard<std::mutex> _(data->_parseLock);
+            if (data->_parsed)
+            {
+                return 0;
+            }
 
-            //printf("=== TIME SCRUB: %ldms / %ldms (==%ldms)", (long) timeMs, (long) total, (long) mo->DurationMillisecondsTotal());
+            uint32_t duration = 0;
+            try
+            {
+                duration = parseSmilDocument(data);
+            }
+            catch (...)
+            {
+                // leave it to be tried again
+                data->_root = nullptr;
+                throw;
+            }
+
+            installTimeline(smilIndex);
+            data->_parsed = true;
 
-            par = ParallelAt(timeMs);
-            if (par == nullptr)
+            return duration;
+        }
+
+        void MediaOverlaysSmilModel::ensureSmilParsed(std::vector<std::shared_ptr<SMILData>>::size_type smilIndex, bool prefetchAhead)
+        {
+            if (smilIndex >= _smilDatas.size() || _smilDatas[smilIndex]->_parsed)
             {
                 return;
             }
 
-            std::shared_ptr<SMILData> smilDataPar = par->Owner(); // internally: std::weak_ptr<SMILData>.lock()
-            if (smilDataPar == nullptr)
+            loadSmil(smilIndex);
+
+            if (prefetchAhead)
+            {
+                PrefetchSmils(smilIndex + 1, _prefetchCount);
+            }
+        }
+
+        void MediaOverlaysSmilModel::PrefetchSmils(std::vector<std::shared_ptr<SMILData>>::size_type first, size_t count)
+        {
+            std::vector<std::vector<std::shared_ptr<SMILData>>::size_type> pending;
+            for (std::vector<std::shared_ptr<SMILData>>::size_type i = first; i < _smilDatas.size() && i < first + count; i++)
+            {
+                if (!_smilDatas[i]->_parsed)
+                {
+                    pending.push_back(i);
+                }
+            }
+
+            if (pending.empty())
             {
                 return;
             }
-            
-            uint32_t smilDataOffset = 0;
-            for (std::vector<std::shared_ptr<SMILData>>::size_type i = 0; i < GetSmilCount(); i++)
+
+            std::shared_ptr<executor> prefetchExecutor = _prefetchExecutor;
+            if (prefetchExecutor == nullptr)
             {
-                smilData = GetSmil(i);
-                if (smilData == smilDataPar) // smart shared pointer comparison operator overloaded
+                static std::shared_ptr<executor> __sharedPrefetchExecutor;
+                static std::once_flag __once;
+                std::call_once(__once, [](){
+                    __sharedPrefetchExecutor = std::make_shared<thread_pool>(thread_pool::Automatic);
+                });
+                prefetchExecutor = __sharedPrefetchExecutor;
+            }
+
+            std::weak_ptr<MediaOverlaysSmilModel> weakSelf = shared_from_this();
+            prefetchExecutor->add([weakSelf, pending]() {
+                std::shared_ptr<MediaOverlaysSmilModel> self = weakSelf.lock();
+                if (self == nullptr)
+                {
+                    return;
+                }
+
+                for (auto smilIndex : pending)
                 {
-                    break;
+                    try
+                    {
+                        self->ensureSmilParsed(smilIndex, false);
+                    }
+                    catch (std::exception& exc)
+                    {
+                        // whoever needs it next will see the error
+                        std::cerr << "Media Overlays: cannot prefetch SMIL: " << exc.what() << std::endl;
+                    }
+                    catch (...)
+                    {
+                        std::cerr << "Media Overlays: cannot prefetch SMIL" << std::endl;
+                    }
                 }
-                smilDataOffset += smilData->DurationMilliseconds_Calculated();
+            });
+        }
+
+        const uint32_t MediaOverlaysSmilModel::DurationMilliseconds_Calculated() const
+        {
+            std::lock_guard<std::mutex> _(_timelineLock);
+            if (_smilOffsets.empty())
+            {
+                return 0;
             }
 
-            milliseconds = timeMs - (smilDataOffset + smilData->ClipOffset(par));
+            return _smilOffsets.back();
         }
 
-        const double MediaOverlaysSmilModel::PositionToPercent(std::vector<std::shared_ptr<SMILData>>::size_type smilIndex, uint32_t parIndex, uint32_t milliseconds) const
+        const MediaOverlaysSmilModel::TimelineEntry * MediaOverlaysSmilModel::TimelineEntryAt(uint32_t timeMilliseconds, std::vector<std::shared_ptr<SMILData>>::size_type & smilIndex, uint32_t & smilOffset) const
         {
-            if (smilIndex >= GetSmilCount())
+            // a time on a boundary belongs to the earlier SMIL or par
+            for (;;)
             {
-                return -1.0;
+                const SmilTimeline * timeline = nullptr;
+                {
+                    std::lock_guard<std::mutex> _(_timelineLock);
+
+                    auto pos = std::lower_bound(_timedSmils.begin(), _timedSmils.end(), timeMilliseconds, [this](uint32_t index, uint32_t time)
+                    {
+                        return _smilOffsets[index + 1] < time;
+                    });
+
+                    if (pos == _timedSmils.end())
+                    {
+                        return nullptr;
+                    }
+
+                    smilIndex = *pos;
+                    smilOffset = _smilOffsets[smilIndex];
+                    if (_smilTimelines[smilIndex].parsed)
+                    {
+                        timeline = &_smilTimelines[smilIndex];
+                    }
+                }
+
+                if (timeline == nullptr)
+                {
+                    // parsing is logically const; the offsets may change, so look again afterwards
+                    const_cast<MediaOverlaysSmilModel*>(this)->ensureSmilParsed(smilIndex);
+                    continue;
+                }
+
+                // a parsed timeline doesn't change, and needs no lock
+                uint32_t timeAdjusted = timeMilliseconds - smilOffset;
+                auto pos = std::lower_bound(timeline->timedEntries.begin(), timeline->timedEntries.end(), timeAdjusted, [timeline](uint32_t index, uint32_t time)
+                {
+                    const TimelineEntry & entry = timeline->entries[index];
+                    return entry.start + entry.duration < time;
+                });
+
+                if (pos == timeline->timedEntries.end())
+                {
+                    return nullptr;
+                }
+
+                return &timeline->entries[*pos];
+            }
+        }
+
+        shared_ptr<const SMILData::Parallel> MediaOverlaysSmilModel::ParallelAt(uint32_t timeMilliseconds) const
+        {
+            std::vector<std::shared_ptr<SMILData>>::size_type smilIndex = 0;
+            uint32_t smilOffset = 0;
+
+            const TimelineEntry * entry = TimelineEntryAt(timeMilliseconds, smilIndex, smilOffset);
+            if (entry == nullptr)
+            {
+                return nullptr;
             }
 
-            uint32_t smilDataOffset = 0;
-            for (std::vector<std::shared_ptr<SMILData>>::size_type i = 0; i < smilIndex; i++)
+            return entry->par;
+        }
+
+        const void MediaOverlaysSmilModel::PercentToPosition(double percent, SMILDataPtr & smilData, uint32_t & smilIndex, shared_ptr<const SMILData::Parallel>& par, uint32_t & parIndex, uint32_t & milliseconds) const
+        {
+            if (percent < 0.0 || percent > 100.0)
             {
-                const std::shared_ptr<SMILData> sd = GetSmil(i);
-                smilDataOffset += sd->DurationMilliseconds_Calculated();
+                percent = 0.0;
             }
 
-            const std::shared_ptr<SMILData> smilData = GetSmil(smilIndex);
+            uint32_t total = DurationMilliseconds_Calculated();
+
+            uint32_t timeMs = (uint32_t) (total * (percent / 100.0));
+
+            //printf("=== TIME SCRUB: %ldms / %ldms (==%ldms)", (long) timeMs, (long) total, (long) mo->DurationMillisecondsTotal());
+
+            std::vector<std::shared_ptr<SMILData>>::size_type index = 0;
+            uint32_t smilOffset = 0;
 
-            shared_ptr<const SMILData::Parallel> par = smilData->NthParallel(parIndex);
-            if (par == nullptr)
+            const TimelineEntry * entry = TimelineEntryAt(timeMs, index, smilOffset);
+            if (entry == nullptr)
+            {
+                par = nullptr;
+                return;
+            }
+
+            par = entry->par;
+            smilData = GetSmil(index);
+            smilIndex = (uint32_t) index;
+            parIndex = entry->parIndex;
+            milliseconds = timeMs - (smilOffset + entry->start);
+        }
+
+        const double MediaOverlaysSmilModel::PositionToPercent(std::vector<std::shared_ptr<SMILData>>::size_type smilIndex, uint32_t parIndex, uint32_t milliseconds) const
+        {
+            if (smilIndex >= GetSmilCount())
             {
                 return -1.0;
             }
 
-            uint32_t offset = smilDataOffset + smilData->ClipOffset(par) + milliseconds;
+            // parsing is logically const
+            const_cast<MediaOverlaysSmilModel*>(this)->ensureSmilParsed(smilIndex);
 
-            uint32_t total = DurationMilliseconds_Calculated();
+            uint32_t offset = 0;
+            uint32_t total = 0;
+            {
+                std::lock_guard<std::mutex> _(_timelineLock);
+
+                const SmilTimeline & timeline = _smilTimelines[smilIndex];
+                if (parIndex >= timeline.entries.size())
+                {
+                    return -1.0;
+                }
+
+                offset = _smilOffsets[smilIndex] + timeline.entries[parIndex].start + milliseconds;
+                total = _smilOffsets.back();
+            }
 
             double percent = ((double) offset / (double) total) * 100.0;
 
@@ -27,6 +27,7 @@
 #include <ePub3/xml/node.h>
 #include "media-overlays_smil_data.h"
 #include "package.h"
+#include <mutex>
 
 //#include <ePub3/utilities/make_unique.h>
 //std::unique_ptr<KLASS> obj = make_unique<KLASS>(constructor_params);
@@ -37,6 +38,8 @@ EPUB3_BEGIN_NAMESPACE
 
         class MediaOverlaysSmilModel;
 
+        class executor;
+
         /**
 Parser that reads SMIL XML files into an in-memory data model
 
@@ -52,6 +55,8 @@ http://www.idpf.org/epub/30/spec/epub30-mediaoverlays.html
 			, public NativeBridge
 #endif
         {
+            friend class SMILData; // ensureSmilParsed
+
         private:
             MediaOverlaysSmilModel() _DELETED_;
 
@@ -62,6 +67,48 @@ http://www.idpf.org/epub/30/spec/epub30-mediaoverlays.html
             uint32_t _totalDuration; //whole milliseconds (resolution = 1ms)
 
             shared_vector<SMILData> _smilDatas;
+
+            /**
+             One par in the flattened timeline of a SMIL.
+             */
+            struct TimelineEntry
+            {
+                shared_ptr<const SMILData::Parallel> par;
+
+                uint32_t start; // milliseconds from the start of its SMIL
+
+                uint32_t duration; // milliseconds, zero for pars which don't contribute any audio
+
+                uint32_t parIndex; // within its SMIL, in document order
+            };
+
+            /**
+             The flattened timeline of a single SMIL.
+             */
+            struct SmilTimeline
+            {
+                std::vector<TimelineEntry> entries; // every par, in document order
+
+                std::vector<uint32_t> timedEntries; // indices into entries of the pars with a duration
+
+                uint32_t duration; // calculated once parsed, taken from the metadata until then
+
+                bool parsed;
+            };
+
+            std::vector<SmilTimeline> _smilTimelines; // one per SMILData
+
+            std::vector<uint32_t> _smilOffsets; // start of each SMIL from the start of the first, plus the total at the end
+
+            std::vector<uint32_t> _timedSmils; // indices of the SMILs with a duration
+
+            mutable std::mutex _timelineLock; // guards the above: SMILs may be parsed on any thread
+
+            bool _lazy;
+
+            size_t _prefetchCount;
+
+            std::shared_ptr<executor> _prefetchExecutor;
     
             template <class _Function>
             inline FORCE_INLINE
@@ -79,9 +126,63 @@ http://www.idpf.org/epub/30/spec/epub30-mediaoverlays.html
 
             virtual ~MediaOverlaysSmilModel();
 
+            /**
+             Loads the model.
+             @param lazy If `true`, only the durations given by the package metadata are
+             read now, and each SMIL document is parsed the first time it's needed: see
+             SMILData::Body(). Whenever that happens, the following SMILs are parsed in the
+             background; see SetPrefetchCount().
+             */
+            EPUB3_EXPORT
+
+            void Initialize(bool lazy = false);
+
+            EPUB3_EXPORT
+
+            bool ParsesLazily() const
+            {
+                return _lazy;
+            }
+
+            /**
+             Parses SMIL documents on the prefetch executor. Those already parsed are skipped.
+             @param first The index of the first SMIL to parse.
+             @param count The number of SMILs to parse.
+             */
+            EPUB3_EXPORT
+
+            void PrefetchSmils(std::vector<std::shared_ptr<SMILData>>::size_type first, size_t count);
+
+            /**
+             The number of SMILs parsed ahead in the background whenever a lazily-loaded
+             model parses one on demand. Zero disables prefetching.
+             */
+            EPUB3_EXPORT
+
+            size_t PrefetchCount() const
+            {
+                return _prefetchCount;
+            }
+
+            EPUB3_EXPORT
+
+            void SetPrefetchCount(size_t count)
+            {
+                _prefetchCount = count;
+            }
+
+            /**
+             Sets the executor on which prefetching runs. By default a thread pool shared
+             by all models is used.
+             */
             EPUB3_EXPORT
 
-            void Initialize();
+            void SetPrefetchExecutor(std::shared_ptr<executor> prefetchExecutor)
+            {
+                _prefetchExecutor = prefetchExecutor;
+            }
+
+            static const size_t DefaultPrefetchCount = 2;
 
             EPUB3_EXPORT
 
@@ -102,6 +203,10 @@ http://www.idpf.org/epub/30/spec/epub30-mediaoverlays.html
                 return _totalDuration;
             }
 
+            /**
+             The total duration of the SMILs' audio. While a lazily-loaded model has SMILs
+             still to parse, their durations are taken from the package metadata.
+             */
             EPUB3_EXPORT
 
             const uint32_t DurationMilliseconds_Calculated() const;
@@ -178,20 +283,34 @@ http://www.idpf.org/epub/30/spec/epub30-mediaoverlays.html
             static const std::vector<string> _Skippables;
             static const std::vector<string> _Escapables;
 
-            bool _excludeAudioDuration;
-
             void resetData();
 
             void populateData();
 
             void parseMetadata();
 
+            void initTimelines();
+
+            void installTimeline(std::vector<std::shared_ptr<SMILData>>::size_type smilIndex);
+
+            void updateSmilOffsets(); // call with _timelineLock held
+
+            void appendToTimeline(shared_ptr<const SMILData::Sequence> sequence, const ManifestItemPtr xhtmlItem, uint32_t & offset, SmilTimeline & timeline); // recursive
+
+            uint32_t loadSmil(std::vector<std::shared_ptr<SMILData>>::size_type smilIndex);
+
+            void ensureSmilParsed(std::vector<std::shared_ptr<SMILData>>::size_type smilIndex, bool prefetchAhead = true);
+
+            uint32_t parseSmilDocument(SMILDataPtr smilData);
+
             uint32_t parseSMILs();
 
-            uint32_t parseSMIL(SMILDataPtr smilData, shared_ptr<SMILData::Sequence> sequence, shared_ptr<SMILData::Parallel> parallel, const ManifestItemPtr item, shared_ptr<xml::Node> element, std::map<std::shared_ptr<ManifestItem>, string> & cache_manifestItemToAbsolutePath, std::map<string, std::shared_ptr<ManifestItem>> & cache_smilRelativePathToManifestItem); // recursive
+            uint32_t parseSMIL(SMILDataPtr smilData, shared_ptr<SMILData::Sequence> sequence, shared_ptr<SMILData::Parallel> parallel, const ManifestItemPtr item, shared_ptr<xml::Node> element, std::map<std::shared_ptr<ManifestItem>, string> & cache_manifestItemToAbsolutePath, std::map<string, std::shared_ptr<ManifestItem>> & cache_smilRelativePathToManifestItem, bool & excludeAudioDuration); // recursive
 
         protected:
             shared_ptr<const SMILData::Parallel> ParallelAt(uint32_t timeMilliseconds) const;
+
+            const TimelineEntry * TimelineEntryAt(uint32_t timeMilliseconds, std::vector<std::shared_ptr<SMILData>>::size_type & smilIndex, uint32_t & smilOffset) const;
         };
 
         EPUB3_END_NAMESPACE
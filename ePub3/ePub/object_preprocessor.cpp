@@ -22,14 +22,15 @@
 #include "package.h"
 #include "filter_manager.h"
 
-static const REGEX_NS::regex::flag_type regexFlags(REGEX_NS::regex::ECMAScript|REGEX_NS::regex::optimize);
-static const REGEX_NS::regex reEscaper("\\\\\\.\\(\\)\\[\\]\\$\\^\\*\\+\\?\\:\\=\\|", regexFlags);
-
 EPUB3_BEGIN_NAMESPACE
 
-static REGEX_NS::regex ParamMatcher("<param[^>]+(name|value)=\"([^\"]*)\"[^>]*?(value|name)=\"([^\"]*)\"(.|\\n|\\r)*?>", regexFlags);
-static REGEX_NS::regex SourceFinder("data=\\\"([^\\\"]*)\\\"", regexFlags);
-static REGEX_NS::regex IDFinder("id=\\\"([^\\\"]*)\\\"", regexFlags);
+static string AttributeValue(const MarkupTokenizer::Token& token, string_view name)
+{
+    string_view value;
+    if ( !token.GetAttribute(name, value) )
+        return string();
+    return string(value.data(), value.size());
+}
 
 bool ObjectPreprocessor::ShouldApply(ConstManifestItemPtr item)
 {
@@ -45,7 +46,7 @@ void ObjectPreprocessor::Register()
 {
     FilterManager::Instance()->RegisterFilter("ObjectPreprocessor", ObjectPreprocessing, ObjectFilterFactory);
 }
-ObjectPreprocessor::ObjectPreprocessor(ConstPackagePtr pkg, const string& buttonTitle) : ContentFilter(ShouldApply), _button(buttonTitle)
+ObjectPreprocessor::ObjectPreprocessor(ConstPackagePtr pkg, const string& buttonTitle) : MarkupRewriter(ShouldApply), _button(buttonTitle)
 {
     Package::StringList mediaTypes = pkg->MediaTypesWithDHTMLHandlers();
     if ( mediaTypes.empty() )
@@ -55,27 +56,6 @@ ObjectPreprocessor::ObjectPreprocessor(ConstPackagePtr pkg, const string& button
         return;
     }
     
-    std::stringstream ss;
-    ss << "<object\\s+?([^>]*?(?:media-)?type=\"(";
-    
-    auto pos = mediaTypes.begin();
-    auto end = mediaTypes.end();
-    
-    while ( pos != end )
-    {
-        auto here = pos++;
-        std::string regstr("$`\\\\$&$'");
-        std::string str = REGEX_NS::regex_replace(here->stl_str(), reEscaper, regstr);    // yes, double-backslash, so it doesn't escape whatever '$&' is (i.e. the character which needs to be escaped)
-        if ( pos == end )
-            ss << str;
-        else
-            ss << str << "|";
-    }
-    
-    ss << ")\"[^>]*?)>((?:.|\\n|\\r)*?)</object>";
-    std::string reStr = ss.str();
-    _objectMatcher = REGEX_NS::regex(reStr, regexFlags);
-    
     for ( auto mediaType : mediaTypes )
     {
 #if EPUB_HAVE(CXX_MAP_EMPLACE)
@@ -85,118 +65,97 @@ ObjectPreprocessor::ObjectPreprocessor(ConstPackagePtr pkg, const string& button
 #endif
     }
 }
-void* ObjectPreprocessor::FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen)
+bool ObjectPreprocessor::RewriteToken(MarkupRewriterContext* context, const MarkupTokenizer::Token& token, Output& output)
 {
-    char* input = reinterpret_cast<char*>(data);
-    // find each `object` tag
-    REGEX_NS::cregex_iterator pos(input, input+len, _objectMatcher);
-    REGEX_NS::cregex_iterator end;
-    if ( pos == end )
-    {
-        *outputLen = len;
-        return data;        // no match == no change
-    }
+    typedef MarkupTokenizer::TokenType TokenType;
+    ObjectContext* ctx = static_cast<ObjectContext*>(context);
     
-    std::string output;
-    while ( pos != end )
+    if ( ctx->depth > 0 )
     {
-        // output any leading non-matched characters
-        output += pos->prefix();
-        
-        std::string type(pos->str(2));
-        // we have matched an <object> element: find the appropriate media handler
-        auto found = _handlers.find(type);
-        if ( found == _handlers.end() )
+        // the whole `object` element is replaced, so nothing inside it is output
+        if ( token.IsTag() && token.Name() == "object" )
         {
-            output += pos->str();
-            continue;
+            if ( token.Type() == TokenType::StartTag )
+                ctx->depth++;
+            else if ( token.Type() == TokenType::EndTag && --ctx->depth == 0 )
+                WriteReplacement(ctx, output);
         }
-        
-        const MediaHandler& handler = found->second;
-        ContentHandler::ParameterList params;
-        params["type"] = type;
-        
-        // find the data source
-        REGEX_NS::smatch m;
-        std::string attrs(pos->str(1));
-        REGEX_NS::regex_search(attrs.cbegin(), attrs.cend(), m, SourceFinder);
-        string src(m[1].str());
-        
-        // find any parameters to the object tag
-        std::string content(pos->str(3));
-        REGEX_NS::sregex_iterator cpos(content.begin(), content.end(), ParamMatcher);
-        REGEX_NS::sregex_iterator cend;
-        
-        while ( cpos != cend )
+        else if ( ctx->depth == 1 && token.IsTag() && token.Type() != TokenType::EndTag && token.Name() == "param" )
+        {
+            ctx->params[AttributeValue(token, "name")] = AttributeValue(token, "value");
+        }
+        return true;
+    }
+    
+    if ( token.Type() == TokenType::StartTag || token.Type() == TokenType::EmptyElementTag )
+    {
+        if ( token.Name() == "object" )
         {
-            if ( cpos->length() >= 4 )
+            string type = AttributeValue(token, "type");
+            if ( type.empty() )
+                type = AttributeValue(token, "media-type");
+            
+            // we have an <object> element: find the appropriate media handler
+            auto found = _handlers.find(type);
+            if ( found != _handlers.end() )
             {
-                string name, value;
-                if ( cpos->str(1) == "name" )
-                    name = cpos->str(2);
-                else
-                    value = cpos->str(2);
+                ctx->handler = &found->second;
+                ctx->source = AttributeValue(token, "data");
+                ctx->identifier = AttributeValue(token, "id");
+                ctx->params.clear();
+                ctx->params["type"] = type;
                 
-                if ( cpos->str(3) == "value" )
-                    value = cpos->str(4);
+                if ( token.Type() == TokenType::EmptyElementTag )
+                    WriteReplacement(ctx, output);
                 else
-                    name = cpos->str(4);
-                
-                params[name] = value;
+                    ctx->depth = 1;
+                return true;
             }
-            
-            ++cpos;
         }
-        
-        // now determine the target-- this is an absolute URL
-        IRI target = handler.Target(src, params);
-        
-        // find out if the object tag had an id attribute
-        std::string objectID;
-        if ( REGEX_NS::regex_search(attrs.cbegin(), attrs.cend(), m, IDFinder) )
-            objectID = m[1].str();
-        
-        // now construct the `iframe` tag
-        std::string url = target.URIString().stl_str();
-        output += "<iframe src=\"" + url + "\" srcdoc=\"" + url + "\"";
-        
-        // replicate any id attribute from the `object` tag
-        if ( !objectID.empty() )
-            output += " id=\"" + objectID + "\"";
-        
-        // enable sandbox and allow some stuff, and use seamless presentation
-        output += " sandbox=\"allow-forms allow-scripts allow-same-origin\" seamless=\"seamless\"></iframe>";
-        
-        // now add the form & button
-        output += "<form action=\"" + url + "\" method=\"get\"";
-        if ( !objectID.empty() )
-            output += " id=\"" + objectID + "-form\"";
-        output += "><button type=\"submit\"";
-        if ( !objectID.empty() )
-            output += " id=\"" + objectID + "-button\"";
-        output += ">" + _button.stl_str() + "</button></form>";
-        
-        // that's it-- we've replaced the whole lot!
-        
-        // step forward, and if we get the end let's output the current suffix
-        // this ensures that we don't lose everything following the last match
-        auto here = pos++;
-        if ( pos == end )
-            output += here->suffix();
     }
     
-    *outputLen = output.size();
-    if ( output.size() < len )
+    output.Write(token);
+    return true;
+}
+void ObjectPreprocessor::FinishRewriting(MarkupRewriterContext* context, Output& output)
+{
+    ObjectContext* ctx = static_cast<ObjectContext*>(context);
+    if ( ctx->depth > 0 )
     {
-        // use the incoming buffer directly
-        output.copy(input, output.size());
-        return input;
+        ctx->depth = 0;
+        WriteReplacement(ctx, output);
     }
+}
+void ObjectPreprocessor::WriteReplacement(ObjectContext* ctx, Output& output) const
+{
+    // now determine the target-- this is an absolute URL
+    IRI target = ctx->handler->Target(ctx->source, ctx->params);
+    const std::string& objectID = ctx->identifier.stl_str();
+    
+    // now construct the `iframe` tag
+    std::string url = target.URIString().stl_str();
+    std::string result = "<iframe src=\"" + url + "\" srcdoc=\"" + url + "\"";
+    
+    // replicate any id attribute from the `object` tag
+    if ( !objectID.empty() )
+        result += " id=\"" + objectID + "\"";
+    
+    // enable sandbox and allow some stuff, and use seamless presentation
+    result += " sandbox=\"allow-forms allow-scripts allow-same-origin\" seamless=\"seamless\"></iframe>";
+    
+    // now add the form & button
+    result += "<form action=\"" + url + "\" method=\"get\"";
+    if ( !objectID.empty() )
+        result += " id=\"" + objectID + "-form\"";
+    result += "><button type=\"submit\"";
+    if ( !objectID.empty() )
+        result += " id=\"" + objectID + "-button\"";
+    result += ">" + _button.stl_str() + "</button></form>";
     
-    // allocate an output buffer
-    char* result = new char[output.size()];
-    output.copy(result, output.size());
-    return result;
+    // that's it-- we've replaced the whole lot!
+    output.Write(result.data(), result.size());
+    ctx->handler = nullptr;
+    ctx->params.clear();
 }
 
 EPUB3_END_NAMESPACE
@@ -22,10 +22,9 @@
 #define __ePub3__object_preprocessor__
 
 #include <ePub3/epub3.h>
-#include <ePub3/filter.h>
+#include <ePub3/markup_rewriter.h>
 #include <ePub3/utilities/iri.h>
 #include <ePub3/content_handler.h>
-#include REGEX_INCLUDE
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -36,7 +35,7 @@ class Package;
  elements with `iframe` elements referencing the appropriate DHTML handler.
  @ingroup filters
  */
-class ObjectPreprocessor : public ContentFilter, public PointerType<ObjectPreprocessor>
+class ObjectPreprocessor : public MarkupRewriter, public PointerType<ObjectPreprocessor>
 {
 protected:
     ///
@@ -45,6 +44,24 @@ protected:
     
     /// The factory routine
     static ContentFilterPtr ObjectFilterFactory(ConstPackagePtr package);
+    
+    /**
+     Per-stream state: the `object` element being replaced, if any.
+     */
+    class ObjectContext : public MarkupRewriterContext
+    {
+    public:
+        ObjectContext() : MarkupRewriterContext(), depth(0), handler(nullptr), source(), identifier(), params() {}
+        virtual ~ObjectContext() {}
+        
+        ///
+        /// The nesting depth of `object` elements within the one being replaced.
+        int                                 depth;
+        const MediaHandler*                 handler;
+        string                              source;
+        string                              identifier;
+        ContentHandler::ParameterList       params;
+    };
 
 private:
     ///
@@ -62,20 +79,22 @@ public:
     
     ///
     /// Standard copy constructor.
-    ObjectPreprocessor(const ObjectPreprocessor& o) : ContentFilter(o), _objectMatcher(o._objectMatcher), _handlers(o._handlers) {}
+    ObjectPreprocessor(const ObjectPreprocessor& o) : MarkupRewriter(o), _button(o._button), _handlers(o._handlers) {}
     
     ///
     /// C++11 'move' constructor.
-    ObjectPreprocessor(ObjectPreprocessor&& o) : ContentFilter(std::move(o)), _objectMatcher(std::move(o._objectMatcher)), _handlers(std::move(o._handlers)) {}
+    ObjectPreprocessor(ObjectPreprocessor&& o) : MarkupRewriter(std::move(o)), _button(o._button), _handlers(std::move(o._handlers)) {}
     
     ///
     /// Destructor.
     virtual ~ObjectPreprocessor() {}
     
-    ///
-    /// This preprocessor requires access to the entire content document at once.
-    virtual bool    RequiresCompleteData() const OVERRIDE   { return true; }
+    virtual FilterContext* MakeFilterContext(ConstManifestItemPtr item) const OVERRIDE { return new ObjectContext(); }
+    
+    // register with the filter manager
+    static void Register();
     
+protected:
     /**
      Performs the static replacement of `object` tags whose `type` attribute
      identifies a media-type for which the Publication provides a media handler.
@@ -98,39 +117,19 @@ public:
      and `-button` and applied to the `form` and `button` elements respectively.  It
      is our intention that these rules will make it possible for content authors to
      anticipate these substitutions and build CSS or JavaScript rules directly.
+     
+     The `name` and `value` of each `param` element within the `object` are passed to
+     the media handler when building its URL.
      */
-    virtual void*   FilterData(FilterContext* context, void* data, size_t len, size_t* outputLen) OVERRIDE;
+    virtual bool    RewriteToken(MarkupRewriterContext* context, const MarkupTokenizer::Token& token, Output& output) OVERRIDE;
     
-    // register with the filter manager
-    static void Register();
+    ///
+    /// Outputs the replacement for an `object` element left open at the end of the document.
+    virtual void    FinishRewriting(MarkupRewriterContext* context, Output& output) OVERRIDE;
     
-protected:
-    /**
-     This regex is used to locate only those `object` tags for which handlers exist.
-     
-     Its text is:
-     
-         <object\s+?([^>]*?media-type="(...|...|...)"[^>]*?)>(.*?)</object>
-     
-     The three ellipses in the middle represent media types. For example, with
-     handlers for 'application/x-slideshow+xml' and 'image/x-slideshow', the regex
-     would read:
-     
-         <object\s+?([^>]*?type="(application/x-slideshow\.xml|image/x-slideshow)"[^>]*?)>(.*?)</object>
-     
-     Note that any and all regex special characters will be replaced automatically
-     during insertion.
-     
-     #### Matches
-     
-     There are a few things captured by the expression:
-     
-     - *0:* The entire `<object...>...</object>` construct.
-     - *1:* The complete string containing all the attribute definitions of the `<object>` tag.
-     - *2:* The value of the `object` element's `type` attribute.
-     - *3:* The `innerHTML` content of the `object` element.
-     */
-    REGEX_NS::regex                         _objectMatcher;
+    ///
+    /// Outputs the `iframe` and `form` elements replacing the current `object` element.
+    void            WriteReplacement(ObjectContext* context, Output& output) const;
     
     ///
     /// The (hopefully localized!) title of the generated HTML5 `<button>`.
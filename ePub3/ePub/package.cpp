@@ -26,6 +26,7 @@
 #include "nav_table.h"
 #include "glossary.h"
 #include "iri.h"
+#include "path_help.h"
 #include "basic.h"
 #include "byte_stream.h"
 #include "filter_chain.h"
@@ -81,12 +82,12 @@ static const xmlChar * MediaTypeElementName = (const xmlChar*)"mediaType";
 
 bool Package::gValidateSchema = true;
 
-PackageBase::PackageBase(const shared_ptr<Container>& owner, const string& type) : _archive(owner->GetArchive()), _opf(nullptr), _type(type)
+PackageBase::PackageBase(const shared_ptr<Container>& owner, const string& type) : _archive(owner->GetArchive()), _opf(nullptr), _type(type), _deferredContentPending(false), _loadingDeferredContent(false)
 {
     if ( !_archive )
         throw std::invalid_argument("Owner doesn't have an archive!");
 }
-PackageBase::PackageBase(PackageBase&& o) : _archive(o._archive), _opf(std::move(o._opf)), _pathBase(std::move(o._pathBase)), _type(std::move(o._type)), _manifest(std::move(o._manifest)), _spine(std::move(o._spine))
+PackageBase::PackageBase(PackageBase&& o) : _archive(o._archive), _opf(std::move(o._opf)), _pathBase(std::move(o._pathBase)), _type(std::move(o._type)), _manifest(std::move(o._manifest)), _manifestByPath(std::move(o._manifestByPath)), _spine(std::move(o._spine)), _spineItems(std::move(o._spineItems)), _spineIDRefIndex(std::move(o._spineIDRefIndex)), _deferredContentPending(o._deferredContentPending.load()), _loadingDeferredContent(false)
 {
     o._archive = nullptr;
 }
@@ -120,25 +121,45 @@ bool PackageBase::Open(const string& path)
     
     return true;
 }
-shared_ptr<SpineItem> PackageBase::SpineItemAt(size_t idx) const
+void PackageBase::LoadDeferredContent() const
 {
-    shared_ptr<SpineItem> item = _spine;
-    for ( size_t i = 0; i < idx && item != nullptr; i++ )
+    if ( !_deferredContentPending )
+        return;
+    
+    // loading is logically const: it only materializes what Open() would have
+    PackageBase* self = const_cast<PackageBase*>(this);
+    std::lock_guard<std::recursive_mutex> _(self->_deferredContentLock);
+    
+    // the loader itself uses the public accessors, so let it see the partial tables
+    if ( !_deferredContentPending || _loadingDeferredContent )
+        return;
+    
+    self->_loadingDeferredContent = true;
+    try
     {
-        item = item->Next();
+        self->UnpackDeferredContent();
     }
-    return item;
+    catch (...)
+    {
+        self->_loadingDeferredContent = false;
+        self->_deferredContentPending = false;
+        throw;
+    }
+    self->_loadingDeferredContent = false;
+    self->_deferredContentPending = false;
+}
+shared_ptr<SpineItem> PackageBase::SpineItemAt(size_t idx) const
+{
+    if ( idx >= _spineItems.size() )
+        return nullptr;
+    return _spineItems[idx];
 }
 size_t PackageBase::IndexOfSpineItemWithIDRef(const string &idref) const
 {
-    shared_ptr<SpineItem> item = FirstSpineItem();
-    for ( size_t i = 0; item != nullptr; i++, item = item->Next() )
-    {
-        if ( item->Idref() == idref )
-            return i;
-    }
-    
-    return size_t(-1);
+    auto found = _spineIDRefIndex.find(idref.stl_str());
+    if ( found == _spineIDRefIndex.end() )
+        return size_t(-1);
+    return found->second;
 }
 shared_ptr<ManifestItem> PackageBase::ManifestItemWithID(const string &ident) const
 {
@@ -168,16 +189,27 @@ const shared_vector<ManifestItem> PackageBase::ManifestItemsWithProperties(Prope
 }
 ConstManifestItemPtr PackageBase::ManifestItemAtRelativePath(const string& path) const
 {
+    if ( path.empty() )
+        return nullptr;
+    
     string absPath = _pathBase + (path[0] == '/' ? path.substr(1) : path);
-	for (auto& item : _manifest)
-	{
-		if (item.second->AbsolutePath() == absPath)
-			return item.second;
-	}
-	return nullptr;
+    auto found = _manifestByPath.find(ManifestPathKey(absPath));
+    if ( found == _manifestByPath.end() )
+        return nullptr;
+    return found->second;
+}
+std::string PackageBase::ManifestPathKey(const string& absPath)
+{
+    // strip any query or fragment before decoding, so escaped '#' and '?' survive
+    string path(absPath);
+    size_t s = path.find_first_of("#?");
+    if ( s != string::npos )
+        path.erase(s);
+    return CleanupPath(IRI::URLDecodeComponent(path)).stl_str();
 }
 shared_ptr<NavigationTable> PackageBase::NavigationTable(const string &title) const
 {
+    LoadDeferredContent();
     auto found = _navigation.find(title);
     if ( found == _navigation.end() )
         return nullptr;
@@ -199,19 +231,16 @@ shared_ptr<SpineItem> PackageBase::ConfirmOrCorrectSpineItemQualifier(shared_ptr
     if ( pComponent->HasQualifier() && pItem->Idref() != pComponent->qualifier )
     {
         // find the item with the qualifier
-        pItem = _spine;
-        uint32_t idx = 2;
-        
-        while ( pItem != nullptr )
+        size_t idx = IndexOfSpineItemWithIDRef(pComponent->qualifier);
+        if ( idx == size_t(-1) )
         {
-            if ( pItem->Idref() == pComponent->qualifier )
-            {
-                // found it-- correct the CFI
-                pComponent->nodeIndex = idx;
-                break;
-            }
-            
-            pItem = pItem->Next();
+            pItem = nullptr;
+        }
+        else
+        {
+            // found it-- correct the CFI
+            pItem = _spineItems[idx];
+            pComponent->nodeIndex = static_cast<uint32_t>((idx+1)*2);
         }
     }
     else if ( pComponent->HasQualifier() == false )
@@ -330,7 +359,7 @@ NavigationList PackageBase::_LoadNCXNavTablesFromManifestItem(PackagePtr sharedP
 #pragma mark - Package High-Level API
 #endif
 
-Package::Package(const shared_ptr<Container>& owner, const string& type) : PropertyHolder(), OwnedBy(owner), PackageBase(owner, type)
+Package::Package(const shared_ptr<Container>& owner, const string& type) : PropertyHolder(), OwnedBy(owner), PackageBase(owner, type), _defersContent(false)
 {
 }
 bool Package::Open(const string& path)
@@ -338,6 +367,19 @@ bool Package::Open(const string& path)
 #if _XML_OVERRIDE_SWITCHES
     __setupLibXML();
 #endif
+    _defersContent = false;
+    auto status = PackageBase::Open(path) && Unpack();
+#if _XML_OVERRIDE_SWITCHES
+    __resetLibXMLOverrides();
+#endif
+    return status;
+}
+bool Package::OpenLazily(const string& path)
+{
+#if _XML_OVERRIDE_SWITCHES
+    __setupLibXML();
+#endif
+    _defersContent = true;
     auto status = PackageBase::Open(path) && Unpack();
 #if _XML_OVERRIDE_SWITCHES
     __resetLibXMLOverrides();
@@ -403,32 +445,29 @@ bool Package::Unpack()
     InstallPrefixesFromAttributeValue(val);
     
     // go through children to determine the CFI index of the <spine> tag
-    static xml::string kSpineName((const char*)"spine");
-    static xml::string kManifestName((const char*)"manifest");
-    static xml::string kMetadataName((const char*)"metadata");
-
+    // handles, since only the names are needed here
     _spineCFIIndex = 0;
     uint32_t idx = 0;
-    auto child = root->FirstElementChild();
+    xml::NodeHandle child = xml::NodeHandle(root).FirstElementChild();
     while ( bool(child) )
     {
         idx += 2;
-        if ( child->Name() == kSpineName )
+        if ( child.HasName("spine") )
         {
             _spineCFIIndex = idx;
             if ( _spineCFIIndex != 6 )
                 HandleError(EPUBError::OPFSpineOutOfOrder);
         }
-        else if ( child->Name() == kManifestName && idx != 4 )
+        else if ( child.HasName("manifest") && idx != 4 )
         {
             HandleError(EPUBError::OPFManifestOutOfOrder);
         }
-        else if ( child->Name() == kMetadataName && idx != 2 )
+        else if ( child.HasName("metadata") && idx != 2 )
         {
             HandleError(EPUBError::OPFMetadataOutOfOrder);
         }
         
-		child = child->NextElementSibling();
+		child = child.NextElementSibling();
     }
     
     if ( _spineCFIIndex == 0 )
@@ -465,6 +504,7 @@ bool Package::Unpack()
             HandleError(EPUBError::OPFNoSpineItems);
         }
         
+        _manifestByPath.clear();
         for ( auto node : manifestNodes )
         {
             auto p = ManifestItem::New(sharedMe);
@@ -475,6 +515,8 @@ bool Package::Unpack()
 #else
                 _manifest[p->Identifier()] = p;
 #endif
+                // the first item with a given path wins
+                _manifestByPath.emplace(ManifestPathKey(p->AbsolutePath()), p);
                 StoreXMLIdentifiable(p);
             }
             else
@@ -508,6 +550,9 @@ bool Package::Unpack()
         }
         
         SpineItemPtr cur;
+        _spineItems.clear();
+        _spineIDRefIndex.clear();
+        _spineItems.reserve(spineNodes.size());
         for ( auto node : spineNodes )
         {
             auto next = SpineItem::New(sharedMe);
@@ -553,6 +598,10 @@ bool Package::Unpack()
                 _spine = next;
             }
             
+            // the first item with a given idref wins, as with a linear search
+            _spineIDRefIndex.emplace(next->Idref().stl_str(), _spineItems.size());
+            _spineItems.push_back(next);
+            
             cur = next;
         }
     }
@@ -767,11 +816,11 @@ bool Package::Unpack()
         }
         
         // now look at the <spine> element for properties
-		auto spineNode = root->FirstElementChild();
+		xml::NodeHandle spineNode = xml::NodeHandle(root).FirstElementChild();
         for ( uint32_t i = 2; i < _spineCFIIndex; i += 2 )
-            spineNode = spineNode->NextElementSibling();
+            spineNode = spineNode.NextElementSibling();
         
-        string value = _getProp(spineNode, "page-progression-direction");
+        string value = spineNode.AttributeValue("page-progression-direction");
         if ( !value.empty() )
         {
             PropertyPtr prop = Property::New(holderPtr);
@@ -879,6 +928,24 @@ bool Package::Unpack()
 		return false;
     }
     
+    // lastly, let's set the media support information
+    InitMediaSupport();
+    
+    if ( _defersContent )
+    {
+        _deferredContentPending = true;
+        return true;
+    }
+
+    return UnpackDeferredContent();
+}
+bool Package::UnpackDeferredContent()
+{
+    PackagePtr sharedMe = shared_from_this();
+    
+    string versionStr = _getProp(_opf->Root(), "version");
+    bool isEPUB3 = (versionStr.empty() || strtol(versionStr.c_str(), nullptr, 10) >= 3);
+    
     // now the navigation tables
 	if (isEPUB3)
 	{
@@ -962,13 +1029,10 @@ bool Package::Unpack()
 
 	// go through the TOC and copy titles to the relevant spine items for easy access
 	CompileSpineItemTitles();
-    
-    // lastly, let's set the media support information
-    InitMediaSupport();
 
     //std::weak_ptr<Package> weakSharedMe = sharedMe; // Not needed: smart shared pointer passed as reference, then onto OwnedBy() which maintains its own weak pointer
     _mediaOverlays = std::make_shared<class MediaOverlaysSmilModel>(sharedMe);
-    _mediaOverlays->Initialize();
+    _mediaOverlays->Initialize(_defersContent);     // lazy packages parse each SMIL on demand too
 
     return true;
 }
@@ -1079,13 +1143,7 @@ void Package::FireLoadEvent(const IRI &url) const
 }
 shared_ptr<SpineItem> Package::SpineItemWithIDRef(const string &idref) const
 {
-    for ( auto item = FirstSpineItem(); item != nullptr; item = item->Next() )
-    {
-        if ( item->Idref() == idref )
-            return item;
-    }
-    
-    return nullptr;
+    return SpineItemAt(IndexOfSpineItemWithIDRef(idref));
 }
 const CFI Package::CFIForManifestItem(shared_ptr<ManifestItem> item) const
 {
@@ -1134,7 +1192,10 @@ shared_ptr<ManifestItem> Package::ManifestItemForCFI(ePub3::CFI &cfi, CFI* pRema
     {
         if ( (component.nodeIndex & 1) == 1 )
             throw CFI::InvalidCFI("CFI spine item index is odd, which makes no sense for always-empty spine nodes.");
-        SpineItemPtr item = _spine->at((component.nodeIndex>>1)-1);
+        size_t idx = (component.nodeIndex>>1)-1;
+        if ( idx >= _spineItems.size() )
+            throw std::out_of_range(_Str("Index ", idx, " is beyond the end of the spine (", _spineItems.size(), " items)"));
+        SpineItemPtr item = _spineItems[idx];
         
         // check and correct any qualifiers
         item = ConfirmOrCorrectSpineItemQualifier(item, &component);
@@ -1144,7 +1205,7 @@ shared_ptr<ManifestItem> Package::ManifestItemForCFI(ePub3::CFI &cfi, CFI* pRema
             return nullptr;
         }
         
-        // we know it's not null, because SpineItem::at() throws an exception if out of range
+        // we know it's not null, because out-of-range indices throw above
         result = ManifestItemWithID(item->Idref());
         
         if ( pRemainingCFI != nullptr )
@@ -1161,22 +1222,30 @@ unique_ptr<ByteStream> Package::ReadStreamForRelativePath(const string &path) co
 {
     return _archive->ByteStreamAtPath(_Str(_pathBase, path.stl_str()));
 }
+FilterChainPtr Package::GetFilterChain() const
+{
+    Package* self = const_cast<Package*>(this);
+    std::lock_guard<std::mutex> _(self->_filterChainLock);
+    if ( !bool(_filterChain) )
+        self->_filterChain = FilterManager::Instance()->BuildFilterChainForPackage(shared_from_this());
+    return _filterChain;
+}
 shared_ptr<AsyncByteStream> Package::ContentStreamForItem(ManifestItemPtr manifestItem) const
 {
-    return _filterChain->GetFilteredOutputStreamForManifestItem(manifestItem);
+    return GetFilterChain()->GetFilteredOutputStreamForManifestItem(manifestItem);
 }
 shared_ptr<ByteStream> Package::SyncContentStreamForItem(ManifestItemPtr manifestItem) const
 {
-	return _filterChain->GetSyncFilteredOutputStreamForManifestItem(manifestItem);
+	return GetFilterChain()->GetSyncFilteredOutputStreamForManifestItem(manifestItem);
 }
 const string& Package::Title(bool localized) const
 {
-    IRI titleTypeIRI(MakePropertyIRI("title-type"));      // http://idpf.org/epub/vocab/package/#title-type
+    PropertyAtom titleType(MakePropertyIRI("title-type"));     // http://idpf.org/epub/vocab/package/#title-type
     
     // find the main one
-    for ( auto& item : PropertiesMatching(titleTypeIRI) )
+    for ( auto& item : PropertiesMatching(titleType) )
     {
-        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleTypeIRI);
+        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleType);
         if ( extension == nullptr )
             continue;
         
@@ -1196,12 +1265,12 @@ const string& Package::Title(bool localized) const
 }
 const string& Package::Subtitle(bool localized) const
 {
-    IRI titleTypeIRI(MakePropertyIRI("title-type"));      // http://idpf.org/epub/vocab/package/#title-type
+    PropertyAtom titleType(MakePropertyIRI("title-type"));     // http://idpf.org/epub/vocab/package/#title-type
     
     // find the main one
-    for ( auto item : PropertiesMatching(titleTypeIRI) )
+    for ( auto item : PropertiesMatching(titleType) )
     {
-        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleTypeIRI);
+        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleType);
         if ( extension == nullptr )
             continue;
         
@@ -1218,12 +1287,12 @@ const string& Package::Subtitle(bool localized) const
 }
 const string& Package::ShortTitle(bool localized) const
 {
-    IRI titleTypeIRI(MakePropertyIRI("title-type"));      // http://idpf.org/epub/vocab/package/#title-type
+    PropertyAtom titleType(MakePropertyIRI("title-type"));     // http://idpf.org/epub/vocab/package/#title-type
     
     // find the main one
-    for ( auto item : PropertiesMatching(titleTypeIRI) )
+    for ( auto item : PropertiesMatching(titleType) )
     {
-        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleTypeIRI);
+        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleType);
         if ( extension == nullptr )
             continue;
         
@@ -1240,12 +1309,12 @@ const string& Package::ShortTitle(bool localized) const
 }
 const string& Package::CollectionTitle(bool localized) const
 {
-    IRI titleTypeIRI(MakePropertyIRI("title-type"));      // http://idpf.org/epub/vocab/package/#title-type
+    PropertyAtom titleType(MakePropertyIRI("title-type"));     // http://idpf.org/epub/vocab/package/#title-type
     
     // find the main one
-    for ( auto item : PropertiesMatching(titleTypeIRI) )
+    for ( auto item : PropertiesMatching(titleType) )
     {
-        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleTypeIRI);
+        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleType);
         if ( extension == nullptr )
             continue;
         
@@ -1262,12 +1331,12 @@ const string& Package::CollectionTitle(bool localized) const
 }
 const string& Package::EditionTitle(bool localized) const
 {
-    IRI titleTypeIRI(MakePropertyIRI("title-type"));      // http://idpf.org/epub/vocab/package/#title-type
+    PropertyAtom titleType(MakePropertyIRI("title-type"));     // http://idpf.org/epub/vocab/package/#title-type
     
     // find the main one
-    for ( auto item : PropertiesMatching(titleTypeIRI) )
+    for ( auto item : PropertiesMatching(titleType) )
     {
-        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleTypeIRI);
+        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleType);
         if ( extension == nullptr )
             continue;
         
@@ -1284,12 +1353,12 @@ const string& Package::EditionTitle(bool localized) const
 }
 const string& Package::ExpandedTitle(bool localized) const
 {
-    IRI titleTypeIRI(MakePropertyIRI("title-type"));      // http://idpf.org/epub/vocab/package/#title-type
+    PropertyAtom titleType(MakePropertyIRI("title-type"));     // http://idpf.org/epub/vocab/package/#title-type
     
     // find the main one
-    for ( auto item : PropertiesMatching(titleTypeIRI) )
+    for ( auto item : PropertiesMatching(titleType) )
     {
-        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleTypeIRI);
+        PropertyExtensionPtr extension = item->ExtensionWithIdentifier(titleType);
         if ( extension == nullptr )
             continue;
         
@@ -1314,16 +1383,16 @@ const string Package::FullTitle(bool localized) const
     if ( items.size() == 1 )
         return items[0]->Value();
     
-    IRI displaySeqIRI(MakePropertyIRI("display-seq"));  // http://idpf.org/epub/vocab/package/#display-seq
+    PropertyAtom displaySeq(MakePropertyIRI("display-seq"));   // http://idpf.org/epub/vocab/package/#display-seq
     std::vector<string> titles(items.size());
     
-    auto sequencedItems = PropertiesMatching(displaySeqIRI);
+    auto sequencedItems = PropertiesMatching(displaySeq);
     if ( !sequencedItems.empty() )
     {
         // all these have a 1-based sequence number
         for ( auto item : sequencedItems )
         {
-            PropertyExtensionPtr extension = item->ExtensionWithIdentifier(displaySeqIRI);
+            PropertyExtensionPtr extension = item->ExtensionWithIdentifier(displaySeq);
             size_t sz = strtoul(extension->Value().c_str(), nullptr, 10) - 1;
             titles[sz] = (localized ? item->LocalizedValue() : item->Value());
         }
@@ -1374,10 +1443,10 @@ const Package::AttributionList Package::AuthorNames(bool localized) const
 const Package::AttributionList Package::AttributionNames(bool localized) const
 {
     AttributionList result;
-    IRI fileAsIRI(MakePropertyIRI("file-as"));
+    PropertyAtom fileAs(MakePropertyIRI("file-as"));
     for ( auto item : PropertiesMatching(DCType::Creator) )
     {
-        auto extension = item->ExtensionWithIdentifier(fileAsIRI);
+        auto extension = item->ExtensionWithIdentifier(fileAs);
         if ( extension )
             result.emplace_back(extension->Value());
         else
@@ -25,7 +25,10 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <list>
+#include <atomic>
+#include <mutex>
 #include <ePub3/xml/node.h>
 #include <ePub3/utilities/owned_by.h>
 #include <ePub3/encryption.h>
@@ -34,6 +37,7 @@
 #include <ePub3/cfi.h>
 #include <ePub3/nav_element.h>
 #include <ePub3/archive_xml.h>
+#include <ePub3/document_cache.h>
 #include <ePub3/utilities/utfstring.h>
 #include <ePub3/utilities/iri.h>
 #include <ePub3/content_handler.h>
@@ -86,6 +90,12 @@ public:
     ///
     /// An XML-ID lookup table for relevant types
     typedef std::map<string, shared_ptr<XMLIdentifiable>>   XMLIDLookup;
+    ///
+    /// Spine positions indexed by idref.
+    typedef std::unordered_map<std::string, size_t>         SpineIDRefIndex;
+    ///
+    /// Manifest items indexed by normalized absolute path.
+    typedef std::unordered_map<std::string, shared_ptr<ManifestItem>>   ManifestPathIndex;
     
 private:
     /** There is no default constructor for PackageBase. */
@@ -118,6 +128,17 @@ public:
      */
     virtual bool            Open(const string& path);
     
+    /**
+     Loads the navigation documents and media overlays, if the package was opened
+     with their loading deferred.
+     
+     Accessors which need this content call it automatically. Any errors in the
+     deferred content are reported through the error handler at this point, rather
+     than from Open().
+     */
+    EPUB3_EXPORT
+    void                    LoadDeferredContent()   const;
+    
     /**
      Returns the path used to construct this object minus the filename, e.g.
      
@@ -136,7 +157,7 @@ public:
     const ManifestTable&    Manifest()              const       { return _manifest; }
     ///
     /// Returns an immutable reference to the map of navigation tables.
-    const NavigationMap&    NavigationTables()      const       { return _navigation; }
+    const NavigationMap&    NavigationTables()      const       { LoadDeferredContent(); return _navigation; }
 
     /// @}
     
@@ -148,8 +169,12 @@ public:
      */
     shared_ptr<SpineItem>   FirstSpineItem()        const       { return _spine; }
     
+    ///
+    /// Returns the number of items in the spine. O(1).
+    size_t                  SpineItemCount()        const       { return _spineItems.size(); }
+    
     /**
-     Locates a spine item by position.
+     Locates a spine item by position. O(1).
      @param idx The zero-based position of the item to return.
      @result A pointer to the requested spine item, or `nullptr` if the index was
      out of bounds.
@@ -157,6 +182,12 @@ public:
     EPUB3_EXPORT
     shared_ptr<SpineItem>   SpineItemAt(size_t idx) const;
 
+    /**
+     Locates a spine item by the idref of its manifest item. O(1).
+     @param idref The IDRef for which to search.
+     @result The zero-based position of the first spine item with that idref, or
+     `size_t(-1)` if none was found.
+     */
     EPUB3_EXPORT
     size_t                  IndexOfSpineItemWithIDRef(const string& idref)  const;
     
@@ -204,6 +235,9 @@ public:
 
 	/**
 	 Get a ManifestItem corresponding to a package-relative path.
+	 
+	 The path may be percent-encoded, and may contain `.` and `..` segments; any
+	 query or fragment is ignored.
 	 @param path The package-relative path to the item whose ManifestItem to locate.
 	 @result A ManifestItem pointer, or `nullptr` if no manifest item matches the path.
 	 */
@@ -255,9 +289,12 @@ protected:
     string						_pathBase;          ///< The base path of the document within the archive.
     string						_type;              ///< The MIME type of the package document.
     ManifestTable				_manifest;          ///< All manifest items, indexed by unique identifier.
+    ManifestPathIndex           _manifestByPath;    ///< All manifest items, indexed by normalized absolute path.
     NavigationMap				_navigation;        ///< All navigation tables, indexed by type.
     ContentHandlerMap			_contentHandlers;   ///< All installed content handlers, indexed by media-type.
     shared_ptr<SpineItem>		_spine;             ///< The first item in the spine (SpineItems are a linked list).
+    shared_vector<SpineItem>    _spineItems;        ///< All spine items, in spine order.
+    SpineIDRefIndex             _spineIDRefIndex;   ///< Spine positions indexed by idref.
     XMLIDLookup					_xmlIDLookup;       ///< Lookup table for all items with XML ID values.
     CollectionList              _collections;       ///< List of all parsed <collection> elements.
 
@@ -265,9 +302,16 @@ protected:
     // used to verify/correct CFIs
     uint32_t					_spineCFIIndex;     ///< The CFI index for the `<spine>` element in the package document.
     
+    std::atomic<bool>           _deferredContentPending;    ///< Whether LoadDeferredContent() has work to do.
+    bool                        _loadingDeferredContent;    ///< Set while the deferred content is being loaded.
+    std::recursive_mutex        _deferredContentLock;       ///< Serializes LoadDeferredContent().
+    
     ///
     /// Unpacks the _opf document. Implemented by the subclass, to make PackageBase pure-virtual.
     virtual bool            Unpack() = 0;
+    ///
+    /// Unpacks the content which Unpack() may defer: navigation tables and media overlays.
+    virtual bool            UnpackDeferredContent()     { return true; }
     
     /**
      Locates a spine item based on the corresponding CFI component.
@@ -276,6 +320,10 @@ protected:
      */
     shared_ptr<SpineItem>   ConfirmOrCorrectSpineItemQualifier(shared_ptr<SpineItem> pItem, CFI::Component* pComponent) const;
     
+    ///
+    /// Returns the key under which an absolute path is stored in `_manifestByPath`.
+    static std::string      ManifestPathKey(const string& absPath);
+    
     ///
     /// Loads navigation tables from a given manifest item (which has the `"nav"` property) or one referencing an NCX document.
     static NavigationList   NavTablesFromManifestItem(shared_ptr<PackageBase> owner, shared_ptr<ManifestItem> pItem);
@@ -312,7 +360,7 @@ protected:
     std::shared_ptr<MediaOverlaysSmilModel> _mediaOverlays;      ///< The Media Overlays SMIL model
 public:
     // returns a copy of the smart shared pointer (reference count++)
-    std::shared_ptr<MediaOverlaysSmilModel>    MediaOverlaysSmilModel()      const       { return _mediaOverlays; }
+    std::shared_ptr<MediaOverlaysSmilModel>    MediaOverlaysSmilModel()      const       { LoadDeferredContent(); return _mediaOverlays; }
 
     shared_ptr<Archive> Archive() const { return _archive; }
 };
@@ -357,7 +405,7 @@ private:
 
 public:
     EPUB3_EXPORT            Package(const shared_ptr<Container>& owner, const string& type);
-                            Package(Package&& o) : OwnedBy(std::move(o)), PackageBase(std::move(o)) {}
+                            Package(Package&& o) : OwnedBy(std::move(o)), PackageBase(std::move(o)), _defersContent(o._defersContent) {}
     virtual                 ~Package() {}
     
     ContainerPtr            GetContainer()          const       { return Owner(); }
@@ -365,6 +413,18 @@ public:
     virtual bool            Open(const string& path);
     bool                    _OpenForTest(shared_ptr<xml::Document> doc, const string& basePath);
     
+    /**
+     Parses the package document at the given location, deferring its navigation
+     documents and media overlays until they're first needed.
+     
+     Only the OPF document itself is read. Metadata, manifest and spine are all
+     available immediately; see LoadDeferredContent(). Once loaded, the media
+     overlays model parses each SMIL document only when it's first needed.
+     @param path The container-relative path to the XML OPF file.
+     @result Returns `true` if the package was parsed successfully, `false` otherwise.
+     */
+    bool                    OpenLazily(const string& path);
+    
     ///
     /// The full Unique Identifier, built from the package unique-id and the modification date.
     virtual string          UniqueID()              const;
@@ -862,9 +922,25 @@ public:
      @param chain The filter chain for the receiving Package instance.
      */
     virtual void            SetFilterChain(FilterChainPtr chain) _NOEXCEPT {
+        std::lock_guard<std::mutex> _(_filterChainLock);
         _filterChain = chain;
     }
     
+    /**
+     Returns the filter chain for this package.
+     
+     If no chain has been assigned (as when the Container was opened lazily), one is
+     built by the FilterManager on first use.
+     */
+    FilterChainPtr          GetFilterChain()            const;
+    
+    /**
+     The cache of documents parsed by ManifestItem::ReferencedDocument().
+     
+     Use this to adjust the cache's byte budget, or to read its statistics.
+     */
+    DocumentCache&          ParsedDocumentCache()       const       { return _documentCache; }
+    
     /// @}
     
 protected:
@@ -872,6 +948,9 @@ protected:
     /// Extracts information from the OPF XML document.
     virtual bool            Unpack();
     ///
+    /// Loads the navigation tables and media overlays.
+    virtual bool            UnpackDeferredContent();
+    ///
     /// Used to handle the `prefix` attribute of the OPF `<package>` element.
     void                    InstallPrefixesFromAttributeValue(const string& attrValue);
 	///
@@ -900,6 +979,9 @@ protected:
     void                    InitMediaSupport();
     
     FilterChainPtr          _filterChain;           ///< The filter chain for this package.
+    std::mutex              _filterChainLock;       ///< Guards the lazy creation of _filterChain.
+    bool                    _defersContent;         ///< Whether Unpack() should leave the deferred content for later.
+    mutable DocumentCache   _documentCache;         ///< Documents parsed from the manifest items.
 };
 
 EPUB3_END_NAMESPACE
@@ -21,6 +21,7 @@
 #include <ePub3/property.h>
 #include <ePub3/utilities/iri.h>
 #include <ePub3/property_holder.h>
+#include <mutex>
 
 EPUB3_BEGIN_NAMESPACE
 #if EPUB_USE(LIBXML2)
@@ -183,6 +184,23 @@ const IRI IRIForDCType(DCType type)
     return IRI(DCMES_uri + found->second);
 }
 
+EPUB3_EXPORT
+PropertyAtom AtomForDCType(DCType type)
+{
+    static std::once_flag __once;
+    static std::map<DCType, PropertyAtom>* __atoms = nullptr;
+    std::call_once(__once, []{
+        __atoms = new std::map<DCType, PropertyAtom>;
+        for ( auto& pair : IDToNameMap )
+            (*__atoms)[pair.first] = PropertyAtom(IRIForDCType(pair.first));
+    });
+    
+    auto found = __atoms->find(type);
+    if ( found == __atoms->end() )
+        return PropertyAtom(IRI());
+    return found->second;
+}
+
 EPUB3_EXPORT
 DCType DCTypeFromIRI(const IRI& iri)
 {
@@ -213,6 +231,7 @@ bool Property::ParseMetaElement(shared_ptr<xml::Node> node)
         
         // special property IRI, not actually in the spec, but useful for comparisons and printouts
         _identifier = IRI(string(DCMES_uri) + node->Name());
+        _atom = AtomForDCType(_type);
         _value = node->Content();
         _language = node->Language();
         SetXMLIdentifier(_getProp(node, "id"));
@@ -227,6 +246,7 @@ bool Property::ParseMetaElement(shared_ptr<xml::Node> node)
             return false;
         
 		_identifier = OwnedBy::Owner()->PropertyIRIFromString(property);
+        _atom = PropertyAtom(_identifier);
 		_value = node->Content();
 		_language = node->Language();
         SetXMLIdentifier(_getProp(node, "id"));
@@ -241,11 +261,19 @@ void Property::SetDCType(DCType type)
     if ( type == DCType::Invalid )
     {
         _identifier = IRI();
+        _atom = PropertyAtom(_identifier);
     }
     else if ( type != DCType::Custom )
     {
         _identifier = IRIForDCType(type);
+        _atom = AtomForDCType(type);
     }
+    else
+    {
+        return;
+    }
+    
+    IdentifiersChanged();
 }
 void Property::SetPropertyIdentifier(const IRI& iri)
 {
@@ -262,6 +290,9 @@ void Property::SetPropertyIdentifier(const IRI& iri)
         _identifier.SetFragment(found->second.first);
         SetValue(found->second.second);
     }
+    
+    _atom = PropertyAtom(_identifier);
+    IdentifiersChanged();
 }
 const string& Property::LocalizedValue(const std::locale& locale) const
 {
@@ -293,9 +324,16 @@ const string& Property::LocalizedValue(const std::locale& locale) const
 }
 const shared_ptr<PropertyExtension> Property::ExtensionWithIdentifier(const IRI& ident) const
 {
-    for ( auto extension : _extensions )
+    return ExtensionWithIdentifier(PropertyAtom::Lookup(ident));
+}
+const shared_ptr<PropertyExtension> Property::ExtensionWithIdentifier(PropertyAtom ident) const
+{
+    if ( !bool(ident) )
+        return nullptr;
+    
+    for ( auto& extension : _extensions )
     {
-        if ( extension->PropertyIdentifier() == ident )
+        if ( extension->IdentifierAtom() == ident )
             return extension;
     }
     return nullptr;
@@ -303,22 +341,44 @@ const shared_ptr<PropertyExtension> Property::ExtensionWithIdentifier(const IRI&
 const Property::ExtensionList Property::AllExtensionsWithIdentifier(const IRI& ident) const
 {
     ExtensionList output;
-    for ( auto extension : _extensions )
+    PropertyAtom atom = PropertyAtom::Lookup(ident);
+    if ( !bool(atom) )
+        return output;
+    
+    for ( auto& extension : _extensions )
     {
-        if ( extension->PropertyIdentifier() == ident )
+        if ( extension->IdentifierAtom() == atom )
             output.push_back(extension);
     }
     return output;
 }
+void Property::AddExtension(const std::shared_ptr<PropertyExtension>& ext)
+{
+    _extensions.push_back(ext);
+    IdentifiersChanged();
+}
 bool Property::HasExtensionWithIdentifier(const IRI& ident) const
 {
+    return HasExtensionWithIdentifier(PropertyAtom::Lookup(ident));
+}
+bool Property::HasExtensionWithIdentifier(PropertyAtom ident) const
+{
+    if ( !bool(ident) )
+        return false;
+    
     for ( auto& ext : _extensions )
     {
-        if ( ext->PropertyIdentifier() == ident )
+        if ( ext->IdentifierAtom() == ident )
             return true;
     }
     return false;
 }
+void Property::IdentifiersChanged()
+{
+    auto owner = OwnedBy::Owner();
+    if ( owner )
+        owner->ReindexProperty(this);
+}
 const Property::ValueMap Property::DebugValues() const
 {
     ValueMap values;
@@ -26,6 +26,7 @@
 #include <ePub3/utilities/owned_by.h>
 #include <ePub3/utilities/iri.h>
 #include <ePub3/utilities/utfstring.h>
+#include <ePub3/property_atom.h>
 #include <ePub3/property_extension.h>
 #include <ePub3/utilities/epub_locale.h>
 #include <ePub3/utilities/xml_identifiable.h>
@@ -118,6 +119,15 @@ EPUB3_EXPORT
 const IRI       IRIForDCType(DCType type);
 EPUB3_EXPORT
 DCType          DCTypeFromIRI(const IRI& iri);
+/**
+ Obtains the interned form of the IRI returned by IRIForDCType().
+ @param type A type-code for a DCMES metadata item.
+ @result The type's atom. The `Custom` and `Invalid` pseudo-types share the atom
+ for an empty IRI.
+ @ingroup utilities
+ */
+EPUB3_EXPORT
+PropertyAtom    AtomForDCType(DCType type);
     
 __private_extern__ string __lang_from_locale(const std::locale& loc);
 #if EPUB_USE(LIBXML2)
@@ -160,13 +170,14 @@ private:
     string          _language;
     ExtensionList   _extensions;
     IRI             _identifier;
+    PropertyAtom    _atom;
     
                             Property()                              _DELETED_;
     
 public:
-                            Property(shared_ptr<PropertyHolder>& owner) : OwnedBy(owner), _type(DCType::Invalid), _value(), _language(), _extensions(), _identifier() {}
-                            Property(const Property& o) : OwnedBy(o), XMLIdentifiable(o), _type(o._type), _value(o._value), _language(o._language), _extensions(o._extensions), _identifier(o._identifier) {}
-                            Property(Property&& o) : OwnedBy(std::move(o)), XMLIdentifiable(std::move(o)), _type(o._type), _value(std::move(o._value)), _language(std::move(o._language)), _extensions(std::move(o._extensions)), _identifier(std::move(o._identifier)) {}
+                            Property(shared_ptr<PropertyHolder>& owner) : OwnedBy(owner), _type(DCType::Invalid), _value(), _language(), _extensions(), _identifier(), _atom() {}
+                            Property(const Property& o) : OwnedBy(o), XMLIdentifiable(o), _type(o._type), _value(o._value), _language(o._language), _extensions(o._extensions), _identifier(o._identifier), _atom(o._atom) {}
+                            Property(Property&& o) : OwnedBy(std::move(o)), XMLIdentifiable(std::move(o)), _type(o._type), _value(std::move(o._value)), _language(std::move(o._language)), _extensions(std::move(o._extensions)), _identifier(std::move(o._identifier)), _atom(o._atom) {}
     virtual                 ~Property() {}
     
     EPUB3_EXPORT
@@ -193,6 +204,10 @@ public:
     /// The canonical property IRI which identifies this item's type.
     const IRI&              PropertyIdentifier()   const            { return _identifier; }
     
+    ///
+    /// The interned form of PropertyIdentifier(), for fast comparisons.
+    PropertyAtom            IdentifierAtom()        const           { return _atom; }
+    
     /**
      Sets the type of this property using an EPUB 3 identifier IRI.
      
@@ -267,6 +282,10 @@ public:
      */
     EPUB3_EXPORT
     const shared_ptr<PropertyExtension> ExtensionWithIdentifier(const IRI& ident) const;
+    ///
+    /// Retrieves an extension identified by an interned property IRI.
+    EPUB3_EXPORT
+    const shared_ptr<PropertyExtension> ExtensionWithIdentifier(PropertyAtom ident) const;
     /**
      Retrieves all extensions with a given type (property IRI).
      @param property A property IRI.
@@ -279,12 +298,13 @@ public:
      Adds a new PropertyExtension which refines this Property's value.
      @param ext The new extension.
      */
-    void                        AddExtension(const std::shared_ptr<PropertyExtension>& ext) {
-        _extensions.push_back(ext);
-    }
+    EPUB3_EXPORT
+    void                        AddExtension(const std::shared_ptr<PropertyExtension>& ext);
     
     EPUB3_EXPORT
     bool                        HasExtensionWithIdentifier(const IRI& ident) const;
+    EPUB3_EXPORT
+    bool                        HasExtensionWithIdentifier(PropertyAtom ident) const;
     
     /// @}
     
@@ -295,6 +315,14 @@ public:
     EPUB3_EXPORT
     const ValueMap              DebugValues()       const;
     
+protected:
+    friend class PropertyExtension;
+    
+    ///
+    /// Asks the owning PropertyHolder to re-index this property after its identifier
+    /// or those of its extensions have changed.
+    void                        IdentifiersChanged();
+    
 };
 
 
@@ -0,0 +1,93 @@
+//
+//  property_atom.cpp
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "property_atom.h"
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+EPUB3_BEGIN_NAMESPACE
+
+namespace
+{
+    // Atoms are never removed, so the strings can be handed out by index.
+    struct AtomTable
+    {
+        std::mutex                                      lock;
+        std::unordered_map<std::string, uint32_t>       atoms;
+        std::deque<std::string>                         strings;
+    };
+
+    AtomTable& Atoms()
+    {
+        // constructed on first use, as atoms are made by other static initializers
+        static AtomTable* __table = new AtomTable;
+        return *__table;
+    }
+
+    // the same spelling for any two IRIs which compare equal
+    std::string AtomKey(const IRI& iri)
+    {
+        if ( iri.IsURN() )
+            return _Str("urn:", iri.NameID(), ":", iri.NamespacedString());
+        return iri.URIString().stl_str();
+    }
+}
+
+PropertyAtom::PropertyAtom(const IRI& iri) : _value(0)
+{
+    std::string key = AtomKey(iri);
+    AtomTable& table = Atoms();
+
+    std::lock_guard<std::mutex> _(table.lock);
+    auto inserted = table.atoms.emplace(key, static_cast<value_type>(table.strings.size() + 1));
+    if ( inserted.second )
+        table.strings.push_back(std::move(key));
+    _value = inserted.first->second;
+}
+PropertyAtom PropertyAtom::Lookup(const IRI& iri)
+{
+    std::string key = AtomKey(iri);
+    AtomTable& table = Atoms();
+    PropertyAtom result;
+
+    std::lock_guard<std::mutex> _(table.lock);
+    auto found = table.atoms.find(key);
+    if ( found != table.atoms.end() )
+        result._value = found->second;
+    return result;
+}
+IRI PropertyAtom::AtomIRI() const
+{
+    if ( _value == 0 )
+        return IRI();
+
+    AtomTable& table = Atoms();
+    std::string key;
+    {
+        std::lock_guard<std::mutex> _(table.lock);
+        key = table.strings[_value - 1];
+    }
+
+    if ( key.empty() )
+        return IRI();
+    return IRI(key);
+}
+
+EPUB3_END_NAMESPACE
@@ -0,0 +1,103 @@
+//
+//  property_atom.h
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __ePub3__property_atom__
+#define __ePub3__property_atom__
+
+#include <ePub3/epub3.h>
+#include <ePub3/utilities/iri.h>
+#include <functional>
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ An interned property IRI.
+
+ Every distinct property IRI is entered once into a process-wide table, and is
+ thereafter represented by its small integer index. Two atoms are equal exactly
+ when their IRIs are, so properties can be compared and hashed without touching
+ the IRIs themselves.
+
+ A default-constructed atom is null, and matches no IRI at all (not even an empty
+ one). Lookup() returns a null atom for IRIs which have never been interned, so
+ looking up unknown properties doesn't grow the table.
+ @ingroup epub-model
+ */
+class PropertyAtom
+{
+public:
+    typedef uint32_t        value_type;
+
+public:
+    ///
+    /// Creates a null atom.
+                PropertyAtom() : _value(0) {}
+    ///
+    /// Interns an IRI, returning its atom.
+    EPUB3_EXPORT
+    explicit    PropertyAtom(const IRI& iri);
+                PropertyAtom(const PropertyAtom& o) : _value(o._value) {}
+                ~PropertyAtom() {}
+
+    PropertyAtom&   operator=(const PropertyAtom& o)    { _value = o._value; return *this; }
+
+    /**
+     Finds the atom for an IRI without interning it.
+     @result The IRI's atom, or a null atom if it has never been interned.
+     */
+    EPUB3_EXPORT
+    static PropertyAtom Lookup(const IRI& iri);
+
+    ///
+    /// The IRI this atom stands for, or an empty IRI for a null atom.
+    EPUB3_EXPORT
+    IRI         AtomIRI()                               const;
+
+    ///
+    /// The index of this atom in the table; zero for a null atom.
+    value_type  Value()                                 const   { return _value; }
+
+    ///
+    /// Whether this atom represents an IRI.
+    explicit    operator bool()                         const   { return _value != 0; }
+
+    bool        operator==(const PropertyAtom& o)       const   { return _value == o._value; }
+    bool        operator!=(const PropertyAtom& o)       const   { return _value != o._value; }
+    bool        operator<(const PropertyAtom& o)        const   { return _value < o._value; }
+
+private:
+    value_type  _value;
+
+};
+
+EPUB3_END_NAMESPACE
+
+namespace std
+{
+    template <>
+    struct hash<::ePub3::PropertyAtom> : public unary_function<::ePub3::PropertyAtom, size_t>
+    {
+        size_t operator()(const ::ePub3::PropertyAtom& atom) const _NOEXCEPT
+        {
+            return static_cast<size_t>(atom.Value());
+        }
+    };
+}
+
+#endif /* defined(__ePub3__property_atom__) */
@@ -38,11 +38,22 @@ bool PropertyExtension::ParseMetaElement(shared_ptr<xml::Node> node)
         return false;
     
     _identifier = Owner()->Owner()->PropertyIRIFromString(property);
+    _atom = PropertyAtom(_identifier);
 	_value = node->StringValue();
     _scheme = _getProp(node, "scheme");
     _language = node->Language();
     SetXMLIdentifier(_getProp(node, "id"));
     return true;
 }
+void PropertyExtension::SetPropertyIdentifier(const IRI& ident)
+{
+    _identifier = ident;
+    _atom = PropertyAtom(ident);
+    
+    // the property's holder indexes it by its extensions' identifiers too
+    auto owner = Owner();
+    if ( owner )
+        owner->IdentifiersChanged();
+}
 
 EPUB3_END_NAMESPACE
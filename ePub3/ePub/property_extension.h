@@ -25,6 +25,7 @@
 #include <ePub3/utilities/owned_by.h>
 #include <ePub3/utilities/utfstring.h>
 #include <ePub3/utilities/iri.h>
+#include <ePub3/property_atom.h>
 #include <ePub3/utilities/xml_identifiable.h>
 #include <ePub3/xml/node.h>
 #include <memory>
@@ -58,10 +59,10 @@ public:
      @param owner The Package to which the metadata belongs; used for property
      IRI resolution.
      */
-                    PropertyExtension(const shared_ptr<Property>& owner) : OwnedBy(owner), _scheme(), _language(), _identifier() {}
+                    PropertyExtension(const shared_ptr<Property>& owner) : OwnedBy(owner), _scheme(), _language(), _identifier(), _atom() {}
     ///
     /// C++11 move constructor.
-                    PropertyExtension(PropertyExtension&& o) : OwnedBy(std::move(o)), XMLIdentifiable(std::move(o)), _scheme(std::move(o._scheme)), _language(std::move(o._language)), _identifier(std::move(o._identifier)) {}
+                    PropertyExtension(PropertyExtension&& o) : OwnedBy(std::move(o)), XMLIdentifiable(std::move(o)), _scheme(std::move(o._scheme)), _language(std::move(o._language)), _identifier(std::move(o._identifier)), _atom(o._atom) {}
     virtual         ~PropertyExtension() {}
     
     EPUB3_EXPORT
@@ -71,11 +72,16 @@ public:
     /// Retrieves the extension's property IRI, declaring its type.
     const IRI&      PropertyIdentifier()    const           { return _identifier; }
     
+    ///
+    /// The interned form of PropertyIdentifier().
+    PropertyAtom    IdentifierAtom()        const           { return _atom; }
+    
     /**
      Sets the property's identifier IRI.
      @param ident The new identifier.
      */
-    void            SetPropertyIdentifier(const IRI& ident) { _identifier = ident; }
+    EPUB3_EXPORT
+    void            SetPropertyIdentifier(const IRI& ident);
     
     ///
     /// Retrieves a scheme constant which determines how the Value() is interpreted.
@@ -112,6 +118,7 @@ private:
     string      _scheme;
     string      _language;
     IRI         _identifier;
+    PropertyAtom _atom;
 };
 
 EPUB3_END_NAMESPACE
@@ -20,6 +20,8 @@
 
 #include "property_holder.h"
 #include REGEX_INCLUDE
+#include <algorithm>
+#include <iterator>
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -98,6 +100,8 @@ PropertyHolder& PropertyHolder::operator=(const PropertyHolder& o)
     _parent = o._parent;
     _properties = o._properties;
     _vocabularyLookup = o._vocabularyLookup;
+    _identifierIndex = o._identifierIndex;
+    _extensionIndex = o._extensionIndex;
     return *this;
 }
 PropertyHolder& PropertyHolder::operator=(PropertyHolder&& o)
@@ -105,6 +109,8 @@ PropertyHolder& PropertyHolder::operator=(PropertyHolder&& o)
     _parent = std::move(o._parent);
     _properties = std::move(o._properties);
     _vocabularyLookup = std::move(o._vocabularyLookup);
+    _identifierIndex = std::move(o._identifierIndex);
+    _extensionIndex = std::move(o._extensionIndex);
     return *this;
 }
 void PropertyHolder::AppendProperties(const PropertyHolder& o, shared_ptr<PropertyHolder> sharedMe)
@@ -114,7 +120,10 @@ void PropertyHolder::AppendProperties(const PropertyHolder& o, shared_ptr<Proper
         prop->SetOwner(sharedMe);
     }
     
+    size_type first = _properties.size();
     _properties.insert(_properties.end(), o._properties.begin(), o._properties.end());
+    for ( size_type i = first; i < _properties.size(); i++ )
+        IndexPropertyAt(i);
 }
 void PropertyHolder::AppendProperties(PropertyHolder&& o, shared_ptr<PropertyHolder> sharedMe)
 {
@@ -122,18 +131,17 @@ void PropertyHolder::AppendProperties(PropertyHolder&& o, shared_ptr<PropertyHol
     {
         i->SetOwner(sharedMe);
         _properties.push_back(std::move(i));
+        IndexPropertyAt(_properties.size()-1);
     }
+    
+    o._identifierIndex.clear();
+    o._extensionIndex.clear();
 }
 void PropertyHolder::RemoveProperty(const IRI& iri)
 {
-    for ( auto pos = _properties.begin(), end = _properties.end(); pos != end; ++pos )
-    {
-        if ( (*pos)->PropertyIdentifier() == iri )
-        {
-            _properties.erase(pos);
-            break;
-        }
-    }
+    auto found = _identifierIndex.find(PropertyAtom::Lookup(iri));
+    if ( found != _identifierIndex.end() )
+        ErasePropertyAt(found->second.front());
 }
 void PropertyHolder::RemoveProperty(const string& reference, const string& prefix)
 {
@@ -144,31 +152,34 @@ void PropertyHolder::RemoveProperty(const string& reference, const string& prefi
 }
 void PropertyHolder::ErasePropertyAt(size_type idx)
 {
-    if ( idx > _properties.size() )
+    if ( idx >= _properties.size() )
         throw std::out_of_range("ErasePropertyAt: Index out of range");
     
     auto pos = _properties.begin();
     pos += idx;
     _properties.erase(pos);
+    UnindexPropertyAt(idx, true);
 }
 bool PropertyHolder::ContainsProperty(DCType type, bool lookupParents) const
 {
-    IRI iri = IRIForDCType(type);
-    return ContainsProperty(iri, lookupParents);
+    return ContainsProperty(AtomForDCType(type), lookupParents);
 }
 bool PropertyHolder::ContainsProperty(const IRI& iri, bool lookupParents) const
 {
-    for ( auto &i : _properties )
-    {
-        if ( i->PropertyIdentifier() == iri )
-            return true;
-    }
+    return ContainsProperty(PropertyAtom::Lookup(iri), lookupParents);
+}
+bool PropertyHolder::ContainsProperty(PropertyAtom atom, bool lookupParents) const
+{
+    if ( !bool(atom) )
+        return false;
+    if ( _identifierIndex.find(atom) != _identifierIndex.end() )
+        return true;
 
     if (lookupParents)
     {
         auto parent = _parent.lock();
         if ( parent )
-            return parent->ContainsProperty(iri, lookupParents);
+            return parent->ContainsProperty(atom, lookupParents);
     }
     
     return false;
@@ -197,13 +208,18 @@ bool PropertyHolder::ContainsProperty(const string& reference, const string& pre
 
 const PropertyHolder::PropertyList PropertyHolder::PropertiesMatching(DCType type, bool lookupParents) const
 {
-    IRI iri = IRIForDCType(type);
-    return PropertiesMatching(iri, lookupParents);
+    return PropertiesMatching(AtomForDCType(type), lookupParents);
 }
 const PropertyHolder::PropertyList PropertyHolder::PropertiesMatching(const IRI& iri, bool lookupParents) const
+{
+    if ( iri.IsEmpty() )
+        return PropertyList();
+    return PropertiesMatching(PropertyAtom::Lookup(iri), lookupParents);
+}
+const PropertyHolder::PropertyList PropertyHolder::PropertiesMatching(PropertyAtom atom, bool lookupParents) const
 {
     PropertyList output;
-    BuildPropertyList(output, iri);
+    BuildPropertyList(output, atom);
 
     if (lookupParents)
     {
@@ -212,7 +228,7 @@ const PropertyHolder::PropertyList PropertyHolder::PropertiesMatching(const IRI&
         {
             //parent->BuildPropertyList(output, iri);
 
-            PropertyHolder::PropertyList pList = parent->PropertiesMatching(iri, lookupParents);
+            PropertyHolder::PropertyList pList = parent->PropertiesMatching(atom, lookupParents);
             output.insert(output.end(), pList.begin(), pList.end());
         }
     }
@@ -245,22 +261,26 @@ const PropertyHolder::PropertyList PropertyHolder::PropertiesMatching(const stri
 
 PropertyPtr PropertyHolder::PropertyMatching(DCType type, bool lookupParents) const
 {
-    IRI iri = IRIForDCType(type);
-    return PropertyMatching(iri, lookupParents);
+    return PropertyMatching(AtomForDCType(type), lookupParents);
 }
 PropertyPtr PropertyHolder::PropertyMatching(const IRI& iri, bool lookupParents) const
 {
-    for ( auto &i : _properties )
-    {
-        if ( i->PropertyIdentifier() == iri )
-            return i;
-    }
+    return PropertyMatching(PropertyAtom::Lookup(iri), lookupParents);
+}
+PropertyPtr PropertyHolder::PropertyMatching(PropertyAtom atom, bool lookupParents) const
+{
+    if ( !bool(atom) )
+        return nullptr;
+    
+    auto found = _identifierIndex.find(atom);
+    if ( found != _identifierIndex.end() )
+        return _properties[found->second.front()];
 
     if (lookupParents)
     {
         auto parent = _parent.lock();
         if ( parent )
-            return parent->PropertyMatching(iri, lookupParents);
+            return parent->PropertyMatching(atom, lookupParents);
     }
 
     return nullptr;
@@ -320,11 +340,81 @@ void PropertyHolder::BuildPropertyList(PropertyList& output, const IRI& iri) con
 {
     if ( iri.IsEmpty() )
         return;
+    BuildPropertyList(output, PropertyAtom::Lookup(iri));
+}
+void PropertyHolder::BuildPropertyList(PropertyList& output, PropertyAtom atom) const
+{
+    if ( !bool(atom) )
+        return;
+    
+    static const PositionList __none;
+    auto byIdentifier = _identifierIndex.find(atom);
+    auto byExtension = _extensionIndex.find(atom);
+    const PositionList& identified = (byIdentifier == _identifierIndex.end() ? __none : byIdentifier->second);
+    const PositionList& extended = (byExtension == _extensionIndex.end() ? __none : byExtension->second);
+    
+    // both lists are in document order, as is their union
+    PositionList positions;
+    positions.reserve(identified.size() + extended.size());
+    std::set_union(identified.begin(), identified.end(), extended.begin(), extended.end(), std::back_inserter(positions));
+    
+    for ( size_type idx : positions )
+        output.push_back(_properties[idx]);
+}
+void PropertyHolder::ReindexProperty(const Property* prop)
+{
+    for ( size_type idx = 0; idx < _properties.size(); idx++ )
+    {
+        if ( _properties[idx].get() != prop )
+            continue;
+        
+        UnindexPropertyAt(idx, false);
+        IndexPropertyAt(idx);
+    }
+}
+void PropertyHolder::IndexPropertyAt(size_type idx)
+{
+    auto insert = [idx](PositionList& list) {
+        auto pos = std::lower_bound(list.begin(), list.end(), idx);
+        if ( pos == list.end() || *pos != idx )
+            list.insert(pos, idx);
+    };
+    
+    const PropertyPtr& prop = _properties[idx];
+    if ( !bool(prop) )
+        return;
     
-    for ( auto& i : _properties )
+    if ( bool(prop->IdentifierAtom()) )
+        insert(_identifierIndex[prop->IdentifierAtom()]);
+    for ( auto& extension : prop->Extensions() )
     {
-        if ( i->PropertyIdentifier() == iri || i->HasExtensionWithIdentifier(iri) )
-            output.push_back(i);
+        if ( bool(extension->IdentifierAtom()) )
+            insert(_extensionIndex[extension->IdentifierAtom()]);
+    }
+}
+void PropertyHolder::UnindexPropertyAt(size_type idx, bool erased)
+{
+    // the property's old atoms aren't known, so visit every entry
+    PropertyIndex* indices[] = { &_identifierIndex, &_extensionIndex };
+    for ( PropertyIndex* index : indices )
+    {
+        for ( auto pos = index->begin(); pos != index->end(); )
+        {
+            PositionList& list = pos->second;
+            auto found = std::lower_bound(list.begin(), list.end(), idx);
+            if ( found != list.end() && *found == idx )
+                found = list.erase(found);
+            if ( erased )
+            {
+                for ( ; found != list.end(); ++found )
+                    --(*found);
+            }
+            
+            if ( list.empty() )
+                pos = index->erase(pos);
+            else
+                ++pos;
+        }
     }
 }
 
@@ -24,9 +24,21 @@
 #include <ePub3/utilities/basic.h>
 #include <ePub3/utilities/owned_by.h>
 #include <ePub3/property.h>
+#include <ePub3/property_atom.h>
+#include <unordered_map>
+#include <vector>
 
 EPUB3_BEGIN_NAMESPACE
 
+/**
+ A list of properties, along with the prefix vocabulary used to name them.
+ 
+ Properties are kept in document order, and indexed by the atoms of their
+ identifiers and of their extensions' identifiers, so looking up a property costs
+ a hash lookup rather than a comparison against every IRI held. The index is kept
+ up to date as properties are added and removed, and as a property or extension
+ whose owner is this holder changes its identifier or gains an extension.
+ */
 class PropertyHolder
 {
 public:
@@ -57,12 +69,18 @@ private:
     PropertyList                                _properties;        ///< All properties, in document order.
     PropertyVocabularyMap                       _vocabularyLookup;  ///< A lookup table for property-prefix->IRI-stem mappings.
     
+    typedef std::vector<size_type>                          PositionList;
+    typedef std::unordered_map<PropertyAtom, PositionList>  PropertyIndex;
+    
+    PropertyIndex                               _identifierIndex;   ///< Positions in `_properties` by identifier atom, ascending.
+    PropertyIndex                               _extensionIndex;    ///< Positions in `_properties` by extension identifier atom, ascending.
+    
 public:
-                        PropertyHolder() : _parent(), _properties(), _vocabularyLookup(ReservedVocabularies) {}
+                        PropertyHolder() : _parent(), _properties(), _vocabularyLookup(ReservedVocabularies), _identifierIndex(), _extensionIndex() {}
     template <class _Parent>
-                        PropertyHolder(const shared_ptr<_Parent>& parent) : _parent(std::dynamic_pointer_cast<PropertyHolder>(parent)), _properties(), _vocabularyLookup(ReservedVocabularies) {}
-                        PropertyHolder(const PropertyHolder& o) : _parent(o._parent), _properties(o._properties), _vocabularyLookup(o._vocabularyLookup) {}
-                        PropertyHolder(PropertyHolder&& o) : _parent(std::move(o._parent)), _properties(std::move(o._properties)), _vocabularyLookup(std::move(o._vocabularyLookup)) {}
+                        PropertyHolder(const shared_ptr<_Parent>& parent) : _parent(std::dynamic_pointer_cast<PropertyHolder>(parent)), _properties(), _vocabularyLookup(ReservedVocabularies), _identifierIndex(), _extensionIndex() {}
+                        PropertyHolder(const PropertyHolder& o) : _parent(o._parent), _properties(o._properties), _vocabularyLookup(o._vocabularyLookup), _identifierIndex(o._identifierIndex), _extensionIndex(o._extensionIndex) {}
+                        PropertyHolder(PropertyHolder&& o) : _parent(std::move(o._parent)), _properties(std::move(o._properties)), _vocabularyLookup(std::move(o._vocabularyLookup)), _identifierIndex(std::move(o._identifierIndex)), _extensionIndex(std::move(o._extensionIndex)) {}
     virtual             ~PropertyHolder() {}
     
     virtual PropertyHolder& operator=(const PropertyHolder& o);
@@ -71,9 +89,9 @@ public:
     virtual size_type   NumberOfProperties() const                      { return _properties.size(); }
     
     
-    virtual void        AddProperty(const shared_ptr<Property>& prop)   { _properties.push_back(prop); }
-    virtual void        AddProperty(const shared_ptr<Property>&& prop)  { _properties.push_back(std::move(prop)); }
-    virtual void        AddProperty(Property* prop)                     { _properties.emplace_back(prop); }
+    virtual void        AddProperty(const shared_ptr<Property>& prop)   { _properties.push_back(prop); IndexPropertyAt(_properties.size()-1); }
+    virtual void        AddProperty(const shared_ptr<Property>&& prop)  { _properties.push_back(std::move(prop)); IndexPropertyAt(_properties.size()-1); }
+    virtual void        AddProperty(Property* prop)                     { _properties.emplace_back(prop); IndexPropertyAt(_properties.size()-1); }
     
     EPUB3_EXPORT
     virtual void        AppendProperties(const PropertyHolder& properties, shared_ptr<PropertyHolder> sharedMe);
@@ -102,6 +120,9 @@ public:
     EPUB3_EXPORT
     virtual bool        ContainsProperty(const string& reference, const string& prefix="") const;
     
+    EPUB3_EXPORT
+    bool                ContainsProperty(PropertyAtom atom, bool lookupParents=true) const;
+    
     EPUB3_EXPORT
     const PropertyList  PropertiesMatching(DCType type, bool lookupParents) const;
     EPUB3_EXPORT
@@ -116,6 +137,13 @@ public:
     EPUB3_EXPORT
     const PropertyList  PropertiesMatching(const string& reference, const string& prefix="") const;
     
+    /**
+     Finds the properties identified by an atom, or having an extension identified
+     by it, in document order.
+     */
+    EPUB3_EXPORT
+    const PropertyList  PropertiesMatching(PropertyAtom atom, bool lookupParents=true) const;
+    
     EPUB3_EXPORT
     PropertyPtr         PropertyMatching(DCType type, bool lookupParents) const;
     EPUB3_EXPORT
@@ -130,6 +158,9 @@ public:
     EPUB3_EXPORT
     PropertyPtr         PropertyMatching(const string& reference, const string& prefix="") const;
     
+    EPUB3_EXPORT
+    PropertyPtr         PropertyMatching(PropertyAtom atom, bool lookupParents=true) const;
+    
     template <class _Function>
     inline FORCE_INLINE
     _Function           ForEachProperty(_Function __f) const
@@ -144,8 +175,27 @@ public:
     EPUB3_EXPORT
     IRI                 PropertyIRIFromString(const string& value) const;
     
+    /**
+     Updates the index entries for a property held here, after its identifier or
+     its extensions have changed.
+     
+     Properties call this on their owner themselves; it need only be called for
+     properties held by some other holder as well.
+     @param prop The property, which is ignored if it isn't held here.
+     */
+    EPUB3_EXPORT
+    void                ReindexProperty(const Property* prop);
+    
 protected:
     void                BuildPropertyList(PropertyList& output, const IRI& iri) const;
+    void                BuildPropertyList(PropertyList& output, PropertyAtom atom) const;
+    
+    ///
+    /// Adds the property at `idx` to the index.
+    void                IndexPropertyAt(size_type idx);
+    ///
+    /// Removes the property at `idx` from the index, optionally moving later entries down one position.
+    void                UnindexPropertyAt(size_type idx, bool erased);
     
 };
 
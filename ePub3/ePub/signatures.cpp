@@ -18,13 +18,420 @@
 //  the License, or (at your option) any later version. You should have received a copy of the GNU 
 //  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <ePub3/base.h>
+
+// OpenSSL APIs are deprecated on OS X and iOS
+#if EPUB_OS(DARWIN)
+#define COMMON_DIGEST_FOR_OPENSSL
+#include <CommonCrypto/CommonDigest.h>
+#elif EPUB_PLATFORM(WIN)
+#include <windows.h>
+#include <Wincrypt.h>
+#elif EPUB_PLATFORM(WINRT)
+using namespace ::Platform;
+using namespace ::Windows::Security::Cryptography;
+using namespace ::Windows::Security::Cryptography::Core;
+#else
+#include <openssl/sha.h>
+#endif
+
 #include "signatures.h"
+#include "archive.h"
+#include "xpath_wrangler.h"
+#include <ePub3/utilities/byte_stream.h>
+#include <ePub3/utilities/executor.h>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#if EPUB_ENABLE(XML_C14N)
+#include <ePub3/xml/document.h>
+#include <ePub3/xml/c14n.h>
+#endif
 
 EPUB3_BEGIN_NAMESPACE
 
-DigitalSignature::DigitalSignature(shared_ptr<xml::Node> signatureNode)
+static const char * const SHA1DigestMethod      = "http://www.w3.org/2000/09/xmldsig#sha1";
+static const char * const SHA256DigestMethod    = "http://www.w3.org/2001/04/xmlenc#sha256";
+static const char * const SHA512DigestMethod    = "http://www.w3.org/2001/04/xmlenc#sha512";
+
+static const char * const C14N10Transform       = "http://www.w3.org/TR/2001/REC-xml-c14n-20010315";
+static const char * const C14N11Transform       = "http://www.w3.org/2006/12/xml-c14n11";
+static const char * const ExclusiveC14NTransform = "http://www.w3.org/2001/10/xml-exc-c14n#";
+static const char * const WithCommentsSuffix    = "#WithComments";
+
+static const size_t       DigestReadSize        = 64 * 1024;
+
+static std::string Base64Decode(const std::string& text)
+{
+    std::string result;
+    result.reserve(text.size() * 3 / 4);
+    
+    uint32_t accumulator = 0;
+    int bits = 0;
+    for ( char ch : text )
+    {
+        int value;
+        if ( ch >= 'A' && ch <= 'Z' )
+            value = ch - 'A';
+        else if ( ch >= 'a' && ch <= 'z' )
+            value = ch - 'a' + 26;
+        else if ( ch >= '0' && ch <= '9' )
+            value = ch - '0' + 52;
+        else if ( ch == '+' )
+            value = 62;
+        else if ( ch == '/' )
+            value = 63;
+        else
+            continue;       // whitespace & padding
+        
+        accumulator = (accumulator << 6) | uint32_t(value);
+        bits += 6;
+        if ( bits >= 8 )
+        {
+            bits -= 8;
+            result.push_back(char((accumulator >> bits) & 0xFF));
+        }
+    }
+    
+    return result;
+}
+
+/**
+ Incrementally computes one of the supported XML-DSig digests.
+ */
+class ReferenceDigester
+{
+public:
+    enum Algorithm { None, SHA1, SHA256, SHA512 };
+    
+    ReferenceDigester(const string& method);
+    ~ReferenceDigester();
+    
+    bool            IsSupported()   const   { return _algorithm != None; }
+    
+    void            Update(const void* data, size_t len);
+    std::string     Final();
+    
+private:
+    Algorithm       _algorithm;
+#if EPUB_PLATFORM(WIN)
+    HCRYPTPROV      _provider;
+    HCRYPTHASH      _hash;
+#elif EPUB_PLATFORM(WINRT)
+    CryptographicHash^  _hash;
+#else
+    union
+    {
+        SHA_CTX     sha1;
+        SHA256_CTX  sha256;
+        SHA512_CTX  sha512;
+    }               _ctx;
+#endif
+};
+
+ReferenceDigester::ReferenceDigester(const string& method) : _algorithm(None)
+{
+    if ( method == SHA1DigestMethod )
+        _algorithm = SHA1;
+    else if ( method == SHA256DigestMethod )
+        _algorithm = SHA256;
+    else if ( method == SHA512DigestMethod )
+        _algorithm = SHA512;
+    
+#if EPUB_PLATFORM(WIN)
+    _provider = 0;
+    _hash = 0;
+    ALG_ID algs[] = { 0, CALG_SHA1, CALG_SHA_256, CALG_SHA_512 };
+    if ( _algorithm != None )
+    {
+        if ( !::CryptAcquireContext(&_provider, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT) )
+            _THROW_LAST_ERROR_();
+        if ( !::CryptCreateHash(_provider, algs[_algorithm], 0, 0, &_hash) )
+        {
+            DWORD err = ::GetLastError();
+            ::CryptReleaseContext(_provider, 0);
+            _THROW_WIN_ERROR_(err);
+        }
+    }
+#elif EPUB_PLATFORM(WINRT)
+    String^ names[] = { nullptr, HashAlgorithmNames::Sha1, HashAlgorithmNames::Sha256, HashAlgorithmNames::Sha512 };
+    if ( _algorithm != None )
+        _hash = HashAlgorithmProvider::OpenAlgorithm(names[_algorithm])->CreateHash();
+#else
+    switch ( _algorithm )
+    {
+        case SHA1:
+            SHA1_Init(&_ctx.sha1);
+            break;
+        case SHA256:
+            SHA256_Init(&_ctx.sha256);
+            break;
+        case SHA512:
+            SHA512_Init(&_ctx.sha512);
+            break;
+        default:
+            break;
+    }
+#endif
+}
+ReferenceDigester::~ReferenceDigester()
+{
+#if EPUB_PLATFORM(WIN)
+    if ( _hash != 0 )
+        ::CryptDestroyHash(_hash);
+    if ( _provider != 0 )
+        ::CryptReleaseContext(_provider, 0);
+#endif
+}
+void ReferenceDigester::Update(const void *data, size_t len)
+{
+#if EPUB_PLATFORM(WIN)
+    if ( _hash != 0 && !::CryptHashData(_hash, reinterpret_cast<const BYTE*>(data), static_cast<DWORD>(len), 0) )
+        _THROW_LAST_ERROR_();
+#elif EPUB_PLATFORM(WINRT)
+    if ( _hash != nullptr )
+    {
+        auto bytes = ArrayReference<byte>(reinterpret_cast<byte*>(const_cast<void*>(data)), static_cast<unsigned int>(len));
+        _hash->Append(CryptographicBuffer::CreateFromByteArray(bytes));
+    }
+#else
+    switch ( _algorithm )
+    {
+        case SHA1:
+            SHA1_Update(&_ctx.sha1, data, len);
+            break;
+        case SHA256:
+            SHA256_Update(&_ctx.sha256, data, len);
+            break;
+        case SHA512:
+            SHA512_Update(&_ctx.sha512, data, len);
+            break;
+        default:
+            break;
+    }
+#endif
+}
+std::string ReferenceDigester::Final()
+{
+#if EPUB_PLATFORM(WIN)
+    if ( _hash == 0 )
+        return std::string();
+    
+    DWORD size = 0, sizeLen = sizeof(size);
+    if ( !::CryptGetHashParam(_hash, HP_HASHSIZE, reinterpret_cast<BYTE*>(&size), &sizeLen, 0) )
+        _THROW_LAST_ERROR_();
+    std::string result(size, '\0');
+    if ( !::CryptGetHashParam(_hash, HP_HASHVAL, reinterpret_cast<BYTE*>(&result[0]), &size, 0) )
+        _THROW_LAST_ERROR_();
+    return result;
+#elif EPUB_PLATFORM(WINRT)
+    if ( _hash == nullptr )
+        return std::string();
+    
+    Array<byte>^ outArray = nullptr;
+    CryptographicBuffer::CopyToByteArray(_hash->GetValueAndReset(), &outArray);
+    return std::string(reinterpret_cast<const char*>(outArray->Data), outArray->Length);
+#else
+    unsigned char md[SHA512_DIGEST_LENGTH];
+    switch ( _algorithm )
+    {
+        case SHA1:
+            SHA1_Final(md, &_ctx.sha1);
+            return std::string(reinterpret_cast<char*>(md), SHA_DIGEST_LENGTH);
+        case SHA256:
+            SHA256_Final(md, &_ctx.sha256);
+            return std::string(reinterpret_cast<char*>(md), SHA256_DIGEST_LENGTH);
+        case SHA512:
+            SHA512_Final(md, &_ctx.sha512);
+            return std::string(reinterpret_cast<char*>(md), SHA512_DIGEST_LENGTH);
+        default:
+            return std::string();
+    }
+#endif
+}
+
+#if EPUB_ENABLE(XML_C14N)
+// returns false if the transform isn't a canonicalization this build of libxml2 supports
+static bool Canonicalize(const string& transform, shared_ptr<xml::Document> doc, std::string& output)
+{
+    std::string alg(transform.stl_str());
+    bool withComments = false;
+    size_t suffix = alg.size() - strlen(WithCommentsSuffix);
+    if ( alg.size() > strlen(WithCommentsSuffix) && alg.compare(suffix, std::string::npos, WithCommentsSuffix) == 0 )
+    {
+        withComments = true;
+        alg.erase(suffix);
+        if ( alg == "http://www.w3.org/2001/10/xml-exc-c14n" )
+            alg.push_back('#');
+    }
+    
+    std::ostringstream stream;
+    bool ok = false;
+    {
+        xml::StreamOutputBuffer buf(stream);
+        if ( alg == C14N10Transform )
+            ok = (withComments ? xml::C14N::Canonicalize(doc.get(), buf, xml::C14N::V1_0_WithComments) : xml::C14N::Canonicalize(doc.get(), buf, xml::C14N::V1_0));
+        else if ( alg == C14N11Transform )
+            ok = (withComments ? xml::C14N::Canonicalize(doc.get(), buf, xml::C14N::V1_1_WithComments) : xml::C14N::Canonicalize(doc.get(), buf, xml::C14N::V1_1));
+        else if ( alg == ExclusiveC14NTransform )
+            ok = (withComments ? xml::C14N::Canonicalize(doc.get(), buf, xml::C14N::V1_0_Exclusive_WithComments) : xml::C14N::Canonicalize(doc.get(), buf, xml::C14N::V1_0_Exclusive));
+    }
+    
+    if ( ok )
+        output = stream.str();
+    return ok;
+}
+#endif
+
+bool SignatureReference::ParseXML(shared_ptr<xml::Node> node)
+{
+#if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
+    XPathWrangler xpath(node->Document(), {{"dsig", XMLDSigNamespaceURI}});
+#else
+    XPathWrangler::NamespaceList nsList;
+    nsList["dsig"] = XMLDSigNamespaceURI;
+    XPathWrangler xpath(node->Document(), nsList);
+#endif
+    
+    auto strings = xpath.Strings("./@URI", node);
+    _uri = (strings.empty() ? string() : strings[0]);
+    
+    _transforms.clear();
+    for ( auto& alg : xpath.Strings("./dsig:Transforms/dsig:Transform/@Algorithm", node) )
+    {
+        _transforms.emplace_back(alg);
+    }
+    
+    auto method = xpath.Strings("./dsig:DigestMethod/@Algorithm", node);
+    auto value = xpath.Strings("./dsig:DigestValue", node);
+    if ( method.empty() || value.empty() )
+        return false;
+    
+    _digest = DigestValue(method[0], Base64Decode(value[0].stl_str()));
+    return true;
+}
+string SignatureReference::Path() const
+{
+    std::string uri(_uri.stl_str());
+    if ( uri.empty() || uri[0] == '#' )
+        return string();
+    
+    // references are relative to the root of the container
+    std::string path;
+    path.reserve(uri.size());
+    for ( size_t i = (uri[0] == '/' ? 1 : 0); i < uri.size(); i++ )
+    {
+        if ( uri[i] == '%' && i+2 < uri.size() && isxdigit(uri[i+1]) && isxdigit(uri[i+2]) )
+        {
+            path.push_back(char(std::stoi(uri.substr(i+1, 2), nullptr, 16)));
+            i += 2;
+        }
+        else
+        {
+            path.push_back(uri[i]);
+        }
+    }
+    return path;
+}
+DigestStatus SignatureReference::VerifyDigest(const Archive &archive, const std::atomic<bool>* cancel) const
+{
+    string path = Path();
+    ReferenceDigester digester(_digest.Algorithm());
+    if ( path.empty() || !digester.IsSupported() || _transforms.size() > 1 )
+        return DigestStatus::Unsupported;
+    
+    bool canonicalize = !_transforms.empty();
+#if !EPUB_ENABLE(XML_C14N)
+    if ( canonicalize )
+        return DigestStatus::Unsupported;
+#endif
+    
+    if ( !archive.ContainsItem(path) )
+        return DigestStatus::MissingItem;
+    
+    auto stream = archive.ByteStreamAtPath(path);
+    if ( !bool(stream) )
+        return DigestStatus::MissingItem;
+    
+    std::string document;
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[DigestReadSize]);
+    ByteStream::size_type n;
+    while ( (n = stream->ReadBytes(buf.get(), DigestReadSize)) > 0 )
+    {
+        if ( cancel != nullptr && *cancel )
+            return DigestStatus::NotChecked;
+        
+        if ( canonicalize )
+            document.append(reinterpret_cast<char*>(buf.get()), n);
+        else
+            digester.Update(buf.get(), n);
+    }
+    
+#if EPUB_ENABLE(XML_C14N)
+    if ( canonicalize )
+    {
+        xmlDocPtr raw = xmlReadMemory(document.data(), static_cast<int>(document.size()), path.c_str(), nullptr,
+                                      XML_PARSE_NOENT|XML_PARSE_DTDATTR|XML_PARSE_NONET);
+        if ( raw == nullptr )
+            return DigestStatus::Mismatch;      // not XML, so can't have been signed this way
+        
+        std::string canonical;
+        if ( !Canonicalize(_transforms[0].Algorithm(), xml::Wrapped<xml::Document>(raw), canonical) )
+            return DigestStatus::Unsupported;
+        
+        digester.Update(canonical.data(), canonical.size());
+    }
+#endif
+    
+    return (digester.Final() == _digest.Bytes() ? DigestStatus::Valid : DigestStatus::Mismatch);
+}
+
+bool SignedInfo::ParseXML(shared_ptr<xml::Node> node)
 {
+#if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
+    XPathWrangler xpath(node->Document(), {{"dsig", XMLDSigNamespaceURI}});
+#else
+    XPathWrangler::NamespaceList nsList;
+    nsList["dsig"] = XMLDSigNamespaceURI;
+    XPathWrangler xpath(node->Document(), nsList);
+#endif
     
+    auto strings = xpath.Strings("./dsig:CanonicalizationMethod/@Algorithm", node);
+    if ( !strings.empty() )
+        _canonicalizationMethod = strings[0];
+    strings = xpath.Strings("./dsig:SignatureMethod/@Algorithm", node);
+    if ( !strings.empty() )
+        _signatureMethod = strings[0];
+    
+    _references.clear();
+    for ( auto refNode : xpath.Nodes("./dsig:Reference", node) )
+    {
+        SignatureReference ref;
+        if ( ref.ParseXML(refNode) )
+            _references.push_back(ref);
+    }
+    
+    return !_references.empty();
+}
+
+DigitalSignature::DigitalSignature(shared_ptr<xml::Node> signatureNode) : _signedInfo(), _keyInfo(), _object()
+{
+#if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
+    XPathWrangler xpath(signatureNode->Document(), {{"dsig", XMLDSigNamespaceURI}});
+#else
+    XPathWrangler::NamespaceList nsList;
+    nsList["dsig"] = XMLDSigNamespaceURI;
+    XPathWrangler xpath(signatureNode->Document(), nsList);
+#endif
+    
+    auto nodes = xpath.Nodes("./dsig:SignedInfo", signatureNode);
+    if ( nodes.empty() )
+        return;
+    
+    unique_ptr<class SignedInfo> info(new class SignedInfo());
+    if ( info->ParseXML(nodes[0]) )
+        _signedInfo = std::move(info);
 }
 DigitalSignature& DigitalSignature::operator=(DigitalSignature&& o)
 {
@@ -33,5 +440,90 @@ DigitalSignature& DigitalSignature::operator=(DigitalSignature&& o)
     _object = std::move(o._object);
     return *this;
 }
+bool DigitalSignature::VerifyReferenceDigests(const Archive &archive, bool stopAtFirstFailure, DigestResults *results, std::shared_ptr<executor> exec) const
+{
+    std::vector<const SignatureReference*> references;
+    if ( bool(_signedInfo) )
+    {
+        for ( auto& ref : _signedInfo->References() )
+        {
+            references.push_back(&ref);
+        }
+    }
+    
+    return VerifyReferenceDigests(references, archive, stopAtFirstFailure, results, exec);
+}
+bool DigitalSignature::VerifyReferenceDigests(const std::vector<const SignatureReference *> &references, const Archive &archive,
+                                              bool stopAtFirstFailure, DigestResults *results, std::shared_ptr<executor> exec)
+{
+    if ( !bool(exec) )
+    {
+        static std::shared_ptr<executor> __sharedDigestExecutor;
+        static std::once_flag __once;
+        std::call_once(__once, [](){
+            __sharedDigestExecutor = std::make_shared<thread_pool>(thread_pool::Automatic);
+        });
+        exec = __sharedDigestExecutor;
+    }
+    
+    struct Verification
+    {
+        std::mutex                  lock;
+        std::condition_variable     finished;
+        size_t                      remaining;
+        std::atomic<bool>           cancelled;
+        std::vector<DigestStatus>   statuses;
+    };
+    auto state = std::make_shared<Verification>();
+    state->remaining = references.size();
+    state->cancelled = false;
+    state->statuses.assign(references.size(), DigestStatus::NotChecked);
+    
+    const Archive* pArchive = &archive;
+    for ( size_t i = 0; i < references.size(); i++ )
+    {
+        const SignatureReference* ref = references[i];
+        exec->add([state, ref, i, pArchive, stopAtFirstFailure]() {
+            DigestStatus status = DigestStatus::NotChecked;
+            if ( !state->cancelled )
+            {
+                try
+                {
+                    status = ref->VerifyDigest(*pArchive, (stopAtFirstFailure ? &state->cancelled : nullptr));
+                }
+                catch (std::exception& e)
+                {
+                    std::cerr << "Unable to verify the digest of " << ref->URI() << ": " << e.what() << std::endl;
+                    status = DigestStatus::Mismatch;
+                }
+                
+                if ( stopAtFirstFailure && status != DigestStatus::Valid && status != DigestStatus::NotChecked )
+                    state->cancelled = true;
+            }
+            
+            std::lock_guard<std::mutex> _(state->lock);
+            state->statuses[i] = status;
+            if ( --state->remaining == 0 )
+                state->finished.notify_all();
+        });
+    }
+    
+    // the tasks use the archive, so every one must finish
+    std::unique_lock<std::mutex> lock(state->lock);
+    state->finished.wait(lock, [&]() { return state->remaining == 0; });
+    
+    bool allValid = true;
+    if ( results != nullptr )
+        results->clear();
+    for ( size_t i = 0; i < references.size(); i++ )
+    {
+        if ( state->statuses[i] != DigestStatus::Valid )
+            allValid = false;
+        if ( results != nullptr )
+            results->emplace_back(references[i], state->statuses[i]);
+    }
+    
+    return allValid;
+}
 
 EPUB3_END_NAMESPACE
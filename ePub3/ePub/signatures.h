@@ -22,20 +22,166 @@
 #define __ePub3__signatures__
 
 #include <ePub3/epub3.h>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 EPUB3_BEGIN_NAMESPACE
 
-class SignatureTransform {};
-class SignedInfo {};
-class DigestValue {};
+class Archive;
+class executor;
+
+/**
+ The result of checking the digest of a single signature reference.
+ @ingroup epub-model
+ */
+enum class DigestStatus : uint8_t
+{
+    NotChecked,         ///< Verification stopped before this reference was checked.
+    Valid,              ///< The digest matches the referenced data.
+    Mismatch,           ///< The digest does not match the referenced data.
+    MissingItem,        ///< The referenced item is not in the container.
+    Unsupported         ///< The reference uses a transform, digest method or URI which is not supported.
+};
+
+/**
+ A transform applied to a reference's data before it is digested.
+ @ingroup epub-model
+ */
+class SignatureTransform
+{
+public:
+    typedef string          algorithm_type;
+    
+public:
+                        SignatureTransform(const algorithm_type& alg=algorithm_type()) : _algorithm(alg) {}
+                        SignatureTransform(const SignatureTransform& o) : _algorithm(o._algorithm) {}
+    
+    ///
+    /// The transform's algorithm URI.
+    const algorithm_type&   Algorithm()     const   { return _algorithm; }
+    
+protected:
+    algorithm_type      _algorithm;
+};
+
+/**
+ A digest value, and the algorithm used to compute it.
+ @ingroup epub-model
+ */
+class DigestValue
+{
+public:
+    typedef string          algorithm_type;
+    
+public:
+                        DigestValue() : _algorithm(), _bytes() {}
+                        DigestValue(const algorithm_type& alg, const std::string& bytes) : _algorithm(alg), _bytes(bytes) {}
+                        DigestValue(const DigestValue& o) : _algorithm(o._algorithm), _bytes(o._bytes) {}
+    
+    ///
+    /// The digest algorithm URI, as in `<DigestMethod>`.
+    const algorithm_type&   Algorithm()     const   { return _algorithm; }
+    ///
+    /// The raw (decoded) bytes of the digest.
+    const std::string&      Bytes()         const   { return _bytes; }
+    
+protected:
+    algorithm_type      _algorithm;
+    std::string         _bytes;
+};
+
 class KeyInfo {};
 class SignatureObject {};
-class SignatureReference {};
+
+/**
+ A single `<Reference>` from a signature's `<SignedInfo>`.
+ @see http://www.w3.org/TR/xmldsig-core1/#sec-Reference
+ @ingroup epub-model
+ */
+class SignatureReference
+{
+public:
+                        SignatureReference() : _uri(), _transforms(), _digest() {}
+                        SignatureReference(const SignatureReference& o) : _uri(o._uri), _transforms(o._transforms), _digest(o._digest) {}
+    
+    /**
+     Reads the reference from a `<Reference>` element.
+     @result Returns `false` if the element has no digest method or value.
+     */
+    EPUB3_EXPORT
+    bool                ParseXML(shared_ptr<xml::Node> node);
+    
+    ///
+    /// The reference's `URI` attribute.
+    const string&       URI()           const   { return _uri; }
+    /**
+     The container-relative path of the referenced item.
+     
+     Returns an empty string for same-document references (those beginning with
+     `#`), which do not refer to an item in the container.
+     */
+    EPUB3_EXPORT
+    string              Path()          const;
+    ///
+    /// The transforms applied to the data before it is digested, in order.
+    const std::vector<SignatureTransform>&  Transforms()    const   { return _transforms; }
+    ///
+    /// The expected digest of the referenced data.
+    const class DigestValue&                Digest()        const   { return _digest; }
+    
+    /**
+     Computes the digest of the referenced item and compares it to Digest().
+     
+     The item is read as a stream, and is only loaded completely when a
+     canonicalization transform is to be applied.
+     @param archive The archive containing the referenced item.
+     @param cancel If not `nullptr`, reading stops as soon as this becomes `true`,
+     and DigestStatus::NotChecked is returned.
+     */
+    EPUB3_EXPORT
+    DigestStatus        VerifyDigest(const Archive& archive, const std::atomic<bool>* cancel=nullptr) const;
+    
+protected:
+    string                          _uri;
+    std::vector<SignatureTransform> _transforms;
+    class DigestValue               _digest;
+};
+
+/**
+ The `<SignedInfo>` of a signature: the list of references it covers.
+ @see http://www.w3.org/TR/xmldsig-core1/#sec-SignedInfo
+ @ingroup epub-model
+ */
+class SignedInfo
+{
+public:
+    typedef string          algorithm_type;
+    typedef std::vector<SignatureReference> ReferenceList;
+    
+public:
+                        SignedInfo() : _canonicalizationMethod(), _signatureMethod(), _references() {}
+    
+    ///
+    /// Reads the `<SignedInfo>` element, returning `false` if it has no references.
+    EPUB3_EXPORT
+    bool                ParseXML(shared_ptr<xml::Node> node);
+    
+    const algorithm_type&   CanonicalizationMethod()    const   { return _canonicalizationMethod; }
+    const algorithm_type&   SignatureMethod()           const   { return _signatureMethod; }
+    const ReferenceList&    References()                const   { return _references; }
+    
+protected:
+    algorithm_type      _canonicalizationMethod;
+    algorithm_type      _signatureMethod;
+    ReferenceList       _references;
+};
 
 /**
  Encapsulates details of a digital signature in an EPUB container.
  
- @todo Implement.
+ Only the digests of a signature's references are verified; the signature value
+ itself, and the KeyInfo and Object elements, are not yet examined.
  @ingroup epub-model
  */
 class DigitalSignature
@@ -48,6 +194,10 @@ public:
     /// Digital signature algorithms are identified using URI strings.
     typedef string          algorithm_type;
     
+    ///
+    /// The status of each reference checked by VerifyReferenceDigests().
+    typedef std::vector<std::pair<const SignatureReference*, DigestStatus>>   DigestResults;
+    
 public:
                 DigitalSignature() : _signedInfo(), _keyInfo(), _object() {}
     /**
@@ -93,6 +243,37 @@ public:
     EPUB3_EXPORT
     bool                        Validate()                          const;
     
+    /**
+     Checks the digests of all this signature's references.
+     @see VerifyReferenceDigests(const std::vector<const SignatureReference*>&, const Archive&, bool, DigestResults*, std::shared_ptr<executor>)
+     */
+    EPUB3_EXPORT
+    bool                        VerifyReferenceDigests(const Archive& archive, bool stopAtFirstFailure=false,
+                                                       DigestResults* results=nullptr,
+                                                       std::shared_ptr<executor> exec=nullptr) const;
+    
+    /**
+     Checks the digests of a set of references concurrently.
+     
+     Each referenced item is streamed from the archive and hashed in its own task
+     on an executor (a shared thread pool by default).
+     @param references The references to check.
+     @param archive The archive containing the referenced items.
+     @param stopAtFirstFailure If `true`, verification stops as soon as any
+     reference fails: tasks not yet started are skipped, and those in progress stop
+     reading. The skipped references are reported as DigestStatus::NotChecked.
+     @param results If not `nullptr`, receives the status of every reference, in
+     the order given.
+     @param exec The executor on which to hash the items, or `nullptr` to use the
+     shared thread pool.
+     @result Returns `true` if every reference's digest is valid.
+     */
+    EPUB3_EXPORT
+    static bool                 VerifyReferenceDigests(const std::vector<const SignatureReference*>& references,
+                                                       const Archive& archive, bool stopAtFirstFailure=false,
+                                                       DigestResults* results=nullptr,
+                                                       std::shared_ptr<executor> exec=nullptr);
+    
 protected:
     unique_ptr<class SignedInfo>        _signedInfo;
     unique_ptr<class KeyInfo>           _keyInfo;
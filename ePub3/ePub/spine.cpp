@@ -27,10 +27,10 @@ EPUB3_BEGIN_NAMESPACE
 const IRI SpineItem::PageSpreadRightPropertyIRI("http://idpf.org/epub/vocab/package/#page-spread-right");
 const IRI SpineItem::PageSpreadLeftPropertyIRI("http://idpf.org/epub/vocab/package/#page-spread-left");
 
-SpineItem::SpineItem(const shared_ptr<Package>& owner) : OwnedBy(owner), PropertyHolder(owner), _idref(), _linear(true), _next(), _prev()
+SpineItem::SpineItem(const shared_ptr<Package>& owner) : OwnedBy(owner), PropertyHolder(owner), _idref(), _linear(true), _next(), _prev(), _index(0)
 {
 }
-SpineItem::SpineItem(SpineItem&& o) : OwnedBy(std::move(o)), PropertyHolder(std::move(o)), XMLIdentifiable(std::move(o)), _idref(std::move(o._idref)), _linear(o._linear), _prev(std::move(o._prev)), _next(std::move(o._next))
+SpineItem::SpineItem(SpineItem&& o) : OwnedBy(std::move(o)), PropertyHolder(std::move(o)), XMLIdentifiable(std::move(o)), _idref(std::move(o._idref)), _linear(o._linear), _prev(std::move(o._prev)), _next(std::move(o._next)), _index(o._index)
 {
 }
 SpineItem::~SpineItem()
@@ -89,6 +89,14 @@ PageSpread SpineItem::Spread() const
     
     return PageSpread::Automatic;
 }
+const string& SpineItem::Title() const
+{
+    // titles come from the TOC, which a lazily-opened package loads on demand
+    PackagePtr package = GetPackage();
+    if ( bool(package) )
+        package->LoadDeferredContent();
+    return _toc_title;
+}
 shared_ptr<SpineItem> SpineItem::NextStep() const
 {
     auto n = Next();
@@ -137,6 +145,11 @@ void SpineItem::SetNextItem(const shared_ptr<SpineItem>& next)
     next->_next = _next;
     next->_prev = enable_shared_from_this<SpineItem>::shared_from_this();
     _next = next;
+    
+    // renumber from the insertion point; a no-op beyond `next` when appending
+    size_t idx = _index;
+    for ( SpineItem* item = next.get(); item != nullptr; item = item->_next.get() )
+        item->_index = ++idx;
 }
 
 EPUB3_END_NAMESPACE
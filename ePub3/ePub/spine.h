@@ -118,8 +118,8 @@ public:
     /// Returns an O(n) count of items in the spine (starting with this item).
     inline size_t       Count()             const       { return (_next == nullptr ? 1 : 1 + _next->Count()); }
     ///
-    /// Returns the index of the current item in the overall spine. O(n).
-    inline size_t       Index()             const       { return (_prev.expired() ? 0 : _prev.lock()->Index() + 1); }
+    /// Returns the index of the current item in the overall spine. O(1).
+    inline size_t       Index()             const       { return _index; }
     
     ///
     /// Returns this item's identifier (if any).
@@ -142,7 +142,7 @@ public:
 	///
 	/// The title for this spine item, as defined in the TOC.
 	EPUB3_EXPORT
-	const string&		Title()				const		{ return _toc_title; }
+	const string&		Title()				const;
 	void				SetTitle(const string& str)		{ _toc_title = str; }
     
     /// @}
@@ -206,6 +206,7 @@ protected:
     
     weak_ptr<SpineItem>     _prev;              ///< The SpineItem preceding this one in the spine.
     shared_ptr<SpineItem>   _next;              ///< The SpineItem following this one in the spine.
+    size_t                  _index;             ///< The position of this item in the spine.
     
     friend class Package;
     
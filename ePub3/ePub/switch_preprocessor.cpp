@@ -22,17 +22,9 @@
 #include "package.h"
 #include "container.h"
 #include "filter_manager.h"
-#include REGEX_INCLUDE
 
 EPUB3_BEGIN_NAMESPACE
 
-static const REGEX_NS::regex_constants::syntax_option_type SwitchRegexFlags = REGEX_NS::regex::icase|REGEX_NS::regex::optimize|REGEX_NS::regex::ECMAScript;
-
-REGEX_NS::regex SwitchPreprocessor::CommentedSwitchIdentifier("(?:<!--)(\\s*<(?:epub:)switch(?:.|\\n|\\r)*?<(?:epub:)default(?:.|\\n|\\r)*?>\\s*)(?:-->)((?:.|\\n|\\r)*?)(?:<!--)(\\s*</(?:epub:)default>(?:.|\\n|\\r)*?)(?:-->)", SwitchRegexFlags);
-REGEX_NS::regex SwitchPreprocessor::SwitchContentExtractor("<(?:epub:)?switch(?:.|\\n|\\r)*?>((?:.|\\n|\\r)*?)</(?:epub:)?switch(?:.|\\n|\\r)*?>", SwitchRegexFlags);
-REGEX_NS::regex SwitchPreprocessor::CaseContentExtractor("<(?:epub:)?case\\s+required-namespace=\"(.*?)\">((?:.|\\n|\\r)*?)</(?:epub:)?case(?:.|\\n|\\r)*?>", SwitchRegexFlags);
-REGEX_NS::regex SwitchPreprocessor::DefaultContentExtractor("<(?:epub:)?default(?:.|\\n|\\r)*?>((?:.|\\n|\\r)*?)</(?:epub:)?default(?:.|\\n|\\r)*?>", SwitchRegexFlags);
-
 #if EPUB_COMPILER_SUPPORTS(CXX_INITIALIZER_LISTS)
 SwitchPreprocessor::NamespaceList SwitchPreprocessor::_supportedNamespaces{};
 #else
@@ -40,6 +32,48 @@ static const string __default_namespaces[1] = {MathMLNamespaceURI};
 SwitchPreprocessor::NamespaceList SwitchPreprocessor::_supportedNamespaces(&__default_namespaces[0], &__default_namespaces[1]);
 #endif
 
+// ASCII case-insensitive equality, as element names were matched before
+static bool EqualsIgnoringCase(string_view a, string_view b)
+{
+    if ( a.size() != b.size() )
+        return false;
+    for ( size_t i = 0; i < a.size(); i++ )
+    {
+        if ( ::tolower(static_cast<unsigned char>(a[i])) != ::tolower(static_cast<unsigned char>(b[i])) )
+            return false;
+    }
+    return true;
+}
+static bool StartsWithIgnoringCase(string_view str, string_view prefix)
+{
+    return str.size() >= prefix.size() && EqualsIgnoringCase(str.substr(0, prefix.size()), prefix);
+}
+// matches `epub:name`, or also a bare `name` if `prefixOptional` is set
+static bool IsEPUBElement(string_view qname, string_view name, bool prefixOptional)
+{
+    if ( qname.size() == name.size() + 5 )
+        return StartsWithIgnoringCase(qname, "epub:") && EqualsIgnoringCase(qname.substr(5), name);
+    return prefixOptional && EqualsIgnoringCase(qname, name);
+}
+static string_view TrimMarkupSpace(string_view str)
+{
+    size_t start = str.find_first_not_of(" \t\r\n");
+    if ( start == string_view::npos )
+        return string_view();
+    size_t end = str.find_last_not_of(" \t\r\n");
+    return str.substr(start, end - start + 1);
+}
+
+bool SwitchPreprocessor::SwitchContext::IsOutputting() const
+{
+    for ( auto& sw : _switches )
+    {
+        if ( sw.state != State::InChosenBranch )
+            return false;
+    }
+    return true;
+}
+
 bool SwitchPreprocessor::SniffSwitchableContent(ConstManifestItemPtr item)
 {
     return (item->MediaType() == "application/xhtml+xml" && item->HasProperty(ItemProperties::ContainsSwitch));
@@ -57,81 +91,210 @@ void SwitchPreprocessor::Register()
 {
     FilterManager::Instance()->RegisterFilter("SwitchPreprocessor", SwitchStaticHandling, SwitchFilterFactory);
 }
-void * SwitchPreprocessor::FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen)
+// how a comment opening with an epub:switch relates to the switch within it
+enum class CommentedSwitch
+{
+    Unknown,    ///< We need to see more of the document.
+    Partially,  ///< Only the switch's structure is commented, ending before the default's content.
+    Entirely    ///< The whole switch is commented out.
+};
+static CommentedSwitch ClassifyCommentedSwitch(const char* begin, const char* end, bool final)
+{
+    typedef MarkupTokenizer::TokenType TokenType;
+    
+    // walk forward to the default's start tag, and see whether a `-->` comes next
+    CommentedSwitch result = CommentedSwitch::Unknown;
+    int depth = 0;
+    bool inDefault = false;
+    MarkupTokenizer tokenizer;
+    tokenizer.Tokenize(begin, size_t(end - begin), final, [&](const MarkupTokenizer::Token& token) {
+        if ( inDefault )
+        {
+            if ( token.Type() == TokenType::Text )
+            {
+                string_view text = TrimMarkupSpace(string_view(token.Data(), token.Length()));
+                if ( text.empty() )
+                    return true;
+                if ( text.substr(0, 3) == "-->" )
+                {
+                    result = CommentedSwitch::Partially;
+                    return false;
+                }
+                if ( !final && token.Data() + token.Length() == end && string_view("-->").substr(0, text.size()) == text )
+                    return false;
+            }
+            result = CommentedSwitch::Entirely;
+            return false;
+        }
+        
+        if ( token.IsTag() && IsEPUBElement(token.Name(), "switch", false) )
+        {
+            if ( token.Type() == TokenType::StartTag )
+                depth++;
+            else if ( token.Type() == TokenType::EndTag && --depth <= 0 )
+            {
+                result = CommentedSwitch::Entirely;
+                return false;
+            }
+        }
+        else if ( depth == 1 && token.Type() == TokenType::StartTag && IsEPUBElement(token.Name(), "default", true) )
+        {
+            inDefault = true;
+        }
+        return true;
+    });
+    
+    if ( result == CommentedSwitch::Unknown && final )
+        result = CommentedSwitch::Entirely;
+    return result;
+}
+void SwitchPreprocessor::RewriteCommentContent(MarkupRewriterContext* context, const char* begin, const char* end, Output& output)
 {
-    char* input = reinterpret_cast<char*>(data);
+    MarkupTokenizer tokenizer;
+    tokenizer.Tokenize(begin, size_t(end - begin), true, [&](const MarkupTokenizer::Token& inner) {
+        return RewriteToken(context, inner, output);
+    });
+}
+bool SwitchPreprocessor::RewriteToken(MarkupRewriterContext* context, const MarkupTokenizer::Token& token, Output& output)
+{
+    typedef MarkupTokenizer::TokenType TokenType;
+    typedef SwitchContext::State State;
     
-    // handle partially-commented switch statements
-    std::string inputStr(reinterpret_cast<const char*>(data));
-    std::string replacement("$1$2$3");
-    std::string str = REGEX_NS::regex_replace(inputStr, CommentedSwitchIdentifier, replacement);
+    SwitchContext* ctx = static_cast<SwitchContext*>(context);
+    std::vector<SwitchContext::Switch>& switches = ctx->Switches();
     
-    // str now contains a non-commented value (or the input if no switch statements were commented out)
-    auto pos = REGEX_NS::sregex_iterator(str.begin(), str.end(), SwitchContentExtractor);
-    auto end = REGEX_NS::sregex_iterator();
+    if ( ctx->_stripClose )
+    {
+        // the `-->` closing the comment before a partially-commented default's content
+        if ( token.Type() == TokenType::Text )
+        {
+            string_view text(token.Data(), token.Length());
+            size_t first = text.find_first_not_of(" \t\r\n");
+            if ( first == string_view::npos )
+            {
+                if ( ctx->IsOutputting() )
+                    output.Write(token);
+                return true;
+            }
+            if ( text.substr(first, 3) == "-->" )
+            {
+                ctx->_stripClose = false;
+                if ( ctx->IsOutputting() )
+                {
+                    output.Write(token.Data(), first);
+                    output.Write(token.Data() + first + 3, token.Length() - first - 3);
+                }
+                return true;
+            }
+            if ( !ctx->IsFinal() && ctx->Lookahead(token).empty() && string_view("-->").substr(0, text.size() - first) == text.substr(first) )
+                return false;   // wait and see
+        }
+        ctx->_stripClose = false;
+    }
     
-    std::string output;
-    while ( pos != end )
+    if ( token.IsTag() )
     {
-        // output any non-matched characters
-        output += pos->prefix();
-        
-        std::string switchContents = pos->str(1);
+        string_view name = token.Name();
         
-        bool matched = false;
+        if ( IsEPUBElement(name, "switch", false) )
+        {
+            // the switch's own tags are never output
+            if ( token.Type() == TokenType::StartTag )
+            {
+                switches.emplace_back();
+            }
+            else if ( token.Type() == TokenType::EndTag && !switches.empty() )
+            {
+                if ( switches.size() == ctx->_commentedDepth )
+                    ctx->_commentedDepth = 0;
+                switches.pop_back();
+            }
+            else if ( token.Type() == TokenType::EndTag && ctx->IsOutputting() )
+            {
+                output.Write(token);
+            }
+            return true;
+        }
         
-        // now scan the contents for any epub:case statements
-        if ( _supportedNamespaces.size() != 0 )
+        bool isCase = IsEPUBElement(name, "case", true);
+        if ( !switches.empty() && (isCase || IsEPUBElement(name, "default", true)) )
         {
-            auto cpos = REGEX_NS::sregex_iterator(switchContents.begin(), switchContents.end(), CaseContentExtractor);
-            while ( cpos != end )
+            SwitchContext::Switch& sw = switches.back();
+            if ( token.Type() != TokenType::EndTag && sw.state == State::BetweenBranches )
             {
-                for ( auto ns : _supportedNamespaces )
+                // the first supported case wins, else the default
+                bool chosen = !sw.matched;
+                if ( chosen && isCase )
                 {
-                    if ( ns == cpos->str(1) )
+                    string_view ns;
+                    chosen = false;
+                    if ( token.GetAttribute("required-namespace", ns) )
                     {
-                        // this case uses a supported namespace
-                        matched = true;
-                        break;
+                        for ( auto& supported : _supportedNamespaces )
+                        {
+                            if ( ns == string_view(supported.stl_str()) )
+                            {
+                                chosen = true;
+                                break;
+                            }
+                        }
                     }
                 }
                 
-                if ( matched )
+                sw.matched = sw.matched || chosen;
+                if ( token.Type() == TokenType::StartTag )
                 {
-                    // we matched the case, so append its contents and skip the remainder
-                    output += cpos->str(2);
-                    break;
+                    sw.state = (chosen ? State::InChosenBranch : State::InSkippedBranch);
+                    if ( !isCase && switches.size() == ctx->_commentedDepth )
+                        ctx->_stripClose = true;
                 }
-                
-                ++cpos;
+                return true;
+            }
+            if ( token.Type() == TokenType::EndTag && sw.state != State::BetweenBranches )
+            {
+                sw.state = State::BetweenBranches;
+                return true;
             }
         }
+    }
+    else if ( token.Type() == TokenType::Comment )
+    {
+        string_view comment = TrimMarkupSpace(token.CommentText());
+        const char* commentEnd = token.Data() + token.Length();
         
-        if ( !matched )
+        if ( ctx->_commentedDepth == 0 && StartsWithIgnoringCase(comment, "<epub:switch") )
         {
-            // no matching case statements, so find the epub:default
-            REGEX_NS::smatch defaultCase;
-            if ( REGEX_NS::regex_search(switchContents, defaultCase, DefaultContentExtractor) )
-                output += defaultCase[1].str();
+            // the switch may contain comments of its own, so this might not be where the comment really ends
+            string_view lookahead = ctx->Lookahead(token);
+            switch ( ClassifyCommentedSwitch(token.Data() + 4, lookahead.data() + lookahead.size(), ctx->IsFinal()) )
+            {
+                case CommentedSwitch::Unknown:
+                    return false;
+                case CommentedSwitch::Partially:
+                    ctx->_commentedDepth = switches.size() + 1;
+                    break;
+                case CommentedSwitch::Entirely:
+                    if ( ctx->IsOutputting() )
+                        output.Write("<!--", 4);
+                    break;
+            }
+            
+            // either way, the switch itself is processed
+            RewriteCommentContent(context, token.Data() + 4, commentEnd, output);
+            return true;
         }
         
-        // step forward, and if we get the end let's output the current suffix
-        // this ensures that we don't lose everything following the last match
-        auto here = pos++;
-        if ( pos == end )
-            output += here->suffix();
-    }
-    
-    *outputLen = output.size();
-    if ( output.size() < len )
-    {
-        output.copy(input, output.size());
-        return input;
+        if ( !switches.empty() && (StartsWithIgnoringCase(comment, "</epub:default") || StartsWithIgnoringCase(comment, "</default")) )
+        {
+            // the closing half of a partially-commented switch: `<!--</epub:default></epub:switch>-->`
+            RewriteCommentContent(context, token.Data() + 4, commentEnd - 3, output);
+            return true;
+        }
     }
     
-    char* result = new char[output.size()];
-    output.copy(result, output.size());
-    return result;
+    if ( ctx->IsOutputting() )
+        output.Write(token);
+    return true;
 }
 
 EPUB3_END_NAMESPACE
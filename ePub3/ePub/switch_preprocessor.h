@@ -22,9 +22,8 @@
 #define __ePub3__switch_preprocessor__
 
 #include <ePub3/epub3.h>
-#include <ePub3/filter.h>
+#include <ePub3/markup_rewriter.h>
 #include <vector>
-#include REGEX_INCLUDE
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -40,10 +39,13 @@ EPUB3_BEGIN_NAMESPACE
  If a document contains an epub:switch statement but doesn't have this property,
  then that file will be passed through unchanged.
  
+ The document is rewritten in place as it streams through the filter chain; since
+ the output is only ever a subset of the input, no additional memory is needed.
+ 
  It should be used only for reading, never for writing.
  @ingroup filters
  */
-class SwitchPreprocessor : public ContentFilter, public PointerType<SwitchPreprocessor>
+class SwitchPreprocessor : public MarkupRewriter, public PointerType<SwitchPreprocessor>
 {
 public:
     ///
@@ -57,40 +59,67 @@ protected:
     
     static ContentFilterPtr SwitchFilterFactory(ConstPackagePtr package);
     
+    /**
+     Per-stream state: the epub:switch elements currently open.
+     */
+    class SwitchContext : public MarkupRewriterContext
+    {
+    public:
+        enum class State : uint8_t
+        {
+            BetweenBranches,    ///< Within the switch, outside any case or default.
+            InChosenBranch,     ///< Within the case or default whose content is output.
+            InSkippedBranch     ///< Within a case or default whose content is dropped.
+        };
+        
+        struct Switch
+        {
+            State   state;
+            bool    matched;    ///< Whether a branch has been chosen yet.
+            
+            Switch() : state(State::BetweenBranches), matched(false) {}
+        };
+        
+        SwitchContext() : MarkupRewriterContext(), _switches(), _commentedDepth(0), _stripClose(false) {}
+        virtual ~SwitchContext() {}
+        
+        ///
+        /// All open switch elements, outermost first.
+        std::vector<Switch>&    Switches()      { return _switches; }
+        
+        ///
+        /// Content is output only if every open switch is within its chosen branch.
+        bool                    IsOutputting()  const;
+        
+    private:
+        std::vector<Switch>     _switches;
+        size_t                  _commentedDepth;    ///< The depth of a partially-commented switch, or zero.
+        bool                    _stripClose;        ///< Whether the next `-->` is that switch's stray comment terminator.
+        
+        friend class SwitchPreprocessor;
+    };
+    
 public:
     
     /**
      The default constructor indicates that no additional content is supported, and
      the resulting filter will only preserve the content of epub:default tags.
      */
-    SwitchPreprocessor() : ContentFilter(SniffSwitchableContent) {}
+    SwitchPreprocessor() : MarkupRewriter(SniffSwitchableContent) {}
     
     ///
     /// The standard copy constructor.
-    SwitchPreprocessor(const SwitchPreprocessor& o) : ContentFilter(o) {}
+    SwitchPreprocessor(const SwitchPreprocessor& o) : MarkupRewriter(o) {}
     
     ///
     /// The standard C++11 'move' constructor.
-    SwitchPreprocessor(SwitchPreprocessor&& o) : ContentFilter(std::move(o)) {}
+    SwitchPreprocessor(SwitchPreprocessor&& o) : MarkupRewriter(std::move(o)) {}
     
-    /**
-     This processor won't work on streamed data, it requires the whole thing at once.
-     */
-    virtual bool RequiresCompleteData() const { return true; }
+    virtual FilterContext* MakeFilterContext(ConstManifestItemPtr item) const OVERRIDE { return new SwitchContext(); }
     
-    /**
-     Filters the input data using regular expressions to identify epub:switch
-     compounds and replace them wholesale wih the contents of an epub:case or
-     epub:default element.
-     
-     If the list of supported namespaces is empty, then this takes an optimized path,
-     ignoring epub:case elements completely. Otherwise, it will inspect the 
-     `required-namespace` attribute of each case element and will match it against
-     the contents of its supported namespace list to make a decision. The first
-     matching epub:case statement will be output in place of the entire switch
-     compound.
-     */
-    virtual void * FilterData(FilterContext* context, void *data, size_t len, size_t *outputLen) OVERRIDE;
+    ///
+    /// The output is never longer than the input.
+    virtual bool SupportsInPlaceFiltering() const OVERRIDE { return true; }
     
     ///
     /// Register this filter with the filter manager
@@ -109,11 +138,16 @@ protected:
      */
     static NamespaceList    _supportedNamespaces;
     
-private:
     /**
-     A regex to un-comment any epub:switch blocks.
+     Replaces each epub:switch compound with the contents of an epub:case or
+     epub:default element.
      
-     For instance, we might see:
+     If the list of supported namespaces is empty, then no epub:case element will
+     match. Otherwise, the `required-namespace` attribute of each case element is
+     matched against the supported namespace list, and the first matching epub:case
+     element's content is output in place of the entire switch compound.
+     
+     Partially-commented switch compounds are also handled. For instance, we might see:
      
          <!--<epub:switch id="bob">
            <epub:case required-namespace="...">
@@ -124,27 +158,20 @@ private:
            </epub:default>
          </epub:switch>-->
      
-     This regex will identify such constructs, but will NOT match an entire
-     commented-out epub:switch block (i.e. where the publisher has chosen to comment
-     out the whole thing and provide only the default content).
-     */
-    static REGEX_NS::regex   CommentedSwitchIdentifier;
-    
-    /**
-     This expression locates and isolates the content of each epub:switch element.
-     */
-    static REGEX_NS::regex   SwitchContentExtractor;
-    
-    /**
-     This expression locates and extracts the contents and types of each epub:case
-     element.
+     Comments such as these are treated as though their contents were not commented
+     out. A comment containing an entire epub:switch block (i.e. where the publisher
+     has chosen to comment out the whole thing and provide only the default content)
+     stays a comment, though the switch within it is still processed.
+     
+     The two can't be told apart until the epub:default element is reached, so the
+     `<!--` is held back (along with everything after it) until then.
      */
-    static REGEX_NS::regex   CaseContentExtractor;
+    virtual bool RewriteToken(MarkupRewriterContext* context, const MarkupTokenizer::Token& token, Output& output) OVERRIDE;
     
-    /**
-     This expression locates and extracts the content of the epub:default element.
-     */
-    static REGEX_NS::regex   DefaultContentExtractor;
+private:
+    ///
+    /// Runs the content of a comment through RewriteToken() as markup.
+    void RewriteCommentContent(MarkupRewriterContext* context, const char* begin, const char* end, Output& output);
     
 };
 
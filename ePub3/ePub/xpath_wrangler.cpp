@@ -24,28 +24,40 @@
 
 EPUB3_BEGIN_NAMESPACE
 
-XPathWrangler::XPathWrangler(shared_ptr<xml::Document> doc, const NamespaceList& namespaces) : _doc(doc), _namespaces(namespaces)
+XPathWrangler::XPathWrangler(shared_ptr<xml::Document> doc, const NamespaceList& namespaces) : _doc(doc), _namespaces(namespaces), _evaluator()
 {
 }
-XPathWrangler::XPathWrangler(const XPathWrangler& o) : _doc(o._doc), _namespaces(o._namespaces)
+XPathWrangler::XPathWrangler(const XPathWrangler& o) : _doc(o._doc), _namespaces(o._namespaces), _evaluator()
 {
 }
-XPathWrangler::XPathWrangler(XPathWrangler&& o) : _doc(std::move(o._doc))
+XPathWrangler::XPathWrangler(XPathWrangler&& o) : _doc(std::move(o._doc)), _namespaces(std::move(o._namespaces)), _evaluator(std::move(o._evaluator))
 {
 }
 XPathWrangler::~XPathWrangler()
 {
 }
+xml::XPathEvaluator& XPathWrangler::Evaluator(const string& xpath)
+{
+    if ( !bool(_evaluator) )
+    {
+        _evaluator.reset(new xml::XPathEvaluator(xpath, _doc));
+        for ( auto& pair : _namespaces )
+        {
+            _evaluator->RegisterNamespace(pair.first, pair.second);
+        }
+    }
+    else
+    {
+        _evaluator->SetXPath(xpath);
+    }
+    return *_evaluator;
+}
 XPathWrangler::StringList XPathWrangler::Strings(const string& xpath, shared_ptr<xml::Node> node)
 {
     StringList strings;
     
-	xml::XPathEvaluator eval(xml::string(xpath.c_str()), _doc);
+	xml::XPathEvaluator& eval = Evaluator(xpath);
 	xml::XPathEvaluator::ObjectType type;
-    for (auto& pair : _namespaces)
-    {
-        eval.RegisterNamespace(pair.first.stl_str(), pair.second.stl_str());
-    }
 
 	if ( eval.Evaluate((bool(node) ? node : _doc), &type) )
     {
@@ -77,11 +89,7 @@ xml::NodeSet XPathWrangler::Nodes(const string& xpath, shared_ptr<xml::Node> nod
 {
 	xml::NodeSet result;
 
-    xml::XPathEvaluator eval(xml::string(xpath.c_str()), _doc);
-	for (auto& item : _namespaces)
-	{
-		eval.RegisterNamespace(item.first.stl_str(), item.second.stl_str());
-	}
+    xml::XPathEvaluator& eval = Evaluator(xpath);
 	xml::XPathEvaluator::ObjectType type;
     if ( eval.Evaluate((bool(node) ? node : _doc), &type) )
     {
@@ -98,6 +106,8 @@ void XPathWrangler::RegisterNamespaces(const NamespaceList &namespaces)
     for ( auto item : namespaces )
     {
 		_namespaces[item.first] = item.second;
+        if ( bool(_evaluator) )
+            _evaluator->RegisterNamespace(item.first, item.second);
     }
 }
 void XPathWrangler::NameDefaultNamespace(const string& name)
@@ -108,6 +118,8 @@ void XPathWrangler::NameDefaultNamespace(const string& name)
 		if (ns->Prefix().empty())
 		{
 			_namespaces[""] = ns->URI();
+            if ( bool(_evaluator) )
+                _evaluator->RegisterNamespace("", ns->URI());
 		}
 	}
 }
@@ -27,6 +27,7 @@
 #include <ePub3/utilities/utfstring.h>
 #include <ePub3/xml/xpath.h>
 #include <map>
+#include <memory>
 #include <vector>
 
 EPUB3_BEGIN_NAMESPACE
@@ -34,6 +35,11 @@ EPUB3_BEGIN_NAMESPACE
 /**
  A simple object which encapsulates the use of an XPath expression in libxml2.
  
+ A single XPath evaluation context is created for the document when the first query
+ is run, and is reused for every query after that. The compiled form of each XPath
+ is shared across the whole process. An XPathWrangler should therefore not be used
+ from more than one thread at a time.
+ 
  @ingroup utilities
  */
 class XPathWrangler
@@ -166,8 +172,13 @@ public:
     /// @}
     
 protected:
+    ///
+    /// Returns the document's evaluation context, ready to evaluate `xpath`.
+    xml::XPathEvaluator&        Evaluator(const string& xpath);
+    
 	shared_ptr<xml::Document>	_doc;			///< The XML document on which this will operate.
 	NamespaceList				_namespaces;	///< The namespaces to register when running XPath queries.
+    std::unique_ptr<xml::XPathEvaluator>    _evaluator; ///< Created on first use.
 };
 
 EPUB3_END_NAMESPACE
@@ -25,8 +25,12 @@
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <cctype>
+#include <cstring>
 #if EPUB_OS(UNIX)
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 #include <fcntl.h>
 #if EPUB_OS(WINDOWS)
@@ -178,13 +182,14 @@ string ZipArchive::TempFilePath()
 {
     return GetTempFilePath("zip");
 }
-ZipArchive::ZipArchive(const string & path)
+ZipArchive::ZipArchive(const string & path) : _caseInsensitive(false)
 {
     int zerr = 0;
     _zip = zip_open(path.c_str(), ZIP_CREATE, &zerr);
     if ( _zip == nullptr )
         throw std::runtime_error(std::string("zip_open() failed: ") + zError(zerr));
     _path = path;
+    BuildNameIndex();
 }
 ZipArchive::~ZipArchive()
 {
@@ -197,6 +202,8 @@ Archive & ZipArchive::operator = (ZipArchive &&o)
         zip_close(_zip);
     _zip = o._zip;
     o._zip = nullptr;
+    _nameIndex = std::move(o._nameIndex);
+    _caseInsensitive = o._caseInsensitive;
     return dynamic_cast<Archive&>(*this);
 }
 void ZipArchive::EachItem(std::function<void (const ArchiveItemInfo &)> fn) const
@@ -214,33 +221,45 @@ void ZipArchive::EachItem(std::function<void (const ArchiveItemInfo &)> fn) cons
 }
 bool ZipArchive::ContainsItem(const string & path) const
 {
-    return (zip_name_locate(_zip, Sanitized(path).c_str(), 0) >= 0);
+    return (IndexOfItem(path) >= 0);
 }
 bool ZipArchive::DeleteItem(const string & path)
 {
-    int idx = zip_name_locate(_zip, Sanitized(path).c_str(), 0);
-    if ( idx >= 0 )
-        return (zip_delete(_zip, idx) >= 0);
+    int idx = IndexOfItem(path);
+    if ( idx >= 0 && zip_delete(_zip, idx) >= 0 )
+    {
+        _nameIndex.erase(IndexKey(path));
+        return true;
+    }
     return false;
 }
 bool ZipArchive::CreateFolder(const string & path)
 {
-    return (zip_add_dir(_zip, Sanitized(path).c_str()) >= 0);
+    int idx = zip_add_dir(_zip, Sanitized(path).c_str());
+    if ( idx < 0 )
+        return false;
+    
+    IndexItem(idx);
+    return true;
 }
 unique_ptr<ByteStream> ZipArchive::ByteStreamAtPath(const string &path) const
 {
-    return make_unique<ZipFileByteStream>(_zip, path);
+    return make_unique<ZipFileByteStream>(_zip, IndexOfItem(path));
 }
 unique_ptr<AsyncByteStream> ZipArchive::AsyncByteStreamAtPath(const string& path) const
 {
-    return make_unique<AsyncZipFileByteStream>(_zip, path);
+    return make_unique<AsyncZipFileByteStream>(_zip, IndexOfItem(path));
 }
 unique_ptr<ArchiveReader> ZipArchive::ReaderAtPath(const string & path) const
 {
     if (_zip == nullptr)
         return nullptr;
     
-    struct zip_file* file = zip_fopen(_zip, Sanitized(path).c_str(), 0);
+    int idx = IndexOfItem(path);
+    if (idx < 0)
+        return nullptr;
+    
+    struct zip_file* file = zip_fopen_index(_zip, idx, 0);
 
     if (file == nullptr)
         return nullptr;
@@ -252,7 +271,13 @@ unique_ptr<ArchiveWriter> ZipArchive::WriterAtPath(const string & path, bool com
     if (_zip == nullptr)
         return nullptr;
     
-    int idx = zip_name_locate(_zip, Sanitized(path).c_str(), (create ? ZIP_CREATE : 0));
+    int idx = IndexOfItem(path);
+    if (idx == -1 && create)
+    {
+        idx = zip_name_locate(_zip, Sanitized(path).c_str(), ZIP_CREATE);
+        if (idx >= 0)
+            IndexItem(idx);
+    }
     if (idx == -1)
         return nullptr;
     
@@ -268,16 +293,202 @@ unique_ptr<ArchiveWriter> ZipArchive::WriterAtPath(const string & path, bool com
 ArchiveItemInfo ZipArchive::InfoAtPath(const string & path) const
 {
     struct zip_stat sbuf;
-    if ( zip_stat(_zip, Sanitized(path).c_str(), 0, &sbuf) < 0 )
+    int idx = IndexOfItem(path);
+    if ( idx < 0 )
+        throw std::runtime_error(std::string("zip_stat("+path.stl_str()+") - No such file"));
+    if ( zip_stat_index(_zip, idx, 0, &sbuf) < 0 )
         throw std::runtime_error(std::string("zip_stat("+path.stl_str()+") - " + zip_strerror(_zip)));
     return ZipItemInfo(sbuf);
 }
+void ZipArchive::SetCaseInsensitiveLookup(bool flag)
+{
+    if ( flag == _caseInsensitive )
+        return;
+    
+    _caseInsensitive = flag;
+    BuildNameIndex();
+}
+size_t ZipArchive::SeekCheckpointInterval() const
+{
+    if ( _zip == nullptr )
+        return 0;
+    return static_cast<size_t>(_zip->inflate_span);
+}
+void ZipArchive::SetSeekCheckpointInterval(size_t bytes)
+{
+    if ( _zip == nullptr )
+        return;
+    _zip->inflate_span = static_cast<unsigned long>(bytes);
+}
 string ZipArchive::Sanitized(const string& path) const
 {
     if ( path.find('/') == 0 )
         return path.substr(1);
     return path;
 }
+void ZipArchive::BuildNameIndex()
+{
+    _nameIndex.clear();
+    if ( _zip == nullptr )
+        return;
+    
+    int n = zip_get_num_files(_zip);
+    if ( n <= 0 )
+        return;
+    
+    _nameIndex.reserve(static_cast<size_t>(n));
+    for ( int i = 0; i < n; i++ )
+    {
+        IndexItem(i);
+    }
+}
+void ZipArchive::IndexItem(int idx)
+{
+    const char* name = zip_get_name(_zip, idx, 0);
+    if ( name == nullptr )
+        return;
+    
+    // like zip_name_locate(), the first entry with a given name wins
+    _nameIndex.emplace(IndexKey(name), idx);
+}
+std::string ZipArchive::IndexKey(const string& path) const
+{
+    std::string key(Sanitized(path).stl_str());
+    if ( _caseInsensitive )
+    {
+        // only ASCII is folded, same as libzip's ZIP_FL_NOCASE
+        for ( auto& ch : key )
+        {
+            ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+        }
+    }
+    return key;
+}
+int ZipArchive::IndexOfItem(const string& path) const
+{
+    auto found = _nameIndex.find(IndexKey(path));
+    if ( found == _nameIndex.end() )
+        return -1;
+    return found->second;
+}
+
+MappedZipArchive::MappedZipArchive(const string & path) : ZipArchive(path), _base(nullptr), _length(0)
+#if EPUB_PLATFORM(WIN)
+    , _mapping(nullptr)
+#endif
+{
+    Map();
+}
+MappedZipArchive::~MappedZipArchive()
+{
+    // unmap before ZipArchive closes (and possibly rewrites) the file
+    Unmap();
+}
+void MappedZipArchive::Register()
+{
+    RegisterArchive([](const string& path) { return std::unique_ptr<MappedZipArchive>(new MappedZipArchive(path)); },
+                    [](const string& path) { return path.rfind(".zip") == path.size()-4; });
+    RegisterArchive([](const string& path) { return std::unique_ptr<MappedZipArchive>(new MappedZipArchive(path)); },
+                    [](const string& path) { return path.rfind(".epub") == path.size()-5; });
+}
+ArchiveSpan MappedZipArchive::SpanAtPath(const string& path) const
+{
+    if ( _base == nullptr || _zip == nullptr )
+        return ArchiveSpan();
+    
+    int idx = IndexOfItem(path);
+    if ( idx < 0 || idx >= _zip->cdir->nentry || ZIP_ENTRY_DATA_CHANGED(_zip->entry+idx) )
+        return ArchiveSpan();
+    
+    const struct zip_dirent& entry = _zip->cdir->entry[idx];
+    if ( entry.comp_method != ZIP_CM_STORE || (entry.bitflags & ZIP_GPBF_ENCRYPTED) != 0 )
+        return ArchiveSpan();
+    
+    // the data follows the local header, whose name & extra field lengths
+    //  may differ from those in the central directory
+    size_t offset = entry.offset;
+    if ( offset > _length || _length - offset < LENTRYSIZE )
+        return ArchiveSpan();
+    
+    const uint8_t* local = _base + offset;
+    if ( std::memcmp(local, LOCAL_MAGIC, 4) != 0 )
+        return ArchiveSpan();
+    
+    offset += LENTRYSIZE;
+    offset += size_t(local[26]) | (size_t(local[27]) << 8);
+    offset += size_t(local[28]) | (size_t(local[29]) << 8);
+    
+    size_t size = static_cast<size_t>(entry.comp_size);
+    if ( offset > _length || _length - offset < size )
+        return ArchiveSpan();
+    
+    return ArchiveSpan(_base + offset, size);
+}
+void MappedZipArchive::Map()
+{
+#if EPUB_OS(UNIX)
+    int fd = ::open(_path.c_str(), O_RDONLY);
+    if ( fd == -1 )
+        return;
+    
+    struct stat sb;
+    if ( ::fstat(fd, &sb) == 0 && sb.st_size > 0 )
+    {
+        void* addr = ::mmap(nullptr, static_cast<size_t>(sb.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if ( addr != MAP_FAILED )
+        {
+            _base = reinterpret_cast<const uint8_t*>(addr);
+            _length = static_cast<size_t>(sb.st_size);
+        }
+    }
+    
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+#elif EPUB_PLATFORM(WIN)
+    HANDLE file = ::CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+                                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if ( file == INVALID_HANDLE_VALUE )
+        return;
+    
+    LARGE_INTEGER size;
+    if ( ::GetFileSizeEx(file, &size) && size.QuadPart > 0 )
+    {
+        HANDLE mapping = ::CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if ( mapping != NULL )
+        {
+            void* addr = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if ( addr != NULL )
+            {
+                _base = reinterpret_cast<const uint8_t*>(addr);
+                _length = static_cast<size_t>(size.QuadPart);
+                _mapping = mapping;
+            }
+            else
+            {
+                ::CloseHandle(mapping);
+            }
+        }
+    }
+    
+    ::CloseHandle(file);
+#endif
+}
+void MappedZipArchive::Unmap()
+{
+    if ( _base == nullptr )
+        return;
+    
+#if EPUB_OS(UNIX)
+    ::munmap(const_cast<uint8_t*>(_base), _length);
+#elif EPUB_PLATFORM(WIN)
+    ::UnmapViewOfFile(_base);
+    ::CloseHandle(reinterpret_cast<HANDLE>(_mapping));
+    _mapping = nullptr;
+#endif
+    
+    _base = nullptr;
+    _length = 0;
+}
 
 void ZipWriter::DataBlob::Append(const void *data, size_t len)
 {
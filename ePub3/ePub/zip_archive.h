@@ -24,6 +24,7 @@
 #include <ePub3/archive.h>
 #include <libzip/zip.h>
 #include <list>
+#include <unordered_map>
 
 EPUB3_BEGIN_NAMESPACE
 
@@ -33,7 +34,13 @@ EPUB3_BEGIN_NAMESPACE
  @note ZIP archives do not contain any access permission information.
  @note The underlying implementation, `libzip`, writes data only when the archive
  is closed. Any data written to a zip file will therefore be kept in temporary
- storage until the archive object is closed.
+ storage until the archive object is closed. To write a new archive without any
+ temporary storage, use a ZipStreamWriter.
+ @note Item names are looked up through a hash index built when the archive is
+ opened, rather than through `libzip`'s linear search of the central directory.
+ @note Item data is read using positional reads of the archive file, so separate
+ streams opened from one archive may be read concurrently from different threads.
+ Any single stream must still only be used by one thread at a time.
  @see http://www.idpf.org/epub/30/spec/epub30-ocf.html#physical-container-zip
  @ingroup archives
  */
@@ -55,10 +62,10 @@ public:
     ZipArchive(const string & path="");
     ///
     /// move constructos.
-    ZipArchive(ZipArchive &&o) : _zip(o._zip) { o._zip = nullptr; }
+    ZipArchive(ZipArchive &&o) : _zip(o._zip), _nameIndex(std::move(o._nameIndex)), _caseInsensitive(o._caseInsensitive) { o._zip = nullptr; }
     ///
     /// Initialize directly from a `libzip` internal structure.
-    explicit ZipArchive(struct zip * aZip) : _zip(aZip) {}
+    explicit ZipArchive(struct zip * aZip) : _zip(aZip), _caseInsensitive(false) { BuildNameIndex(); }
     virtual ~ZipArchive();
     
     ///
@@ -81,8 +88,48 @@ public:
         
     virtual ArchiveItemInfo InfoAtPath(const string & path) const;
     
+    /**
+     Whether item lookups ignore the case of ASCII characters in item paths.
+     
+     This is `false` by default, matching the behavior of the OCF specification.
+     */
+    bool CaseInsensitiveLookup() const { return _caseInsensitive; }
+    /**
+     Enables or disables case-insensitive lookup of item paths.
+     
+     Changing this setting rebuilds the archive's name index.
+     */
+    EPUB3_EXPORT
+    void SetCaseInsensitiveLookup(bool flag);
+    
+    /**
+     The spacing, in uncompressed bytes, of the seek checkpoints recorded for
+     compressed items.
+     
+     A value of zero (the default) means no checkpoints are recorded.
+     */
+    size_t SeekCheckpointInterval() const;
+    /**
+     Enables seek checkpoints for compressed items.
+     
+     While a compressed item is read, the decompressor's state is recorded
+     roughly every `bytes` bytes of output (each checkpoint costs about 32KB).
+     Later seeks within that item-- by any stream on this archive-- resume
+     decompression from the nearest checkpoint rather than from the start of
+     the item. Only items larger than `bytes` are indexed.
+     @param bytes The checkpoint interval, or zero to stop recording checkpoints.
+     */
+    EPUB3_EXPORT
+    void SetSeekCheckpointInterval(size_t bytes);
+    
 protected:
+    ///
+    /// Maps sanitized (and optionally case-folded) item names to `libzip` indices.
+    typedef std::unordered_map<std::string, int>    NameIndex;
+    
     struct zip *    _zip;           ///< Pointer to the underlying `libzip` data type.
+    NameIndex       _nameIndex;     ///< Hash index of the archive's central directory.
+    bool            _caseInsensitive;   ///< Whether index keys are case-folded.
     
     typedef std::list<zip_source*>  ZipSourceList;
     ZipSourceList   _liveSources;   ///< A list of live zip sources, which must be cleaned up upon closing.
@@ -90,6 +137,71 @@ protected:
     ///
     /// Sanitizes a path string, since `libzip` can be finnicky about them.
     string Sanitized(const string& path) const;
+    
+    ///
+    /// (Re)builds the name index from the archive's central directory.
+    void BuildNameIndex();
+    ///
+    /// Adds a single `libzip` entry to the name index.
+    void IndexItem(int idx);
+    ///
+    /// Returns the key used in the name index for a given item path.
+    std::string IndexKey(const string& path) const;
+    ///
+    /// Locates an item in the name index, returning `-1` if not found.
+    int IndexOfItem(const string& path) const;
+};
+
+/**
+ A ZipArchive which maps the entire archive file into memory.
+ 
+ Items which are stored without compression (typically images, audio, video and
+ fonts) can be accessed in place through SpanAtPath(const string&)const, without
+ any data being copied. All other operations behave exactly as for ZipArchive.
+ 
+ If the file cannot be mapped, the archive still works, but SpanAtPath() will
+ always return an empty span.
+ @ingroup archives
+ */
+class MappedZipArchive : public ZipArchive
+{
+public:
+    ///
+    /// Opens and maps the ZipArchive at a given filesystem path.
+    EPUB3_EXPORT
+    MappedZipArchive(const string & path);
+    virtual ~MappedZipArchive();
+    
+    /**
+     Registers MappedZipArchive as the Archive type used by Archive::Open() for
+     `.epub` and `.zip` files.
+     */
+    EPUB3_EXPORT
+    static void Register();
+    
+    virtual ArchiveSpan SpanAtPath(const string& path) const OVERRIDE;
+    
+    ///
+    /// Whether the archive file was successfully mapped into memory.
+    bool IsMapped() const { return _base != nullptr; }
+    
+private:
+    MappedZipArchive(const MappedZipArchive&) _DELETED_;
+    MappedZipArchive& operator=(const MappedZipArchive&) _DELETED_;
+    
+protected:
+    const uint8_t*  _base;          ///< The start of the mapped archive file.
+    size_t          _length;        ///< The size of the mapped archive file.
+#if EPUB_PLATFORM(WIN)
+    void*           _mapping;       ///< The file mapping object's HANDLE.
+#endif
+    
+    ///
+    /// Maps the file at `_path`, if possible.
+    void Map();
+    ///
+    /// Unmaps the archive file.
+    void Unmap();
 };
 
 EPUB3_END_NAMESPACE
@@ -0,0 +1,563 @@
+//
+//  zip_stream_writer.cpp
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "zip_stream_writer.h"
+#include <ePub3/utilities/executor.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <zlib.h>
+#if EPUB_OS(UNIX)
+#include <unistd.h>
+#endif
+#if EPUB_OS(WINDOWS)
+#include <windows.h>
+#endif
+
+EPUB3_BEGIN_NAMESPACE
+
+// deflate's window: each block is compressed with this much of the previous one as its dictionary
+static const size_t DictionarySize          = 32 * 1024;
+static const size_t MinimumBlockSize        = 64 * 1024;
+
+static const uint32_t LocalHeaderMagic      = 0x04034b50;
+static const uint32_t CentralHeaderMagic    = 0x02014b50;
+static const uint32_t EndOfDirectoryMagic   = 0x06054b50;
+static const size_t   LocalHeaderSize       = 30;
+static const size_t   LocalHeaderCRCOffset  = 14;
+static const uint16_t VersionNeeded         = 20;           // 2.0: deflate & folders
+static const uint16_t VersionMadeBy         = (3 << 8) | 20;    // UNIX, 2.0
+static const uint16_t UTF8NameFlag          = 1 << 11;
+
+static inline void PutLE16(uint8_t*& p, uint16_t v)
+{
+    *p++ = uint8_t(v);
+    *p++ = uint8_t(v >> 8);
+}
+static inline void PutLE32(uint8_t*& p, uint32_t v)
+{
+    PutLE16(p, uint16_t(v));
+    PutLE16(p, uint16_t(v >> 16));
+}
+static uint16_t NameFlags(const string& name)
+{
+    for ( auto ch : name.stl_str() )
+    {
+        if ( static_cast<unsigned char>(ch) > 0x7F )
+            return UTF8NameFlag;
+    }
+    return 0;
+}
+
+static string SiblingTempPath(const string& path)
+{
+#if EPUB_OS(UNIX)
+    std::string tmpl(path.stl_str() + ".XXXXXX");
+    std::vector<char> buf(tmpl.begin(), tmpl.end());
+    buf.push_back('\0');
+
+    int fd = ::mkstemp(buf.data());
+    if ( fd == -1 )
+        throw std::runtime_error(std::string("mkstemp() failed: ") + strerror(errno));
+
+    ::close(fd);
+    return string(buf.data());
+#else
+    return path + ".partial";
+#endif
+}
+static bool MoveFileIntoPlace(const string& from, const string& to)
+{
+#if EPUB_PLATFORM(WIN)
+    return ::MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+# if EPUB_PLATFORM(WINRT)
+    std::remove(to.c_str());
+# endif
+    return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+/**
+ A run of an item's data, deflated independently of its neighbours.
+
+ Every block but the last of an item ends with a sync flush, which byte-aligns the
+ output without ending the deflate stream, so the blocks' outputs can simply be
+ concatenated.
+ */
+struct ZipStreamWriter::Block
+{
+    std::vector<uint8_t>    input;
+    std::vector<uint8_t>    dictionary;     ///< The tail of the previous block's input.
+    std::vector<uint8_t>    output;
+    size_t                  length;         ///< The number of input bytes.
+    uLong                   crc;            ///< The CRC of the input bytes.
+    bool                    last;
+    std::promise<void>      promise;
+    std::future<void>       done;
+
+    Block() : input(), dictionary(), output(), length(0), crc(0), last(false), promise(), done(promise.get_future()) {}
+
+    void                    Deflate(int level);
+};
+
+void ZipStreamWriter::Block::Deflate(int level)
+{
+    length = input.size();
+    crc = crc32(0L, input.data(), static_cast<uInt>(length));
+
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    if ( deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK )
+        throw std::runtime_error(std::string("deflateInit2() failed: ") + (strm.msg != nullptr ? strm.msg : ""));
+
+    if ( !dictionary.empty() )
+        deflateSetDictionary(&strm, dictionary.data(), static_cast<uInt>(dictionary.size()));
+
+    // room for the sync flush's empty stored block, too
+    output.resize(deflateBound(&strm, static_cast<uLong>(input.size())) + 16);
+    strm.next_in = input.data();
+    strm.avail_in = static_cast<uInt>(input.size());
+
+    int flush = (last ? Z_FINISH : Z_SYNC_FLUSH);
+    int r = Z_OK;
+    for ( ;; )
+    {
+        strm.next_out = output.data() + strm.total_out;
+        strm.avail_out = static_cast<uInt>(output.size() - strm.total_out);
+        r = deflate(&strm, flush);
+        if ( r == Z_STREAM_END || (r == Z_OK && !last && strm.avail_in == 0 && strm.avail_out != 0) )
+            break;
+        if ( r != Z_OK && r != Z_BUF_ERROR )
+            break;
+        output.resize(output.size() * 2);
+    }
+
+    output.resize(strm.total_out);
+    deflateEnd(&strm);
+
+    if ( r != Z_OK && r != Z_STREAM_END )
+        throw std::runtime_error(std::string("deflate() failed: ") + zError(r));
+
+    input.clear();
+    input.shrink_to_fit();
+    dictionary.clear();
+    dictionary.shrink_to_fit();
+}
+
+class ZipStreamWriter::ItemWriter : public ArchiveWriter
+{
+public:
+    ItemWriter(ZipStreamWriter* owner, bool compress)
+        : _owner(owner), _compress(compress), _level(owner->_level), _blockSize(owner->_blockSize),
+          _executor(), _crc(crc32(0L, Z_NULL, 0)), _size(0), _compressedSize(0), _input(), _dictionary(), _pending(),
+          _maxPending(std::max<size_t>(2, std::thread::hardware_concurrency() * 2))
+        {
+            if ( _compress )
+                _input.reserve(_blockSize);
+        }
+    virtual ~ItemWriter() { if (_owner != nullptr) _owner->FinishEntry(); }
+
+    virtual bool operator !() const { return _owner == nullptr || _owner->_failed; }
+    virtual ssize_t write(const void *p, size_t len);
+
+    virtual size_t total_size() const { return static_cast<size_t>(_size); }
+    virtual size_t position() const { return static_cast<size_t>(_size); }
+
+    ///
+    /// Writes all the item's remaining data, and detaches from the owner.
+    void            Finish();
+
+    uint32_t        CRC()               const   { return static_cast<uint32_t>(_crc); }
+    uint64_t        Size()              const   { return _size; }
+    uint64_t        CompressedSize()    const   { return _compressedSize; }
+
+private:
+    ZipStreamWriter*                    _owner;
+    bool                                _compress;
+    int                                 _level;
+    size_t                              _blockSize;
+    std::shared_ptr<executor>           _executor;
+    uLong                               _crc;
+    uint64_t                            _size;
+    uint64_t                            _compressedSize;
+
+    std::vector<uint8_t>                _input;         ///< The block currently being filled.
+    std::vector<uint8_t>                _dictionary;    ///< The tail of the last block dispatched.
+    std::deque<std::shared_ptr<Block>>  _pending;       ///< Blocks being compressed, in order.
+    size_t                              _maxPending;
+
+    ///
+    /// Sends the current block away to be compressed.
+    void            Dispatch();
+    ///
+    /// Waits for a block to be compressed, then writes it out.
+    void            Output(std::shared_ptr<Block> block);
+
+};
+
+ssize_t ZipStreamWriter::ItemWriter::write(const void *p, size_t len)
+{
+    if ( !(*this) )
+        return -1;
+
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(p);
+    _size += len;
+
+    if ( !_compress )
+    {
+        _crc = crc32(_crc, bytes, static_cast<uInt>(len));
+        _compressedSize += len;
+        return (_owner->Output(bytes, len) ? static_cast<ssize_t>(len) : -1);
+    }
+
+    size_t remaining = len;
+    while ( remaining > 0 )
+    {
+        size_t n = std::min(remaining, _blockSize - _input.size());
+        _input.insert(_input.end(), bytes, bytes + n);
+        bytes += n;
+        remaining -= n;
+
+        if ( _input.size() == _blockSize )
+            Dispatch();
+    }
+
+    return (_owner->_failed ? -1 : static_cast<ssize_t>(len));
+}
+void ZipStreamWriter::ItemWriter::Dispatch()
+{
+    auto block = std::make_shared<Block>();
+    block->input.swap(_input);
+    block->dictionary.swap(_dictionary);
+
+    // blocks are never smaller than the window, so one block's tail is enough
+    _dictionary.assign(block->input.end() - DictionarySize, block->input.end());
+    _input.reserve(_blockSize);
+
+    if ( !bool(_executor) )
+        _executor = _owner->Executor();
+
+    int level = _level;
+    _executor->add([block, level]() {
+        try
+        {
+            block->Deflate(level);
+            block->promise.set_value();
+        }
+        catch (...)
+        {
+            block->promise.set_exception(std::current_exception());
+        }
+    });
+
+    _pending.push_back(block);
+    if ( _pending.size() > _maxPending )
+    {
+        block = _pending.front();
+        _pending.pop_front();
+        Output(block);
+    }
+}
+void ZipStreamWriter::ItemWriter::Output(std::shared_ptr<Block> block)
+{
+    try
+    {
+        block->done.get();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "ZipStreamWriter: " << e.what() << std::endl;
+        _owner->_failed = true;
+    }
+
+    if ( _owner->_failed )
+        return;
+
+    _crc = crc32_combine(_crc, block->crc, static_cast<z_off_t>(block->length));
+    _compressedSize += block->output.size();
+    _owner->Output(block->output.data(), block->output.size());
+}
+void ZipStreamWriter::ItemWriter::Finish()
+{
+    if ( _compress )
+    {
+        // the final block is compressed here, while the others finish on the executor
+        Block last;
+        last.input.swap(_input);
+        last.dictionary.swap(_dictionary);
+        last.last = true;
+
+        try
+        {
+            last.Deflate(_level);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "ZipStreamWriter: " << e.what() << std::endl;
+            _owner->_failed = true;
+        }
+
+        // every block must be waited for, even after a failure
+        while ( !_pending.empty() )
+        {
+            auto block = _pending.front();
+            _pending.pop_front();
+            Output(block);
+        }
+
+        if ( !_owner->_failed )
+        {
+            _crc = crc32_combine(_crc, last.crc, static_cast<z_off_t>(last.length));
+            _compressedSize += last.output.size();
+            _owner->Output(last.output.data(), last.output.size());
+        }
+    }
+
+    _owner = nullptr;
+}
+
+ZipStreamWriter::ZipStreamWriter(const string& path, bool replaceInPlace)
+    : _path(path), _outputPath(replaceInPlace ? SiblingTempPath(path) : path), _out(), _offset(0), _failed(false),
+      _level(Archive::DefaultCompression), _blockSize(DefaultBlockSize), _executor(), _dosTime(0), _dosDate(0),
+      _entries(), _current(nullptr)
+{
+    if ( !_out.Open(_outputPath, std::ios::out|std::ios::trunc|std::ios::binary) )
+    {
+        if ( replaceInPlace )
+            std::remove(_outputPath.c_str());
+        throw std::runtime_error(std::string("ZipStreamWriter: unable to create ") + _outputPath.stl_str());
+    }
+
+    time_t now = ::time(NULL);
+    struct tm local;
+#if EPUB_OS(WINDOWS)
+    ::localtime_s(&local, &now);
+#else
+    ::localtime_r(&now, &local);
+#endif
+    _dosTime = uint16_t((local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2));
+    _dosDate = uint16_t(((local.tm_year - 80) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday);
+}
+ZipStreamWriter::~ZipStreamWriter()
+{
+    if ( _out.IsOpen() )
+        Close();
+}
+unique_ptr<ArchiveWriter> ZipStreamWriter::WriterAtPath(const string& path, bool compress)
+{
+    if ( !StartEntry(path, compress, false) )
+        return nullptr;
+
+    _current = new ItemWriter(this, compress);
+    return unique_ptr<ArchiveWriter>(_current);
+}
+bool ZipStreamWriter::CreateFolder(const string& path)
+{
+    return StartEntry(path, false, true);
+}
+bool ZipStreamWriter::Close()
+{
+    if ( !_out.IsOpen() )
+        return false;
+
+    FinishEntry();
+
+    uint64_t directoryOffset = _offset;
+    for ( auto& entry : _entries )
+    {
+        const std::string& name = entry.path.stl_str();
+        uint8_t header[46];
+        uint8_t* p = header;
+        PutLE32(p, CentralHeaderMagic);
+        PutLE16(p, VersionMadeBy);
+        PutLE16(p, VersionNeeded);
+        PutLE16(p, NameFlags(entry.path));
+        PutLE16(p, entry.method);
+        PutLE16(p, _dosTime);
+        PutLE16(p, _dosDate);
+        PutLE32(p, entry.crc);
+        PutLE32(p, entry.compressedSize);
+        PutLE32(p, entry.uncompressedSize);
+        PutLE16(p, uint16_t(name.size()));
+        PutLE16(p, 0);                      // extra field length
+        PutLE16(p, 0);                      // comment length
+        PutLE16(p, 0);                      // disk number
+        PutLE16(p, 0);                      // internal attributes
+        PutLE32(p, entry.folder ? ((040755u << 16) | 0x10) : (0100644u << 16));
+        PutLE32(p, entry.offset);
+
+        if ( !Output(header, sizeof(header)) || !Output(name.data(), name.size()) )
+            break;
+    }
+
+    uint64_t directorySize = _offset - directoryOffset;
+    if ( _offset > UINT32_MAX )
+    {
+        std::cerr << "ZipStreamWriter: " << _path << " would need ZIP64 extensions" << std::endl;
+        _failed = true;
+    }
+
+    uint8_t trailer[22];
+    uint8_t* p = trailer;
+    PutLE32(p, EndOfDirectoryMagic);
+    PutLE16(p, 0);                          // this disk
+    PutLE16(p, 0);                          // the directory's disk
+    PutLE16(p, uint16_t(_entries.size()));
+    PutLE16(p, uint16_t(_entries.size()));
+    PutLE32(p, uint32_t(directorySize));
+    PutLE32(p, uint32_t(directoryOffset));
+    PutLE16(p, 0);                          // comment length
+    Output(trailer, sizeof(trailer));
+
+    _out.Close();
+
+    if ( !_failed && _outputPath != _path && !MoveFileIntoPlace(_outputPath, _path) )
+        _failed = true;
+    if ( _failed )
+        std::remove(_outputPath.c_str());
+
+    return !_failed;
+}
+void ZipStreamWriter::SetBlockSize(size_t bytes)
+{
+    _blockSize = std::max(bytes, MinimumBlockSize);
+}
+std::shared_ptr<executor> ZipStreamWriter::Executor() const
+{
+    if ( bool(_executor) )
+        return _executor;
+
+    static std::shared_ptr<executor> __sharedCompressionExecutor;
+    static std::once_flag __once;
+    std::call_once(__once, [](){
+        __sharedCompressionExecutor = std::make_shared<thread_pool>(thread_pool::Automatic);
+    });
+    return __sharedCompressionExecutor;
+}
+bool ZipStreamWriter::StartEntry(const string& path, bool compress, bool folder)
+{
+    FinishEntry();
+    if ( !IsOpen() )
+        return false;
+
+    std::string name(path.stl_str());
+    if ( name.find('/') == 0 )
+        name.erase(0, 1);
+    if ( folder && (name.empty() || name.back() != '/') )
+        name.push_back('/');
+
+    if ( name.size() > UINT16_MAX || _entries.size() >= UINT16_MAX )
+        return false;
+    if ( _offset > UINT32_MAX )
+    {
+        std::cerr << "ZipStreamWriter: " << _path << " would need ZIP64 extensions" << std::endl;
+        _failed = true;
+        return false;
+    }
+
+    Entry entry;
+    entry.path = name;
+    entry.offset = uint32_t(_offset);
+    entry.crc = 0;
+    entry.compressedSize = 0;
+    entry.uncompressedSize = 0;
+    entry.method = (compress && !folder ? Z_DEFLATED : 0);
+    entry.folder = folder;
+
+    // the CRC and sizes are filled in by FinishEntry()
+    uint8_t header[LocalHeaderSize];
+    uint8_t* p = header;
+    PutLE32(p, LocalHeaderMagic);
+    PutLE16(p, VersionNeeded);
+    PutLE16(p, NameFlags(entry.path));
+    PutLE16(p, entry.method);
+    PutLE16(p, _dosTime);
+    PutLE16(p, _dosDate);
+    PutLE32(p, 0);
+    PutLE32(p, 0);
+    PutLE32(p, 0);
+    PutLE16(p, uint16_t(name.size()));
+    PutLE16(p, 0);                          // extra field length
+
+    if ( !Output(header, sizeof(header)) || !Output(name.data(), name.size()) )
+        return false;
+
+    _entries.push_back(std::move(entry));
+    return true;
+}
+void ZipStreamWriter::FinishEntry()
+{
+    if ( _current == nullptr )
+        return;
+
+    ItemWriter* writer = _current;
+    _current = nullptr;
+    writer->Finish();
+
+    if ( _failed )
+        return;
+    if ( writer->Size() > UINT32_MAX || writer->CompressedSize() > UINT32_MAX )
+    {
+        std::cerr << "ZipStreamWriter: " << _entries.back().path << " would need ZIP64 extensions" << std::endl;
+        _failed = true;
+        return;
+    }
+
+    Entry& entry = _entries.back();
+    entry.crc = writer->CRC();
+    entry.compressedSize = uint32_t(writer->CompressedSize());
+    entry.uncompressedSize = uint32_t(writer->Size());
+
+    // the output is a file, so the local header can be completed in place
+    uint8_t fields[12];
+    uint8_t* p = fields;
+    PutLE32(p, entry.crc);
+    PutLE32(p, entry.compressedSize);
+    PutLE32(p, entry.uncompressedSize);
+
+    _out.Seek(entry.offset + LocalHeaderCRCOffset, std::ios::beg);
+    if ( _out.WriteBytes(fields, sizeof(fields)) != sizeof(fields) )
+        _failed = true;
+    _out.Seek(_offset, std::ios::beg);
+}
+bool ZipStreamWriter::Output(const void* p, size_t len)
+{
+    if ( _failed )
+        return false;
+
+    if ( _out.WriteBytes(p, len) != len )
+    {
+        std::cerr << "ZipStreamWriter: unable to write to " << _outputPath << ": " << strerror(errno) << std::endl;
+        _failed = true;
+        return false;
+    }
+
+    _offset += len;
+    return true;
+}
+
+EPUB3_END_NAMESPACE
@@ -0,0 +1,196 @@
+//
+//  zip_stream_writer.h
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __ePub3__zip_stream_writer__
+#define __ePub3__zip_stream_writer__
+
+#include <ePub3/archive.h>
+#include <ePub3/utilities/byte_stream.h>
+#include <memory>
+#include <vector>
+
+EPUB3_BEGIN_NAMESPACE
+
+class executor;
+
+/**
+ Writes a new ZIP archive front to back, compressing each item as it is written.
+
+ Unlike ZipArchive::WriterAtPath(), which keeps every item's data in a temporary
+ file until the archive is closed, a ZipStreamWriter writes each item's local
+ header and data straight to the output file. Items are written one at a time:
+ asking for a writer for the next item finishes the previous one.
+
+ Large items are deflated in parallel. Their data is cut into blocks of
+ BlockSize() bytes, each of which is compressed on an executor (a shared thread
+ pool by default) using the tail of the previous block as its dictionary, and the
+ results are written out in order. Items smaller than one block are compressed on
+ the calling thread.
+
+ The output is written directly to its destination, replacing any file already
+ there, unless the writer is created with `replaceInPlace` set. In that case it is
+ written to a temporary file alongside the destination, which is moved into place
+ by Close(); this allows the archive being replaced to be read while the new one
+ is written.
+
+ @note ZIP64 extensions are not supported: archives are limited to 65535 items,
+ and no item or archive may exceed 4GB.
+ @note A ZipStreamWriter must be used by one thread at a time.
+ @ingroup archives
+ */
+class ZipStreamWriter
+{
+    class ItemWriter;
+    struct Block;
+
+    ///
+    /// The central directory's record of an item.
+    struct Entry
+    {
+        string      path;
+        uint32_t    offset;             ///< The offset of the item's local header.
+        uint32_t    crc;
+        uint32_t    compressedSize;
+        uint32_t    uncompressedSize;
+        uint16_t    method;
+        bool        folder;
+    };
+
+public:
+    ///
+    /// The default number of uncompressed bytes in each parallel-deflated block.
+    static EPUB3_EXPORT const size_t DefaultBlockSize = 128 * 1024;
+
+    /**
+     Creates a new archive.
+     @param path The filesystem path at which to create the archive.
+     @param replaceInPlace If `true`, the archive is written to a temporary file
+     which replaces the file at `path` when the archive is closed.
+     @throws std::runtime_error if the output file cannot be created.
+     */
+    EPUB3_EXPORT
+    ZipStreamWriter(const string& path, bool replaceInPlace=false);
+    ///
+    /// Closes the archive, if Close() has not yet been called.
+    EPUB3_EXPORT
+    ~ZipStreamWriter();
+
+    /**
+     Starts a new item in the archive, finishing any item currently being written.
+
+     The returned writer must not be used once another item has been started or
+     the archive has been closed, and must not outlive the ZipStreamWriter.
+     @param path The path of the item within the archive.
+     @param compress Whether to deflate the item's data.
+     @result A writer for the item's data, or `nullptr` if the archive is closed or
+     an earlier write failed.
+     */
+    EPUB3_EXPORT
+    unique_ptr<ArchiveWriter> WriterAtPath(const string& path, bool compress=true);
+
+    /**
+     Adds a folder to the archive, finishing any item currently being written.
+     @param path The path of the folder within the archive.
+     @result Returns `true` if the folder was added, `false` otherwise.
+     */
+    EPUB3_EXPORT
+    bool CreateFolder(const string& path);
+
+    /**
+     Finishes the last item and writes the archive's central directory.
+
+     When replacing in place, the temporary file is then moved to the archive's
+     path. If any write failed, the output file is removed instead.
+     @result Returns `true` if the archive was written successfully.
+     */
+    EPUB3_EXPORT
+    bool Close();
+
+    ///
+    /// The path of the archive.
+    const string& Path() const { return _path; }
+    ///
+    /// Whether items can still be added to the archive.
+    bool IsOpen() const { return _out.IsOpen() && !_failed; }
+
+    ///
+    /// The deflate level used for compressed items.
+    Archive::CompressionLevel CompressionLevel() const { return _level; }
+    ///
+    /// Sets the deflate level used for items started from now on.
+    void SetCompressionLevel(Archive::CompressionLevel level) { _level = level; }
+
+    ///
+    /// The number of uncompressed bytes in each parallel-deflated block.
+    size_t BlockSize() const { return _blockSize; }
+    /**
+     Sets the size of the blocks into which compressed items are divided.
+
+     Values below 64KB are raised to 64KB. Affects items started from now on.
+     */
+    EPUB3_EXPORT
+    void SetBlockSize(size_t bytes);
+
+    ///
+    /// The executor on which blocks are compressed.
+    std::shared_ptr<executor> Executor() const;
+    /**
+     Sets the executor on which blocks are compressed.
+     @param exec An executor, or `nullptr` to use the shared thread pool.
+     */
+    void SetExecutor(std::shared_ptr<executor> exec) { _executor = exec; }
+
+private:
+    ZipStreamWriter(const ZipStreamWriter&) _DELETED_;
+    ZipStreamWriter& operator=(const ZipStreamWriter&) _DELETED_;
+
+protected:
+    string                          _path;          ///< The archive's final path.
+    string                          _outputPath;    ///< The file actually being written.
+    FileByteStream                  _out;
+    uint64_t                        _offset;        ///< The number of bytes written to `_out`.
+    bool                            _failed;        ///< Set when any write fails.
+
+    Archive::CompressionLevel       _level;
+    size_t                          _blockSize;
+    std::shared_ptr<executor>       _executor;
+    uint16_t                        _dosTime;       ///< Modification time recorded for every item.
+    uint16_t                        _dosDate;       ///< Modification date recorded for every item.
+
+    std::vector<Entry>              _entries;       ///< Every item written, for the central directory.
+    ItemWriter*                     _current;       ///< The writer of the item being written, if any.
+
+    ///
+    /// Records a new item and writes its local header.
+    bool                StartEntry(const string& path, bool compress, bool folder);
+    ///
+    /// Writes the remainder of the current item's data, then completes its local header.
+    void                FinishEntry();
+
+    ///
+    /// Writes bytes to the output, recording any failure.
+    bool                Output(const void* p, size_t len);
+
+    friend class ItemWriter;
+
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__zip_stream_writer__) */
@@ -0,0 +1,350 @@
+//
+//  async_io_engine.cpp
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "async_io_engine.h"
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#if EPUB_OS(LINUX)
+# include <cerrno>
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <unistd.h>
+#else
+# include <condition_variable>
+#endif
+
+EPUB3_BEGIN_NAMESPACE
+
+static std::mutex                       gSharedEngineLock;
+static std::shared_ptr<AsyncIOEngine>   gSharedEngine;
+
+std::shared_ptr<AsyncIOEngine> AsyncIOEngine::SharedEngine()
+{
+    std::lock_guard<std::mutex> _(gSharedEngineLock);
+    if ( !bool(gSharedEngine) )
+        gSharedEngine = std::make_shared<ShardedAsyncIOEngine>();
+    return gSharedEngine;
+}
+void AsyncIOEngine::SetSharedEngine(std::shared_ptr<AsyncIOEngine> engine)
+{
+    std::shared_ptr<AsyncIOEngine> old;
+    {
+        std::lock_guard<std::mutex> _(gSharedEngineLock);
+        old = gSharedEngine;
+        gSharedEngine = engine;
+    }
+
+    // the old engine (if this was the last reference) shuts down here, outside the lock
+}
+
+#if 0
+#pragma mark - Shards
+#endif
+
+class ShardedAsyncIOEngine::Shard : public std::enable_shared_from_this<Shard>
+{
+public:
+    Shard();
+    ~Shard();
+
+    void                Start();
+    void                Stop();
+
+    ///
+    /// Queues a signalled channel for service.
+    void                Enqueue(std::shared_ptr<ShardChannel> channel);
+
+    bool                IsCurrentThread()   const   { return std::this_thread::get_id() == _thread.get_id(); }
+
+private:
+    void                Run();
+
+    ///
+    /// Wakes the shard's thread. Call without the lock held.
+    void                WakeUp();
+
+    std::mutex                                  _lock;
+    std::vector<std::shared_ptr<ShardChannel>>  _ready;     ///< Channels waiting to be serviced.
+    bool                                        _stop;
+    std::thread                                 _thread;
+#if EPUB_OS(LINUX)
+    int                                         _epoll;     ///< The descriptor on which the thread waits.
+    int                                         _event;     ///< The eventfd used to wake the thread.
+#else
+    std::condition_variable                     _wakeUp;
+#endif
+
+};
+
+class ShardedAsyncIOEngine::ShardChannel : public AsyncIOEngine::Channel, public std::enable_shared_from_this<ShardChannel>
+{
+    typedef ShardedAsyncIOEngine::Shard     ShardType;
+
+public:
+    ShardChannel(std::shared_ptr<ShardType> shard, size_t index, ServiceFn fn)
+        : _shard(shard), _index(index), _fn(fn), _serviceLock(), _queued(false), _cancelled(false)
+        {}
+    virtual ~ShardChannel() {}
+
+    virtual void        Signal()            OVERRIDE;
+    virtual void        Cancel()            OVERRIDE;
+    virtual bool        IsCancelled() const OVERRIDE    { return _cancelled; }
+    virtual size_t      Shard()       const OVERRIDE    { return _index; }
+
+    bool                IsServicedBy(const std::shared_ptr<ShardType>& shard) const { return _shard == shard; }
+
+    ///
+    /// Calls the service function. Only ever called on the shard's thread.
+    void                Service();
+
+private:
+    std::shared_ptr<ShardType>      _shard;
+    size_t                          _index;
+    ServiceFn                       _fn;
+    std::mutex                      _serviceLock;   ///< Held while _fn runs, so Cancel() can wait for it.
+    std::atomic<bool>               _queued;        ///< Set while the channel is in the shard's ready queue.
+    std::atomic<bool>               _cancelled;
+
+};
+
+ShardedAsyncIOEngine::Shard::Shard() : _lock(), _ready(), _stop(false), _thread()
+{
+#if EPUB_OS(LINUX)
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    if ( _epoll < 0 )
+        throw std::system_error(errno, std::system_category(), "epoll_create1");
+
+    _event = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if ( _event < 0 )
+    {
+        int err = errno;
+        ::close(_epoll);
+        throw std::system_error(err, std::system_category(), "eventfd");
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = _event;
+    if ( epoll_ctl(_epoll, EPOLL_CTL_ADD, _event, &ev) < 0 )
+    {
+        int err = errno;
+        ::close(_event);
+        ::close(_epoll);
+        throw std::system_error(err, std::system_category(), "epoll_ctl");
+    }
+#endif
+}
+ShardedAsyncIOEngine::Shard::~Shard()
+{
+#if EPUB_OS(LINUX)
+    ::close(_event);
+    ::close(_epoll);
+#endif
+}
+void ShardedAsyncIOEngine::Shard::Start()
+{
+    // the thread keeps its shard alive, in case it's detached by Stop()
+    auto self = shared_from_this();
+    _thread = std::thread([self]() {
+        self->Run();
+    });
+}
+void ShardedAsyncIOEngine::Shard::Stop()
+{
+    {
+        std::lock_guard<std::mutex> _(_lock);
+        _stop = true;
+    }
+    WakeUp();
+
+    if ( !_thread.joinable() )
+        return;
+
+    // an engine released by one of its own service functions can't wait for itself
+    if ( IsCurrentThread() )
+        _thread.detach();
+    else
+        _thread.join();
+}
+void ShardedAsyncIOEngine::Shard::Enqueue(std::shared_ptr<ShardChannel> channel)
+{
+    bool wasEmpty = false;
+    {
+        std::lock_guard<std::mutex> _(_lock);
+        if ( _stop )
+            return;
+
+        wasEmpty = _ready.empty();
+        _ready.push_back(channel);
+    }
+
+    // the thread only sleeps once it has emptied the queue
+    if ( wasEmpty )
+        WakeUp();
+}
+void ShardedAsyncIOEngine::Shard::WakeUp()
+{
+#if EPUB_OS(LINUX)
+    uint64_t one = 1;
+    ssize_t r;
+    do
+    {
+        r = ::write(_event, &one, sizeof(one));
+
+    } while ( r < 0 && errno == EINTR );
+    // EAGAIN means the counter is saturated, so the thread is awake anyway
+#else
+    _wakeUp.notify_one();
+#endif
+}
+void ShardedAsyncIOEngine::Shard::Run()
+{
+    std::vector<std::shared_ptr<ShardChannel>> batch;
+
+    for ( ;; )
+    {
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+            while ( _ready.empty() && !_stop )
+            {
+#if EPUB_OS(LINUX)
+                lock.unlock();
+
+                struct epoll_event ev;
+                if ( epoll_wait(_epoll, &ev, 1, -1) > 0 )
+                {
+                    // reset the counter; anything signalled after this point writes again
+                    uint64_t count;
+                    while ( ::read(_event, &count, sizeof(count)) < 0 && errno == EINTR )
+                        continue;
+                }
+
+                lock.lock();
+#else
+                _wakeUp.wait(lock);
+#endif
+            }
+
+            if ( _ready.empty() )
+                break;      // stopped, with nothing left to do
+
+            batch.swap(_ready);
+        }
+
+        for ( auto& channel : batch )
+        {
+            channel->Service();
+        }
+        batch.clear();
+    }
+}
+
+#if 0
+#pragma mark - Channels
+#endif
+
+void ShardedAsyncIOEngine::ShardChannel::Signal()
+{
+    if ( _cancelled )
+        return;
+
+    // only one trip through the queue at a time
+    if ( _queued.exchange(true) == false )
+        _shard->Enqueue(shared_from_this());
+}
+void ShardedAsyncIOEngine::ShardChannel::Cancel()
+{
+    _cancelled = true;
+
+    // wait for a call in progress on the shard's thread to finish
+    if ( !_shard->IsCurrentThread() )
+    {
+        std::lock_guard<std::mutex> _(_serviceLock);
+    }
+}
+void ShardedAsyncIOEngine::ShardChannel::Service()
+{
+    // clear this first: a signal arriving while _fn runs must queue us again
+    _queued = false;
+
+    std::lock_guard<std::mutex> _(_serviceLock);
+    if ( _cancelled )
+        return;
+
+    try
+    {
+        _fn();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "ShardedAsyncIOEngine: exception servicing channel : " << e.what() << std::endl;
+    }
+    catch (...)
+    {
+        std::cerr << "ShardedAsyncIOEngine: unknown exception servicing channel" << std::endl;
+    }
+}
+
+#if 0
+#pragma mark - ShardedAsyncIOEngine
+#endif
+
+ShardedAsyncIOEngine::ShardedAsyncIOEngine(size_t threadCount) : _shards(), _nextShard(0)
+{
+    if ( threadCount == 0 )
+        threadCount = DefaultThreadCount();
+
+    _shards.reserve(threadCount);
+    for ( size_t i = 0; i < threadCount; i++ )
+    {
+        auto shard = std::make_shared<Shard>();
+        shard->Start();
+        _shards.push_back(shard);
+    }
+}
+ShardedAsyncIOEngine::~ShardedAsyncIOEngine()
+{
+    // channels keep their shards alive, but nothing will service them from now on
+    for ( auto& shard : _shards )
+    {
+        shard->Stop();
+    }
+}
+AsyncIOEngine::ChannelPtr ShardedAsyncIOEngine::Attach(ServiceFn fn, ChannelPtr companion)
+{
+    size_t index = 0;
+
+    auto sibling = std::dynamic_pointer_cast<ShardChannel>(companion);
+    if ( bool(sibling) && sibling->Shard() < _shards.size() && sibling->IsServicedBy(_shards[sibling->Shard()]) )
+        index = sibling->Shard();
+    else
+        index = _nextShard++ % _shards.size();
+
+    return std::make_shared<ShardChannel>(_shards[index], index, fn);
+}
+size_t ShardedAsyncIOEngine::DefaultThreadCount()
+{
+    size_t hw = std::thread::hardware_concurrency();
+    return std::max<size_t>(1, std::min<size_t>(hw, 4));
+}
+
+EPUB3_END_NAMESPACE
@@ -0,0 +1,183 @@
+//
+//  async_io_engine.h
+//  ePub3
+//
+//  Copyright (c) 2014 Readium Foundation and/or its licensees. All rights reserved.
+//
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY
+//  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+//  Licensed under Gnu Affero General Public License Version 3 (provided, notwithstanding this notice,
+//  Readium Foundation reserves the right to license this material under a different separate license,
+//  and if you have done so, the terms of that separate license control and the following references
+//  to GPL do not apply).
+//
+//  This program is free software: you can redistribute it and/or modify it under the terms of the GNU
+//  Affero General Public License as published by the Free Software Foundation, either version 3 of
+//  the License, or (at your option) any later version. You should have received a copy of the GNU
+//  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __ePub3__async_io_engine__
+#define __ePub3__async_io_engine__
+
+#include <ePub3/epub3.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+EPUB3_BEGIN_NAMESPACE
+
+/**
+ The engine on which asynchronous streams perform their I/O.
+
+ A stream attaches a service function to the engine and is handed a Channel in
+ return. Whenever the stream signals its channel, the engine arranges for the
+ service function to be called on one of its I/O threads. Each channel is pinned
+ to a single thread for its entire life, so the service function of any one
+ stream is never called concurrently with itself, and signals are handled in
+ order.
+
+ The engine is pluggable: install a different one with SetSharedEngine(), or give
+ individual streams their own via AsyncByteStream::SetIOEngine().
+ @ingroup utilities
+ */
+class AsyncIOEngine
+{
+public:
+    ///
+    /// The function called on an I/O thread to service a channel.
+    typedef std::function<void()>   ServiceFn;
+
+    /**
+     A single stream's connection to the engine.
+     */
+    class Channel
+    {
+    public:
+        virtual         ~Channel() {}
+
+        /**
+         Asks for the service function to be called.
+
+         Signals arriving before the service function gets to run are coalesced into
+         a single call. A signal arriving while it's running causes it to be called
+         again afterwards.
+         */
+        virtual void    Signal()                = 0;
+
+        /**
+         Detaches the channel from the engine.
+
+         Once this returns, the service function will not be called again. If the
+         service function is running on another thread at the time, this waits for
+         it to finish; if it's called from the service function itself, the current
+         invocation is left to complete normally.
+         */
+        virtual void    Cancel()                = 0;
+
+        ///
+        /// Whether Cancel() has been called.
+        virtual bool    IsCancelled()   const   = 0;
+
+        ///
+        /// The index of the I/O thread to which the channel is pinned.
+        virtual size_t  Shard()         const   = 0;
+    };
+    typedef std::shared_ptr<Channel>    ChannelPtr;
+
+public:
+    virtual             ~AsyncIOEngine() {}
+
+    /**
+     Attaches a service function to the engine.
+     @param fn The function to call whenever the returned channel is signalled.
+     @param companion An existing channel of this engine. If supplied, the new
+     channel is pinned to the same thread, so neither service function ever runs
+     concurrently with the other.
+     @result A channel, pinned to one of the engine's I/O threads.
+     */
+    virtual ChannelPtr  Attach(ServiceFn fn, ChannelPtr companion=nullptr) = 0;
+
+    ///
+    /// The number of I/O threads servicing channels.
+    virtual size_t      ThreadCount()   const   = 0;
+
+    /**
+     Retrieves the engine used by streams which haven't been given their own.
+
+     Unless one has been installed, a ShardedAsyncIOEngine with the default number
+     of threads is created on first use.
+     */
+    EPUB3_EXPORT
+    static std::shared_ptr<AsyncIOEngine>   SharedEngine();
+
+    /**
+     Replaces the shared engine.
+
+     Channels already attached to the previous engine remain with it; only streams
+     opened afterwards will use the new one.
+     */
+    EPUB3_EXPORT
+    static void         SetSharedEngine(std::shared_ptr<AsyncIOEngine> engine);
+
+};
+
+/**
+ The default AsyncIOEngine: a fixed pool of I/O threads, or shards.
+
+ Channels are spread across the shards round-robin as they're attached, unless a
+ companion is supplied. Each shard keeps a queue of signalled channels, and sleeps
+ while that queue is empty. On Linux the shards block in `epoll_wait()` on an
+ `eventfd`, which signalling a channel writes to; elsewhere they wait on a
+ condition variable.
+
+ The threads are started by the constructor, and stopped and joined by the
+ destructor.
+ @ingroup utilities
+ */
+class ShardedAsyncIOEngine : public AsyncIOEngine
+{
+public:
+    /**
+     Creates an engine and starts its threads.
+     @param threadCount The number of I/O threads to run. Zero is taken to mean
+     DefaultThreadCount().
+     */
+    EPUB3_EXPORT
+    explicit            ShardedAsyncIOEngine(size_t threadCount=0);
+    EPUB3_EXPORT
+    virtual             ~ShardedAsyncIOEngine();
+
+    ///
+    /// @copydoc AsyncIOEngine::Attach()
+    EPUB3_EXPORT
+    virtual ChannelPtr  Attach(ServiceFn fn, ChannelPtr companion=nullptr) OVERRIDE;
+
+    ///
+    /// @copydoc AsyncIOEngine::ThreadCount()
+    virtual size_t      ThreadCount()   const   OVERRIDE    { return _shards.size(); }
+
+    /**
+     The number of threads used when none is specified.
+
+     I/O threads spend most of their time blocked, so there's little point having
+     more than a few: this is the number of hardware threads, up to a maximum of 4.
+     */
+    EPUB3_EXPORT
+    static size_t       DefaultThreadCount();
+
+private:
+    class Shard;
+    class ShardChannel;
+
+    std::vector<std::shared_ptr<Shard>> _shards;
+    std::atomic<size_t>                 _nextShard;     ///< Where the next channel will be attached.
+
+                        ShardedAsyncIOEngine(const ShardedAsyncIOEngine&)   _DELETED_;
+    ShardedAsyncIOEngine& operator=(const ShardedAsyncIOEngine&)            _DELETED_;
+};
+
+EPUB3_END_NAMESPACE
+
+#endif /* defined(__ePub3__async_io_engine__) */
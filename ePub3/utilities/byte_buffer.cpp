@@ -21,6 +21,7 @@
 #define _EPUB3_BUILDING_BYTE_BUFFER
 
 #include "byte_buffer.h"
+#include <algorithm>
 #include <stdexcept>
 #include <system_error>
 #include "CPUCacheUtils.h"
@@ -41,7 +42,7 @@ EPUB3_BEGIN_NAMESPACE
 
 const prealloc_buf_t prealloc_buf = {};
 
-ByteBuffer::ByteBuffer(size_t bufferSize) : m_buffer(nullptr), m_bufferSize(0), m_bufferCapacity(0)
+ByteBuffer::ByteBuffer(size_t bufferSize) : m_buffer(nullptr), m_bufferOffset(0), m_bufferSize(0), m_bufferCapacity(0), m_erasedLength(0), m_secure(false)
 {
     size_t cap = GoodSize(bufferSize);
 	m_buffer = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
@@ -51,7 +52,7 @@ ByteBuffer::ByteBuffer(size_t bufferSize) : m_buffer(nullptr), m_bufferSize(0),
     m_bufferSize = bufferSize;
     m_bufferCapacity = cap;
 }
-ByteBuffer::ByteBuffer(size_t bufferSize, prealloc_buf_t) : m_buffer(nullptr), m_bufferSize(0), m_bufferCapacity(0)
+ByteBuffer::ByteBuffer(size_t bufferSize, prealloc_buf_t) : m_buffer(nullptr), m_bufferOffset(0), m_bufferSize(0), m_bufferCapacity(0), m_erasedLength(0), m_secure(false)
 {
     size_t cap = GoodSize(bufferSize);
 	m_buffer = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
@@ -60,27 +61,29 @@ ByteBuffer::ByteBuffer(size_t bufferSize, prealloc_buf_t) : m_buffer(nullptr), m
     
     m_bufferCapacity = cap;
 }
-ByteBuffer::ByteBuffer(const unsigned char* buffer, size_t bufferSize)
+ByteBuffer::ByteBuffer(const unsigned char* buffer, size_t bufferSize) : m_buffer(nullptr), m_bufferOffset(0), m_bufferSize(0), m_bufferCapacity(0), m_erasedLength(0), m_secure(false)
 {
     size_t cap = GoodSize(bufferSize);
 	m_buffer = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
     if ( m_buffer == nullptr )
         throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
     
-    memcpy(m_buffer, buffer, bufferSize);
+    if ( bufferSize > 0 )
+        memcpy(m_buffer, buffer, bufferSize);
     m_bufferSize = bufferSize;
     m_bufferCapacity = cap;
 }
 #if !EPUB_COMPILER_SUPPORTS(CXX_DELEGATING_CONSTRUCTORS)
-ByteBuffer::ByteBuffer(const ByteBuffer& o)
+ByteBuffer::ByteBuffer(const ByteBuffer& o) : m_buffer(nullptr), m_bufferOffset(0), m_bufferSize(0), m_bufferCapacity(0), m_erasedLength(0), m_secure(false)
 {
-    m_buffer = reinterpret_cast<unsigned char*>(malloc(o.m_bufferCapacity));
+    size_t cap = GoodSize(o.m_bufferSize);
+    m_buffer = reinterpret_cast<unsigned char*>(calloc(cap, sizeof(unsigned char)));
     if ( m_buffer == nullptr )
         throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
     
-    memcpy(m_buffer, o.m_buffer, o.m_bufferSize);
+    memcpy(m_buffer, o.GetBytes(), o.m_bufferSize);
     m_bufferSize = o.m_bufferSize;
-    m_bufferCapacity = o.m_bufferCapacity;
+    m_bufferCapacity = cap;
 }
 #endif
 ByteBuffer::~ByteBuffer()
@@ -94,22 +97,32 @@ ByteBuffer::~ByteBuffer()
     }
     
     m_buffer = nullptr;
+    m_bufferOffset = 0;
     m_bufferSize = 0;
     m_bufferCapacity = 0;
+    m_erasedLength = 0;
 }
 
 ByteBuffer& ByteBuffer::operator=(const ByteBuffer& o)
 {
-    EnsureCapacity(o.m_bufferCapacity);
-    if ( m_secure && o.m_bufferSize < m_bufferSize )
-        Clean(m_buffer+o.m_bufferSize, m_bufferSize-o.m_bufferSize);
-    ::memcpy(m_buffer, o.m_buffer, o.m_bufferSize);
+    if ( this == &o )
+        return *this;
+    
+    // discard the current content
+    RemoveBytes(m_bufferSize);
+    
+    EnsureCapacity(o.m_bufferSize);
+    if ( o.m_bufferSize > 0 )
+        ::memcpy(m_buffer, o.GetBytes(), o.m_bufferSize);
     
     m_bufferSize = o.m_bufferSize;
     return *this;
 }
 ByteBuffer& ByteBuffer::operator=(ByteBuffer&& o)
 {
+    if ( this == &o )
+        return *this;
+    
     if ( m_buffer != nullptr )
     {
         if ( m_secure )
@@ -118,12 +131,14 @@ ByteBuffer& ByteBuffer::operator=(ByteBuffer&& o)
     }
     
     m_buffer = o.m_buffer;
+    m_bufferOffset = o.m_bufferOffset;
     m_bufferSize = o.m_bufferSize;
     m_bufferCapacity = o.m_bufferCapacity;
+    m_erasedLength = o.m_erasedLength;
     m_secure = o.m_secure;
     
     o.m_buffer = nullptr;
-    o.m_bufferSize = o.m_bufferCapacity = 0;
+    o.m_bufferOffset = o.m_bufferSize = o.m_bufferCapacity = o.m_erasedLength = 0;
     o.m_secure = false;
     
     return *this;
@@ -133,7 +148,9 @@ bool ByteBuffer::operator==(const ByteBuffer& o) const
 {
     if ( m_bufferSize != o.m_bufferSize )
         return false;
-    return (::memcmp(m_buffer, o.m_buffer, m_bufferSize) == 0);
+    if ( m_bufferSize == 0 )
+        return true;
+    return (::memcmp(GetBytes(), o.GetBytes(), m_bufferSize) == 0);
 }
 
 size_t ByteBuffer::MoveTo(unsigned char *targetBuffer, size_t targetBufferSize)
@@ -143,104 +160,171 @@ size_t ByteBuffer::MoveTo(unsigned char *targetBuffer, size_t targetBufferSize)
         return 0;
     }
     
-    size_t resultLen = 0;
-    
-    if (m_bufferSize <= targetBufferSize)
-    {
-        ::memmove(targetBuffer, m_buffer, m_bufferSize);
-        ::bzero(targetBuffer+m_bufferSize, targetBufferSize-m_bufferSize);
-        resultLen = m_bufferSize;
-        
-        if ( m_secure )
-            Clean(m_buffer, m_bufferCapacity);
-        m_bufferSize = 0;       // allocation & capacity remain until Compact() is called
-    }
-    else
-    {
-        // move some bytes out
-        ::memmove(targetBuffer, m_buffer, targetBufferSize);
-        
-        // determine the remainder
-        unsigned char *remainderBuffer = m_buffer+targetBufferSize;
-        size_t remainderLen = m_bufferSize-targetBufferSize;
-        
-        // move the remainder down
-        ::memmove(m_buffer, remainderBuffer, remainderLen);
-        
-        // set the new length
-        m_bufferSize = remainderLen;
-        
-        if ( m_secure )
-            Clean(m_buffer+m_bufferSize, m_bufferCapacity-m_bufferSize);
-        
-        resultLen = targetBufferSize;
-        // capacity remains until Compact() is called
-    }
+    size_t resultLen = std::min(m_bufferSize, targetBufferSize);
+    ::memmove(targetBuffer, GetBytes(), resultLen);
+    if ( resultLen < targetBufferSize )
+        ::bzero(targetBuffer+resultLen, targetBufferSize-resultLen);
     
+    // allocation & capacity remain until Compact() is called
+    RemoveBytes(resultLen);
     return resultLen;
 }
 
 void ByteBuffer::AddBytes(unsigned char *extraBytes, size_t extraBytesSize)
 {
-    EnsureCapacity(m_bufferSize + extraBytesSize);
-    memcpy(m_buffer+m_bufferSize, extraBytes, extraBytesSize);
+    size_t required = m_bufferSize + extraBytesSize;
+    if ( m_bufferCapacity - m_bufferOffset < required )
+    {
+        if ( m_bufferOffset >= m_bufferSize && m_bufferCapacity >= required )
+        {
+            // at least as much has been consumed as remains: reclaiming that space
+            // costs no more than the removals which freed it
+            MoveContentToFront();
+        }
+        else
+        {
+            // grow geometrically, so repeated appends are amortized
+            EnsureCapacity(std::max(required, m_bufferCapacity + m_bufferCapacity/2));
+        }
+    }
+    
+    if ( extraBytesSize > 0 )
+        memcpy(GetBytes()+m_bufferSize, extraBytes, extraBytesSize);
     m_bufferSize += extraBytesSize;
 }
 
 void ByteBuffer::RemoveBytes(size_t numBytesToRemove, size_t pos)
 {
-	if (numBytesToRemove >= m_bufferSize && pos == 0)
+    if ( pos >= m_bufferSize )
+        return;
+    
+	numBytesToRemove = std::min(numBytesToRemove, m_bufferSize - pos);
+    if ( numBytesToRemove == 0 )
+        return;
+    
+    if ( pos == 0 )
     {
-        m_bufferSize = 0;
+        // consuming from the front just moves the start of the content
+        m_bufferOffset += numBytesToRemove;
+        m_bufferSize -= numBytesToRemove;
+        
+        if ( m_bufferSize == 0 )
+        {
+            // all gone: start again at the front of the storage
+            if ( m_secure )
+                EraseConsumedBytes();
+            m_bufferOffset = m_erasedLength = 0;
+        }
+        else if ( m_secure && m_bufferOffset - m_erasedLength >= SecureErasureBatchSize )
+        {
+            EraseConsumedBytes();
+        }
         return;
     }
-
-	numBytesToRemove = std::min(numBytesToRemove, m_bufferSize - pos);
     
-    size_t newBufferSize = m_bufferSize - numBytesToRemove;
-	if (pos < m_bufferSize - numBytesToRemove)
-	{
-		::memmove(m_buffer + pos, m_buffer + pos + numBytesToRemove, newBufferSize);
-	}
-
-    m_bufferSize = newBufferSize;
+    // close up the gap
+    unsigned char* content = GetBytes();
+    size_t trailing = m_bufferSize - pos - numBytesToRemove;
+    if ( trailing > 0 )
+        ::memmove(content + pos, content + pos + numBytesToRemove, trailing);
+    
+    m_bufferSize -= numBytesToRemove;
     
     if ( m_secure )
-        Clean(m_buffer+m_bufferSize, m_bufferCapacity-m_bufferSize);
+        Clean(content+m_bufferSize, numBytesToRemove);
 }
 
 void ByteBuffer::Compact()
 {
     if ( m_bufferCapacity > m_bufferSize )
     {
-        if ( m_secure )
-            Clean(m_buffer+m_bufferSize, m_bufferCapacity-m_bufferSize);
+        if ( m_bufferSize == 0 )
+        {
+            // realloc() might return nullptr for zero bytes; just let it all go
+            if ( m_buffer != nullptr )
+            {
+                if ( m_secure )
+                    Clean(m_buffer, m_bufferCapacity);
+                free(m_buffer);
+            }
+            m_buffer = nullptr;
+            m_bufferOffset = m_bufferCapacity = m_erasedLength = 0;
+            return;
+        }
         
-        m_buffer = reinterpret_cast<unsigned char*>(realloc(m_buffer, m_bufferSize));
-        if ( m_buffer == nullptr )
-            throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
-        m_bufferCapacity = m_bufferSize;
+        Reallocate(m_bufferSize);
     }
 }
 
 void ByteBuffer::EnsureCapacity(size_t desired)
 {
-    if ( m_bufferCapacity >= desired )
+    if ( m_bufferCapacity - m_bufferOffset >= desired )
         return;
     
-    size_t newCap = GoodSize(desired);
-    m_buffer = reinterpret_cast<unsigned char*>(realloc(m_buffer, newCap));
-    if ( m_buffer == nullptr )
-        throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
-    m_bufferCapacity = newCap;
+    Reallocate(GoodSize(desired));
+}
+
+void ByteBuffer::Reallocate(size_t newCapacity)
+{
+    if ( m_secure )
+    {
+        // realloc() could leave a copy of the content in freed memory, so do it by hand
+        unsigned char* newBuffer = reinterpret_cast<unsigned char*>(calloc(newCapacity, sizeof(unsigned char)));
+        if ( newBuffer == nullptr )
+            throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
+        
+        if ( m_buffer != nullptr )
+        {
+            if ( m_bufferSize > 0 )
+                ::memcpy(newBuffer, GetBytes(), m_bufferSize);
+            Clean(m_buffer, m_bufferCapacity);
+            free(m_buffer);
+        }
+        
+        m_buffer = newBuffer;
+        m_bufferOffset = m_erasedLength = 0;
+    }
+    else
+    {
+        MoveContentToFront();
+        
+        unsigned char* newBuffer = reinterpret_cast<unsigned char*>(realloc(m_buffer, newCapacity));
+        if ( newBuffer == nullptr )
+            throw std::system_error(std::make_error_code(std::errc::not_enough_memory), "ByteBuffer");
+        m_buffer = newBuffer;
+    }
+    
+    m_bufferCapacity = newCapacity;
+}
+
+void ByteBuffer::MoveContentToFront()
+{
+    if ( m_bufferOffset == 0 )
+        return;
+    
+    if ( m_bufferSize > 0 )
+        ::memmove(m_buffer, m_buffer+m_bufferOffset, m_bufferSize);
     
-    // zero trailing data
+    // everything from the new end of the content to the old one is now stale: either
+    // consumed bytes, or copies of content which has since moved
     if ( m_secure )
-        Clean(m_buffer+m_bufferSize, m_bufferCapacity-m_bufferSize);
+        Clean(m_buffer+m_bufferSize, m_bufferOffset);
+    
+    m_bufferOffset = m_erasedLength = 0;
+}
+
+void ByteBuffer::EraseConsumedBytes()
+{
+    if ( m_bufferOffset > m_erasedLength )
+        Clean(m_buffer+m_erasedLength, m_bufferOffset-m_erasedLength);
+    m_erasedLength = m_bufferOffset;
 }
 
 void ByteBuffer::Clean(unsigned char *ptr, size_t len)
 {
+    if ( len == 0 )
+        return;
+    
     ::bzero(ptr, len);
     epub_sys_cache_flush(ptr, len);
 }
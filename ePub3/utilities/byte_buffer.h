@@ -49,16 +49,17 @@ class ByteBuffer
 {
 public:
     
-    ByteBuffer() : m_buffer(nullptr), m_bufferSize(0), m_bufferCapacity(0) {}
+    ByteBuffer() : m_buffer(nullptr), m_bufferOffset(0), m_bufferSize(0), m_bufferCapacity(0), m_erasedLength(0), m_secure(false) {}
     ByteBuffer(size_t bufferSize);
     ByteBuffer(size_t bufferSize, prealloc_buf_t);
     ByteBuffer(const unsigned char *buffer, size_t bufferSize);   // copy-in
 #if EPUB_COMPILER_SUPPORTS(CXX_DELEGATING_CONSTRUCTORS)
-    ByteBuffer(const ByteBuffer& o) : ByteBuffer(o.m_buffer, o.m_bufferSize) {}
+    ByteBuffer(const ByteBuffer& o) : ByteBuffer(o.GetBytes(), o.m_bufferSize) {}
 #else
     ByteBuffer(const ByteBuffer& o);
 #endif
-    ByteBuffer(ByteBuffer &&o) : m_buffer(std::move(o.m_buffer)), m_bufferSize(o.m_bufferSize), m_bufferCapacity(o.m_bufferCapacity) { o.m_bufferSize = o.m_bufferCapacity = 0; }
+    ByteBuffer(ByteBuffer &&o) : m_buffer(o.m_buffer), m_bufferOffset(o.m_bufferOffset), m_bufferSize(o.m_bufferSize), m_bufferCapacity(o.m_bufferCapacity), m_erasedLength(o.m_erasedLength), m_secure(o.m_secure)
+        { o.m_buffer = nullptr; o.m_bufferOffset = o.m_bufferSize = o.m_bufferCapacity = o.m_erasedLength = 0; }
     virtual ~ByteBuffer();
     
     ByteBuffer& operator=(const ByteBuffer&);
@@ -70,7 +71,9 @@ public:
     /**
      Tells the buffer to perform secure erasure by zeroing all unused memory.
      
-     This will also trigger a data cache flush where supported.
+     This will also trigger a data cache flush where supported. Bytes consumed from
+     the front of the buffer are erased in batches of at least SecureErasureBatchSize
+     bytes, and whenever the buffer is emptied, compacted, reallocated or destroyed.
      @param value `true` to perform secure erasure, `false` otherwise.
      */
     void SetUsesSecureErasure(bool value=true) { m_secure = value; }
@@ -79,9 +82,8 @@ public:
     /**
      Moves bytes from the receiver into another memory range.
      
-     The receiver keeps its allocation and storage, though its size will be reduced.
-     If data remains in the receiver, the remainder will be moved to the start of its
-     internal storage.
+     The receiver keeps its allocation and storage, though its size will be reduced,
+     as with RemoveBytes().
      
      Call Compact() to collapse the size of the receiver's buffer.
      
@@ -101,14 +103,18 @@ public:
     
     /**
      Removes a number of bytes from the the buffer.
+     
+     Removing bytes from the front of the buffer (the default) is a constant-time
+     operation: the start of the buffer's content simply moves forward within its
+     storage. The space is reclaimed when the buffer is emptied, or once enough of it
+     has accumulated to be worth moving the remaining content down.
      @param numBytesToRemove The number of bytes to remove.
-     @note If this is used a lot, would be useful to maintain a start/end range rather
-     than just a size-- this would make 'removal' much simpler and O(1).
+     @param pos The offset of the first byte to remove.
      */
     void RemoveBytes(size_t numBytesToRemove, size_t pos=0);
     
-    unsigned char* GetBytes() { return m_buffer; }
-    const unsigned char* GetBytes() const { return m_buffer; }
+    unsigned char* GetBytes() { return m_buffer + m_bufferOffset; }
+    const unsigned char* GetBytes() const { return m_buffer + m_bufferOffset; }
     size_t GetBufferSize() const { return m_bufferSize; }
     
     /**
@@ -117,17 +123,37 @@ public:
      */
     void Compact();
     
+    ///
+    /// The minimum number of consumed bytes erased at once when using secure erasure.
+    static const size_t SecureErasureBatchSize = 64 * 1024;
+    
 private:
     
+    ///
+    /// Ensures there's room for `desired` bytes of content, from the start of the content.
     void EnsureCapacity(size_t desired);
+    ///
+    /// Replaces the storage, moving the content to its start.
+    void Reallocate(size_t newCapacity);
     void Clean(unsigned char* ptr, size_t len);
     
+    ///
+    /// Moves the content to the start of the storage, erasing what it leaves behind.
+    void MoveContentToFront();
+    ///
+    /// Securely erases consumed bytes which haven't yet been erased.
+    void EraseConsumedBytes();
+    
     // the object is managing this memory, so a raw pointer is acceptable here
     unsigned char* m_buffer;
+    // offset of the first byte of data; everything before it has been consumed
+    size_t m_bufferOffset;
     // size of actual data
     size_t m_bufferSize;
     // actual allocated capacity (may be more)
     size_t m_bufferCapacity;
+    // length of the consumed prefix which has already been erased (secure erasure only)
+    size_t m_erasedLength;
     // whether to zero unused bytes
     bool m_secure;
 #if EPUB_PLATFORM(WINRT)
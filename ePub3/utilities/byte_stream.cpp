@@ -24,9 +24,6 @@
 #include <libzip/zip.h>
 #include <libzip/zipint.h>          // for internals of zip_file
 #include <sys/stat.h>
-#if EPUB_OS(ANDROID) || EPUB_OS(LINUX) || EPUB_OS(WINDOWS)
-# include <condition_variable>
-#endif
 #if EPUB_OS(WINDOWS)
 # include <io.h>
 #endif
@@ -52,14 +49,11 @@ extern "C" _LIBCPP_NORETURN void __cxa_deleted_virtual()
 
 EPUB3_BEGIN_NAMESPACE
 
-std::thread         AsyncByteStream::_asyncIOThread;
-RunLoopPtr          AsyncByteStream::_asyncRunLoop(nullptr);
-std::atomic_flag    AsyncByteStream::_asyncInited;
-
 AsyncByteStream::AsyncByteStream(size_type bufsize)
   : _bufsize(bufsize),
     _eventHandler(nullptr),
-    _eventSource(nullptr),
+    _ioEngine(nullptr),
+    _ioChannel(nullptr),
     _event(ReadSpaceAvailable),
     _targetRunLoop(nullptr),
     _eventDispatchSource(nullptr)
@@ -68,7 +62,8 @@ AsyncByteStream::AsyncByteStream(size_type bufsize)
 AsyncByteStream::AsyncByteStream(StreamEventHandler handler, size_type bufsize)
   : _bufsize(bufsize),
     _eventHandler(handler),
-    _eventSource(nullptr),
+    _ioEngine(nullptr),
+    _ioChannel(nullptr),
     _event(ReadSpaceAvailable),
     _targetRunLoop(nullptr),
     _eventDispatchSource(nullptr)
@@ -115,11 +110,11 @@ void AsyncByteStream::Close()
     if ( _closing.test_and_set() )
         return;
     
-    if ( bool(_eventSource) )
+    if ( bool(_ioChannel) )
     {
-        if ( !(_eventSource->IsCancelled()) )
-            _eventSource->Cancel();
-        _eventSource = nullptr;
+        if ( !(_ioChannel->IsCancelled()) )
+            _ioChannel->Cancel();
+        _ioChannel = nullptr;
     }
     if ( bool(_eventDispatchSource) )
     {
@@ -155,7 +150,7 @@ ByteStream::size_type AsyncByteStream::ReadBytes(void *buf, size_type len)
     {
         _readbuf->RemoveBytes(result);
         _event |= ReadSpaceAvailable;
-        _eventSource->Signal();
+        _ioChannel->Signal();
     }
     return result;
 }
@@ -166,7 +161,7 @@ ByteStream::size_type AsyncByteStream::WriteBytes(const void *buf, size_type len
     
     size_type result = _writebuf->WriteBytes(reinterpret_cast<const uint8_t*>(buf), len);
     _event |= DataToWrite;
-    _eventSource->Signal();
+    _ioChannel->Signal();
     return result;
 }
 AsyncEvent AsyncByteStream::WaitNextEvent(timeout_type timeout)
@@ -188,80 +183,25 @@ AsyncEvent AsyncByteStream::WaitNextEvent(timeout_type timeout)
     
     return event;
 }
+std::shared_ptr<AsyncIOEngine> AsyncByteStream::IOEngine() const
+{
+    if ( bool(_ioEngine) )
+        return _ioEngine;
+    return AsyncIOEngine::SharedEngine();
+}
 void AsyncByteStream::InitAsyncHandler()
 {
-    if ( _eventSource != nullptr )
+    if ( _ioChannel != nullptr )
         throw std::logic_error("This stream is already set up for async operation.");
     
-    _eventSource = AsyncEventSource();
-    
-    static std::mutex __mut;
-    static std::condition_variable __inited;
-    
-    if ( _asyncInited.test_and_set() == false )
-    {
-        std::unique_lock<std::mutex> __lock(__mut);
-        _asyncIOThread = std::thread([&]() {
-            AsyncByteStream::_asyncRunLoop = RunLoop::CurrentRunLoop();
-            {
-                std::unique_lock<std::mutex> __(__mut);
-                __inited.notify_all();
-            }
-            
-            // now run the run loop
-            
-            // only spin an empty run loop a certain amount of time before giving up
-            // and exiting the thread entirely
-            // FIXME: There's a gap here where a race could lose an EventSource addition
-            static CONSTEXPR unsigned kMaxEmptyTicks(1000);
-            static CONSTEXPR std::chrono::milliseconds kTickLen(10);
-            unsigned __emptyTickCounter = 0;
-            
-            do
-            {
-                RunLoop::ExitReason __r = RunLoop::CurrentRunLoop()->Run(true, std::chrono::seconds(20));
-                if ( __r == RunLoop::ExitReason::RunFinished )
-                {
-                    if ( ++__emptyTickCounter == kMaxEmptyTicks )
-                        break;      // exit the thread
-                    
-                    // wait a bit and try again
-                    std::this_thread::sleep_for(kTickLen);
-                    continue;
-                }
-                
-                // by definition not an empty runloop
-                __emptyTickCounter = 0;
-                
-            } while (1);
-            
-            // nullify the global before we quit
-            // deletion isn't necessary, it's done by TLS in run_loop.cpp
-            _asyncRunLoop = nullptr;
-            _asyncInited.clear();
-        });
-        
-        // detach the new thread
-        _asyncIOThread.detach();
-        
-        // wait for the runloop to be set
-        __inited.wait(__lock, [](){return bool(_asyncRunLoop);});
-    }
-    else if ( _asyncRunLoop == nullptr )
-    {
-        std::unique_lock<std::mutex> __lock(__mut);
-        __inited.wait_for(__lock, std::chrono::milliseconds(150), [](){return bool(_asyncRunLoop);});
-    }
-    
-    // install the event source into the run loop, then we're all done
-    _asyncRunLoop->AddEventSource(_eventSource);
+    _ioChannel = IOEngine()->Attach(AsyncServiceFunction());
 }
-RunLoop::EventSourcePtr AsyncByteStream::AsyncEventSource()
+AsyncIOEngine::ServiceFn AsyncByteStream::AsyncServiceFunction()
 {
     weak_ptr<RingBuffer> weakReadBuf = _readbuf;
     weak_ptr<RingBuffer> weakWriteBuf = _writebuf;
     
-    return RunLoop::EventSource::New([=](RunLoop::EventSource&) {
+    return [=]() {
         // atomically pull out the event flags here
         ThreadEvent t = _event.exchange(Wait);
         if ( t == Wait )
@@ -269,39 +209,58 @@ RunLoop::EventSourcePtr AsyncByteStream::AsyncEventSource()
         
         bool hasRead = false, hasWritten = false;
         
-        uint8_t buf[4096];
-        
         shared_ptr<RingBuffer> readBuf = weakReadBuf.lock();
         shared_ptr<RingBuffer> writeBuf = weakWriteBuf.lock();
         
+        // This thread is the only producer for the read buffer and the only consumer
+        // of the write buffer, so both can be accessed without locking, and the data
+        // moved straight into or out of their storage. Free space or data which wraps
+        // around the end of a buffer takes two regions to cover.
         if ( (t & ReadSpaceAvailable) == ReadSpaceAvailable && readBuf )
         {
-            std::lock_guard<RingBuffer> _(*readBuf);
-            size_type read = this->read_for_async(buf, readBuf->SpaceAvailable());
-            if ( read != 0 )
+            for ( int region = 0; region < 2; region++ )
             {
-                readBuf->WriteBytes(buf, read);
+                size_type space = 0;
+                uint8_t* dst = readBuf->WriteRegion(&space);
+                if ( space == 0 )
+                    break;
+                
+                size_type read = this->read_for_async(dst, space);
+                if ( read == 0 )
+                {
+                    _eof = true;
+                    break;
+                }
+                
+                readBuf->CommitBytes(read);
                 hasRead = true;
-            }
-            else
-            {
-                _eof = true;
+                
+                if ( read < space )
+                    break;
             }
         }
         if ( (t & DataToWrite) == DataToWrite && writeBuf )
         {
-            std::lock_guard<RingBuffer> _(*writeBuf);
-            size_type written = writeBuf->ReadBytes(buf, writeBuf->BytesAvailable());
-            written = this->write_for_async(buf, written);
-            if ( written != 0 )
+            for ( int region = 0; region < 2; region++ )
             {
+                size_type available = 0;
+                const uint8_t* src = writeBuf->ReadRegion(&available);
+                if ( available == 0 )
+                    break;
+                
+                size_type written = this->write_for_async(src, available);
+                if ( written == 0 )
+                {
+                    _eof = true;
+                    break;
+                }
+                
                 // only remove as much as actually went out
                 writeBuf->RemoveBytes(written);
                 hasWritten = true;
-            }
-            else
-            {
-                _eof = true;
+                
+                if ( written < available )
+                    break;
             }
         }
         
@@ -316,7 +275,7 @@ RunLoop::EventSourcePtr AsyncByteStream::AsyncEventSource()
             if ( writeBuf->HasSpace() )
                 _eventHandler(AsyncEvent::HasSpaceAvailable, this);
         }
-    });
+    };
 }
 RunLoop::EventSourcePtr AsyncByteStream::EventDispatchSource()
 {
@@ -327,8 +286,8 @@ RunLoop::EventSourcePtr AsyncByteStream::EventDispatchSource()
                 _eventHandler(AsyncEvent::ErrorOccurred, this);
             if ( bool(_eventDispatchSource) )
                 _eventDispatchSource->Cancel();
-            if ( bool(_eventSource) )
-                _eventSource->Cancel();
+            if ( bool(_ioChannel) )
+                _ioChannel->Cancel();
             return;
         }
         if ( _eof )
@@ -337,8 +296,8 @@ RunLoop::EventSourcePtr AsyncByteStream::EventDispatchSource()
                 _eventHandler(AsyncEvent::EndEncountered, this);
             if ( bool(_eventDispatchSource) )
                 _eventDispatchSource->Cancel();
-            if ( bool(_eventSource) )
-                _eventSource->Cancel();
+            if ( bool(_ioChannel) )
+                _ioChannel->Cancel();
             return;
         }
         
@@ -350,7 +309,7 @@ RunLoop::EventSourcePtr AsyncByteStream::EventDispatchSource()
 }
 void AsyncByteStream::ReadyToRun()
 {
-    if ( _eventSource == nullptr )
+    if ( _ioChannel == nullptr )
         InitAsyncHandler();
     
     ThreadEvent wakeEvent = Wait;
@@ -362,7 +321,7 @@ void AsyncByteStream::ReadyToRun()
     if ( wakeEvent != Wait )
     {
         _event |= wakeEvent;
-        _eventSource->Signal();
+        _ioChannel->Signal();
     }
 }
 
@@ -410,7 +369,7 @@ void AsyncPipe::CounterpartClosed()
     {
         _eof = true;
         _event |= Exceptional;
-        _eventSource->Signal();
+        _ioChannel->Signal();
     }
 }
 AsyncPipe::size_type AsyncPipe::ReadBytes(void *buf, size_type len)
@@ -420,7 +379,7 @@ AsyncPipe::size_type AsyncPipe::ReadBytes(void *buf, size_type len)
     {
         _eof = true;
         _event |= Exceptional;
-        _eventSource->Signal();
+        _ioChannel->Signal();
     }
     return result;
 }
@@ -448,9 +407,22 @@ ByteStream::size_type AsyncPipe::write_for_async(const void* buf, size_type len)
 {
     return _writebuf->BytesAvailable();
 }
-RunLoop::EventSourcePtr AsyncPipe::AsyncEventSource()
+void AsyncPipe::InitAsyncHandler()
 {
-    return RunLoop::EventSource::New([this](RunLoop::EventSource&) {
+    if ( _ioChannel != nullptr )
+        throw std::logic_error("This stream is already set up for async operation.");
+    
+    // a pipe calls its counterpart's handlers, so the two must never run concurrently
+    AsyncIOEngine::ChannelPtr companion;
+    auto counterpart = _counterpart.lock();
+    if ( bool(counterpart) )
+        companion = counterpart->_ioChannel;
+    
+    _ioChannel = IOEngine()->Attach(AsyncServiceFunction(), companion);
+}
+AsyncIOEngine::ServiceFn AsyncPipe::AsyncServiceFunction()
+{
+    return [this]() {
         // atomically pull out the event flags here
         ThreadEvent t = _event.exchange(Wait);
         if ( t == Wait )
@@ -506,7 +478,7 @@ RunLoop::EventSourcePtr AsyncPipe::AsyncEventSource()
                 }
             }
         }
-    });
+    };
 }
 
 #if 0
@@ -734,6 +706,10 @@ ZipFileByteStream::ZipFileByteStream(struct zip* archive, const string& path, in
 {
     Open(archive, path, flags);
 }
+ZipFileByteStream::ZipFileByteStream(struct zip* archive, int index, int flags) : SeekableByteStream(), _file(nullptr), _mode(0)
+{
+    Open(archive, index, flags);
+}
 ZipFileByteStream::~ZipFileByteStream()
 {
     Close();
@@ -767,6 +743,14 @@ bool ZipFileByteStream::Open(struct zip *archive, const string &path, int flags)
     _file = zip_fopen(archive, Sanitized(path).c_str(), flags);
     return ( _file != nullptr );
 }
+bool ZipFileByteStream::Open(struct zip *archive, int index, int flags)
+{
+    if ( _file != nullptr )
+        Close();
+    
+    _file = zip_fopen_index(archive, index, flags);
+    return ( _file != nullptr );
+}
 void ZipFileByteStream::Close()
 {
     if ( _file == nullptr )
@@ -915,6 +899,13 @@ AsyncZipFileByteStream::AsyncZipFileByteStream(struct zip* archive, const string
     if ( !Open(archive, path, zipFlags) )
         throw std::invalid_argument("AsyncZipFileByteStream: failed to Open() archive");
 }
+AsyncZipFileByteStream::AsyncZipFileByteStream(struct zip* archive, int index, int zipFlags)
+ : AsyncByteStream(),
+   ZipFileByteStream()
+{
+    if ( !Open(archive, index, zipFlags) )
+        throw std::invalid_argument("AsyncZipFileByteStream: failed to Open() archive");
+}
 bool AsyncZipFileByteStream::Open(struct zip *archive, const string &path, int flags)
 {
     if ( __F::Open(archive, path, flags) == false )
@@ -923,6 +914,14 @@ bool AsyncZipFileByteStream::Open(struct zip *archive, const string &path, int f
     __A::Open(std::ios::in|std::ios::out);
     return true;
 }
+bool AsyncZipFileByteStream::Open(struct zip *archive, int index, int flags)
+{
+    if ( __F::Open(archive, index, flags) == false )
+        return false;
+    
+    __A::Open(std::ios::in|std::ios::out);
+    return true;
+}
 void AsyncZipFileByteStream::Close()
 {
     __A::Close();
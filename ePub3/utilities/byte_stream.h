@@ -27,6 +27,7 @@
 #include <ios>
 #include <thread>
 #include <ePub3/utilities/run_loop.h>
+#include <ePub3/utilities/async_io_engine.h>
 #include <ePub3/utilities/make_unique.h>
 
 struct zip;
@@ -154,18 +155,18 @@ public:
 /**
  A simple asynchronous stream class.
  
- This class spawns a single shared thread on which reads and writes are issued. Each
- async stream uses a RunLoop::EventSource to notify the shared thread when the
- stream's ReadBytes() or WriteBytes() methods have been called. Similarly, a stream
- may be given a RunLoop on which to fire events advertising the availablility of
- either data to read or space to write.
+ Reads and writes are issued on the I/O threads of an AsyncIOEngine. Each async
+ stream attaches to the engine, which pins it to one of those threads, and signals
+ its AsyncIOEngine::Channel when the stream's ReadBytes() or WriteBytes() methods
+ have been called. Similarly, a stream may be given a RunLoop on which to fire
+ events advertising the availablility of either data to read or space to write.
  @ingroup utilities
  */
 class AsyncByteStream : public ByteStream
 {
 protected:
     ///
-    /// Internal event type-- used to signal the shared I/O thread.
+    /// Internal event type-- used to signal the stream's I/O thread.
     typedef uint8_t             ThreadEvent;
     ///
     /// Take no action: wait for a different event.
@@ -225,13 +226,24 @@ public:
      Retrieve the RunLoop on which the event-handler will be invoked.
      
      If no RunLoop has been assigned, the event-handler will be invoked from the
-     shared I/O thread directly.
+     stream's I/O thread directly.
      */
     virtual RunLoopPtr            EventTargetRunLoop()                const _NOEXCEPT { return _targetRunLoop; }
     ///
     /// Assign a RunLoop on which to invoke the event-handler.
     virtual void                SetTargetRunLoop(RunLoopPtr rl)             _NOEXCEPT;
     
+    ///
+    /// Retrieve the engine performing this stream's I/O: its own, or the shared engine.
+    std::shared_ptr<AsyncIOEngine>  IOEngine()                      const;
+    /**
+     Assign an engine to perform this stream's I/O.
+     
+     This only takes effect if called before the stream is opened or scheduled on a
+     RunLoop. Pass `nullptr` to use AsyncIOEngine::SharedEngine().
+     */
+    void                        SetIOEngine(std::shared_ptr<AsyncIOEngine> engine) _NOEXCEPT { _ioEngine = engine; }
+    
     ///
     /// Retrieve the runloop-assignment callback.
     StreamScheduledHandler      GetScheduledHandler()               const _NOEXCEPT {
@@ -290,11 +302,8 @@ private:
     
     std::atomic_flag            _closing;           ///< A flag used to prevent double-closures.
     
-    static std::thread          _asyncIOThread;     ///< The shared async I/O thread.
-    static RunLoopPtr           _asyncRunLoop;      ///< The shared I/O thread's run loop, to which streams will attach.
-    static std::atomic_flag     _asyncInited;       ///< Set when the async thread is live, unset otherwise.
-    
-    RunLoop::EventSourcePtr     _eventSource;       ///< The event source used to communicate with the shared I/O thread.
+    std::shared_ptr<AsyncIOEngine>  _ioEngine;      ///< The engine to use in place of the shared one, if any.
+    AsyncIOEngine::ChannelPtr   _ioChannel;         ///< The channel used to communicate with the stream's I/O thread.
     std::atomic<ThreadEvent>    _event;             ///< The internal event bitmask. @see ThreadEvent.
     RunLoopPtr                  _targetRunLoop;     ///< The runloop on which this stream should post status events.
     RunLoop::EventSourcePtr     _eventDispatchSource;   ///< The source used to post events to _targetRunLoop.
@@ -306,13 +315,13 @@ private:
     
 protected:
     ///
-    /// Called by subclasses to initialize the asynchronous event handler and RunLoop.
-    /// @throw std::logic_error if this stream has already set up its RunLoop::EventSource.
+    /// Called by subclasses to attach the stream to its I/O engine.
+    /// @throw std::logic_error if this stream has already set up its AsyncIOEngine::Channel.
     virtual void                InitAsyncHandler();
     ///
-    /// Subclasses can override this to return their own EventSource. AsyncByteStream's
+    /// Subclasses can override this to return their own I/O service function. AsyncByteStream's
     /// implementation uses read_for_async() and write_for_async().
-    virtual RunLoop::EventSourcePtr AsyncEventSource();
+    virtual AsyncIOEngine::ServiceFn AsyncServiceFunction();
     ///
     /// Subclasses can implement this to return an event-dispatch source.
     virtual RunLoop::EventSourcePtr EventDispatchSource();
@@ -386,7 +395,11 @@ protected:
     virtual size_type read_for_async(void* buf, size_type len);
     virtual size_type write_for_async(const void* buf, size_type len);
     
-    virtual RunLoop::EventSourcePtr AsyncEventSource();
+    virtual AsyncIOEngine::ServiceFn AsyncServiceFunction() OVERRIDE;
+    
+    ///
+    /// Each end of a pipe services the other's handlers, so both are kept on the same I/O thread.
+    virtual void                InitAsyncHandler() OVERRIDE;
     
     virtual void                CounterpartClosed();
     
@@ -539,6 +552,13 @@ public:
      @param zipFlags Flags such as whether to read the raw compressed data.
      */
     EPUB3_EXPORT            ZipFileByteStream(struct zip* archive, const string& pathToOpen, int zipFlags=0);
+    /**
+     Create a new stream to a file within a zip archive, located by its index.
+     @param archive The Zip arrchive containing the target file.
+     @param index The index within the archive of the resource to open.
+     @param zipFlags Flags such as whether to read the raw compressed data.
+     */
+    EPUB3_EXPORT            ZipFileByteStream(struct zip* archive, int index, int zipFlags=0);
     virtual                 ~ZipFileByteStream();
     
 private:
@@ -566,6 +586,14 @@ public:
      @result Returns `true` if the file opened successfully, `false` otherwise.
      */
     virtual bool            Open(struct zip* archive, const string& path, int zipFlags=0);
+    /**
+     Opens a file within an archive by its index and attaches the stream.
+     @param archive The Zip arrchive containing the target file.
+     @param index The index within the archive of the resource to open.
+     @param zipFlags Flags such as whether to read the raw compressed data.
+     @result Returns `true` if the file opened successfully, `false` otherwise.
+     */
+    virtual bool            Open(struct zip* archive, int index, int zipFlags=0);
     ///
     /// @copydoc ByteStream::Close()
     virtual void            Close();
@@ -711,6 +739,9 @@ public:
     /// Create a new opened stream with no default handler.
                             AsyncZipFileByteStream(struct zip* archive, const string& path, int zipFlags=0);
     ///
+    /// Create a new opened stream to an archive item located by index, with no default handler.
+                            AsyncZipFileByteStream(struct zip* archive, int index, int zipFlags=0);
+    ///
     /// @copydoc AsyncFileByteStream::AsyncFileByteStream(StreamEventHandler)
                             AsyncZipFileByteStream(StreamEventHandler handler) : AsyncByteStream(handler), ZipFileByteStream() {}
     ///
@@ -752,6 +783,9 @@ public:
     /// @copydoc ZipFileByteStream::Open()
     virtual bool            Open(struct zip* archive, const string& path, int zipFlags=0) OVERRIDE;
     ///
+    /// @copydoc ZipFileByteStream::Open(struct zip*,int,int)
+    virtual bool            Open(struct zip* archive, int index, int zipFlags=0) OVERRIDE;
+    ///
     /// @copydoc ByteStream::Close()
 	virtual void            Close();
 
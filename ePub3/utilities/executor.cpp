@@ -141,95 +141,336 @@ void serial_executor::add(closure_type closure)
 #pragma mark -
 #endif
 
-__thread_pool_impl_stdcpp::__thread_pool_impl_stdcpp(int num_threads) : _queue(), _timed_queue(), _threads(), _jobs_in_flight(0), _mutex(), _exiting(false), _jobs_ready(), _timers_updated(), _timed_addition_thread()
+__work_stealing_deque::__work_stealing_deque(int64_t capacity) : _top(0), _bottom(0), _array(new __array(capacity)), _retired()
+{
+}
+__work_stealing_deque::~__work_stealing_deque()
+{
+    __array* a = _array.load(std::memory_order_relaxed);
+    for ( int64_t i = _top.load(std::memory_order_relaxed); i < _bottom.load(std::memory_order_relaxed); i++ )
+        delete a->get(i);
+    delete a;
+    
+    for ( __array* old : _retired )
+        delete old;
+}
+void __work_stealing_deque::push(value_type v)
+{
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_acquire);
+    __array* a = _array.load(std::memory_order_relaxed);
+    if ( b - t > a->__mask )
+    {
+        // full: copy into a larger array, keeping the old one for any thief still reading it
+        __array* bigger = new __array((a->__mask + 1) * 2);
+        for ( int64_t i = t; i < b; i++ )
+            bigger->put(i, a->get(i));
+        _retired.push_back(a);
+        _array.store(bigger, std::memory_order_release);
+        a = bigger;
+    }
+    
+    a->put(b, v);
+    std::atomic_thread_fence(std::memory_order_release);
+    _bottom.store(b + 1, std::memory_order_relaxed);
+}
+__work_stealing_deque::value_type __work_stealing_deque::pop()
+{
+    int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+    __array* a = _array.load(std::memory_order_relaxed);
+    _bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+    
+    if ( t > b )
+    {
+        // empty
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    
+    value_type v = a->get(b);
+    if ( t == b )
+    {
+        // the last one: race any thieves for it
+        if ( !_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+            v = nullptr;
+        _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return v;
+}
+__work_stealing_deque::value_type __work_stealing_deque::steal()
+{
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = _bottom.load(std::memory_order_acquire);
+    if ( t >= b )
+        return nullptr;
+    
+    __array* a = _array.load(std::memory_order_acquire);
+    value_type v = a->get(t);
+    if ( !_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+        return nullptr;
+    return v;
+}
+
+#if 0
+#pragma mark -
+#endif
+
+__injection_queue::__injection_queue(size_t capacity) : _cells(new __cell[capacity]), _mask(capacity-1), _enqueue_pos(0), _dequeue_pos(0), _overflow_lock(), _overflow(), _overflow_count(0)
+{
+    assert((capacity & _mask) == 0);
+    for ( size_t i = 0; i < capacity; i++ )
+        _cells[i].__sequence.store(i, std::memory_order_relaxed);
+}
+void __injection_queue::push(value_type v)
+{
+    if ( _TryPush(v) )
+        return;
+    
+    std::lock_guard<std::mutex> _(_overflow_lock);
+    _overflow.push(v);
+    ++_overflow_count;
+}
+__injection_queue::value_type __injection_queue::pop()
+{
+    value_type v = _TryPop();
+    if ( v != nullptr || _overflow_count == 0 )
+        return v;
+    
+    std::lock_guard<std::mutex> _(_overflow_lock);
+    if ( _overflow.empty() )
+        return nullptr;
+    
+    v = _overflow.front();
+    _overflow.pop();
+    --_overflow_count;
+    return v;
+}
+bool __injection_queue::_TryPush(value_type v)
+{
+    __cell* cell = nullptr;
+    size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->__sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos);
+        if ( diff == 0 )
+        {
+            if ( _enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+                break;
+        }
+        else if ( diff < 0 )
+        {
+            return false;       // full
+        }
+        else
+        {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    
+    cell->__value = v;
+    cell->__sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+__injection_queue::value_type __injection_queue::_TryPop()
+{
+    __cell* cell = nullptr;
+    size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->__sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+        if ( diff == 0 )
+        {
+            if ( _dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+                break;
+        }
+        else if ( diff < 0 )
+        {
+            return nullptr;     // empty
+        }
+        else
+        {
+            pos = _dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    
+    value_type v = cell->__value;
+    cell->__sequence.store(pos + _mask + 1, std::memory_order_release);
+    return v;
+}
+
+#if 0
+#pragma mark -
+#endif
+
+// the worker running on the current thread, if any
+#if EPUB_COMPILER_SUPPORTS(CXX_THREAD_LOCAL)
+static thread_local void* __current_pool_worker = nullptr;
+#endif
+
+__thread_pool_impl_stdcpp::__thread_pool_impl_stdcpp(int num_threads) : _workers(), _injected(), _timed_queue(), _timed_addition_thread(), _timer_mutex(), _timers_updated(), _timed_count(0), _pending(0), _sleepers(0), _idle_mutex(), _jobs_ready(), _exiting(false)
 {
     if ( num_threads < 1 )
         num_threads = std::thread::hardware_concurrency();
     if ( num_threads < 1 )
         num_threads = 1;
     
-    for ( int i = 0; i < num_threads; i++ ) {
-		_threads.emplace_back(&__thread_pool_impl_stdcpp::_RunWorker, this);
+    // all the workers must exist before any of them starts looking for work to steal
+    for ( int i = 0; i < num_threads; i++ )
+    {
+        std::unique_ptr<__worker> worker(new __worker);
+        worker->__pool = this;
+        worker->__index = size_t(i);
+        worker->__rand = uint32_t(i) * 2654435761u + 1;
+        _workers.push_back(std::move(worker));
+    }
+    for ( auto& worker : _workers ) {
+        worker->__os_thread = std::thread(&__thread_pool_impl_stdcpp::_RunWorker, this, worker.get());
     }
     
     _timed_addition_thread = std::thread(&__thread_pool_impl_stdcpp::_RunTimer, this);
 }
 __thread_pool_impl_stdcpp::~__thread_pool_impl_stdcpp()
 {
-    _mutex.lock();
+    // the timer thread takes _idle_mutex while holding _timer_mutex, so never hold both here
+    _timer_mutex.lock();
     _exiting = true;
-    _mutex.unlock();
+    _timer_mutex.unlock();
+    
+    // any worker about to sleep will now see _exiting
+    _idle_mutex.lock();
+    _idle_mutex.unlock();
     
     // wake up all threads -- any that are waiting will see _exiting and exit immediately
     _jobs_ready.notify_all();
     _timers_updated.notify_all();
     
     // wait until all threads have exited
-    for ( std::thread& thr : _threads ) {
-        thr.join();
+    for ( auto& worker : _workers ) {
+        worker->__os_thread.join();
     }
     
     _timed_addition_thread.join();
+    
+    // discard anything which never ran
+    while ( executor::closure_type* closure = _injected.pop() )
+        delete closure;
 }
 void __thread_pool_impl_stdcpp::add(executor::closure_type closure)
 {
-    std::unique_lock<std::mutex> _(_mutex);
-    
-    // enqueue the job
-    _queue.push(closure);
-    
-    // wake one available thread
-    _jobs_ready.notify_one();
+    _Enqueue(new executor::closure_type(std::move(closure)));
 }
 void __thread_pool_impl_stdcpp::add_at(std::chrono::system_clock::time_point abs_time, executor::closure_type closure)
 {
-    std::unique_lock<std::mutex> _(_mutex);
+    std::unique_lock<std::mutex> _(_timer_mutex);
     
     // enqueue the time and the closure-- the priority_queue will sort it into place automatically
     _timed_queue.emplace(abs_time, closure);
+    ++_timed_count;
     
     // notify the timer thread that changes have been made
     _timers_updated.notify_all();
 }
-void __thread_pool_impl_stdcpp::_RunWorker()
+void __thread_pool_impl_stdcpp::_Enqueue(executor::closure_type* closure)
 {
-    do
+    // count it first, so no worker can decide there's nothing to do and sleep through it
+    ++_pending;
+    
+#if EPUB_COMPILER_SUPPORTS(CXX_THREAD_LOCAL)
+    __worker* self = reinterpret_cast<__worker*>(__current_pool_worker);
+    if ( self != nullptr && self->__pool == this )
+        self->__deque.push(closure);        // nested submissions stay local
+    else
+#endif
+        _injected.push(closure);
+    
+    // wake one sleeping thread, if there are any
+    if ( _sleepers > 0 )
     {
-        std::unique_lock<std::mutex> lk(_mutex);
-        if (!_exiting && _queue.size() == 0)
-            _jobs_ready.wait(lk);
-        
-        if ( _exiting )
-            break;
-        
-        if (_queue.empty())
-            continue;       // is this why the copy below is crashing sometimes?
-        
-        // NB: mutex is locked at this point, remember
-		executor::closure_type closure = _queue.front();
-        _queue.pop();
-        ++_jobs_in_flight;
-        
-        // unlock the mutex
-        lk.unlock();
+        std::lock_guard<std::mutex> _(_idle_mutex);
+        _jobs_ready.notify_one();
+    }
+}
+executor::closure_type* __thread_pool_impl_stdcpp::_FindWork(__worker* self)
+{
+    executor::closure_type* closure = self->__deque.pop();
+    if ( closure != nullptr )
+        return closure;
+    
+    closure = _injected.pop();
+    if ( closure != nullptr )
+        return closure;
+    
+    // steal from the others, starting from a random victim
+    size_t count = _workers.size();
+    self->__rand ^= self->__rand << 13;
+    self->__rand ^= self->__rand >> 17;
+    self->__rand ^= self->__rand << 5;
+    size_t start = self->__rand % count;
+    for ( size_t i = 0; i < count; i++ )
+    {
+        __worker* victim = _workers[(start + i) % count].get();
+        if ( victim == self )
+            continue;
         
-        // run the closure
-        executor::_run_closure(closure);
+        closure = victim->__deque.steal();
+        if ( closure != nullptr )
+            return closure;
+    }
+    
+    return nullptr;
+}
+void __thread_pool_impl_stdcpp::_RunWorker(__worker* self)
+{
+#if EPUB_COMPILER_SUPPORTS(CXX_THREAD_LOCAL)
+    __current_pool_worker = self;
+#endif
+    
+    static CONSTEXPR int kSpinCount = 64;
+    int spins = 0;
+    
+    while ( !_exiting )
+    {
+        executor::closure_type* closure = _FindWork(self);
+        if ( closure != nullptr )
+        {
+            --_pending;
+            spins = 0;
+            
+            executor::_run_closure(std::move(*closure));
+            delete closure;
+            continue;
+        }
         
-//        if ( --_jobs_in_flight == 0 && bool(_drained_handler) )
-//            _drained_handler();
+        // something may be on its way, or a steal may have lost a race
+        if ( ++spins < kSpinCount )
+        {
+            std::this_thread::yield();
+            continue;
+        }
         
-    } while (1);
+        std::unique_lock<std::mutex> lk(_idle_mutex);
+        ++_sleepers;
+        _jobs_ready.wait(lk, [this]{ return _exiting || _pending > 0; });
+        --_sleepers;
+        spins = 0;
+    }
+    
+#if EPUB_COMPILER_SUPPORTS(CXX_THREAD_LOCAL)
+    __current_pool_worker = nullptr;
+#endif
 }
 void __thread_pool_impl_stdcpp::_RunTimer()
 {
+    std::unique_lock<std::mutex> lk(_timer_mutex);
     while (!_exiting)
     {
-        std::unique_lock<std::mutex> lk(_mutex);
-        if (_exiting)
-            break;
-        
-        std::cv_status status = std::cv_status::no_timeout;
         if ( _timed_queue.empty() )
         {
             // wait to be notified of additions
@@ -238,26 +479,23 @@ void __thread_pool_impl_stdcpp::_RunTimer()
         else
         {
             // wait until either notified or a timer expires
-            status = _timers_updated.wait_until(lk, _timed_queue.top().first);
+            _timers_updated.wait_until(lk, _timed_queue.top().first);
         }
         
         if ( _exiting )
             break;
         
-        // if we hit the timeout, add the topmost item from the timed queue to the real queue
-        if ( status == std::cv_status::timeout )
+        // move everything which is due onto the pool
+        auto now = std::chrono::system_clock::now();
+        while ( !_timed_queue.empty() && _timed_queue.top().first <= now )
         {
-            // remember that the mutex is still locked at this point
-			executor::closure_type closure = _timed_queue.top().second;
+            executor::closure_type* closure = new executor::closure_type(std::move(const_cast<timed_closure&>(_timed_queue.top()).second));
             _timed_queue.pop();
             
-            // unlock the mutex before calling add(), which will want to own the lock itself
-            lk.unlock();
-            
-            // add the closure to the execution queue
-            add(closure);
+            // the timer thread is never a worker, so this goes straight into the injection queue
+            _Enqueue(closure);
+            --_timed_count;
         }
-        
     }
 }
 
@@ -25,6 +25,8 @@
 #include <functional>
 #include <chrono>
 #include <queue>
+#include <vector>
+#include <memory>
 #include <atomic>
 #include <mutex>
 #include <thread>
@@ -568,29 +570,148 @@ struct __timed_closure_less;
 typedef std::pair<std::chrono::system_clock::time_point, executor::closure_type>                timed_closure;
 typedef std::priority_queue<timed_closure, std::vector<timed_closure>, __timed_closure_less>    timed_closure_queue;
 
+// orders the queue so the earliest time is on top
 struct __timed_closure_less : std::binary_function<timed_closure, timed_closure, bool>
 {
     inline FORCE_INLINE
     bool operator ()(const timed_closure& __lhs, const timed_closure& __rhs) const
         {
-            return __lhs.first < __rhs.first;
+            return __rhs.first < __lhs.first;
         }
 };
 
+/**
+ A Chase-Lev work-stealing deque of closures.
+ 
+ The owning worker pushes and pops at the bottom, without locking; any other thread
+ may steal from the top. The storage grows as needed; outgrown arrays are kept until
+ the deque is destroyed, since a thief may still be reading from one.
+ */
+class __work_stealing_deque
+{
+public:
+    typedef executor::closure_type*     value_type;
+    
+private:
+    struct __array
+    {
+        int64_t                         __mask;
+        std::atomic<value_type>*        __slots;
+        
+        explicit __array(int64_t __capacity) : __mask(__capacity-1), __slots(new std::atomic<value_type>[__capacity]) {}
+        ~__array() { delete [] __slots; }
+        
+        value_type  get(int64_t __i) const              { return __slots[__i & __mask].load(std::memory_order_relaxed); }
+        void        put(int64_t __i, value_type __v)    { __slots[__i & __mask].store(__v, std::memory_order_relaxed); }
+    };
+    
+    std::atomic<int64_t>                _top;
+    std::atomic<int64_t>                _bottom;
+    std::atomic<__array*>               _array;
+    std::vector<__array*>               _retired;       ///< Outgrown arrays; touched only by the owner.
+    
+public:
+    explicit __work_stealing_deque(int64_t capacity = 256);
+    ~__work_stealing_deque();
+    
+    /// Owner only.
+    void        push(value_type __v);
+    /// Owner only. Returns `nullptr` if empty.
+    value_type  pop();
+    /// Any thread. Returns `nullptr` if empty, or if another thread won the race.
+    value_type  steal();
+    
+    FORCE_INLINE
+    bool        empty() const
+        {
+            return _bottom.load(std::memory_order_relaxed) <= _top.load(std::memory_order_relaxed);
+        }
+    
+private:
+    __work_stealing_deque(const __work_stealing_deque&) _DELETED_;
+    __work_stealing_deque& operator=(const __work_stealing_deque&) _DELETED_;
+    
+};
+
+/**
+ A multi-producer, multi-consumer queue of closures submitted from outside a pool.
+ 
+ Closures go into a fixed-size lock-free ring; only if that fills up are they
+ placed in a locked overflow queue.
+ */
+class __injection_queue
+{
+public:
+    typedef executor::closure_type*     value_type;
+    
+private:
+    struct __cell
+    {
+        std::atomic<size_t>             __sequence;
+        value_type                      __value;
+    };
+    
+    std::unique_ptr<__cell[]>           _cells;
+    size_t                              _mask;
+    std::atomic<size_t>                 _enqueue_pos;
+    std::atomic<size_t>                 _dequeue_pos;
+    
+    std::mutex                          _overflow_lock;
+    std::queue<value_type>              _overflow;
+    std::atomic<size_t>                 _overflow_count;
+    
+public:
+    explicit __injection_queue(size_t capacity = 1024);
+    ~__injection_queue() {}
+    
+    void        push(value_type __v);
+    /// Returns `nullptr` if empty.
+    value_type  pop();
+    
+private:
+    bool        _TryPush(value_type __v);
+    value_type  _TryPop();
+    
+    __injection_queue(const __injection_queue&) _DELETED_;
+    __injection_queue& operator=(const __injection_queue&) _DELETED_;
+    
+};
+
+/**
+ The standard thread_pool implementation.
+ 
+ Each worker thread has its own work-stealing deque. Closures added by a worker go
+ onto its own deque; closures from any other thread, including the timer thread,
+ go into a shared lock-free injection queue. Idle workers take from their own deque,
+ then from the injection queue, then steal from the other workers, and only then
+ sleep. A lock is taken only to put a worker to sleep or wake it, and to schedule
+ timed closures.
+ */
 class __thread_pool_impl_stdcpp
 {
-	std::queue<executor::closure_type>	_queue;
+	struct __worker
+	{
+		__thread_pool_impl_stdcpp*	__pool;
+		size_t						__index;
+		__work_stealing_deque		__deque;
+		std::thread					__os_thread;
+		uint32_t					__rand;			// victim selection
+	};
+	
+	std::vector<std::unique_ptr<__worker>>	_workers;
+	__injection_queue					_injected;
+	
 	timed_closure_queue                 _timed_queue;
-
-	std::vector<std::thread>            _threads;
 	std::thread                         _timed_addition_thread;
+	std::mutex                          _timer_mutex;
+	std::condition_variable             _timers_updated;
+	std::atomic_size_t                  _timed_count;
 
-	std::atomic_size_t                  _jobs_in_flight;
-
-	std::mutex                          _mutex;
-	std::atomic<bool>                   _exiting;
+	std::atomic_size_t                  _pending;       ///< Closures queued but not yet started.
+	std::atomic_size_t                  _sleepers;
+	std::mutex                          _idle_mutex;
 	std::condition_variable             _jobs_ready;
-	std::condition_variable             _timers_updated;
+	std::atomic<bool>                   _exiting;
 	
 	__thread_pool_impl_stdcpp(int num_threads);
     
@@ -602,7 +723,7 @@ class __thread_pool_impl_stdcpp
     FORCE_INLINE
 	size_t uninitiated_task_count() const
         {
-            return _queue.size() + _timed_queue.size();
+            return _pending + _timed_count;
         }
 
 	void add_at(std::chrono::system_clock::time_point abs_time, executor::closure_type closure);
@@ -614,7 +735,9 @@ class __thread_pool_impl_stdcpp
         }
 
 private:
-	void _RunWorker();
+	void _Enqueue(executor::closure_type* closure);
+	executor::closure_type* _FindWork(__worker* self);
+	void _RunWorker(__worker* self);
 	void _RunTimer();
 
 	friend class thread_pool;
@@ -315,6 +315,15 @@ string IRI::URLEncodeComponent(const string& str)
     url_util::EncodeURIComponent(str.c_str(), static_cast<int>(str.utf8_size()), &output);
     return string(output.data(), output.length());
 }
+string IRI::URLDecodeComponent(const string& str)
+{
+    if ( str.find('%') == string::npos )
+        return str;
+    
+    url_canon::RawCanonOutputW<256> output;
+    url_util::DecodeURLEscapeSequences(str.c_str(), static_cast<int>(str.utf8_size()), &output);
+    return string(output.data(), output.length());
+}
 string IRI::PercentEncodeUCS(const string& str)
 {
     std::stringstream ss;
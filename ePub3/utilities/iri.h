@@ -309,6 +309,11 @@ public:
     EPUB3_EXPORT
     static string   URLEncodeComponent(const string& str);
     
+    ///
+    /// Decodes any percent-escaped (UTF-8) characters in a path, query, or fragment component.
+    EPUB3_EXPORT
+    static string   URLDecodeComponent(const string& str);
+    
     ///
     /// Percent-encodes the UTF-8 representation of any non-ASCII characters in a string.
     EPUB3_EXPORT
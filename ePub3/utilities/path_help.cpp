@@ -19,49 +19,56 @@
 //  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "path_help.h"
-#include <sstream>
-#include REGEX_INCLUDE
+#include <vector>
 
 EPUB3_BEGIN_NAMESPACE
 
 string CleanupPath(const string& path)
 {
-	static REGEX_NS::regex _PathSplitter("/");
-	std::vector<string> components = path.split(_PathSplitter);
+	const std::string& in = path.stl_str();
+	if (in.empty())
+		return path;
 
-	auto begin = components.begin();
-	auto end = components.end();
-	for (auto pos = begin; pos < end; ++pos)
-	{
-		if (*pos == ".." && pos != begin)
-		{
-			decltype(pos) dotDot, parent;
+	bool absolute = (in[0] == '/');
+	bool trailingSlash = (in[in.size() - 1] == '/');
 
-			dotDot = pos--;
-			if (pos == begin)
-			{
-				parent = begin;
-				pos = dotDot;
-			}
-			else
-			{
-				parent = pos--;
-			}
+	// resolve '.' and '..' segments, keeping any leading '..' of a relative path
+	std::vector<std::string> components;
+	std::string::size_type start = (absolute ? 1 : 0);
+	while (start <= in.size())
+	{
+		std::string::size_type end = in.find('/', start);
+		if (end == std::string::npos)
+			end = in.size();
 
-			components.erase(parent, dotDot);
-			end = components.end();
+		std::string component(in, start, end - start);
+		if (component == ".")
+		{
+			// refers to the current directory
 		}
+		else if (component == "..")
+		{
+			if (!components.empty() && components.back() != "..")
+				components.pop_back();
+			else if (!absolute)
+				components.push_back(component);
+		}
+		else if (!component.empty() || end < in.size())
+		{
+			components.push_back(component);
+		}
+
+		start = end + 1;
 	}
 
-	std::ostringstream ss;
-	for (auto& str : components)
+	std::string result(absolute ? "/" : "");
+	for (auto& component : components)
 	{
-		ss << str;
-		ss << '/';
+		result.append(component);
+		result.push_back('/');
 	}
 
-	string result = ss.str();
-	if (path[path.size() - 1] != '/')
+	if (!trailingSlash && !components.empty())
 		result.erase(result.size() - 1);
 
 	return result;
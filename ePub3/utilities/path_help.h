@@ -23,6 +23,12 @@
 
 EPUB3_BEGIN_NAMESPACE
 
+/**
+ Removes any `.` and `..` segments from a path.
+ 
+ Leading `..` segments of a relative path are kept; those of an absolute path
+ are discarded. Leading and trailing slashes are preserved.
+ */
 string CleanupPath(const string& path);
 
 EPUB3_END_NAMESPACE
@@ -21,32 +21,40 @@
 #include "ring_buffer.h"
 #include <cstring>
 #include <cstdlib>
+#include <algorithm>
 
 EPUB3_BEGIN_NAMESPACE
-RingBuffer::RingBuffer(std::size_t size) : _capacity(size), _numBytes(0), _readPos(0), _writePos(0), _lock()
+
+static std::size_t RoundUpToPowerOfTwo(std::size_t size)
+{
+    std::size_t result = 1;
+    while ( result < size )
+        result <<= 1;
+    return result;
+}
+
+RingBuffer::RingBuffer(std::size_t size) : _capacity(RoundUpToPowerOfTwo(size)), _readCount(0), _writeCount(0), _lock()
 {
     _buffer = new uint8_t[_capacity];
 }
-RingBuffer::RingBuffer(const RingBuffer& o) : _capacity(o._capacity), _numBytes(0), _readPos(0), _writePos(0), _lock()
+RingBuffer::RingBuffer(const RingBuffer& o) : _capacity(o._capacity), _readCount(0), _writeCount(0), _lock()
 {
     _buffer = new uint8_t[_capacity];
     
     std::lock_guard<RingBuffer> _(const_cast<RingBuffer&>(o));
     
-    _numBytes = o._numBytes;
-    _readPos = o._readPos;
-    _writePos = o._writePos;
+    _readCount = o._readCount.load();
+    _writeCount = o._writeCount.load();
     
     std::memcpy(_buffer, o._buffer, _capacity);
 }
-RingBuffer::RingBuffer(RingBuffer&& o) : _capacity(o._capacity), _numBytes(0), _readPos(0), _writePos(0), _lock()
+RingBuffer::RingBuffer(RingBuffer&& o) : _capacity(o._capacity), _readCount(0), _writeCount(0), _lock()
 {
     std::lock_guard<RingBuffer> _(o);
     
     _buffer = o._buffer;            o._buffer = nullptr;
-    _numBytes = o._numBytes;        o._numBytes = 0;
-    _readPos = o._readPos;          o._readPos = 0;
-    _writePos = o._writePos;        o._writePos = 0;
+    _readCount = o._readCount.exchange(0);
+    _writeCount = o._writeCount.exchange(0);
 }
 RingBuffer::~RingBuffer()
 {
@@ -56,7 +64,12 @@ RingBuffer::~RingBuffer()
 }
 RingBuffer& RingBuffer::operator=(const RingBuffer& o)
 {
-    if ( o._capacity > _capacity )
+    if ( this == &o )
+        return *this;
+    
+    std::lock_guard<RingBuffer> _(const_cast<RingBuffer&>(o));
+    
+    if ( o._capacity != _capacity )
     {
         if ( _buffer != nullptr )
             delete [] _buffer;
@@ -64,87 +77,89 @@ RingBuffer& RingBuffer::operator=(const RingBuffer& o)
         _capacity = o._capacity;
     }
     
-    std::lock_guard<RingBuffer>(const_cast<RingBuffer&>(o));
-    
-    _numBytes = o._numBytes;
-    _readPos = o._readPos;
-    _writePos = o._writePos;
+    _readCount = o._readCount.load();
+    _writeCount = o._writeCount.load();
     
     std::memcpy(_buffer, o._buffer, _capacity);
     return *this;
 }
 RingBuffer& RingBuffer::operator=(RingBuffer&& o)
 {
+    if ( this == &o )
+        return *this;
+    
     std::lock_guard<RingBuffer> _(o);
     
     if ( _buffer != nullptr )
         delete [] _buffer;
     
-    _buffer = o._buffer;            o._buffer = 0;
-    _numBytes = o._numBytes;        o._numBytes = 0;
-    _readPos = o._readPos;          o._readPos = 0;
-    _writePos = o._writePos;        o._writePos = 0;
+    _buffer = o._buffer;            o._buffer = nullptr;
+    _capacity = o._capacity;
+    _readCount = o._readCount.exchange(0);
+    _writeCount = o._writeCount.exchange(0);
     return *this;
 }
 std::size_t RingBuffer::ReadBytes(uint8_t *buf, std::size_t len)
 {
-    std::size_t copied = std::min(len, _numBytes);
+    // consumer side: our own counter needs no ordering, the producer's needs acquire
+    std::size_t readCount = _readCount.load(std::memory_order_relaxed);
+    std::size_t available = _writeCount.load(std::memory_order_acquire) - readCount;
+    
+    std::size_t copied = std::min(len, available);
     if ( copied != 0 )
     {
-        if ( _readPos < _writePos )
-        {
-            std::memcpy(buf, &_buffer[_readPos], len);
-        }
-        else
-        {
-            std::size_t __t = _capacity - _readPos;
-            std::memcpy(buf, &_buffer[_readPos], __t);
-            std::memcpy(&buf[__t], _buffer, len - __t);
-        }
+        std::size_t pos = readCount & (_capacity - 1);
+        std::size_t __t = std::min(copied, _capacity - pos);
+        std::memcpy(buf, &_buffer[pos], __t);
+        if ( __t < copied )
+            std::memcpy(&buf[__t], _buffer, copied - __t);
     }
     
     return copied;
 }
 std::size_t RingBuffer::WriteBytes(const uint8_t *buf, std::size_t len)
 {
-    std::size_t copied = std::min(len, SpaceAvailable());
+    // producer side: our own counter needs no ordering, the consumer's needs acquire
+    std::size_t writeCount = _writeCount.load(std::memory_order_relaxed);
+    std::size_t space = _capacity - (writeCount - _readCount.load(std::memory_order_acquire));
+    
+    std::size_t copied = std::min(len, space);
     if ( copied != 0 )
     {
-        if ( _writePos < _readPos )
-        {
-            std::memcpy(&_buffer[_writePos], buf, len);
-            _writePos += len;
-        }
-        else
-        {
-            std::size_t __t = _capacity - _writePos;
-            if ( __t >= len )
-            {
-                std::memcpy(&_buffer[_writePos], buf, len);
-                _writePos += len;
-            }
-            else
-            {
-                std::size_t __b = len - __t;
-                std::memcpy(&_buffer[_writePos], buf, __t);
-                std::memcpy(_buffer, &buf[__t], __b);
-                _writePos = __b;
-            }
-        }
+        std::size_t pos = writeCount & (_capacity - 1);
+        std::size_t __t = std::min(copied, _capacity - pos);
+        std::memcpy(&_buffer[pos], buf, __t);
+        if ( __t < copied )
+            std::memcpy(_buffer, &buf[__t], copied - __t);
         
-        if ( _writePos == _capacity )
-            _writePos = 0;
-        _numBytes += len;
+        // publish the data
+        _writeCount.store(writeCount + copied, std::memory_order_release);
     }
     
     return copied;
 }
 void RingBuffer::RemoveBytes(std::size_t len) _NOEXCEPT
 {
-    _readPos += len;
-    if ( _readPos >= _capacity )
-        _readPos -= _capacity;
-    _numBytes -= len;
+    // hands the space back to the producer
+    _readCount.store(_readCount.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+uint8_t* RingBuffer::WriteRegion(std::size_t* pLen) _NOEXCEPT
+{
+    std::size_t writeCount = _writeCount.load(std::memory_order_relaxed);
+    std::size_t space = _capacity - (writeCount - _readCount.load(std::memory_order_acquire));
+    std::size_t pos = writeCount & (_capacity - 1);
+    
+    *pLen = std::min(space, _capacity - pos);
+    return &_buffer[pos];
+}
+const uint8_t* RingBuffer::ReadRegion(std::size_t* pLen) _NOEXCEPT
+{
+    std::size_t readCount = _readCount.load(std::memory_order_relaxed);
+    std::size_t available = _writeCount.load(std::memory_order_acquire) - readCount;
+    std::size_t pos = readCount & (_capacity - 1);
+    
+    *pLen = std::min(available, _capacity - pos);
+    return &_buffer[pos];
 }
 
 EPUB3_END_NAMESPACE
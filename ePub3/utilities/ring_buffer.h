@@ -23,6 +23,7 @@
 
 #include <ePub3/epub3.h>
 #include <ePub3/utilities/basic.h>
+#include <atomic>
 #include <mutex>
 
 EPUB3_BEGIN_NAMESPACE
@@ -36,13 +37,20 @@ EPUB3_BEGIN_NAMESPACE
  amount of space available in the ring buffer when reading data from any persistent
  storage to be placed herein: only read as much as you can store here.
  
- It is STRONGLY ADVISED that any use of a RingBuffer class be appropiately wrapped
- in calls to its lock() and unlock() methods.  Note that the lock used is a 
- `std::recursive_mutex`, so it is safe to lock it in a nested manner, so long as
- every lock() call is balanced by an unlock().  The RingBuffer class satisfies the
- BasicLockable and Lockable concepts, so it can be locked directly through a
- `std::lock_guard` or `std::unique_lock`, and can be used with a
- `std::condition_variable`, e.g.:
+ A ring buffer is safe for use by a single producer thread and a single consumer
+ thread at once without any locking. The producer calls WriteBytes(), or
+ WriteRegion() and CommitBytes(); the consumer calls ReadBytes(), or ReadRegion(),
+ followed by RemoveBytes(). The read and write positions are atomic counters, each
+ modified only by its own side, and published with release/acquire ordering. The
+ capacity is always a power of two, so positions wrap with a simple mask.
+ 
+ Any other sharing-- more than one producer or consumer, or copying a buffer which
+ is in use-- must be guarded using the buffer's lock() and unlock() methods.  Note
+ that the lock used is a `std::recursive_mutex`, so it is safe to lock it in a
+ nested manner, so long as every lock() call is balanced by an unlock().  The
+ RingBuffer class satisfies the BasicLockable and Lockable concepts, so it can be
+ locked directly through a `std::lock_guard` or `std::unique_lock`, and can be used
+ with a `std::condition_variable`, e.g.:
  
      void func(RingBuffer& buf)
      {
@@ -59,7 +67,7 @@ class RingBuffer
 {
 public:
     ///
-    /// Constructs a new RingBuffer instance.
+    /// Constructs a new RingBuffer instance. The size is rounded up to a power of two.
     EPUB3_EXPORT    RingBuffer(std::size_t size=4096);
     ///
     /// Destructor.
@@ -131,22 +139,24 @@ public:
     /**
      @return `true` is there is data in the buffer, `false` otherwise.
      */
-    bool            HasData()               const _NOEXCEPT  { return _numBytes != 0; }
+    bool            HasData()               const _NOEXCEPT  { return BytesAvailable() != 0; }
     
     /**
      @return The number of bytes available to read from the buffer.
      */
-    std::size_t     BytesAvailable()        const _NOEXCEPT  { return _numBytes; }
+    std::size_t     BytesAvailable()        const _NOEXCEPT  {
+        return _writeCount.load(std::memory_order_acquire) - _readCount.load(std::memory_order_acquire);
+    }
     
     /**
      @return `true` if there is room to write data to the buffer.
      */
-    bool            HasSpace()              const _NOEXCEPT  { return _numBytes != _capacity; }
+    bool            HasSpace()              const _NOEXCEPT  { return BytesAvailable() != _capacity; }
     
     /**
      @return The maximum number of bytes that may currently be written to the buffer.
      */
-    std::size_t     SpaceAvailable()        const _NOEXCEPT  { return _capacity - _numBytes; }
+    std::size_t     SpaceAvailable()        const _NOEXCEPT  { return _capacity - BytesAvailable(); }
     
     /// @}
     
@@ -165,7 +175,6 @@ public:
     
     /**
      Writes data into the buffer.
-     @note This method acquires the instance's modification lock.
      @param  buf A buffer of at least `len` bytes from which data will be copied.
      @param len The number of bytes to copy. This can be an ideal value; if not
      enough space available, a smaller amount will be copied.
@@ -176,29 +185,63 @@ public:
     
     /**
      Removes bytes from the buffer.
-     @note This method acquire's the instance's modification lock.
-     @param len The number of bytes to remove. When `len > _numBytes` the result is
-     undefined.
+     @param len The number of bytes to remove. When `len > BytesAvailable()` the
+     result is undefined.
      */
     EPUB3_EXPORT
     void            RemoveBytes(std::size_t len)    _NOEXCEPT;
     
     /// @}
     
+    /// @{
+    /**
+     @name Zero-Copy Accessors
+     These expose the buffer's storage directly, so that data can be read into it or
+     written out of it without an intermediate copy. Each region is contiguous, so it
+     may be smaller than the total available: once it's been dealt with, ask again
+     for the remainder, which will start at the beginning of the storage.
+     */
+    
+    /**
+     Obtains the contiguous free space at the write position. Called by the producer.
+     @param pLen Storage for the number of bytes which may be written.
+     @result A pointer to the free space. Nothing is visible to the consumer until
+     it is committed with CommitBytes().
+     */
+    uint8_t*        WriteRegion(std::size_t* pLen)  _NOEXCEPT;
+    
+    /**
+     Publishes bytes placed into the region returned by WriteRegion().
+     @param len The number of bytes written, which must not exceed the length of
+     the region.
+     */
+    void            CommitBytes(std::size_t len)    _NOEXCEPT {
+        _writeCount.store(_writeCount.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+    
+    /**
+     Obtains the contiguous data at the read position. Called by the consumer.
+     @param pLen Storage for the number of bytes available in the region.
+     @result A pointer to the data, which remains valid until the bytes are passed
+     to RemoveBytes().
+     */
+    const uint8_t*  ReadRegion(std::size_t* pLen)   _NOEXCEPT;
+    
+    /// @}
+    
 protected:
-    std::size_t             _capacity;  ///< The allocated capacity (in bytes) of the backing store.
+    std::size_t             _capacity;  ///< The allocated capacity (in bytes) of the backing store; a power of two.
     uint8_t*                _buffer;    ///< The buffer backing store.
     
-    std::size_t             _numBytes;  ///< The number of bytes available to read.
-    std::size_t             _readPos;   ///< The current read position.
-    std::size_t             _writePos;  ///< The current write position.
+    // The counters are free-running: positions are found by masking with (_capacity-1).
+    std::atomic<std::size_t> _readCount;    ///< The total number of bytes ever removed. Modified only by the consumer.
+    uint8_t                 _pad[64];   ///< Keeps the two counters on separate cache lines.
+    std::atomic<std::size_t> _writeCount;   ///< The total number of bytes ever written. Modified only by the producer.
     
     std::recursive_mutex    _lock;      ///< An access lock, used to prevent modifications.
     
 };
 
-
-
 EPUB3_END_NAMESPACE
 
 #endif /* defined(__ePub3__ring_buffer__) */
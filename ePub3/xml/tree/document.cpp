@@ -103,23 +103,43 @@ void prune_unchanged_wrappers(xmlNodePtr node, NodeMap & nmap)
 
 EPUB3_XML_BEGIN_NAMESPACE
 
-Document::Document(const string & version) : Node(reinterpret_cast<xmlNodePtr>(xmlNewDoc(version.utf8())))
+NodeArena* _NodeArenaForDocument(_xmlDoc* doc)
 {
+    if ( doc == nullptr )
+        return nullptr;
+    
+    if ( IS_READIUM_WRAPPED_XML(doc) )
+    {
+        // make sure it really is a Document wrapper
+        auto priv = reinterpret_cast<LibXML2Private<Node>*>(doc->_private);
+        Document* document = dynamic_cast<Document*>(priv->__ptr.get());
+        return (document != nullptr ? document->_arena.get() : nullptr);
+    }
+    
+    auto document = Wrapped<Document>(doc);
+    return (bool(document) ? document->_arena.get() : nullptr);
 }
-Document::Document(xmlDocPtr doc) : Node(reinterpret_cast<xmlNodePtr>(doc))
+
+Document::Document(const string & version) : Node(reinterpret_cast<xmlNodePtr>(xmlNewDoc(version.utf8()))), _arena(std::make_shared<NodeArena>())
+{
+}
+Document::Document(xmlDocPtr doc) : Node(reinterpret_cast<xmlNodePtr>(doc)), _arena(std::make_shared<NodeArena>())
 {
     if ( _xml == nullptr )
         throw InternalError("Failed to create new document");
     // ensure the right polymorphic type ptr is installed
     //_xml->_private = this;
 }
-Document::Document(std::shared_ptr<Element> rootElement) : Node(reinterpret_cast<xmlNodePtr>(xmlNewDoc(BAD_CAST "1.0")))
+Document::Document(std::shared_ptr<Element> rootElement) : Node(reinterpret_cast<xmlNodePtr>(xmlNewDoc(BAD_CAST "1.0"))), _arena(std::make_shared<NodeArena>())
 {
     if ( SetRoot(rootElement) == nullptr )
         throw InternalError("Failed to set document root element");
 }
 Document::~Document()
 {
+    // the wrappers must let go of the nodes before they're freed
+    _arena->ReleaseWrappers();
+    
     xmlDocPtr doc = xml();
     Unwrap(_xml);
     _xml = nullptr;
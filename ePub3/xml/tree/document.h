@@ -116,7 +116,7 @@ public:
 #if EPUB_ENABLE(XML_C14N)
     template <C14NVersion _Version, bool _WithComments>
     string Canonicalize(const C14NParams<_Version, _WithComments> & params) const {
-        return "";
+        return C14N::Canonicalize(this, params);
     }
 #endif
 
@@ -126,6 +126,12 @@ public:
     
     string XMLString() const { string __s; WriteXML(__s); return __s; }
     
+#if EPUB_USE(LIBXML2)
+protected:
+    std::shared_ptr<NodeArena>  _arena;     ///< Storage for the wrappers of this document's nodes.
+    
+    friend NodeArena* _NodeArenaForDocument(_xmlDoc* __doc);
+#endif
 };
 
 EPUB3_XML_END_NAMESPACE
@@ -28,6 +28,7 @@
 #include <string>
 #include <sstream>
 #include <cstdlib>
+#include <algorithm>
 
 #if EPUB_PLATFORM(MAC)
 #include "xml_bridge_dtrace_probes.h"
@@ -115,6 +116,80 @@ std::string TypeString(NodeType type)
     return r;
 }
 
+#if 0
+#pragma mark - NodeArena
+#endif
+
+// blocks hold a few hundred wrappers each
+static CONSTEXPR size_t kNodeArenaBlockSize = 16 * 1024;
+
+struct NodeArenaBlockHeader
+{
+    void*   prev;
+    size_t  size;
+};
+
+NodeArena::~NodeArena()
+{
+    void* block = _block;
+    while ( block != nullptr )
+    {
+        void* prev = reinterpret_cast<NodeArenaBlockHeader*>(block)->prev;
+        ::operator delete(block);
+        block = prev;
+    }
+}
+void* NodeArena::Allocate(size_t size, size_t alignment)
+{
+    std::lock_guard<std::mutex> _(_lock);
+    
+    size_t offset = (_cursor + alignment - 1) & ~(alignment - 1);
+    if ( _block == nullptr || offset + size > reinterpret_cast<NodeArenaBlockHeader*>(_block)->size )
+    {
+        // the header is followed by suitably-aligned space for the request
+        size_t start = (sizeof(NodeArenaBlockHeader) + alignment - 1) & ~(alignment - 1);
+        size_t blockSize = std::max(kNodeArenaBlockSize, start + size);
+        NodeArenaBlockHeader* header = reinterpret_cast<NodeArenaBlockHeader*>(::operator new(blockSize));
+        header->prev = _block;
+        header->size = blockSize;
+        _block = header;
+        offset = start;
+    }
+    
+    _cursor = offset + size;
+    return reinterpret_cast<uint8_t*>(_block) + offset;
+}
+void NodeArena::ReleasePrivate(void* p)
+{
+    Record* r = reinterpret_cast<Record*>(p) - 1;
+    auto release = r->release;
+    if ( release != nullptr )
+    {
+        r->release = nullptr;
+        release(p);
+    }
+}
+void NodeArena::ReleaseWrappers()
+{
+    Record* records = nullptr;
+    {
+        std::lock_guard<std::mutex> _(_lock);
+        records = _records;
+        _records = nullptr;
+    }
+    
+    // releasing a wrapper may free the last reference to this arena
+    auto self = shared_from_this();
+    for ( Record* r = records; r != nullptr; r = r->next )
+    {
+        ReleasePrivate(r + 1);
+    }
+}
+
+#if 0
+#pragma mark - Node
+#endif
+
 Node::Node(_xmlNode *xml) : _xml(xml)
 {
     //_xml->_private = this;
@@ -187,9 +262,10 @@ Node::~Node()
     // free the underlying node if *and only if* it is detached
     if ( _xml->parent == nullptr && _xml->prev == nullptr && _xml->next == nullptr )
     {
-        _xml->_private = nullptr;
-        delete priv;
-        xmlFreeNode(_xml);
+        xmlNodePtr node = _xml;
+        node->_private = nullptr;
+        _DisposePrivate(priv);
+        xmlFreeNode(node);
     }
 }
 
@@ -547,6 +623,73 @@ void Node::Detach()
     xmlUnlinkNode(_xml);
 }
 
+#if 0
+#pragma mark - NodeHandle
+#endif
+
+NodeType NodeHandle::Type() const
+{
+    return NodeType(_xml->type);
+}
+string NodeHandle::Name() const
+{
+    if ( _xml->name == nullptr )
+        return string::EmptyString;
+    return _xml->name;
+}
+bool NodeHandle::HasName(const char* name) const
+{
+    return (_xml->name != nullptr && xmlStrEqual(_xml->name, BAD_CAST name) != 0);
+}
+string NodeHandle::AttributeValue(const string& name, const string& nsURI) const
+{
+    xmlChar * ch = nullptr;
+    if ( !nsURI.empty() )
+        ch = xmlGetNsProp(_xml, name.xml_str(), nsURI.xml_str());
+    if ( ch == nullptr )
+        ch = xmlGetProp(_xml, name.xml_str());
+    if ( ch == nullptr )
+        return string::EmptyString;
+    
+    string result(ch);
+    xmlFree(ch);
+    return result;
+}
+string NodeHandle::StringValue() const
+{
+    xmlChar * content = xmlNodeGetContent(_xml);
+    if ( content == nullptr )
+        return string();
+    
+    string result(content);
+    xmlFree(content);
+    return result;
+}
+NodeHandle NodeHandle::Parent() const
+{
+    return NodeHandle(_xml->parent);
+}
+NodeHandle NodeHandle::FirstChild() const
+{
+    return NodeHandle(_xml->children);
+}
+NodeHandle NodeHandle::FirstElementChild() const
+{
+    return NodeHandle(xmlFirstElementChild(_xml));
+}
+NodeHandle NodeHandle::NextSibling() const
+{
+    return NodeHandle(_xml->next);
+}
+NodeHandle NodeHandle::NextElementSibling() const
+{
+    return NodeHandle(xmlNextElementSibling(_xml));
+}
+std::shared_ptr<Node> NodeHandle::Wrapper() const
+{
+    return Wrapped<Node>(_xml);
+}
+
 #if 0
 #pragma mark - XPath Utilities
 #endif
@@ -646,7 +789,7 @@ void Node::Unwrap(_xmlNode *aNode)
         if (ptr->__sig == _READIUM_XML_SIGNATURE)
         {
             ptr->__ptr->release();
-            delete ptr;
+            _DisposePrivate(ptr);
         }
         aNode->_private = nullptr;
     }
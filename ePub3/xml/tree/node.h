@@ -216,6 +216,60 @@ protected:
     
 };
 
+/**
+ A lightweight, non-owning reference to a node in a document tree.
+ 
+ Walking a tree through Node's accessors creates a wrapper for every node visited,
+ and keeps it for the lifetime of the document. A NodeHandle reads the native node
+ directly, so loops which only inspect names and attributes wrap nothing at all.
+ Use Wrapper() to obtain the full Node when one is needed.
+ 
+ A handle is only valid for as long as the document containing its node.
+ @ingroup tree
+ */
+class NodeHandle
+{
+public:
+    typedef Node::NativePtr NativePtr;
+    
+public:
+    NodeHandle() : _xml(nullptr) {}
+    explicit NodeHandle(NativePtr node) : _xml(node) {}
+    NodeHandle(std::shared_ptr<const Node> node) : _xml(bool(node) ? const_cast<Node*>(node.get())->xml() : nullptr) {}
+    NodeHandle(const NodeHandle& o) : _xml(o._xml) {}
+    ~NodeHandle() {}
+    
+    NodeHandle& operator=(const NodeHandle& o) { _xml = o._xml; return *this; }
+    
+    explicit operator bool() const { return _xml != nullptr; }
+    bool operator==(const NodeHandle& o) const { return _xml == o._xml; }
+    bool operator!=(const NodeHandle& o) const { return _xml != o._xml; }
+    
+    NativePtr xml() const { return _xml; }
+    
+    NodeType Type() const;
+    bool IsElementNode() const { return Type() == NodeType::Element; }
+    
+    string Name() const;
+    /// Compares the node's local name without copying it.
+    bool HasName(const char* name) const;
+    string AttributeValue(const string& name, const string& namespaceURI = string()) const;
+    string StringValue() const;
+    
+    NodeHandle Parent() const;
+    NodeHandle FirstChild() const;
+    NodeHandle FirstElementChild() const;
+    NodeHandle NextSibling() const;
+    NodeHandle NextElementSibling() const;
+    
+    /// Returns the node's wrapper, creating it if necessary.
+    std::shared_ptr<Node> Wrapper() const;
+    
+private:
+    NativePtr _xml;
+    
+};
+
 EPUB3_XML_END_NAMESPACE
 
 #endif /* defined(__ePub3_xml_node__) */
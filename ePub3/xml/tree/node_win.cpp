@@ -595,6 +595,70 @@ void Node::Detach()
 	xmlUnlinkNode(_xml);
 }
 #endif	// EPUB_ENABLE(XML_BUILDER)
+#if 0
+#pragma mark - NodeHandle
+#endif
+
+NodeType NodeHandle::Type() const
+{
+	return NodeType(_xml->NodeType);
+}
+string NodeHandle::Name() const
+{
+	return __winstr(_xml->LocalName);
+}
+bool NodeHandle::HasName(const char* name) const
+{
+	return Name() == name;
+}
+string NodeHandle::AttributeValue(const string& name, const string& namespaceURI) const
+{
+	IXmlElement^ element = dynamic_cast<IXmlElement^>(_xml);
+	if (element == nullptr)
+		return string();
+
+	if (namespaceURI.empty())
+		return element->GetAttribute(name);
+
+	return element->GetAttributeNS(namespaceURI, name);
+}
+string NodeHandle::StringValue() const
+{
+	return _xml->InnerText;
+}
+NodeHandle NodeHandle::Parent() const
+{
+	return NodeHandle(_xml->ParentNode);
+}
+NodeHandle NodeHandle::FirstChild() const
+{
+	return NodeHandle(_xml->FirstChild);
+}
+NodeHandle NodeHandle::FirstElementChild() const
+{
+	auto child = _xml->FirstChild;
+	while (child != nullptr && child->NodeType != ::Windows::Data::Xml::Dom::NodeType::ElementNode)
+		child = child->NextSibling;
+	return NodeHandle(child);
+}
+NodeHandle NodeHandle::NextSibling() const
+{
+	return NodeHandle(_xml->NextSibling);
+}
+NodeHandle NodeHandle::NextElementSibling() const
+{
+	auto next = _xml->NextSibling;
+	while (next != nullptr && next->NodeType != ::Windows::Data::Xml::Dom::NodeType::ElementNode)
+		next = next->NextSibling;
+	return NodeHandle(next);
+}
+std::shared_ptr<Node> NodeHandle::Wrapper() const
+{
+	if (_xml == nullptr)
+		return nullptr;
+	return Node::NewNode(_xml);
+}
+
 #if 0
 #pragma mark - XPath Utilities
 #endif
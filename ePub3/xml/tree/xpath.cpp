@@ -22,6 +22,9 @@
 #include "node.h"
 #include "document.h"
 #include <libxml/xpathInternals.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 EPUB3_XML_BEGIN_NAMESPACE
 
@@ -52,6 +55,66 @@ void XPathEvaluator::_XMLFunctionWrapper(xmlXPathParserContextPtr ctx, int nargs
     evaluator->PerformFunction(ctx, ctx->context->function, ctx->context->functionURI, nargs);
 }
 
+// Idle compiled expressions, keyed by XPath. There are at most as many copies of
+// an expression as there have ever been concurrent evaluators using it.
+class CompiledExpressionCache
+{
+public:
+    typedef std::unordered_map<std::string, std::vector<xmlXPathCompExprPtr>> ExpressionMap;
+    
+    CompiledExpressionCache() : _lock(), _expressions() {}
+    ~CompiledExpressionCache()
+    {
+        for ( auto& pair : _expressions )
+        {
+            for ( auto compiled : pair.second )
+                xmlXPathFreeCompExpr(compiled);
+        }
+    }
+    
+    xmlXPathCompExprPtr CheckOut(const string & xpath)
+    {
+        {
+            std::lock_guard<std::mutex> _(_lock);
+            auto found = _expressions.find(xpath.stl_str());
+            if ( found != _expressions.end() && !found->second.empty() )
+            {
+                xmlXPathCompExprPtr compiled = found->second.back();
+                found->second.pop_back();
+                return compiled;
+            }
+        }
+        
+        // compile outside the lock
+        return xmlXPathCompile(xpath.utf8());
+    }
+    void Return(const string & xpath, xmlXPathCompExprPtr compiled)
+    {
+        std::lock_guard<std::mutex> _(_lock);
+        _expressions[xpath.stl_str()].push_back(compiled);
+    }
+    
+private:
+    std::mutex      _lock;
+    ExpressionMap   _expressions;
+};
+
+static CompiledExpressionCache& __compiled_expressions()
+{
+    static CompiledExpressionCache __cache;
+    return __cache;
+}
+
+xmlXPathCompExprPtr XPathEvaluator::CheckOutCompiledExpression(const string & xpath)
+{
+    return __compiled_expressions().CheckOut(xpath);
+}
+void XPathEvaluator::ReturnCompiledExpression(const string & xpath, xmlXPathCompExprPtr compiled)
+{
+    if ( compiled != nullptr )
+        __compiled_expressions().Return(xpath, compiled);
+}
+
 XPathEvaluator::XPathEvaluator(const string & xpath, std::shared_ptr<const class Document> document)
 : _xpath(xpath), _document(document), _ctx(nullptr), _compiled(nullptr), _lastResult(NULL)
 {
@@ -70,20 +133,34 @@ XPathEvaluator::XPathEvaluator(const string & xpath, std::shared_ptr<const class
 }
 XPathEvaluator::~XPathEvaluator()
 {
-    if ( _compiled != nullptr )
-        xmlXPathFreeCompExpr(_compiled);
+    ReturnCompiledExpression(_xpath, _compiled);
     if ( _lastResult != nullptr )
         xmlXPathFreeObject(_lastResult);
     if ( _ctx != nullptr )
         xmlXPathFreeContext(_ctx);
 }
 
+void XPathEvaluator::SetXPath(const string & xpath)
+{
+    if ( _lastResult != nullptr )
+    {
+        xmlXPathFreeObject(_lastResult);
+        _lastResult = nullptr;
+    }
+    
+    if ( xpath == _xpath )
+        return;
+    
+    ReturnCompiledExpression(_xpath, _compiled);
+    _compiled = nullptr;
+    _xpath = xpath;
+}
 bool XPathEvaluator::Compile()
 {
     if (_compiled)
         return true;
     
-    _compiled = xmlXPathCompile(_xpath.utf8());
+    _compiled = CheckOutCompiledExpression(_xpath);
     return _compiled != nullptr;
 }
 
@@ -245,7 +322,7 @@ bool XPathEvaluator::Evaluate(std::shared_ptr<const Node> node, ObjectType * res
         xmlXPathFreeObject(_lastResult);
     
     _ctx->node = const_cast<xmlNodePtr>(node->xml());
-    if (_compiled != nullptr)
+    if (Compile())
         _lastResult = xmlXPathCompiledEval(_compiled, _ctx);
     else
         _lastResult = xmlXPathEval(_xpath.utf8(), _ctx);
@@ -256,16 +333,21 @@ bool XPathEvaluator::Evaluate(std::shared_ptr<const Node> node, ObjectType * res
 bool XPathEvaluator::EvaluateAsBoolean(std::shared_ptr<const Node> node)
 {
     if ( _lastResult != nullptr )
+    {
         xmlXPathFreeObject(_lastResult);
+        _lastResult = nullptr;
+    }
     
     _ctx->node = const_cast<xmlNodePtr>(node->xml());
     int r = 0;
-    if (_compiled != nullptr) {
+    if (Compile()) {
         r = xmlXPathCompiledEvalToBoolean(_compiled, _ctx);
     } else {
         xmlXPathObjectPtr obj = xmlXPathEval(_xpath.utf8(), _ctx);
-        if (obj != nullptr)
+        if (obj != nullptr) {
             r = xmlXPathCastToBoolean(obj);
+            xmlXPathFreeObject(obj);
+        }
     }
     return ( r != 0 );
 }
@@ -78,8 +78,25 @@ public:
     string XPath() const { return _xpath; }
 	std::shared_ptr<const class Document> Document() const { return _document; }
     
+    /**
+     Changes the expression to evaluate.
+     
+     The evaluation context, along with any registered namespaces, functions and
+     variables, is retained, so one evaluator can run any number of queries against
+     its document. Any current result is discarded.
+     */
+    void SetXPath(const string & xpath);
+    
     //////////////////////////////////////////////////////////////////
     // Compilation (optional)
+    
+    /**
+     Compiles the expression, if that hasn't been done already.
+     
+     Compiled expressions are cached for the lifetime of the process, and are shared
+     between all evaluators using the same XPath. Evaluate() compiles the expression
+     if necessary, so there is no need to call this first.
+     */
     bool Compile();
     
     //////////////////////////////////////////////////////////////////
@@ -118,6 +135,11 @@ protected:
     
     static void _XMLFunctionWrapper(xmlXPathParserContextPtr ctx, int nargs);
     void PerformFunction(xmlXPathParserContextPtr ctx, const string & name, const string & uri, int nargs);
+    
+    // libxml2 writes to a compiled expression as it evaluates it, so each evaluator
+    // checks one out of the cache for its exclusive use, and returns it when done.
+    static _xmlXPathCompExpr * CheckOutCompiledExpression(const string & xpath);
+    static void ReturnCompiledExpression(const string & xpath, _xmlXPathCompExpr * compiled);
 #endif
     string									_xpath;
 	std::shared_ptr<const class Document>	_document;
@@ -36,6 +36,11 @@ XPathEvaluator::~XPathEvaluator()
 {
 	_lastResult = nullptr;
 }
+void XPathEvaluator::SetXPath(const string & xpath)
+{
+	_xpath = xpath;
+	_lastResult = nullptr;
+}
 
 #if 0
 #pragma mark - XPath Environment
@@ -30,11 +30,13 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <mutex>
 
 #define PROMISCUOUS_LIBXML_OVERRIDES 0
 
 #if EPUB_USE(LIBXML2)
 #include <libxml/xmlerror.h>
+#include <libxml/tree.h>
 #define xml_native_cast reinterpret_cast
 #undef PROMISCUOUS_LIBXML_OVERRIDES
 #define PROMISCUOUS_LIBXML_OVERRIDES 1
@@ -120,13 +122,16 @@ template <typename _Tp>
 struct LibXML2Private
 {
     LibXML2Private()
-        : __sig(_READIUM_XML_SIGNATURE), __ptr(nullptr)
+        : __sig(_READIUM_XML_SIGNATURE), __ptr(nullptr), __pooled(false)
         {}
     LibXML2Private(_Tp* __p)
-        : __sig(_READIUM_XML_SIGNATURE), __ptr(__p)
+        : __sig(_READIUM_XML_SIGNATURE), __ptr(__p), __pooled(false)
         {}
     LibXML2Private(std::shared_ptr<_Tp>& __p)
-        : __sig(_READIUM_XML_SIGNATURE), __ptr(__p)
+        : __sig(_READIUM_XML_SIGNATURE), __ptr(__p), __pooled(false)
+        {}
+    LibXML2Private(std::shared_ptr<_Tp>&& __p, bool __pool)
+        : __sig(_READIUM_XML_SIGNATURE), __ptr(std::move(__p)), __pooled(__pool)
         {}
     ~LibXML2Private()
         { __sig = 0xbaadf00d; }
@@ -134,7 +139,162 @@ struct LibXML2Private
     // data member-- used to determine if this is a Readium-made pointer
     unsigned int __sig;
     std::shared_ptr<_Tp> __ptr;
+    bool __pooled;          // allocated from a NodeArena rather than with new
 };
+
+/**
+ Storage for the wrapper objects of a single document.
+ 
+ Wrapping a node needs three objects: the LibXML2Private attached to the libxml
+ node, the wrapper itself, and its shared_ptr control block. A NodeArena hands
+ these out from large blocks rather than allocating each from the heap, and frees
+ the blocks all at once.
+ 
+ The arena belongs to a Document, which calls ReleaseWrappers() when it's being
+ destroyed. The blocks themselves are freed once every wrapper has gone.
+ @ingroup xml-utils
+ */
+class NodeArena : public std::enable_shared_from_this<NodeArena>
+{
+public:
+    NodeArena() : _lock(), _block(nullptr), _cursor(0), _records(nullptr) {}
+    ~NodeArena();
+    
+    /// Allocates storage, which is never individually freed.
+    void* Allocate(size_t size, size_t alignment);
+    
+    /**
+     Creates the LibXML2Private for a libxml node, and a wrapper to go in it.
+     
+     The private is destroyed by ReleaseWrappers(), or by ReleasePrivate() if the
+     node is unwrapped before then.
+     */
+    template <class _Tp, typename _Nm>
+    LibXML2Private<_Tp>* NewPrivate(_Nm* __n);
+    
+    /// Destroys a private created by NewPrivate().
+    static void ReleasePrivate(void* __p);
+    
+    /// Destroys every private still alive, dropping their references to the wrappers.
+    void ReleaseWrappers();
+    
+    /// Allocator for wrappers and their control blocks, via std::allocate_shared().
+    template <typename _Tp>
+    class Allocator
+    {
+    public:
+        typedef _Tp value_type;
+        template <typename _Up> struct rebind { typedef Allocator<_Up> other; };
+        
+        Allocator(std::shared_ptr<NodeArena> __arena) : _arena(std::move(__arena)) {}
+        template <typename _Up>
+        Allocator(const Allocator<_Up>& __o) : _arena(__o._arena) {}
+        
+        _Tp* allocate(size_t __n)
+            { return reinterpret_cast<_Tp*>(_arena->Allocate(sizeof(_Tp) * __n, alignof(_Tp))); }
+        void deallocate(_Tp*, size_t)
+            {}
+        
+        template <typename _Up>
+        bool operator==(const Allocator<_Up>& __o) const { return _arena == __o._arena; }
+        template <typename _Up>
+        bool operator!=(const Allocator<_Up>& __o) const { return _arena != __o._arena; }
+        
+    private:
+        // keeps the blocks alive for as long as the wrapper
+        std::shared_ptr<NodeArena> _arena;
+        
+        template <typename _Up> friend class Allocator;
+    };
+    
+private:
+    // each private is preceded by one of these, so they can all be found again
+    struct Record
+    {
+        Record*     next;
+        void        (*release)(void*);
+    };
+    
+    template <class _Tp>
+    static void _ReleasePrivate(void* __p)
+    {
+        LibXML2Private<_Tp>* __priv = reinterpret_cast<LibXML2Private<_Tp>*>(__p);
+        if ( __priv->__ptr )
+        {
+            // detach the libxml node first, so nothing can find the private again
+            auto __xml = __priv->__ptr->xml();
+            if ( __xml != nullptr && __xml->_private == __p )
+                __xml->_private = nullptr;
+            __priv->__ptr->release();
+        }
+        __priv->~LibXML2Private<_Tp>();
+    }
+    
+    std::mutex      _lock;
+    void*           _block;     ///< The current block; each starts with a pointer to the previous one.
+    size_t          _cursor;    ///< The offset of the free space in `_block`.
+    Record*         _records;   ///< The most recently created private.
+};
+
+template <class _Tp, typename _Nm>
+LibXML2Private<_Tp>* NodeArena::NewPrivate(_Nm* __n)
+{
+    std::shared_ptr<_Tp> __wrapper = std::allocate_shared<_Tp>(Allocator<_Tp>(shared_from_this()), __n);
+    
+    static_assert(sizeof(Record) % alignof(LibXML2Private<_Tp>) == 0, "NodeArena records must preserve alignment");
+    Record* __r = reinterpret_cast<Record*>(Allocate(sizeof(Record) + sizeof(LibXML2Private<_Tp>), alignof(Record)));
+    __r->release = &NodeArena::_ReleasePrivate<_Tp>;
+    
+    LibXML2Private<_Tp>* __p = new (__r + 1) LibXML2Private<_Tp>(std::move(__wrapper), true);
+    
+    std::lock_guard<std::mutex> _(_lock);
+    __r->next = _records;
+    _records = __r;
+    return __p;
+}
+
+/**
+ Destroys a LibXML2Private, however it was allocated.
+ @ingroup xml-utils
+ */
+template <typename _Tp>
+static inline void _DisposePrivate(LibXML2Private<_Tp>* __p)
+{
+    if ( __p->__pooled )
+        NodeArena::ReleasePrivate(__p);
+    else
+        delete __p;
+}
+
+/**
+ Locates the arena of the document owning a node, creating the document's wrapper
+ if necessary.
+ @result The arena, or `nullptr` if the node's wrapper shouldn't come from one.
+ @ingroup xml-utils
+ */
+NodeArena* _NodeArenaForDocument(_xmlDoc* __doc);
+
+// documents, DTDs and namespaces are few, and their wrappers are allocated normally
+static inline _xmlDoc* _PooledOwnerDocument(_xmlNode* __n)
+{
+    switch ( __n->type )
+    {
+        case XML_ELEMENT_NODE:
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+        case XML_ENTITY_REF_NODE:
+            return __n->doc;
+        default:
+            return nullptr;
+    }
+}
+template <typename _Nm>
+static inline _xmlDoc* _PooledOwnerDocument(_Nm*)
+{
+    return nullptr;
+}
 #endif
 
 #if !EPUB_PLATFORM(WINRT)
@@ -177,7 +337,12 @@ static inline std::shared_ptr<_Tp> Wrapped(_Nm * __n)
     }
     
     
-    _PrivatePtr __p = new LibXML2Private<_Tp>(new _Tp(__n));
+    _PrivatePtr __p = nullptr;
+    NodeArena* __arena = _NodeArenaForDocument(_PooledOwnerDocument(__n));
+    if ( __arena != nullptr )
+        __p = __arena->NewPrivate<_Tp>(__n);
+    else
+        __p = new LibXML2Private<_Tp>(new _Tp(__n));
     __n->_private = __p;
     return __p->__ptr;
 }
@@ -201,7 +366,7 @@ static inline void Rewrap(_Nm* __n, std::shared_ptr<_Tp> __t)
             if (__p->__ptr == __t)
                 return;
             
-            delete __p;
+            _DisposePrivate(__p);
             __n->_private = nullptr;
         }
         
@@ -74,8 +74,14 @@ OutputBuffer::OutputBuffer(const std::string & encoding)
 }
 OutputBuffer::~OutputBuffer()
 {
-    xmlMemFree(_buf);
-    _buf = nullptr;
+    if ( _buf != nullptr )
+    {
+        // subclasses are gone by now, so closing mustn't call back into them
+        _buf->writecallback = nullptr;
+        _buf->closecallback = nullptr;
+        xmlOutputBufferClose(_buf);
+        _buf = nullptr;
+    }
 }
 int OutputBuffer::write_cb(void *context, const char *buffer, int len)
 {
@@ -19,3 +19,59 @@
 //  Affero General Public License along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "c14n.h"
+#include "../tree/document.h"
+
+#if EPUB_ENABLE(XML_C14N)
+
+#include <libxml/c14n.h>
+
+EPUB3_XML_BEGIN_NAMESPACE
+
+const C14NParams<C14NVersion::v1_0, false>              C14N::V1_0;
+const C14NParams<C14NVersion::v1_0, true>               C14N::V1_0_WithComments;
+const C14NParams<C14NVersion::v1_0_Exclusive, false>    C14N::V1_0_Exclusive;
+const C14NParams<C14NVersion::v1_0_Exclusive, true>     C14N::V1_0_Exclusive_WithComments;
+const C14NParams<C14NVersion::v1_1, false>              C14N::V1_1;
+const C14NParams<C14NVersion::v1_1, true>               C14N::V1_1_WithComments;
+const C14NParams<C14NVersion::v2_0, false>              C14N::V2_0;
+const C14NParams<C14NVersion::v2_0, true>               C14N::V2_0_WithComments;
+
+bool C14N::CanonicalizeDocument(const Document *doc, OutputBuffer &output, C14NVersion version, bool withComments)
+{
+    int mode = 0;
+    switch ( version )
+    {
+#if LIBXML_VERSION >= 20704
+        case C14NVersion::v1_0:
+            mode = XML_C14N_1_0;
+            break;
+        case C14NVersion::v1_0_Exclusive:
+            mode = XML_C14N_EXCLUSIVE_1_0;
+            break;
+        case C14NVersion::v1_1:
+            mode = XML_C14N_1_1;
+            break;
+#else
+        // older releases (such as the one bundled for Android) take an 'exclusive' flag, and have no C14N 1.1
+        case C14NVersion::v1_0:
+            mode = 0;
+            break;
+        case C14NVersion::v1_0_Exclusive:
+            mode = 1;
+            break;
+#endif
+        default:
+            return false;
+    }
+    
+    if ( doc == nullptr )
+        return false;
+    
+    int r = xmlC14NDocSaveTo(const_cast<xmlDocPtr>(doc->xml()), nullptr, mode, nullptr, (withComments ? 1 : 0), output.xmlBuffer());
+    output.flush();
+    return r >= 0;
+}
+
+EPUB3_XML_END_NAMESPACE
+
+#endif  // EPUB_ENABLE(XML_C14N)
@@ -99,17 +99,31 @@ struct C14N
     static const C14NParams<C14NVersion::v2_0, false> C14N2Parameters(InputBuffer & input);
     static const C14NParams<C14NVersion::v2_0, false> C14N2Parameters(const Element * element);
     
+    /**
+     Writes the canonical form of an entire document.
+     
+     C14N 1.0, 1.1 and Exclusive C14N 1.0 are supported; the remaining parameters
+     of C14N 2.0 are not, so a request for that version fails.
+     @result Returns `true` if the document was canonicalized.
+     */
     template<C14NVersion _Version, bool _WithComments>
-    static bool Canonicalize(const Document * doc, OutputBuffer & output, const C14NParams<_Version,_WithComments> & params);
+    static bool Canonicalize(const Document * doc, OutputBuffer & output, const C14NParams<_Version,_WithComments> & params)
+    {
+        return CanonicalizeDocument(doc, output, params.Version(), params.PreserveComments());
+    }
     
     template<C14NVersion _Version, bool _WithComments>
     static string Canonicalize(const Document * doc, const C14NParams<_Version,_WithComments> & params)
     {
         std::ostringstream __o;
-        if ( !Canonicalize(doc, StreamOutputBuffer(__o), params) )
+        StreamOutputBuffer __buf(__o);
+        if ( !Canonicalize(doc, __buf, params) )
             return string();
         return xmlString(__o.str());
     }
+    
+private:
+    static bool CanonicalizeDocument(const Document * doc, OutputBuffer & output, C14NVersion version, bool withComments);
 };
 
 EPUB3_XML_END_NAMESPACE